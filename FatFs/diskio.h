@@ -34,6 +34,22 @@ DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 
 void disk_timerproc (void);
 
+/* Read-ahead cache statistics, counts are in sectors except misses which is per disk_read() call */
+typedef struct {
+	DWORD hits;
+	DWORD misses;
+	DWORD prefetched;
+} disk_readahead_stats_t;
+
+void disk_readahead_init (void);
+disk_readahead_stats_t *disk_readahead_stats (void);
+
+/* Handlers run while waiting for the card (SDCARD_YIELD), chained by saving and replacing disk_on_yield.  */
+/* They run from inside FatFs calls and must not block nor call FatFs or the disk functions, nested disk  */
+/* calls fail with RES_NOTRDY. The grbl.on_execute_realtime chain is not run as it may do either.         */
+typedef void (*disk_on_yield_ptr)(void);
+extern disk_on_yield_ptr disk_on_yield;
+
 /* Disk Status Bits (DSTATUS) */
 
 #define STA_NOINIT		0x01	/* Drive not initialized */
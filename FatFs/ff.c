@@ -21,6 +21,10 @@
 
 #include "ff.h"			/* Declarations of FatFs API */
 #include "diskio.h"		/* Declarations of device I/O functions */
+#include "driver.h"		/* SDCARD_FASTSEEK option */
+#if SDCARD_FASTSEEK
+#include "ff_fastseek.h"	/* Cluster link map of files opened for reading */
+#endif
 
 
 /*--------------------------------------------------------------------------
@@ -3720,6 +3724,10 @@ FRESULT f_open (
 		FREE_NAMBUF();
 	}
 
+#if SDCARD_FASTSEEK
+	if (res == FR_OK && !(fp->flag & FA_WRITE)) f_fastseek_enable(fp);	/* Build the cluster link map, on failure the file is read without it */
+#endif
+
 	if (res != FR_OK) fp->obj.fs = 0;	/* Invalidate file object on error */
 
 	LEAVE_FF(fs, res);
@@ -4048,6 +4056,9 @@ FRESULT f_close (
 	{
 		res = validate(&fp->obj, &fs);	/* Lock volume */
 		if (res == FR_OK) {
+#if SDCARD_FASTSEEK
+			f_fastseek_disable(fp);		/* Release the cluster link map */
+#endif
 #if FF_FS_LOCK != 0
 			res = dec_lock(fp->obj.lockid);		/* Decrement file open counter */
 			if (res == FR_OK) fp->obj.fs = 0;	/* Invalidate file object */
@@ -76,10 +76,20 @@
 #define STEPPER_TIMER_IRQn          timerINT(STEPPER_TIMER_N)
 #define STEPPER_TIMER_IRQHandler    timerHANDLER(STEPPER_TIMER_N)
 
+#if STEP_PULSE_DMA
+// DMA1 cannot write to GPIO (AHB1), a timer with update DMA request on DMA2 is needed.
+#define PULSE_TIMER_N               8
+#define PULSE_TIMER                 timer(PULSE_TIMER_N)
+#define PULSE_TIMER_IRQn            TIM8_UP_TIM13_IRQn
+#define PULSE_TIMER_IRQHandler      TIM8_UP_TIM13_IRQHandler
+#define PULSE_TIMER_CLOCK_MUL       2 // APB2 timer clock is twice hal.f_step_timer
+#else
 #define PULSE_TIMER_N               4
 #define PULSE_TIMER                 timer(PULSE_TIMER_N)
 #define PULSE_TIMER_IRQn            timerINT(PULSE_TIMER_N)
 #define PULSE_TIMER_IRQHandler      timerHANDLER(PULSE_TIMER_N)
+#define PULSE_TIMER_CLOCK_MUL       1
+#endif
 
 #define SPINDLE_PWM_TIMER_N         1
 #define SPINDLE_PWM_TIMER           timer(SPINDLE_PWM_TIMER_N)
@@ -123,8 +133,83 @@
 #define STEP_PULSE_LATENCY 1.0f // microseconds
 #endif
 
+#ifndef STEP_PULSE_DMA
+#define STEP_PULSE_DMA 0
+#endif
+
+#ifndef GPIO_OUTPUT_TABLES
+#define GPIO_OUTPUT_TABLES 0
+#endif
+
+#ifndef ISR_PROFILER_ENABLE
+#define ISR_PROFILER_ENABLE 0
+#endif
+
+#ifndef SERIAL_RX_DMA
+#define SERIAL_RX_DMA 0
+#endif
+
+#ifndef SERIAL_TX_DMA
+#define SERIAL_TX_DMA 0
+#endif
+
+#ifndef USB_RX_FLOW_CONTROL
+#define USB_RX_FLOW_CONTROL 0
+#endif
+
+#ifndef SPI_DMA_ENABLE
+#define SPI_DMA_ENABLE 0
+#endif
+
+#ifndef SDCARD_READAHEAD
+#define SDCARD_READAHEAD 0
+#endif
+
+#ifndef SDCARD_YIELD
+#define SDCARD_YIELD 0
+#endif
+
+#ifndef SDCARD_CRC
+#define SDCARD_CRC 0
+#endif
+
+#ifndef SDCARD_RAMDISK
+#define SDCARD_RAMDISK 0
+#endif
+
+#ifndef SDCARD_SDMMC
+#define SDCARD_SDMMC 0
+#endif
+
+#ifndef SDCARD_FASTSEEK
+#define SDCARD_FASTSEEK 0
+#endif
+
+#ifndef SDCARD_JOBCACHE
+#define SDCARD_JOBCACHE 0
+#endif
+
+#ifndef SDCARD_DATALOG
+#define SDCARD_DATALOG 0
+#endif
+
 // End configuration
 
+#define STEP_OUTTABLE       (GPIO_OUTPUT_TABLES && STEP_OUTMODE == GPIO_SINGLE)
+#define DIRECTION_OUTTABLE  (GPIO_OUTPUT_TABLES && DIRECTION_OUTMODE == GPIO_SINGLE)
+
+#if STEP_PULSE_DMA
+  #if PULSE_TIMER_N != 8
+    #error "STEP_PULSE_DMA requires TIM8 as the pulse timer!"
+  #endif
+  #define PULSE_TIMER_DMA_STREAM      DMA2_Stream1 // TIM8_UP
+  #define PULSE_TIMER_DMA_CHANNEL     7
+  #define PULSE_TIMER_DMA_IRQn        DMA2_Stream1_IRQn
+  #define PULSE_TIMER_DMA_IRQHandler  DMA2_Stream1_IRQHandler
+  #define PULSE_TIMER_DMA_TEIF        DMA_LISR_TEIF1
+  #define PULSE_TIMER_DMA_FLAGS       (DMA_LIFCR_CTCIF1|DMA_LIFCR_CHTIF1|DMA_LIFCR_CTEIF1|DMA_LIFCR_CDMEIF1|DMA_LIFCR_CFEIF1)
+#endif
+
 #if EEPROM_ENABLE == 0
 #define FLASH_ENABLE 1
 #else
@@ -175,10 +260,19 @@
 #error Keypad plugin not supported!
 #endif
 
-#if SDCARD_ENABLE && !defined(SD_CS_PORT)
+#if SDCARD_ENABLE && !SDCARD_SDMMC && !defined(SD_CS_PORT)
 #error SD card plugin not supported!
 #endif
 
+#if SDCARD_ENABLE && SDCARD_SDMMC
+  #if SDCARD_READAHEAD
+    #error "SD card read ahead is only supported in SPI mode!"
+  #endif
+  #if SPI_PORT == 3 && TRINAMIC_ENABLE
+    #error "SDMMC1 pins are shared with SPI3!"
+  #endif
+#endif
+
 #ifndef STEP_PINMODE
 #define STEP_PINMODE PINMODE_OUTPUT
 #endif
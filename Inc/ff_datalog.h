@@ -0,0 +1,52 @@
+/*
+
+  ff_datalog.h - FatFs contiguous data capture files
+
+  Part of grblHAL
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __FF_DATALOG_H__
+#define __FF_DATALOG_H__
+
+#include "ff.h"
+
+#define DATALOG_SECTORS 8 // sectors buffered per multi-block write
+
+// NOTE: API only, nothing in the driver writes a data log yet. Producers such as PID or probing logs
+//       live in the core and plugins and have to call these functions themselves.
+
+typedef struct {
+    FIL file;
+    BYTE pdrv;          // physical drive of the volume
+    DWORD sector;       // first sector of the file
+    DWORD sectors;      // number of sectors allocated
+    FSIZE_t size;       // number of bytes requested
+    DWORD written;      // number of sectors written
+    UINT len;           // bytes in buffer
+    BYTE buf[DATALOG_SECTORS * FF_MIN_SS] __attribute__((aligned(4)));
+} datalog_t;
+
+// Creates a file and allocates size bytes of contiguous space for it with f_expand().
+// Data is then written directly to the sectors of the file, bypassing the FAT and directory.
+// The file size is 0 until set by f_datalog_close().
+FRESULT f_datalog_open (datalog_t *log, const TCHAR *path, FSIZE_t size);
+// Returns FR_DENIED if the data does not fit in the size requested by f_datalog_open().
+FRESULT f_datalog_write (datalog_t *log, const void *data, UINT len);
+// Writes any buffered data, then sets the file size to the amount of data written and releases unused space.
+FRESULT f_datalog_close (datalog_t *log);
+
+#endif
@@ -0,0 +1,37 @@
+/*
+
+  ff_fastseek.h - FatFs fast seek (cluster link map) helpers
+
+  Part of grblHAL
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __FF_FASTSEEK_H__
+#define __FF_FASTSEEK_H__
+
+#include "ff.h"
+
+// With SDCARD_FASTSEEK set f_open() calls f_fastseek_enable() for files opened for reading and
+// f_close() calls f_fastseek_disable(), the CLMT pointer (FIL.cltbl) is owned by these functions.
+
+// Builds the cluster link map table (CLMT) for an open file, sized from the number of fragments.
+// Subsequent f_lseek() calls will then not walk the FAT chain.
+// NOTE: the file cannot be expanded while fast seek mode is active, intended for job files opened for reading.
+FRESULT f_fastseek_enable (FIL *fp);
+// Releases the CLMT, e.g. before writing to a file where fast seek mode was enabled.
+void f_fastseek_disable (FIL *fp);
+
+#endif
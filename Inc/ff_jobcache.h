@@ -0,0 +1,48 @@
+/*
+
+  ff_jobcache.h - FatFs compacted job file cache
+
+  Part of grblHAL
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __FF_JOBCACHE_H__
+#define __FF_JOBCACHE_H__
+
+#include <stdbool.h>
+
+#include "ff.h"
+
+#define JOBCACHE_SUFFIX ".jc" // appended to the job file name
+
+typedef struct {
+    DWORD src_size;     // bytes in the job file
+    DWORD size;         // bytes in the cache, excluding the header
+    bool built;         // cache was (re)built by the last call
+} jobcache_info_t;
+
+// Opens the cache of a job file for reading, the cache is (re)built first if missing or if the
+// size or timestamp of the job file has changed. The cache holds the blocks as the protocol layer
+// would pass them to the parser: whitespace, blank lines and comments removed and letters uppercased.
+// (MSG, (PRINT and (DEBUG comments are kept verbatim.
+// On success fp is positioned at the first block and must be closed with f_close() by the caller,
+// on failure the job file should be read directly. info may be NULL.
+// Used by ramdisk_stage() when SDCARD_JOBCACHE is enabled.
+// NOTE: this is a text cache, not a cache of parsed blocks. The core G-code parser has no entry point
+//       for pre-parsed blocks, so the cached blocks are parsed as text like the job file.
+FRESULT f_jobcache_open (FIL *fp, const TCHAR *path, jobcache_info_t *info);
+
+#endif
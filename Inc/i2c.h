@@ -44,4 +44,8 @@ void I2C_GetKeycode (uint32_t i2cAddr, keycode_callback_ptr callback);
 
 void i2c_init (void);
 
+#if EEPROM_ENABLE
+void i2c_nvs_queue_init (void);
+#endif
+
 #endif
@@ -34,6 +34,11 @@
 //#endif
 //#define SPINDLE_HUANYANG     1 // Set to 1 or 2 for Huanyang VFD spindle. Requires spindle plugin. !! NOT TESTED !!
 //#define ETHERNET_ENABLE      1 // Ethernet streaming. Requires networking plugin.
+//#define ETH_ZEROCOPY_RX      1 // Pass received Ethernet frames to lwIP in the DMA buffers instead of copying them. Default off.
+                               // NOTE: adds 4 spare receive buffers of 1524 bytes, set ETH_RX_SPARE_NB to change.
+//#define ETH_ZEROCOPY_TX      1 // Transmit Ethernet frames from the lwIP pbufs instead of copying them to the DMA buffers. Default off.
+//#define ETH_RX_BUDGET        2 // Max number of received Ethernet frames passed to lwIP per poll. Default all 8 receive buffers.
+//#define ETH_RX_INTERRUPT     1 // Flag received Ethernet frames from the ETH interrupt instead of scanning the descriptors on every poll.
 //#define BLUETOOTH_ENABLE   1 // Set to 1 for HC-05 module. Requires Bluetooth plugin.
 //#define SDCARD_ENABLE        1 // Run gcode programs from SD card, requires sdcard plugin.
 //#define KEYPAD_ENABLE        1 // I2C keypad for jogging etc., requires keypad plugin.
@@ -46,6 +51,24 @@
 //#define TRINAMIC_DEV         1 // Development mode, adds a few M-codes to aid debugging. Do not enable in production code.
 //#define EEPROM_ENABLE        2 // I2C EEPROM support. Set to 1 for 24LC16(2K), 2 for larger sizes. Requires eeprom plugin.
 //#define EEPROM_IS_FRAM       1 // Uncomment when EEPROM is enabled and chip is FRAM, this to remove write delay.
+//#define GPIO_OUTPUT_TABLES   1 // Use precomputed BSRR tables for step and direction outputs when output mode is GPIO_SINGLE. Uses up to 9.3 KB RAM (6 axes with squaring).
+//#define STEP_PULSE_DMA       1 // End step pulses by DMA instead of by interrupt, uses TIM8 as the pulse timer. Requires all step outputs on the same port.
+//#define ISR_PROFILER_ENABLE  1 // Interrupt handler cycle profiler, adds $ISR and $ISRR commands and ISR element to the real time report.
+//#define SERIAL_RX_DMA        1 // Receive serial data by DMA, processed on half/full buffer and idle line events.
+//#define SERIAL_TX_DMA        1 // Transmit serial data by DMA.
+//#define USB_RX_FLOW_CONTROL  1 // NAK USB input when the input buffer is full instead of discarding data.
+                               // NOTE: real time commands in the packet that does not fit are handled, those sent after it wait until the packet fits.
+//#define SPI_DMA_ENABLE       1 // Use DMA for SPI block transfers, e.g. SD card sector data.
+//#define SDCARD_READAHEAD     8 // Number of sectors to read ahead when streaming from SD card, each costs 512 bytes of RAM.
+//#define SDCARD_YIELD         1 // Poll the I2C EEPROM write queue and Ethernet (not with FTP) while waiting for the SD card to become ready, see disk_on_yield in diskio.h.
+//#define SDCARD_CRC           1 // Enable CRC checking of SD card commands and data blocks in SPI mode, blocks failing the check are retried.
+//#define SDCARD_RAMDISK      64 // Size in KBytes of a RAM disk mounted as volume 1: for staging uploaded jobs and macros, minimum 64.
+                               // NOTE: the size is allocated as .bss, e.g. 64 KBytes of the 320 KBytes of SRAM. Adds $RD=<file> for copying a file from the SD card.
+//#define SDCARD_SDMMC         1 // Access the SD card in 4-bit SD bus mode via SDMMC1 (PC8-PC12, PD2) instead of SPI mode.
+//#define SDCARD_FASTSEEK      1 // Cluster link map built by f_open() for files opened for reading, fast f_lseek() in fragmented job files. See ff_fastseek.h.
+//#define SDCARD_JOBCACHE      1 // Keep a compacted copy of job files, without whitespace and comments, next to the job file on the SD card.
+                               // NOTE: used by $RD when staging a job to the RAM disk.
+//#define SDCARD_DATALOG       1 // Data capture files pre-allocated with f_expand() and written with multi-block writes, API only, see ff_datalog.h.
 /**/
 
 // If the selected board map supports more than three motors ganging and/or auto-squaring
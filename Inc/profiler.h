@@ -0,0 +1,78 @@
+/*
+
+  profiler.h - interrupt handler cycle profiler for STM32F7xx ARM processors
+
+  Part of grblHAL
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include "driver.h"
+
+#if ISR_PROFILER_ENABLE
+
+#define PROFILER_BUCKETS 16 // log2 histogram, last bucket collects everything >= 2^14 cycles
+
+typedef enum {
+    ProfileISR_Stepper = 0,
+    ProfileISR_Pulse,
+    ProfileISR_Serial,
+    ProfileISR_USB,
+    ProfileISR_EXTI0,
+    ProfileISR_EXTI1,
+    ProfileISR_EXTI2,
+    ProfileISR_EXTI3,
+    ProfileISR_EXTI4,
+    ProfileISR_EXTI9_5,
+    ProfileISR_EXTI15_10,
+    ProfileISR_N
+} profiler_isr_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t histogram[PROFILER_BUCKETS];
+} profiler_stats_t;
+
+// Cycle counter, may be overridden by builds without a DWT unit.
+#ifndef PROFILER_CYCLES
+#define PROFILER_CYCLES() (DWT->CYCCNT)
+#endif
+
+#define PROFILER_ISR_ENTER(isr) uint32_t profiler_t0 = PROFILER_CYCLES();
+#define PROFILER_ISR_EXIT(isr) profiler_record(isr, PROFILER_CYCLES() - profiler_t0);
+#define PROFILER_ISR_LATENCY(isr, ticks) profiler_record_latency(isr, ticks);
+
+void profiler_init (void);
+void profiler_reset (void);
+void profiler_record (profiler_isr_t isr, uint32_t cycles);
+void profiler_record_latency (profiler_isr_t isr, uint32_t ticks);
+void profiler_stats_add (profiler_stats_t *stats, uint32_t cycles);
+const profiler_stats_t *profiler_get_stats (profiler_isr_t isr, bool latency);
+
+#else
+
+#define PROFILER_ISR_ENTER(isr)
+#define PROFILER_ISR_EXIT(isr)
+#define PROFILER_ISR_LATENCY(isr, ticks)
+
+#endif // ISR_PROFILER_ENABLE
+
+#endif // __PROFILER_H__
@@ -0,0 +1,46 @@
+/*
+
+  ramdisk.h - RAM backed FatFs volume
+
+  Part of grblHAL
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __RAMDISK_H__
+#define __RAMDISK_H__
+
+#include <stdbool.h>
+
+#include "ff.h"
+#include "diskio.h"
+
+#define RAMDISK_PDRV 1      // physical drive number, the volume is mounted as "1:"
+#define RAMDISK_PATH "1:"
+
+// Formats and mounts the RAM disk, contents are lost on reset. Returns false if that failed, $I reports the state.
+// Jobs and macros are accessed with the "1:" path prefix, e.g. $F=1:/job.nc, this can be used by upload
+// handlers as the target directory as well. $RD=<file> stages a file from the SD card with ramdisk_stage().
+bool ramdisk_init (void);
+FRESULT ramdisk_stage (const char *path);
+
+// Block device functions, called from the disk_* functions of the SD card backend for RAMDISK_PDRV.
+DSTATUS ramdisk_initialize (void);
+DSTATUS ramdisk_status (void);
+DRESULT ramdisk_read (BYTE *buff, DWORD sector, UINT count);
+DRESULT ramdisk_write (const BYTE *buff, DWORD sector, UINT count);
+DRESULT ramdisk_ioctl (BYTE cmd, void *buff);
+
+#endif
@@ -22,10 +22,16 @@
 #ifndef _GRBL_SPI_H_
 #define _GRBL_SPI_H_
 
+#include <stdint.h>
+#include <stdbool.h>
+
 void spi_init (void);
 void spi_set_max_speed (void);
 uint32_t spi_set_speed (uint32_t prescaler);
+uint32_t spi_set_clock (uint32_t f_max);
 uint8_t spi_get_byte (void);
 uint8_t spi_put_byte (uint8_t byte);
+bool spi_read (uint8_t *data, uint16_t len);
+bool spi_write (const uint8_t *data, uint16_t len);
 
 #endif
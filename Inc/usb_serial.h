@@ -27,8 +27,12 @@
 #include <stdbool.h>
 
 #include "driver.h"
+#include "grbl/stream.h"
+#include "serial.h"
 
 const io_stream_t *usbInit (void);
-void usbBufferInput (uint8_t *data, uint32_t length);
+bool usbBufferInput (uint8_t *data, uint32_t length);
+void usbTxComplete (void);
+void usbReset (void);
 
 /*EOF*/
@@ -67,6 +67,59 @@ __ALIGN_BEGIN uint8_t Tx_Buff[ETH_TXBUFNB][ETH_TX_BUF_SIZE] __ALIGN_END; /* Ethe
 
 /* USER CODE BEGIN 2 */
 
+static ethernetif_stats_t stats = {0};
+
+#if ETH_RX_INTERRUPT
+static volatile u8_t rx_pending = 1;
+#endif
+
+#if ETH_ZEROCOPY_TX
+
+/* Transmit descriptors are pointed directly at the pbuf payloads, a reference to  */
+/* the pbuf is held until the DMA has released the last descriptor of the frame.   */
+/* Volatile payloads and payloads the DMA cannot reach, e.g. in flash, are copied  */
+/* to the DMA buffers.                                                             */
+
+#ifndef ETH_TX_DMA_RAM_START
+#define ETH_TX_DMA_RAM_START 0x20000000UL   /* DTCM */
+#endif
+#ifndef ETH_TX_DMA_RAM_END
+#define ETH_TX_DMA_RAM_END   0x20050000UL   /* end of SRAM2 */
+#endif
+
+static struct pbuf *tx_pbuf[ETH_TXBUFNB];
+static u32_t tx_reclaim = 0, tx_inflight = 0;
+
+#endif
+
+#if ETH_ZEROCOPY_RX
+
+/* Received frames are handed to lwIP as custom pbufs referencing the DMA buffer,  */
+/* a spare buffer is swapped into the descriptor so that it is given back to the   */
+/* DMA immediately. The buffer becomes a spare again when lwIP frees the pbuf.     */
+/* When all spares are held by lwIP, e.g. by TCP out of sequence queueing, frames  */
+/* are copied to pool pbufs, the receive ring is never blocked.                    */
+
+#ifndef ETH_RX_SPARE_NB
+#define ETH_RX_SPARE_NB 4
+#endif
+
+typedef struct {
+  struct pbuf_custom pc;
+  uint8_t *buffer;
+} eth_rx_pbuf_t;
+
+#if defined ( __ICCARM__ ) /*!< IAR Compiler */
+  #pragma data_alignment=4
+#endif
+__ALIGN_BEGIN static uint8_t Rx_Spare[ETH_RX_SPARE_NB][ETH_RX_BUF_SIZE] __ALIGN_END;
+
+static eth_rx_pbuf_t rx_pbuf[ETH_RX_SPARE_NB];
+static eth_rx_pbuf_t *rx_spare[ETH_RX_SPARE_NB]; /* free wrappers, each owns a spare buffer */
+static uint32_t rx_spares = 0;
+
+#endif
+
 /* USER CODE END 2 */
 
 /* Global Ethernet handle */
@@ -132,7 +185,10 @@ void HAL_ETH_MspInit(ETH_HandleTypeDef* ethHandle)
     HAL_GPIO_Init(GPIOG, &GPIO_InitStruct);
 
   /* USER CODE BEGIN ETH_MspInit 1 */
-
+#if ETH_RX_INTERRUPT
+    HAL_NVIC_SetPriority(ETH_IRQn, 3, 0);
+    HAL_NVIC_EnableIRQ(ETH_IRQn);
+#endif
   /* USER CODE END ETH_MspInit 1 */
   }
 }
@@ -172,6 +228,25 @@ void HAL_ETH_MspDeInit(ETH_HandleTypeDef* ethHandle)
 
 /* USER CODE BEGIN 4 */
 
+#if ETH_RX_INTERRUPT
+
+void ETH_IRQHandler(void)
+{
+  HAL_ETH_IRQHandler(&heth);
+}
+
+void HAL_ETH_RxCpltCallback(ETH_HandleTypeDef *heth)
+{
+  rx_pending = 1;
+}
+
+#endif
+
+const ethernetif_stats_t *ethernetif_get_stats(void)
+{
+  return &stats;
+}
+
 /* USER CODE END 4 */
 
 /*******************************************************************************
@@ -204,7 +279,11 @@ static void low_level_init(struct netif *netif)
   MACAddr[4] = 0x00;
   MACAddr[5] = 0x00;
   heth.Init.MACAddr = &MACAddr[0];
+#if ETH_RX_INTERRUPT
+  heth.Init.RxMode = ETH_RXINTERRUPT_MODE;
+#else
   heth.Init.RxMode = ETH_RXPOLLING_MODE;
+#endif
   heth.Init.ChecksumMode = ETH_CHECKSUM_BY_HARDWARE;
   heth.Init.MediaInterface = ETH_MEDIA_INTERFACE_RMII;
 
@@ -225,6 +304,14 @@ static void low_level_init(struct netif *netif)
   /* Initialize Rx Descriptors list: Chain Mode  */
   HAL_ETH_DMARxDescListInit(&heth, DMARxDscrTab, &Rx_Buff[0][0], ETH_RXBUFNB);
 
+#if ETH_ZEROCOPY_RX
+  for(rx_spares = 0; rx_spares < ETH_RX_SPARE_NB; rx_spares++)
+  {
+    rx_pbuf[rx_spares].buffer = Rx_Spare[rx_spares];
+    rx_spare[rx_spares] = &rx_pbuf[rx_spares];
+  }
+#endif
+
 #if LWIP_ARP || LWIP_ETHERNET
 
   /* set MAC hardware address length */
@@ -293,6 +380,88 @@ static void low_level_init(struct netif *netif)
  *       dropped because of memory failure (except for the TCP timers).
  */
 
+#if ETH_ZEROCOPY_TX
+
+/**
+ * Releases descriptors and pbufs of frames transmitted by the DMA.
+ */
+static void tx_reclaim_descriptors(void)
+{
+  while (tx_inflight && (((__IO ETH_DMADescTypeDef *)&DMATxDscrTab[tx_reclaim])->Status & ETH_DMATXDESC_OWN) == (uint32_t)RESET)
+  {
+    if (tx_pbuf[tx_reclaim])
+    {
+      pbuf_free(tx_pbuf[tx_reclaim]);
+      tx_pbuf[tx_reclaim] = NULL;
+    }
+    DMATxDscrTab[tx_reclaim].Buffer1Addr = (uint32_t)Tx_Buff[tx_reclaim];
+    tx_reclaim = (tx_reclaim + 1) % ETH_TXBUFNB;
+    tx_inflight--;
+  }
+}
+
+/**
+ * Queues a frame for transmission without copying.
+ *
+ * @return ERR_OK if queued, ERR_VAL if the frame has to be copied instead
+ */
+static err_t low_level_output_sg(struct pbuf *p)
+{
+  struct pbuf *q;
+  u32_t segments = 0;
+  __IO ETH_DMADescTypeDef *first = heth.TxDesc, *desc = first, *last = NULL, *next;
+
+  for(q = p; q != NULL; q = q->next)
+  {
+    if (q->len == 0)
+      continue;
+    /* Volatile payloads (PBUF_REF) may be changed by the caller after return, copy them as etharp.c does */
+    if (PBUF_NEEDS_COPY(q))
+      return ERR_VAL;
+    if ((u32_t)q->payload < ETH_TX_DMA_RAM_START || (u32_t)q->payload + q->len > ETH_TX_DMA_RAM_END)
+      return ERR_VAL;
+    segments++;
+  }
+
+  if (segments == 0 || segments > ETH_TXBUFNB - tx_inflight)
+    return ERR_VAL;
+
+  for(q = p; q != NULL; q = q->next)
+  {
+    if (q->len == 0)
+      continue;
+    desc->Buffer1Addr = (uint32_t)q->payload;
+    desc->ControlBufferSize = q->len & ETH_DMATXDESC_TBS1;
+    desc->Status &= ~(ETH_DMATXDESC_FS | ETH_DMATXDESC_LS);
+    last = desc;
+    desc = (ETH_DMADescTypeDef *)(desc->Buffer2NextDescAddr);
+  }
+
+  first->Status |= ETH_DMATXDESC_FS;
+  last->Status |= ETH_DMATXDESC_LS;
+
+  pbuf_ref(p);
+  tx_pbuf[(ETH_DMADescTypeDef *)last - DMATxDscrTab] = p;
+  tx_inflight += segments;
+
+  /* Give descriptors to the DMA, the first one last so the frame is not started prematurely */
+  for(next = (ETH_DMADescTypeDef *)(first->Buffer2NextDescAddr); next != desc; next = (ETH_DMADescTypeDef *)(next->Buffer2NextDescAddr))
+    next->Status |= ETH_DMATXDESC_OWN;
+  __DSB();
+  first->Status |= ETH_DMATXDESC_OWN;
+
+  heth.TxDesc = (ETH_DMADescTypeDef *)desc;
+
+  /* When Tx Buffer unavailable flag is set: clear it and resume transmission */
+  if ((heth.Instance->DMASR & ETH_DMASR_TBUS) != (uint32_t)RESET)
+    heth.Instance->DMASR = ETH_DMASR_TBUS;
+  heth.Instance->DMATPDR = 0;
+
+  return ERR_OK;
+}
+
+#endif
+
 static err_t low_level_output(struct netif *netif, struct pbuf *p)
 {
   err_t errval;
@@ -303,6 +472,16 @@ static err_t low_level_output(struct netif *netif, struct pbuf *p)
   uint32_t bufferoffset = 0;
   uint32_t byteslefttocopy = 0;
   uint32_t payloadoffset = 0;
+
+#if ETH_ZEROCOPY_TX
+  tx_reclaim_descriptors();
+
+  if ((errval = low_level_output_sg(p)) == ERR_OK)
+    goto error;
+
+  buffer = (uint8_t *)(heth.TxDesc->Buffer1Addr);
+#endif
+
   DmaTxDesc = heth.TxDesc;
   bufferoffset = 0;
 
@@ -351,7 +530,12 @@ static err_t low_level_output(struct netif *netif, struct pbuf *p)
     }
 
   /* Prepare transmit descriptors to give to DMA */
+#if ETH_ZEROCOPY_TX
+  if (HAL_ETH_TransmitFrame(&heth, framelength) == HAL_OK)
+    tx_inflight += (framelength + ETH_TX_BUF_SIZE - 1) / ETH_TX_BUF_SIZE;
+#else
   HAL_ETH_TransmitFrame(&heth, framelength);
+#endif
 
   errval = ERR_OK;
 
@@ -369,6 +553,18 @@ error:
   return errval;
 }
 
+#if ETH_ZEROCOPY_RX
+
+/**
+ * Custom pbuf free function, the buffer becomes a spare again.
+ */
+static void rx_pbuf_free (struct pbuf *p)
+{
+  rx_spare[rx_spares++] = (eth_rx_pbuf_t *)p;
+}
+
+#endif
+
 /**
  * Should allocate a pbuf and transfer the bytes of the incoming
  * packet from the interface into the pbuf.
@@ -398,6 +594,25 @@ static struct pbuf * low_level_input(struct netif *netif)
   len = heth.RxFrameInfos.length;
   buffer = (uint8_t *)heth.RxFrameInfos.buffer;
 
+#if ETH_ZEROCOPY_RX
+  if (len > 0 && heth.RxFrameInfos.SegCount == 1 && rx_spares)
+  {
+    eth_rx_pbuf_t *rx = rx_spare[rx_spares - 1];
+
+    rx->pc.custom_free_function = rx_pbuf_free;
+
+    if ((p = pbuf_alloced_custom(PBUF_RAW, len, PBUF_REF, &rx->pc, buffer, ETH_RX_BUF_SIZE)) != NULL)
+    {
+      /* Swap buffers, the descriptor is released to the DMA with the spare below */
+      rx_spares--;
+      heth.RxFrameInfos.FSRxDesc->Buffer1Addr = (uint32_t)rx->buffer;
+      rx->buffer = buffer;
+      __DSB();
+      goto release;
+    }
+  }
+#endif
+
   if (len > 0)
   {
     /* We allocate a pbuf chain of pbufs from the Lwip buffer pool */
@@ -433,6 +648,9 @@ static struct pbuf * low_level_input(struct netif *netif)
     }
   }
 
+#if ETH_ZEROCOPY_RX
+release:
+#endif
     /* Release descriptors to DMA */
     /* Point to first descriptor */
     dmarxdesc = heth.RxFrameInfos.FSRxDesc;
@@ -449,6 +667,7 @@ static struct pbuf * low_level_input(struct netif *netif)
   /* When Rx Buffer unavailable flag is set: clear it and resume reception */
   if ((heth.Instance->DMASR & ETH_DMASR_RBUS) != (uint32_t)RESET)
   {
+    stats.rx_overruns++;
     /* Clear RBUS ETHERNET DMA flag */
     heth.Instance->DMASR = ETH_DMASR_RBUS;
     /* Resume DMA reception */
@@ -470,22 +689,43 @@ void ethernetif_input(struct netif *netif)
 {
   err_t err;
   struct pbuf *p;
+  u32_t budget = ETH_RX_BUDGET;
 
-  /* move received packet into a new pbuf */
-  p = low_level_input(netif);
-
-  /* no packet could be read, silently ignore this */
-  if (p == NULL) return;
+#if ETH_ZEROCOPY_TX
+  tx_reclaim_descriptors();
+#endif
 
-  /* entry point to the LwIP stack */
-  err = netif->input(p, netif);
+#if ETH_RX_INTERRUPT
+  if (!rx_pending) return;
+  rx_pending = 0;
+#endif
 
-  if (err != ERR_OK)
+  /* pass up to ETH_RX_BUDGET frames to lwIP */
+  while (budget)
   {
-    LWIP_DEBUGF(NETIF_DEBUG, ("ethernetif_input: IP input error\n"));
-    pbuf_free(p);
-    p = NULL;
+    /* move received packet into a new pbuf */
+    p = low_level_input(netif);
+
+    /* no packet could be read, silently ignore this */
+    if (p == NULL) return;
+
+    budget--;
+    stats.rx_frames++;
+
+    /* entry point to the LwIP stack */
+    err = netif->input(p, netif);
+
+    if (err != ERR_OK)
+    {
+      LWIP_DEBUGF(NETIF_DEBUG, ("ethernetif_input: IP input error\n"));
+      pbuf_free(p);
+      p = NULL;
+    }
   }
+
+#if ETH_RX_INTERRUPT
+  rx_pending = 1; /* budget exhausted, more frames may be waiting */
+#endif
 }
 
 #if !LWIP_ARP
@@ -41,6 +41,13 @@ u32_t sys_now(void);
 
 /* USER CODE BEGIN 1 */
 
+typedef struct {
+  u32_t rx_frames;      /* Frames passed to lwIP */
+  u32_t rx_overruns;    /* Receive buffer unavailable (RBUS) recoveries */
+} ethernetif_stats_t;
+
+const ethernetif_stats_t *ethernetif_get_stats(void);
+
 /* USER CODE END 1 */
 #endif
 
@@ -31,6 +31,11 @@
 /* Within 'USER CODE' section, code will be kept by default at each generation */
 /* USER CODE BEGIN 0 */
 
+/* Ethernet driver options, see my_machine.h */
+#ifndef OVERRIDE_MY_MACHINE
+#include "my_machine.h"
+#endif
+
 /* USER CODE END 0 */
 
 #ifdef __cplusplus
@@ -102,6 +107,31 @@
 /*-----------------------------------------------------------------------------*/
 /* USER CODE BEGIN 1 */
 
+/* Pass received frames to lwIP in the DMA buffers instead of copying them to pool pbufs, */
+/* ETH_RX_SPARE_NB (default 4) extra receive buffers are allocated to swap into the ring */
+#ifndef ETH_ZEROCOPY_RX
+#define ETH_ZEROCOPY_RX 0
+#endif
+
+#if ETH_ZEROCOPY_RX
+#define LWIP_SUPPORT_CUSTOM_PBUF 1
+#endif
+
+/* Point transmit descriptors at the pbuf payloads instead of copying them to the DMA buffers */
+#ifndef ETH_ZEROCOPY_TX
+#define ETH_ZEROCOPY_TX 0
+#endif
+
+/* Max number of received frames passed to lwIP per call to ethernetif_input() */
+#ifndef ETH_RX_BUDGET
+#define ETH_RX_BUDGET ETH_RXBUFNB
+#endif
+
+/* Use the ETH receive interrupt to flag pending frames instead of scanning the descriptors on every poll */
+#ifndef ETH_RX_INTERRUPT
+#define ETH_RX_INTERRUPT 0
+#endif
+
 /* USER CODE END 1 */
 
 #ifdef __cplusplus
@@ -13,16 +13,24 @@
 
 #include "driver.h"
 
-#if SDCARD_ENABLE
+#if SDCARD_ENABLE && !SDCARD_SDMMC
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "main.h"
 #include "ff.h"
 #include "diskio.h"
+#if SDCARD_RAMDISK
+#include "ramdisk.h"
+#endif
 #include "spi.h"
 
+#if SDCARD_READAHEAD
+#include "grbl/hal.h"
+#endif
+
 /* Definitions for MMC/SDC command */
 #define CMD0    (0x40+0)    /* GO_IDLE_STATE */
 #define CMD1    (0x40+1)    /* SEND_OP_COND */
@@ -39,6 +47,7 @@
 #define CMD41    (0x40+41)    /* SEND_OP_COND (ACMD) */
 #define CMD55    (0x40+55)    /* APP_CMD */
 #define CMD58    (0x40+58)    /* READ_OCR */
+#define CMD59    (0x40+59)    /* CRC_ON_OFF */
 
 #define BOOL bool
 #define TRUE true
@@ -73,9 +82,99 @@ BYTE Timer1, Timer2;    /* 100Hz decrement timer */
 static
 BYTE CardType;            /* b0:MMC, b1:SDC, b2:Block addressing */
 
+#if SDCARD_CRC
+
+#define CRC_RETRIES 3
+
+static
+BOOL CrcOn;                /* Card accepted CMD59, data blocks carry valid CRC16 */
+
+static
+BOOL CrcError;            /* Last transfer failed due to a CRC mismatch */
+
+/* CRC7 of a command packet, returned in bits 7..1 with the end bit set */
+static
+BYTE crc7 (
+    const BYTE *buff,
+    UINT len
+)
+{
+    BYTE crc = 0, n;
+
+    while (len--) {
+        crc ^= *buff++;
+        for (n = 0; n < 8; n++)
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x12 : crc << 1;
+    }
+
+    return crc | 0x01;
+}
+
+/* The CRC unit is set up for the CRC16-CCITT polynomial used for data blocks */
+static
+void crc16_init (void)
+{
+    __HAL_RCC_CRC_CLK_ENABLE();
+
+    CRC->POL = 0x1021;
+    CRC->INIT = 0;
+    CRC->CR = CRC_CR_POLYSIZE_0;
+}
+
+static
+WORD crc16 (
+    const BYTE *buff,
+    UINT len
+)
+{
+    CRC->CR |= CRC_CR_RESET;
+
+    /* Words are fed MSB first, i.e. in byte order of the block */
+    for (; len >= 4; len -= 4, buff += 4)
+        CRC->DR = __REV(__UNALIGNED_UINT32_READ(buff));
+
+    while (len--)
+        *(__IO uint8_t *)&CRC->DR = *buff++;
+
+    return (WORD)CRC->DR;
+}
+
+#endif
+
 static
 BYTE PowerFlag = 0;     /* indicates if "power" is on */
 
+static volatile
+bool Busy = false;      /* Card access in progress, nested calls from foreground tasks are rejected */
+
+#if SDCARD_READAHEAD
+
+/* Read-ahead cache, a ring of sector buffers holding the sectors following */
+/* the last sequential read. Refilled by CMD18 from the foreground loop.    */
+
+#define RA_SECTORS SDCARD_READAHEAD
+
+#if RA_SECTORS < 2 || RA_SECTORS > 64
+#error "SDCARD_READAHEAD must be in the range 2 - 64!"
+#endif
+
+typedef struct {
+    bool active;                /* Sequential access detected, refill enabled */
+    DWORD first;                /* LBA of oldest cached sector */
+    DWORD last;                 /* LBA of last sector read by FatFs */
+    uint_fast8_t tail;          /* Ring index of oldest cached sector */
+    uint_fast8_t count;         /* Number of cached sectors */
+    disk_readahead_stats_t stats;
+    BYTE buf[RA_SECTORS][512];
+} readahead_t;
+
+static readahead_t ra = { .last = (DWORD)-2 };
+static on_execute_realtime_ptr on_execute_realtime;
+
+static void readahead_invalidate (void);
+
+#endif
+
 /*-----------------------------------------------------------------------*/
 /* Transmit a byte to MMC via SPI  (Platform dependent)                  */
 /*-----------------------------------------------------------------------*/
@@ -88,15 +187,33 @@ BYTE PowerFlag = 0;     /* indicates if "power" is on */
 
 #define rcvr_spi() (BYTE)spi_get_byte()
 
+/*-----------------------------------------------------------------------*/
+/* Wait for card ready                                                   */
+/*-----------------------------------------------------------------------*/
+
+#if SDCARD_YIELD
+
+disk_on_yield_ptr disk_on_yield = NULL;
+
+/* Runs the disk_on_yield handlers while the card is busy, the card is      */
+/* deselected meanwhile so other devices may use the SPI bus.                */
 static
-void rcvr_spi_m (BYTE *dst)
+void yield (void)
 {
-    *dst = rcvr_spi();
+    static bool yielding = false;
+
+    if (!yielding && disk_on_yield) {
+        yielding = true;
+        DESELECT();
+        rcvr_spi();
+        disk_on_yield();
+        SELECT();
+        rcvr_spi();
+        yielding = false;
+    }
 }
 
-/*-----------------------------------------------------------------------*/
-/* Wait for card ready                                                   */
-/*-----------------------------------------------------------------------*/
+#endif
 
 static
 BYTE wait_ready (void)
@@ -106,9 +223,11 @@ BYTE wait_ready (void)
 
     Timer2 = 50;    /* Wait for ready in timeout of 500ms */
     rcvr_spi();
-    do
-        res = rcvr_spi();
-    while ((res != 0xFF) && Timer2);
+    while ((res = rcvr_spi()) != 0xFF && Timer2) {
+#if SDCARD_YIELD
+        yield();
+#endif
+    }
 
     return res;
 }
@@ -154,6 +273,9 @@ void power_on (void)
 
 #define set_max_speed() spi_set_max_speed()
 
+#define SD_SPI_CLOCK_MAX  25000000UL    /* Max clock for SD cards in SPI mode */
+#define SD_SPI_CLOCK_MIN    400000UL    /* Lowest clock tried before giving up on tuning */
+
 static
 void power_off (void)
 {
@@ -177,6 +299,9 @@ BOOL rcvr_datablock (
 )
 {
     BYTE token;
+#if SDCARD_CRC
+    WORD crc;
+#endif
 
     Timer1 = 100;
     do {                            /* Wait for data packet in timeout of 100ms */
@@ -184,12 +309,19 @@ BOOL rcvr_datablock (
     } while ((token == 0xFF) && Timer1);
     if(token != 0xFE) return FALSE;    /* If not valid data token, retutn with error */
 
-    do {                            /* Receive the data block into buffer */
-        rcvr_spi_m(buff++);
-        rcvr_spi_m(buff++);
-    } while (btr -= 2);
+    if(!spi_read(buff, btr))        /* Receive the data block into buffer */
+        return FALSE;
+#if SDCARD_CRC
+    crc = (WORD)rcvr_spi() << 8;    /* Check CRC */
+    crc |= rcvr_spi();
+    if (CrcOn && crc != crc16(buff, btr)) {
+        CrcError = TRUE;
+        return FALSE;
+    }
+#else
     rcvr_spi();                        /* Discard CRC */
     rcvr_spi();
+#endif
 
     return TRUE;                    /* Return with success */
 }
@@ -207,23 +339,33 @@ BOOL xmit_datablock (
     BYTE token            /* Data/Stop token */
 )
 {
-    BYTE resp, wc;
+    BYTE resp;
+#if SDCARD_CRC
+    WORD crc;
+#endif
 
 
     if (wait_ready() != 0xFF) return FALSE;
 
     xmit_spi(token);                    /* Xmit data token */
     if (token != 0xFD) {    /* Is data token */
-        wc = 0;
-        do {                            /* Xmit the 512 byte data block to MMC */
-            xmit_spi(*buff++);
-            xmit_spi(*buff++);
-        } while (--wc);
+        if(!spi_write(buff, 512))        /* Xmit the 512 byte data block to MMC */
+            return FALSE;
+#if SDCARD_CRC
+        crc = CrcOn ? crc16(buff, 512) : 0xFFFF;
+        xmit_spi((BYTE)(crc >> 8));        /* CRC */
+        xmit_spi((BYTE)crc);
+#else
         xmit_spi(0xFF);                    /* CRC (Dummy) */
         xmit_spi(0xFF);
+#endif
         resp = rcvr_spi();                /* Reveive data response */
-        if ((resp & 0x1F) != 0x05)        /* If not accepted, return with error */
+        if ((resp & 0x1F) != 0x05) {    /* If not accepted, return with error */
+#if SDCARD_CRC
+            CrcError = (resp & 0x1F) == 0x0B;
+#endif
             return FALSE;
+        }
     }
 
     return TRUE;
@@ -243,6 +385,9 @@ BYTE send_cmd (
 )
 {
     BYTE n, res;
+#if SDCARD_CRC
+    BYTE pkt[5] = { cmd, (BYTE)(arg >> 24), (BYTE)(arg >> 16), (BYTE)(arg >> 8), (BYTE)arg };
+#endif
 
 
     if (wait_ready() != 0xFF) return 0xFF;
@@ -253,9 +398,13 @@ BYTE send_cmd (
     xmit_spi((BYTE)(arg >> 16));        /* Argument[23..16] */
     xmit_spi((BYTE)(arg >> 8));            /* Argument[15..8] */
     xmit_spi((BYTE)arg);                /* Argument[7..0] */
+#if SDCARD_CRC
+    n = crc7(pkt, 5);                    /* CRC */
+#else
     n = 0xff;
     if (cmd == CMD0) n = 0x95;            /* CRC for CMD0(0) */
     if (cmd == CMD8) n = 0x87;            /* CRC for CMD8(0x1AA) */
+#endif
     xmit_spi(n);
 
     /* Receive command response */
@@ -298,7 +447,11 @@ BYTE send_cmd12 (void)
     xmit_spi(0);
     xmit_spi(0);
     xmit_spi(0);
+#if SDCARD_CRC
+    xmit_spi(0x61);                        /* CRC for CMD12(0) */
+#else
     xmit_spi(0);
+#endif
 
     /* Read up to 10 bytes from the card, remembering the value read if it's
        not 0xFF */
@@ -314,6 +467,65 @@ BYTE send_cmd12 (void)
     return res;            /* Return with the response value */
 }
 
+/*-----------------------------------------------------------------------*/
+/* Select the SPI clock from the card CSD TRAN_SPEED field               */
+/*-----------------------------------------------------------------------*/
+
+static
+DWORD csd_tran_speed (
+    BYTE tran_speed        /* CSD TRAN_SPEED byte */
+)
+{
+    static const DWORD unit[] = { 100000UL, 1000000UL, 10000000UL, 100000000UL };
+    static const BYTE mult[] = { 0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80 };    /* x 10 */
+
+    if (tran_speed & 0x04)        /* Reserved unit codes */
+        return 0;
+
+    return unit[tran_speed & 0x03] / 10 * mult[(tran_speed >> 3) & 0x0F];
+}
+
+static
+BOOL read_csd (
+    BYTE *csd            /* 16 byte buffer */
+)
+{
+    BOOL ok;
+
+    SELECT();            /* CS = L */
+    ok = send_cmd(CMD9, 0) == 0 && rcvr_datablock(csd, 16);
+    DESELECT();            /* CS = H */
+    rcvr_spi();            /* Idle (Release DO) */
+
+    return ok;
+}
+
+static
+void set_card_speed (void)
+{
+    BYTE csd[16], chk[16];
+    DWORD f_max, f_clk;
+
+    if (!read_csd(csd) || (f_max = csd_tran_speed(csd[3])) == 0) {
+        set_max_speed();        /* No usable CSD, keep legacy behaviour */
+        return;
+    }
+
+    if (f_max > SD_SPI_CLOCK_MAX)
+        f_max = SD_SPI_CLOCK_MAX;
+
+    /* Verify by reading the CSD again at the new clock, step down on token error or mismatch */
+    do {
+        f_clk = spi_set_clock(f_max);
+        if (read_csd(chk) && !memcmp(csd, chk, sizeof(csd)))
+            break;
+        f_max = f_clk >> 1;
+    } while (f_max >= SD_SPI_CLOCK_MIN);
+
+    if (f_max < SD_SPI_CLOCK_MIN)
+        spi_set_clock(SD_SPI_CLOCK_MIN);
+}
+
 /*--------------------------------------------------------------------------
 
    Public Functions
@@ -333,11 +545,21 @@ DSTATUS disk_initialize (
 
 
 //  pinOut(7, 1);
+#if SDCARD_RAMDISK
+    if (drv == RAMDISK_PDRV) return ramdisk_initialize();
+#endif
     if (drv) return STA_NOINIT;            /* Supports only single drive */
     if (Stat & STA_NODISK) return Stat;    /* No card in the socket */
+    if (Busy) return Stat;                /* Called while yielding */
+
+    Busy = true;
 
     power_on();                            /* Force socket power on */
 
+#if SDCARD_READAHEAD
+    readahead_invalidate();
+#endif
+
     send_initial_clock_train();            /* Ensure the card is in SPI mode */
 
     SELECT();                /* CS = L */
@@ -370,17 +592,24 @@ DSTATUS disk_initialize (
         }
     }
 
+#if SDCARD_CRC
+    crc16_init();
+    CrcOn = ty && send_cmd(CMD59, 1) == 0;    /* Enable CRC checking */
+#endif
+
     CardType = ty;
     DESELECT();            /* CS = H */
     rcvr_spi();            /* Idle (Release DO) */
 
     if (ty) {            /* Initialization succeded */
         Stat &= ~STA_NOINIT;        /* Clear STA_NOINIT */
-        set_max_speed();
+        set_card_speed();
     } else {            /* Initialization failed */
         power_off();
     }
 
+    Busy = false;
+
     return Stat;
 }
 
@@ -394,6 +623,9 @@ DSTATUS disk_status (
     BYTE drv        /* Physical drive nmuber (0) */
 )
 {
+#if SDCARD_RAMDISK
+    if (drv == RAMDISK_PDRV) return ramdisk_status();
+#endif
     if (drv) return STA_NOINIT;        /* Supports only single drive */
     return Stat;
 }
@@ -404,15 +636,16 @@ DSTATUS disk_status (
 /* Read Sector(s)                                                        */
 /*-----------------------------------------------------------------------*/
 
-DRESULT disk_read (
-    BYTE drv,            /* Physical drive nmuber (0) */
+static
+UINT read_blocks (
     BYTE *buff,            /* Pointer to the data buffer to store read data */
     DWORD sector,        /* Start sector number (LBA) */
-    BYTE count            /* Sector count (1..255) */
+    UINT count            /* Sector count */
 )
 {
-    if (drv || !count) return RES_PARERR;
-    if (Stat & STA_NOINIT) return RES_NOTRDY;
+#if SDCARD_CRC
+    CrcError = FALSE;
+#endif
 
     if (!(CardType & 4)) sector *= 512;    /* Convert to byte address if needed */
 
@@ -437,7 +670,147 @@ DRESULT disk_read (
     DESELECT();            /* CS = H */
     rcvr_spi();            /* Idle (Release DO) */
 
-    return count ? RES_ERROR : RES_OK;
+    return count;        /* Number of sectors not read */
+}
+
+/* Reads sectors, retrying the remaining ones on a CRC error */
+static
+UINT read_sectors (
+    BYTE *buff,            /* Pointer to the data buffer to store read data */
+    DWORD sector,        /* Start sector number (LBA) */
+    UINT count            /* Sector count */
+)
+{
+    UINT left = read_blocks(buff, sector, count);
+
+#if SDCARD_CRC
+    BYTE retries = CRC_RETRIES;
+
+    while (left && CrcError && retries--)
+        left = read_blocks(buff + (count - left) * 512, sector + count - left, left);
+#endif
+
+    return left;
+}
+
+#if SDCARD_READAHEAD
+
+static
+void readahead_invalidate (void)
+{
+    ra.active = false;
+    ra.count = 0;
+    ra.last = (DWORD)-2;
+}
+
+static
+UINT readahead_read (
+    BYTE *buff,            /* Pointer to the data buffer to store read data */
+    DWORD sector,        /* Start sector number (LBA) */
+    UINT count            /* Sector count */
+)
+{
+    bool sequential = sector == ra.last + 1;
+
+    ra.last = sector + count - 1;
+
+    /* Serve what we can from the cache, sectors before the requested one are dropped */
+    while (count && ra.count && sector >= ra.first && sector < ra.first + ra.count) {
+        uint_fast8_t skip = (uint_fast8_t)(sector - ra.first);
+        ra.tail = (ra.tail + skip) % RA_SECTORS;
+        ra.count -= skip;
+        memcpy(buff, ra.buf[ra.tail], 512);
+        ra.tail = (ra.tail + 1) % RA_SECTORS;
+        ra.count--;
+        ra.first = ++sector;
+        buff += 512;
+        count--;
+        ra.stats.hits++;
+    }
+
+    if (!count)
+        return 0;
+
+    ra.stats.misses++;
+    ra.count = ra.tail = 0;
+    ra.first = sector + count;
+    ra.active = sequential;
+
+    if (sequential && count == 1) {        /* Sequential single sector miss: fill the ring in one go */
+        if (read_sectors(ra.buf[0], sector, RA_SECTORS) == 0) {
+            memcpy(buff, ra.buf[0], 512);
+            ra.stats.prefetched += RA_SECTORS - 1;
+            ra.first = sector + 1;
+            ra.tail = 1;
+            ra.count = RA_SECTORS - 1;
+            return 0;
+        }
+        ra.active = false;                /* Likely beyond end of card, fall back to direct read */
+    }
+
+    return read_sectors(buff, sector, count);
+}
+
+/* Tops up the read-ahead cache when half empty, called from the foreground loop */
+static
+void readahead_poll (sys_state_t state)
+{
+    if (ra.active && !Busy && !(Stat & STA_NOINIT) && ra.count <= RA_SECTORS / 2) {
+
+        uint_fast8_t head = (ra.tail + ra.count) % RA_SECTORS, n = RA_SECTORS - ra.count;
+
+        if (n > RA_SECTORS - head)        /* Only fill up to the ring wrap point */
+            n = RA_SECTORS - head;
+
+        Busy = true;
+        if (read_sectors(ra.buf[head], ra.first + ra.count, n) == 0) {
+            ra.count += n;
+            ra.stats.prefetched += n;
+        } else
+            ra.active = false;
+        Busy = false;
+    }
+
+    on_execute_realtime(state);
+}
+
+void disk_readahead_init (void)
+{
+    on_execute_realtime = grbl.on_execute_realtime;
+    grbl.on_execute_realtime = readahead_poll;
+}
+
+disk_readahead_stats_t *disk_readahead_stats (void)
+{
+    return &ra.stats;
+}
+
+#endif
+
+DRESULT disk_read (
+    BYTE drv,            /* Physical drive nmuber (0) */
+    BYTE *buff,            /* Pointer to the data buffer to store read data */
+    DWORD sector,        /* Start sector number (LBA) */
+    BYTE count            /* Sector count (1..255) */
+)
+{
+    UINT left;
+
+#if SDCARD_RAMDISK
+    if (drv == RAMDISK_PDRV) return ramdisk_read(buff, sector, count);
+#endif
+    if (drv || !count) return RES_PARERR;
+    if ((Stat & STA_NOINIT) || Busy) return RES_NOTRDY;
+
+    Busy = true;
+#if SDCARD_READAHEAD
+    left = readahead_read(buff, sector, count);
+#else
+    left = read_sectors(buff, sector, count);
+#endif
+    Busy = false;
+
+    return left ? RES_ERROR : RES_OK;
 }
 
 
@@ -447,16 +820,16 @@ DRESULT disk_read (
 /*-----------------------------------------------------------------------*/
 
 #if FF_FS_READONLY == 0
-DRESULT disk_write (
-    BYTE drv,            /* Physical drive nmuber (0) */
+static
+UINT write_blocks (
     const BYTE *buff,    /* Pointer to the data to be written */
     DWORD sector,        /* Start sector number (LBA) */
-    BYTE count            /* Sector count (1..255) */
+    UINT count            /* Sector count */
 )
 {
-    if (drv || !count) return RES_PARERR;
-    if (Stat & STA_NOINIT) return RES_NOTRDY;
-    if (Stat & STA_PROTECT) return RES_WRPRT;
+#if SDCARD_CRC
+    CrcError = FALSE;
+#endif
 
     if (!(CardType & 4)) sector *= 512;    /* Convert to byte address if needed */
 
@@ -477,7 +850,7 @@ DRESULT disk_write (
                 if (!xmit_datablock(buff, 0xFC)) break;
                 buff += 512;
             } while (--count);
-            if (!xmit_datablock(0, 0xFD))    /* STOP_TRAN token */
+            if (!xmit_datablock(0, 0xFD) && !count)    /* STOP_TRAN token */
                 count = 1;
         }
     }
@@ -485,7 +858,43 @@ DRESULT disk_write (
     DESELECT();            /* CS = H */
     rcvr_spi();            /* Idle (Release DO) */
 
-    return count ? RES_ERROR : RES_OK;
+    return count;        /* Number of sectors not written */
+}
+
+DRESULT disk_write (
+    BYTE drv,            /* Physical drive nmuber (0) */
+    const BYTE *buff,    /* Pointer to the data to be written */
+    DWORD sector,        /* Start sector number (LBA) */
+    BYTE count            /* Sector count (1..255) */
+)
+{
+    UINT left;
+
+#if SDCARD_RAMDISK
+    if (drv == RAMDISK_PDRV) return ramdisk_write(buff, sector, count);
+#endif
+    if (drv || !count) return RES_PARERR;
+    if ((Stat & STA_NOINIT) || Busy) return RES_NOTRDY;
+    if (Stat & STA_PROTECT) return RES_WRPRT;
+
+    Busy = true;
+
+#if SDCARD_READAHEAD
+    readahead_invalidate();
+#endif
+
+    left = write_blocks(buff, sector, count);
+
+#if SDCARD_CRC
+    BYTE retries = CRC_RETRIES;
+
+    while (left && CrcError && retries--)    /* Resend the rejected sectors */
+        left = write_blocks(buff + (count - left) * 512, sector + count - left, left);
+#endif
+
+    Busy = false;
+
+    return left ? RES_ERROR : RES_OK;
 }
 #endif /* _READONLY */
 
@@ -503,9 +912,12 @@ DRESULT disk_ioctl (
 {
     DRESULT res;
     BYTE n, csd[16], *ptr = buff;
-    WORD csize;
+    DWORD csize;
 
 
+#if SDCARD_RAMDISK
+    if (drv == RAMDISK_PDRV) return ramdisk_ioctl(ctrl, buff);
+#endif
     if (drv) return RES_PARERR;
 
     res = RES_ERROR;
@@ -530,17 +942,18 @@ DRESULT disk_ioctl (
         }
     }
     else {
-        if (Stat & STA_NOINIT) return RES_NOTRDY;
+        if ((Stat & STA_NOINIT) || Busy) return RES_NOTRDY;
 
+        Busy = true;
         SELECT();        /* CS = L */
 //      __HAL_SPI_ENABLE(&hspi1);
 
         switch (ctrl) {
         case GET_SECTOR_COUNT :    /* Get number of sectors on the disk (DWORD) */
             if ((send_cmd(CMD9, 0) == 0) && rcvr_datablock(csd, 16)) {
-                if ((csd[0] >> 6) == 1) {    /* SDC ver 2.00 */
-                    csize = csd[9] + ((WORD)csd[8] << 8) + 1;
-                    *(DWORD*)buff = (DWORD)csize << 10;
+                if ((csd[0] >> 6) == 1) {    /* SDC ver 2.00, 22 bit C_SIZE for SDXC */
+                    csize = csd[9] + ((DWORD)csd[8] << 8) + ((DWORD)(csd[7] & 63) << 16) + 1;
+                    *(DWORD*)buff = csize << 10;
                 } else {                    /* MMC or SDC ver 1.XX */
                     n = (csd[5] & 15) + ((csd[10] & 128) >> 7) + ((csd[9] & 3) << 1) + 2;
                     csize = (csd[8] >> 6) + ((WORD)csd[7] << 2) + ((WORD)(csd[6] & 3) << 10) + 1;
@@ -590,6 +1003,7 @@ DRESULT disk_ioctl (
 
         DESELECT();            /* CS = H */
         rcvr_spi();            /* Idle (Release DO) */
+        Busy = false;
     }
 
     return res;
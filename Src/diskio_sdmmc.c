@@ -0,0 +1,664 @@
+/*-----------------------------------------------------------------------*/
+/* MMC/SDC (in 4-bit SD bus mode) control module                         */
+/*-----------------------------------------------------------------------*/
+/* Alternative to the SPI mode module in diskio.c, selected by setting   */
+/* SDCARD_SDMMC. Uses the SDMMC1 peripheral with DMA2 stream 6, CRC of   */
+/* commands and data is checked by the peripheral.                       */
+/*                                                                       */
+/* Pins: PC8-PC11 = D0-D3, PC12 = CK, PD2 = CMD                          */
+/*-----------------------------------------------------------------------*/
+
+/*
+ * Part of grblHAL, for FatFs R0.13c
+ */
+
+#include "driver.h"
+
+#if SDCARD_ENABLE && SDCARD_SDMMC
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "main.h"
+#include "ff.h"
+#include "diskio.h"
+#if SDCARD_RAMDISK
+#include "ramdisk.h"
+#endif
+
+/* Definitions for SD command indexes */
+#define CMD0    0     /* GO_IDLE_STATE */
+#define CMD2    2     /* ALL_SEND_CID */
+#define CMD3    3     /* SEND_RELATIVE_ADDR */
+#define CMD6    6     /* SWITCH_FUNC */
+#define CMD7    7     /* SELECT_CARD */
+#define CMD8    8     /* SEND_IF_COND */
+#define CMD9    9     /* SEND_CSD */
+#define CMD12   12    /* STOP_TRANSMISSION */
+#define CMD13   13    /* SEND_STATUS */
+#define CMD16   16    /* SET_BLOCKLEN */
+#define CMD17   17    /* READ_SINGLE_BLOCK */
+#define CMD18   18    /* READ_MULTIPLE_BLOCK */
+#define CMD24   24    /* WRITE_BLOCK */
+#define CMD25   25    /* WRITE_MULTIPLE_BLOCK */
+#define CMD55   55    /* APP_CMD */
+#define ACMD6   6     /* SET_BUS_WIDTH (ACMD) */
+#define ACMD41  41    /* SD_SEND_OP_COND (ACMD) */
+
+/* Response types */
+#define R_NONE  0
+#define R1      1     /* Card status, error bits are checked */
+#define R2      2     /* CID or CSD, 136 bits */
+#define R3      3     /* OCR, carries no valid CRC */
+#define R6      6     /* Published RCA, also used for R7 */
+
+#define R1_ERRORS       0xFDFFE008UL    /* Card status error bits */
+#define R1_READY        (1UL << 8)      /* READY_FOR_DATA */
+#define R1_STATE(r)     (((r) >> 9) & 0x0F)
+#define STATE_TRAN      4
+
+#define SDMMC_CLK       48000000UL      /* SDMMC1 kernel clock, from PLL48CLK */
+#define CLKDIV_INIT     (SDMMC_CLK / 400000UL - 2)  /* 400 kHz during identification */
+#define CLKDIV_DS       0               /* 24 MHz default speed */
+
+#define SDMMC_CMD_FLAGS (SDMMC_ICR_CCRCFAILC|SDMMC_ICR_CTIMEOUTC|SDMMC_ICR_CMDRENDC|SDMMC_ICR_CMDSENTC)
+#define SDMMC_DATA_FLAGS (SDMMC_ICR_DCRCFAILC|SDMMC_ICR_DTIMEOUTC|SDMMC_ICR_TXUNDERRC|SDMMC_ICR_RXOVERRC|SDMMC_ICR_DATAENDC|SDMMC_ICR_DBCKENDC)
+#define SDMMC_DATA_ERRORS (SDMMC_STA_DCRCFAIL|SDMMC_STA_DTIMEOUT|SDMMC_STA_TXUNDERR|SDMMC_STA_RXOVERR)
+
+/* DMA2 stream 6 channel 4 is SDMMC1, stream 3 is taken by SPI1 TX */
+#define SD_DMA_STREAM   DMA2_Stream6
+#define SD_DMA_CHANNEL  4
+#define SD_DMA_FLAGS    (DMA_HIFCR_CTCIF6|DMA_HIFCR_CHTIF6|DMA_HIFCR_CTEIF6|DMA_HIFCR_CDMEIF6|DMA_HIFCR_CFEIF6)
+
+#define BOOL bool
+#define TRUE true
+#define FALSE false
+
+/*--------------------------------------------------------------------------
+
+   Module Private Functions
+
+---------------------------------------------------------------------------*/
+
+static volatile
+DSTATUS Stat = STA_NOINIT;    /* Disk status */
+
+static volatile
+BYTE Timer1, Timer2;    /* 100Hz decrement timer */
+
+static volatile
+BOOL Busy = FALSE;        /* Set while a disk function is executing */
+
+static
+BYTE CardType;            /* b1:SDC, b2:Block addressing */
+
+static
+DWORD RCA;                /* Relative card address, in upper 16 bits */
+
+static
+DWORD Clock;            /* Current SDMMC_CK frequency */
+
+static
+BYTE Csd[16], Cid[16], Ocr[4];
+
+#if SDCARD_YIELD
+
+disk_on_yield_ptr disk_on_yield = NULL;
+
+/* Runs the disk_on_yield handlers while waiting for the card, the SDMMC  */
+/* bus is not shared so the transfer may continue meanwhile.              */
+static
+void yield (void)
+{
+    static bool yielding = false;
+
+    if (!yielding && disk_on_yield) {
+        yielding = true;
+        disk_on_yield();
+        yielding = false;
+    }
+}
+
+#endif
+
+static
+void set_clock (
+    DWORD clkcr        /* CLKDIV and BYPASS bits */
+)
+{
+    SDMMC1->CLKCR = (SDMMC1->CLKCR & SDMMC_CLKCR_WIDBUS) | clkcr | SDMMC_CLKCR_CLKEN;
+    Clock = (clkcr & SDMMC_CLKCR_BYPASS) ? SDMMC_CLK : SDMMC_CLK / ((clkcr & SDMMC_CLKCR_CLKDIV) + 2);
+}
+
+static
+void power_on (void)
+{
+    GPIO_InitTypeDef GPIO_InitStruct = {
+        .Mode = GPIO_MODE_AF_PP,
+        .Pull = GPIO_PULLUP,
+        .Speed = GPIO_SPEED_FREQ_VERY_HIGH,
+        .Alternate = GPIO_AF12_SDMMC1
+    };
+
+    __HAL_RCC_GPIOC_CLK_ENABLE();
+    __HAL_RCC_GPIOD_CLK_ENABLE();
+    __HAL_RCC_SDMMC1_CLK_ENABLE();
+    __HAL_RCC_DMA2_CLK_ENABLE();
+
+    GPIO_InitStruct.Pin = GPIO_PIN_8|GPIO_PIN_9|GPIO_PIN_10|GPIO_PIN_11;
+    HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
+
+    GPIO_InitStruct.Pin = GPIO_PIN_2;
+    HAL_GPIO_Init(GPIOD, &GPIO_InitStruct);
+
+    GPIO_InitStruct.Pin = GPIO_PIN_12;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
+
+    SDMMC1->CLKCR = 0;
+    SDMMC1->POWER = SDMMC_POWER_PWRCTRL;
+    HAL_Delay(2);
+    set_clock(CLKDIV_INIT);
+    HAL_Delay(2);    /* At least 74 clocks before the first command */
+}
+
+static
+void power_off (void)
+{
+    SDMMC1->CLKCR = 0;
+    SDMMC1->POWER = 0;
+    Stat |= STA_NOINIT;
+}
+
+static
+int chk_power (void)        /* Socket power state: 0=off, 1=on */
+{
+    return (SDMMC1->POWER & SDMMC_POWER_PWRCTRL) == SDMMC_POWER_PWRCTRL;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Send a command and wait for the response                              */
+/*-----------------------------------------------------------------------*/
+
+static
+BOOL send_cmd (
+    BYTE cmd,        /* Command index */
+    DWORD arg,        /* Argument */
+    BYTE resp        /* Response type */
+)
+{
+    DWORD sta, waitresp = resp == R_NONE ? 0 : (resp == R2 ? SDMMC_CMD_WAITRESP : SDMMC_CMD_WAITRESP_0);
+
+    SDMMC1->ICR = SDMMC_CMD_FLAGS;
+    SDMMC1->ARG = arg;
+    SDMMC1->CMD = cmd | waitresp | SDMMC_CMD_CPSMEN;
+
+    if (resp == R_NONE) {
+        while (!(SDMMC1->STA & SDMMC_STA_CMDSENT));
+        SDMMC1->ICR = SDMMC_CMD_FLAGS;
+        return TRUE;
+    }
+
+    /* Response timeout is handled by the peripheral (64 clocks) */
+    while (!((sta = SDMMC1->STA) & (SDMMC_STA_CMDREND|SDMMC_STA_CCRCFAIL|SDMMC_STA_CTIMEOUT)));
+
+    SDMMC1->ICR = SDMMC_CMD_FLAGS;
+
+    if (sta & SDMMC_STA_CTIMEOUT)
+        return FALSE;
+
+    if (sta & SDMMC_STA_CCRCFAIL)
+        return resp == R3;
+
+    if (resp == R1)
+        return SDMMC1->RESPCMD == cmd && !(SDMMC1->RESP1 & R1_ERRORS);
+
+    return TRUE;
+}
+
+static
+BOOL send_acmd (
+    BYTE cmd,        /* Application command index */
+    DWORD arg,        /* Argument */
+    BYTE resp        /* Response type */
+)
+{
+    return send_cmd(CMD55, RCA, R1) && send_cmd(cmd, arg, resp);
+}
+
+/* Copies a 136 bit response to a byte array, MSB first */
+static
+void get_long_resp (
+    BYTE *buff        /* 16 byte buffer */
+)
+{
+    DWORD r[4] = { SDMMC1->RESP1, SDMMC1->RESP2, SDMMC1->RESP3, SDMMC1->RESP4 };
+    BYTE n;
+
+    for (n = 0; n < 16; n++)
+        buff[n] = (BYTE)(r[n >> 2] >> (24 - ((n & 3) << 3)));
+}
+
+/*-----------------------------------------------------------------------*/
+/* Wait for card ready (transfer state and ready for data)               */
+/*-----------------------------------------------------------------------*/
+
+static
+BOOL wait_ready (void)
+{
+    DWORD r1;
+
+    Timer2 = 50;    /* Wait for ready in timeout of 500ms */
+    do {
+        if (send_cmd(CMD13, RCA, R1)) {
+            r1 = SDMMC1->RESP1;
+            if ((r1 & R1_READY) && R1_STATE(r1) == STATE_TRAN)
+                return TRUE;
+        }
+#if SDCARD_YIELD
+        yield();
+#endif
+    } while (Timer2);
+
+    return FALSE;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Transfer data blocks by DMA                                           */
+/*-----------------------------------------------------------------------*/
+
+static
+BOOL data_transfer (
+    BYTE cmd,        /* Command index, CMD6, CMD17, CMD18, CMD24 or CMD25 */
+    DWORD arg,        /* Argument */
+    BYTE *buff,        /* Data buffer */
+    UINT len,        /* Number of bytes to transfer */
+    BYTE blkbits,    /* Block size as power of 2 */
+    BOOL write        /* Direction */
+)
+{
+    DWORD sta;
+    BOOL ok;
+
+    SD_DMA_STREAM->CR &= ~DMA_SxCR_EN;
+    while (SD_DMA_STREAM->CR & DMA_SxCR_EN);
+    DMA2->HIFCR = SD_DMA_FLAGS;
+
+    /* Peripheral flow control with 4 word bursts from/to the SDMMC FIFO.     */
+    /* The DMA FIFO handles packing so unaligned buffers are accepted as well. */
+    SD_DMA_STREAM->PAR = (uint32_t)&SDMMC1->FIFO;
+    SD_DMA_STREAM->M0AR = (uint32_t)buff;
+    SD_DMA_STREAM->NDTR = len >> 2;
+    SD_DMA_STREAM->FCR = DMA_SxFCR_DMDIS|DMA_SxFCR_FTH;
+    SD_DMA_STREAM->CR = (SD_DMA_CHANNEL << DMA_SxCR_CHSEL_Pos)|DMA_SxCR_PBURST_0|DMA_SxCR_PL|DMA_SxCR_PSIZE_1|
+                         (((uint32_t)buff & 3) ? 0 : DMA_SxCR_MSIZE_1)|DMA_SxCR_MINC|DMA_SxCR_PFCTRL|(write ? DMA_SxCR_DIR_0 : 0);
+    SD_DMA_STREAM->CR |= DMA_SxCR_EN;
+
+    SDMMC1->ICR = SDMMC_DATA_FLAGS;
+    SDMMC1->DTIMER = Clock / 2;    /* 500 ms */
+    SDMMC1->DLEN = len;
+
+    /* The data path is started before a read command so no data is missed, */
+    /* but only after a write command has been accepted by the card.         */
+    if (!write)
+        SDMMC1->DCTRL = (blkbits << SDMMC_DCTRL_DBLOCKSIZE_Pos)|SDMMC_DCTRL_DMAEN|SDMMC_DCTRL_DTEN|SDMMC_DCTRL_DTDIR;
+
+    if ((ok = send_cmd(cmd, arg, R1))) {
+
+        if (write)
+            SDMMC1->DCTRL = (blkbits << SDMMC_DCTRL_DBLOCKSIZE_Pos)|SDMMC_DCTRL_DMAEN|SDMMC_DCTRL_DTEN;
+
+        Timer1 = 100;    /* Transfer timeout of 1000 msec, the data timer covers a stalled card */
+        while (!((sta = SDMMC1->STA) & (SDMMC_STA_DATAEND|SDMMC_DATA_ERRORS)) && Timer1) {
+#if SDCARD_YIELD
+            yield();
+#endif
+        }
+
+        ok = (sta & SDMMC_STA_DATAEND) && !(sta & SDMMC_DATA_ERRORS);
+
+        if (cmd == CMD18 || cmd == CMD25)
+            ok = send_cmd(CMD12, 0, R1) && ok;
+    }
+
+    /* The stream disables itself when the peripheral signals the last transfer */
+    if (ok) {
+        Timer1 = 10;
+        while ((SD_DMA_STREAM->CR & DMA_SxCR_EN) && Timer1);
+        ok = !(DMA2->HISR & DMA_HISR_TEIF6) && !(SD_DMA_STREAM->CR & DMA_SxCR_EN);
+    }
+
+    SDMMC1->DCTRL = 0;
+    SD_DMA_STREAM->CR &= ~DMA_SxCR_EN;
+    while (SD_DMA_STREAM->CR & DMA_SxCR_EN);
+    DMA2->HIFCR = SD_DMA_FLAGS;
+    SDMMC1->ICR = SDMMC_DATA_FLAGS;
+
+    if (write)
+        ok = wait_ready() && ok;
+
+    return ok;
+}
+
+/* Switch to high speed (48 MHz) if supported by the card, */
+/* else run at default speed (24 MHz).                      */
+static
+void set_card_speed (void)
+{
+    BYTE status[64];
+    WORD ccc = ((WORD)Csd[4] << 4) | (Csd[5] >> 4);    /* Card command classes */
+
+    set_clock(CLKDIV_DS);
+
+    if ((ccc & (1 << 10)) &&                                                /* CMD6 supported */
+         data_transfer(CMD6, 0x80FFFFF1, status, sizeof(status), 6, FALSE) &&    /* Set access mode to high speed */
+          (status[16] & 0x0F) == 1) {                                        /* and switched */
+        HAL_Delay(1);
+        set_clock(SDMMC_CLKCR_BYPASS);
+    }
+}
+
+/*--------------------------------------------------------------------------
+
+   Public Functions
+
+---------------------------------------------------------------------------*/
+
+
+/*-----------------------------------------------------------------------*/
+/* Initialize Disk Drive                                                 */
+/*-----------------------------------------------------------------------*/
+
+DSTATUS disk_initialize (
+    BYTE drv        /* Physical drive nmuber (0) */
+)
+{
+    BYTE ty = 0;
+    BOOL v2;
+
+#if SDCARD_RAMDISK
+    if (drv == RAMDISK_PDRV) return ramdisk_initialize();
+#endif
+    if (drv) return STA_NOINIT;            /* Supports only single drive */
+    if (Stat & STA_NODISK) return Stat;    /* No card in the socket */
+    if (Busy) return Stat;                /* Called while yielding */
+
+    Busy = true;
+
+    power_on();                            /* Force socket power on, 1-bit bus at 400 kHz */
+
+    RCA = 0;
+
+    if (send_cmd(CMD0, 0, R_NONE)) {        /* Enter Idle state */
+        Timer1 = 100;                        /* Initialization timeout of 1000 msec */
+        v2 = send_cmd(CMD8, 0x1AA, R6) && (SDMMC1->RESP1 & 0xFFF) == 0x1AA;    /* SDC Ver2+ */
+        do {
+            if (send_acmd(ACMD41, 0x80100000 | (v2 ? (1UL << 30) : 0), R3) && (SDMMC1->RESP1 & (1UL << 31))) {
+                ty = (SDMMC1->RESP1 & (1UL << 30)) ? 6 : 2;    /* Check CCS bit */
+                break;
+            }
+        } while (Timer1);
+    }
+
+    if (ty) {
+        Ocr[0] = (BYTE)(SDMMC1->RESP1 >> 24);
+        Ocr[1] = (BYTE)(SDMMC1->RESP1 >> 16);
+        Ocr[2] = (BYTE)(SDMMC1->RESP1 >> 8);
+        Ocr[3] = (BYTE)SDMMC1->RESP1;
+
+        if (send_cmd(CMD2, 0, R2)) {                                /* Get CID */
+            get_long_resp(Cid);
+            if (send_cmd(CMD3, 0, R6)) {                            /* Get RCA */
+                RCA = SDMMC1->RESP1 & 0xFFFF0000;
+                if (send_cmd(CMD9, RCA, R2)) {                    /* Get CSD */
+                    get_long_resp(Csd);
+                    if (send_cmd(CMD7, RCA, R1) &&                    /* Select card */
+                         send_acmd(ACMD6, 2, R1) &&                /* 4-bit bus */
+                          send_cmd(CMD16, 512, R1))                /* Block length */
+                        SDMMC1->CLKCR |= SDMMC_CLKCR_WIDBUS_0;
+                    else
+                        ty = 0;
+                } else
+                    ty = 0;
+            } else
+                ty = 0;
+        } else
+            ty = 0;
+    }
+
+    CardType = ty;
+
+    if (ty) {            /* Initialization succeded */
+        Stat &= ~STA_NOINIT;        /* Clear STA_NOINIT */
+        set_card_speed();
+    } else {            /* Initialization failed */
+        power_off();
+    }
+
+    Busy = false;
+
+    return Stat;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get Disk Status                                                       */
+/*-----------------------------------------------------------------------*/
+
+DSTATUS disk_status (
+    BYTE drv        /* Physical drive nmuber (0) */
+)
+{
+#if SDCARD_RAMDISK
+    if (drv == RAMDISK_PDRV) return ramdisk_status();
+#endif
+    if (drv) return STA_NOINIT;        /* Supports only single drive */
+    return Stat;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Read Sector(s)                                                        */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_read (
+    BYTE drv,            /* Physical drive nmuber (0) */
+    BYTE *buff,            /* Pointer to the data buffer to store read data */
+    DWORD sector,        /* Start sector number (LBA) */
+    BYTE count            /* Sector count (1..255) */
+)
+{
+    BOOL ok;
+
+#if SDCARD_RAMDISK
+    if (drv == RAMDISK_PDRV) return ramdisk_read(buff, sector, count);
+#endif
+    if (drv || !count) return RES_PARERR;
+    if ((Stat & STA_NOINIT) || Busy) return RES_NOTRDY;
+
+    Busy = true;
+
+    if (!(CardType & 4)) sector *= 512;    /* Convert to byte address if needed */
+
+    ok = data_transfer(count == 1 ? CMD17 : CMD18, sector, buff, count * 512, 9, FALSE);
+
+    Busy = false;
+
+    return ok ? RES_OK : RES_ERROR;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Write Sector(s)                                                       */
+/*-----------------------------------------------------------------------*/
+
+#if FF_FS_READONLY == 0
+DRESULT disk_write (
+    BYTE drv,            /* Physical drive nmuber (0) */
+    const BYTE *buff,    /* Pointer to the data to be written */
+    DWORD sector,        /* Start sector number (LBA) */
+    BYTE count            /* Sector count (1..255) */
+)
+{
+    BOOL ok;
+
+#if SDCARD_RAMDISK
+    if (drv == RAMDISK_PDRV) return ramdisk_write(buff, sector, count);
+#endif
+    if (drv || !count) return RES_PARERR;
+    if (Stat & STA_NOINIT) return RES_NOTRDY;
+    if (Stat & STA_PROTECT) return RES_WRPRT;
+    if (Busy) return RES_NOTRDY;
+
+    Busy = true;
+
+    if (!(CardType & 4)) sector *= 512;    /* Convert to byte address if needed */
+
+    ok = data_transfer(count == 1 ? CMD24 : CMD25, sector, (BYTE *)buff, count * 512, 9, TRUE);
+
+    Busy = false;
+
+    return ok ? RES_OK : RES_ERROR;
+}
+#endif /* _READONLY */
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Miscellaneous Functions                                               */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_ioctl (
+    BYTE drv,        /* Physical drive nmuber (0) */
+    BYTE ctrl,        /* Control code */
+    void *buff        /* Buffer to send/receive control data */
+)
+{
+    DRESULT res;
+    BYTE n, *ptr = buff;
+    WORD csize;
+
+
+#if SDCARD_RAMDISK
+    if (drv == RAMDISK_PDRV) return ramdisk_ioctl(ctrl, buff);
+#endif
+    if (drv) return RES_PARERR;
+
+    res = RES_ERROR;
+
+    if (ctrl == CTRL_POWER) {
+        switch (*ptr) {
+        case 0:        /* Sub control code == 0 (POWER_OFF) */
+            if (chk_power())
+                power_off();        /* Power off */
+            res = RES_OK;
+            break;
+        case 1:        /* Sub control code == 1 (POWER_ON) */
+            power_on();                /* Power on */
+            res = RES_OK;
+            break;
+        case 2:        /* Sub control code == 2 (POWER_GET) */
+            *(ptr+1) = (BYTE)chk_power();
+            res = RES_OK;
+            break;
+        default :
+            res = RES_PARERR;
+        }
+    }
+    else {
+        if ((Stat & STA_NOINIT) || Busy) return RES_NOTRDY;
+
+        Busy = true;
+
+        switch (ctrl) {
+        case GET_SECTOR_COUNT :    /* Get number of sectors on the disk (DWORD) */
+            if ((Csd[0] >> 6) == 1) {    /* SDC ver 2.00 */
+                csize = Csd[9] + ((WORD)Csd[8] << 8) + 1;
+                *(DWORD*)buff = (DWORD)csize << 10;
+            } else {                    /* SDC ver 1.XX */
+                n = (Csd[5] & 15) + ((Csd[10] & 128) >> 7) + ((Csd[9] & 3) << 1) + 2;
+                csize = (Csd[8] >> 6) + ((WORD)Csd[7] << 2) + ((WORD)(Csd[6] & 3) << 10) + 1;
+                *(DWORD*)buff = (DWORD)csize << (n - 9);
+            }
+            res = RES_OK;
+            break;
+
+        case GET_SECTOR_SIZE :    /* Get sectors on the disk (WORD) */
+            *(WORD*)buff = 512;
+            res = RES_OK;
+            break;
+
+        case CTRL_SYNC :    /* Make sure that data has been written */
+            if (wait_ready())
+                res = RES_OK;
+            break;
+
+        case MMC_GET_CSD :    /* Receive CSD as a data block (16 bytes) */
+            memcpy(ptr, Csd, 16);
+            res = RES_OK;
+            break;
+
+        case MMC_GET_CID :    /* Receive CID as a data block (16 bytes) */
+            memcpy(ptr, Cid, 16);
+            res = RES_OK;
+            break;
+
+        case MMC_GET_OCR :    /* Receive OCR as an R3 resp (4 bytes) */
+            memcpy(ptr, Ocr, 4);
+            res = RES_OK;
+            break;
+
+        default:
+            res = RES_PARERR;
+        }
+
+        Busy = false;
+    }
+
+    return res;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Device Timer Interrupt Procedure  (Platform dependent)                */
+/*-----------------------------------------------------------------------*/
+/* This function must be called in period of 10ms                        */
+
+void disk_timerproc (void)
+{
+    BYTE n;
+
+
+    n = Timer1;                        /* 100Hz decrement timer */
+    if (n) Timer1 = --n;
+    n = Timer2;
+    if (n) Timer2 = --n;
+
+}
+
+/*---------------------------------------------------------*/
+/* User Provided Timer Function for FatFs module           */
+/*---------------------------------------------------------*/
+/* This is a real time clock service to be called from     */
+/* FatFs module. Any valid time must be returned even if   */
+/* the system does not support a real time clock.          */
+
+DWORD get_fattime (void)
+{
+
+    return    ((2007UL-1980) << 25)    // Year = 2007
+            | (6UL << 21)            // Month = June
+            | (5UL << 16)            // Day = 5
+            | (11U << 11)            // Hour = 11
+            | (38U << 5)            // Min = 38
+            | (0U >> 1)                // Sec = 0
+            ;
+
+}
+
+#endif
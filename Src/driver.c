@@ -40,6 +40,9 @@
 #include "sdcard/sdcard.h"
 #include "ff.h"
 #include "diskio.h"
+#if SDCARD_RAMDISK
+#include "ramdisk.h"
+#endif
 #endif
 
 #if USB_SERIAL_CDC
@@ -66,6 +69,8 @@
 #include "flash.h"
 #endif
 
+#include "profiler.h"
+
 #if ETHERNET_ENABLE
   #include "enet.h"
   #if TELNET_ENABLE
@@ -254,7 +259,7 @@ static output_signal_t outputpin[] = {
 #ifdef COOLANT_MIST_PIN
     { .id = Output_CoolantMist,     .port = COOLANT_MIST_PORT,      .pin = COOLANT_MIST_PIN,        .group = PinGroup_Coolant },
 #endif
-#ifdef SD_CS_PORT
+#if defined(SD_CS_PORT) && !SDCARD_SDMMC
     { .id = Output_SdCardCS,        .port = SD_CS_PORT,             .pin = SD_CS_PIN,               .group = PinGroup_SdCard },
 #endif
 #ifdef AUXOUTPUT0_PORT
@@ -278,7 +283,7 @@ static const output_signal_t peripin[] = {
 };
 */
 extern __IO uint32_t uwTick;
-static uint32_t pulse_length, pulse_delay, aux_irq = 0;
+static uint32_t pulse_length, pulse_delay, pulse_ticks_us, aux_irq = 0;
 static bool IOInitDone = false;
 static const io_stream_t *serial_stream;
 static axes_signals_t next_step_outbits;
@@ -294,6 +299,50 @@ static probe_state_t probe = {
 static axes_signals_t motors_1 = {AXES_BITMASK}, motors_2 = {AXES_BITMASK};
 #endif
 
+#if STEP_OUTTABLE || DIRECTION_OUTTABLE
+
+// Precomputed BSRR words, one per axes bitmask, for the step/dir outputs of a port.
+// Built by settings_changed() so the stepper interrupts only need one store per port.
+// NOTE: RAM use is 2 * N_OUTPUT_TABLES tables of 4 + 4 * 2^N_AXIS bytes, 4 * 2^N_AXIS more with
+//       squaring: 12 * 36 = 432 bytes for 3 axes, 18 * 516 = 9.3 KB for 6 axes with squaring.
+typedef struct {
+    GPIO_TypeDef *port;
+    uint32_t bsrr[1 << N_AXIS];
+#ifdef SQUARING_ENABLED
+    uint32_t bsrr2[1 << N_AXIS];    // for the second motor of ganged axes
+#endif
+} output_table_t;
+
+#define N_OUTPUT_TABLES (N_AXIS + 3) // worst case: one port per motor, only X, Y and Z may be ganged
+
+#endif
+
+#if STEP_OUTTABLE
+static uint_fast8_t n_step_tables = 0;
+static output_table_t step_table[N_OUTPUT_TABLES];
+#endif
+
+#if DIRECTION_OUTTABLE
+static uint_fast8_t n_dir_tables = 0;
+static output_table_t dir_table[N_OUTPUT_TABLES];
+#endif
+
+#if STEP_PULSE_DMA
+
+// Step pulse reset by DMA: on pulse timer update the DMA stream writes reset to the step port BSRR register,
+// this replaces the pulse timer interrupt at the end of each step pulse.
+// NOTE: only available when all step outputs are on the same port.
+typedef struct {
+    bool enabled;
+    GPIO_TypeDef *port;
+    uint32_t mask;
+    uint32_t reset;
+} step_pulse_dma_t;
+
+static step_pulse_dma_t step_dma = {0};
+
+#endif
+
 #if ETHERNET_ENABLE
 static network_services_t services = {0};
 static stream_write_ptr write_serial;
@@ -481,6 +530,13 @@ static void stepperCyclesPerTick (uint32_t cycles_per_tick)
 
 inline static __attribute__((always_inline)) void stepperSetStepOutputs (axes_signals_t step_outbits_1)
 {
+#if STEP_OUTTABLE
+    uint_fast8_t idx = n_step_tables;
+    uint_fast8_t bits_1 = step_outbits_1.mask & motors_1.mask, bits_2 = step_outbits_1.mask & motors_2.mask;
+
+    while(idx--)
+        step_table[idx].port->BSRR = step_table[idx].bsrr[bits_1] | step_table[idx].bsrr2[bits_2];
+#else
     axes_signals_t step_outbits_2;
     step_outbits_2.mask = (step_outbits_1.mask & motors_2.mask) ^ settings.steppers.step_invert.mask;
 
@@ -514,6 +570,7 @@ inline static __attribute__((always_inline)) void stepperSetStepOutputs (axes_si
 #ifdef Z2_STEP_PIN
     DIGITAL_OUT(Z2_STEP_PORT, Z2_STEP_BIT, step_outbits_2.z);
 #endif
+#endif // STEP_OUTTABLE
 }
 
 static axes_signals_t getAutoSquaredAxes (void)
@@ -548,7 +605,12 @@ static void StepperDisableMotors (axes_signals_t axes, squaring_mode_t mode)
 // NOTE: step_outbits are: bit0 -> X, bit1 -> Y, bit2 -> Z...
 inline static __attribute__((always_inline)) void stepperSetStepOutputs (axes_signals_t step_outbits)
 {
-#if STEP_OUTMODE == GPIO_SINGLE
+#if STEP_OUTTABLE
+    uint_fast8_t idx = n_step_tables;
+
+    while(idx--)
+        step_table[idx].port->BSRR = step_table[idx].bsrr[step_outbits.mask];
+#elif STEP_OUTMODE == GPIO_SINGLE
     step_outbits.mask ^= settings.steppers.step_invert.mask;
     DIGITAL_OUT(X_STEP_PORT, X_STEP_BIT, step_outbits.x);
     DIGITAL_OUT(Y_STEP_PORT, Y_STEP_BIT, step_outbits.y);
@@ -575,7 +637,12 @@ inline static __attribute__((always_inline)) void stepperSetStepOutputs (axes_si
 // NOTE: see note for stepperSetStepOutputs()
 inline static __attribute__((always_inline)) void stepperSetDirOutputs (axes_signals_t dir_outbits)
 {
-#if DIRECTION_OUTMODE == GPIO_SINGLE
+#if DIRECTION_OUTTABLE
+    uint_fast8_t idx = n_dir_tables;
+
+    while(idx--)
+        dir_table[idx].port->BSRR = dir_table[idx].bsrr[dir_outbits.mask];
+#elif DIRECTION_OUTMODE == GPIO_SINGLE
     dir_outbits.mask ^= settings.steppers.dir_invert.mask;
     DIGITAL_OUT(X_DIRECTION_PORT, X_DIRECTION_BIT, dir_outbits.x);
     DIGITAL_OUT(Y_DIRECTION_PORT, Y_DIRECTION_BIT, dir_outbits.y);
@@ -672,6 +739,12 @@ static void stepperPulseStartDelayed (stepper_t *stepper)
         if(stepper->step_outbits.value) {
             next_step_outbits = stepper->step_outbits; // Store out_bits
             PULSE_TIMER->ARR = pulse_delay;
+#if STEP_PULSE_DMA
+            if(step_dma.enabled) {                  // Interrupt is needed to start the delayed pulse, the step outputs
+                PULSE_TIMER->SR = ~TIM_SR_UIF;      // must not be reset by DMA at the end of the delay.
+                PULSE_TIMER->DIER = (PULSE_TIMER->DIER & ~TIM_DIER_UDE)|TIM_DIER_UIE; // UIF is left set by DMA ended pulses.
+            }
+#endif
             PULSE_TIMER->EGR = TIM_EGR_UG;
             PULSE_TIMER->CR1 |= TIM_CR1_CEN;
         }
@@ -1229,6 +1302,101 @@ static uint32_t getElapsedTicks (void)
     return uwTick;
 }
 
+#if STEP_OUTTABLE || DIRECTION_OUTTABLE
+
+static uint_fast8_t outputTableAxis (pin_function_t id, bool *secondary)
+{
+    *secondary = false;
+
+    switch(id) {
+
+        case Output_StepX_2:
+        case Output_DirX_2:
+            *secondary = true;
+            // no break
+        case Output_StepX:
+        case Output_DirX:
+            return X_AXIS;
+
+        case Output_StepY_2:
+        case Output_DirY_2:
+            *secondary = true;
+            // no break
+        case Output_StepY:
+        case Output_DirY:
+            return Y_AXIS;
+
+        case Output_StepZ_2:
+        case Output_DirZ_2:
+            *secondary = true;
+            // no break
+        case Output_StepZ:
+        case Output_DirZ:
+            return Z_AXIS;
+#ifdef A_AXIS
+        case Output_StepA:
+        case Output_DirA:
+            return A_AXIS;
+#endif
+#ifdef B_AXIS
+        case Output_StepB:
+        case Output_DirB:
+            return B_AXIS;
+#endif
+#ifdef C_AXIS
+        case Output_StepC:
+        case Output_DirC:
+            return C_AXIS;
+#endif
+        default:
+            break;
+    }
+
+    return N_AXIS;
+}
+
+// Builds per port BSRR words for all combinations of axis bits for the given pin group, invert mask is applied.
+// NOTE: the step output of the secondary motor of ganged axes is added to the bsrr2 table when auto squaring
+//       is enabled and left out otherwise, as by stepperSetStepOutputs(). Secondary direction outputs are
+//       driven together with the primary motor.
+static uint_fast8_t outputTableInit (output_table_t *table, pin_group_t group, uint8_t invert)
+{
+    bool secondary;
+    uint32_t i, bits, *bsrr;
+    uint_fast8_t axis, idx, n_tables = 0;
+
+    memset(table, 0, sizeof(output_table_t) * N_OUTPUT_TABLES);
+
+    for(i = 0; i < sizeof(outputpin) / sizeof(output_signal_t); i++) {
+
+        if(outputpin[i].group != group || (axis = outputTableAxis(outputpin[i].id, &secondary)) == N_AXIS)
+            continue;
+
+#ifndef SQUARING_ENABLED
+        if(secondary && group == PinGroup_StepperStep)
+            continue;
+#endif
+
+        for(idx = 0; idx < n_tables && table[idx].port != outputpin[i].port; idx++);
+
+        if(idx == n_tables)
+            table[n_tables++].port = outputpin[i].port;
+
+#ifdef SQUARING_ENABLED
+        bsrr = secondary && group == PinGroup_StepperStep ? table[idx].bsrr2 : table[idx].bsrr;
+#else
+        bsrr = table[idx].bsrr;
+#endif
+
+        for(bits = 0; bits < (1 << N_AXIS); bits++)
+            bsrr[bits] |= ((bits ^ invert) & bit(axis)) ? outputpin[i].bit : (outputpin[i].bit << 16);
+    }
+
+    return n_tables;
+}
+
+#endif // STEP_OUTTABLE || DIRECTION_OUTTABLE
+
 // Configures peripherals when settings are initialized or changed
 void settings_changed (settings_t *settings)
 {
@@ -1247,10 +1415,38 @@ void settings_changed (settings_t *settings)
             .Speed = GPIO_SPEED_FREQ_HIGH
         };
 
+#if STEP_OUTTABLE || DIRECTION_OUTTABLE
+        // The stepper interrupts may be running: the tables are unpublished while rebuilt
+        // and the number of tables is published last.
+        uint_fast8_t n_tables;
+#endif
+#if STEP_OUTTABLE
+        n_step_tables = 0;
+        __DMB();
+        n_tables = outputTableInit(step_table, PinGroup_StepperStep, settings->steppers.step_invert.mask);
+        __DMB();
+        n_step_tables = n_tables;
+#endif
+#if DIRECTION_OUTTABLE
+        n_dir_tables = 0;
+        __DMB();
+        n_tables = outputTableInit(dir_table, PinGroup_StepperDir, settings->steppers.dir_invert.mask);
+        __DMB();
+        n_dir_tables = n_tables;
+#endif
+
         stepperSetStepOutputs((axes_signals_t){0});
         stepperSetDirOutputs((axes_signals_t){0});
         stepperEnable(settings->steppers.deenergize);
 
+#if STEP_PULSE_DMA
+        if(step_dma.enabled) {
+            // Step outputs are now in their inactive state, capture it as the BSRR reset word.
+            uint32_t odr = step_dma.port->ODR & step_dma.mask;
+            step_dma.reset = odr | ((~odr & step_dma.mask) << 16);
+        }
+#endif
+
 #ifdef SQUARING_ENABLED
         hal.stepper.disable_motors((axes_signals_t){0}, SquaringMode_Both);
 #endif
@@ -1331,10 +1527,12 @@ void settings_changed (settings_t *settings)
 
 #endif
 
-        pulse_length = (uint32_t)(10.0f * (settings->steppers.pulse_microseconds - STEP_PULSE_LATENCY)) - 1;
+        pulse_length = (uint32_t)((float)pulse_ticks_us * (settings->steppers.pulse_microseconds - STEP_PULSE_LATENCY)) - 1;
+        pulse_length = min(pulse_length, 0xFFFFUL); // 16-bit pulse timer, ~600 us max
 
         if(hal.driver_cap.step_pulse_delay && settings->steppers.pulse_delay_microseconds > 0.0f) {
-            pulse_delay = (uint32_t)(10.0f * (settings->steppers.pulse_delay_microseconds - 1.0f));
+            pulse_delay = (uint32_t)((float)pulse_ticks_us * (settings->steppers.pulse_delay_microseconds - 1.0f));
+            pulse_delay = min(pulse_delay, 0xFFFEUL);
             if(pulse_delay < 2)
                 pulse_delay = 2;
             else if(pulse_delay == pulse_length)
@@ -1609,6 +1807,9 @@ static bool driver_setup (settings_t *settings)
     __HAL_RCC_TIM4_CLK_ENABLE();
     __HAL_RCC_TIM5_CLK_ENABLE();
     __HAL_RCC_TIM9_CLK_ENABLE();
+#if STEP_PULSE_DMA
+    __HAL_RCC_TIM8_CLK_ENABLE();
+#endif
 
     GPIO_InitTypeDef GPIO_Init = {
         .Speed = GPIO_SPEED_FREQ_HIGH,
@@ -1638,9 +1839,10 @@ static bool driver_setup (settings_t *settings)
     NVIC_SetPriority(STEPPER_TIMER_IRQn, 1);
     NVIC_EnableIRQ(STEPPER_TIMER_IRQn);
 
- // Single-shot 100 ns per tick
+ // Single-shot, clocked at hal.f_step_timer for an integer number of ticks per microsecond
+    pulse_ticks_us = hal.f_step_timer / 1000000UL;
     PULSE_TIMER->CR1 |= TIM_CR1_OPM|TIM_CR1_DIR|TIM_CR1_CKD_1|TIM_CR1_ARPE|TIM_CR1_URS;
-    PULSE_TIMER->PSC = hal.f_step_timer / 10000000UL - 1;
+    PULSE_TIMER->PSC = PULSE_TIMER_CLOCK_MUL - 1;
     PULSE_TIMER->SR &= ~(TIM_SR_UIF|TIM_SR_CC1IF);
     PULSE_TIMER->CNT = 0;
     PULSE_TIMER->DIER |= TIM_DIER_UIE;
@@ -1648,6 +1850,45 @@ static bool driver_setup (settings_t *settings)
     NVIC_SetPriority(PULSE_TIMER_IRQn, 0);
     NVIC_EnableIRQ(PULSE_TIMER_IRQn);
 
+#if STEP_PULSE_DMA
+
+    step_dma.port = NULL;
+    step_dma.mask = 0;
+    step_dma.enabled = true;
+
+    for(i = 0 ; i < sizeof(outputpin) / sizeof(output_signal_t); i++) {
+        if(outputpin[i].group == PinGroup_StepperStep) {
+            if(step_dma.port == NULL)
+                step_dma.port = outputpin[i].port;
+            step_dma.enabled &= step_dma.port == outputpin[i].port;
+            step_dma.mask |= outputpin[i].bit;
+        }
+    }
+
+    if(step_dma.enabled) {
+
+        __HAL_RCC_DMA2_CLK_ENABLE();
+
+        PULSE_TIMER_DMA_STREAM->CR &= ~DMA_SxCR_EN;
+        while(PULSE_TIMER_DMA_STREAM->CR & DMA_SxCR_EN);
+        DMA2->LIFCR = PULSE_TIMER_DMA_FLAGS;
+
+        // Memory to peripheral, single 32-bit word, circular so it rearms itself after each transfer
+        PULSE_TIMER_DMA_STREAM->PAR = (uint32_t)&step_dma.port->BSRR;
+        PULSE_TIMER_DMA_STREAM->M0AR = (uint32_t)&step_dma.reset;
+        PULSE_TIMER_DMA_STREAM->NDTR = 1;
+        PULSE_TIMER_DMA_STREAM->FCR = 0;
+        PULSE_TIMER_DMA_STREAM->CR = (PULSE_TIMER_DMA_CHANNEL << DMA_SxCR_CHSEL_Pos)|DMA_SxCR_PL|DMA_SxCR_MSIZE_1|DMA_SxCR_PSIZE_1|DMA_SxCR_CIRC|DMA_SxCR_DIR_0|DMA_SxCR_TEIE;
+        PULSE_TIMER_DMA_STREAM->CR |= DMA_SxCR_EN;
+
+        NVIC_SetPriority(PULSE_TIMER_DMA_IRQn, 0);
+        NVIC_EnableIRQ(PULSE_TIMER_DMA_IRQn);
+
+        PULSE_TIMER->DIER = (PULSE_TIMER->DIER & ~TIM_DIER_UIE)|TIM_DIER_UDE;
+    }
+
+#endif
+
  // Limit pins init
 
     if (settings->limits.flags.hard_enabled)
@@ -1693,10 +1934,20 @@ static bool driver_setup (settings_t *settings)
 
 #if SDCARD_ENABLE
 
+#if !SDCARD_SDMMC
     DIGITAL_OUT(SD_CS_PORT, SD_CS_BIT, 1);
+#endif
 
     sdcard_init();
 
+#if SDCARD_READAHEAD
+    disk_readahead_init();
+#endif
+
+#endif
+
+#if EEPROM_ENABLE
+    i2c_nvs_queue_init();
 #endif
 
 #if PPI_ENABLE
@@ -1737,6 +1988,11 @@ static bool driver_setup (settings_t *settings)
 
     IOInitDone = settings->version == 19;
 
+#if SDCARD_ENABLE && SDCARD_RAMDISK
+    // A RAM disk that fails to format or mount is reported by $I, it does not fail the driver setup.
+    ramdisk_init();
+#endif
+
     hal.settings_changed(settings);
     hal.spindle.set_state((spindle_state_t){0}, 0.0f);
     hal.coolant.set_state((coolant_state_t){0});
@@ -1923,6 +2179,10 @@ bool driver_init (void)
 #endif
 #endif
 
+#if ISR_PROFILER_ENABLE
+    profiler_init();
+#endif
+
 #include "grbl/plugins_init.h"
 
     // No need to move version check before init.
@@ -1935,11 +2195,16 @@ bool driver_init (void)
 // Main stepper driver
 void STEPPER_TIMER_IRQHandler (void)
 {
+    PROFILER_ISR_LATENCY(ProfileISR_Stepper, STEPPER_TIMER->CNT)
+    PROFILER_ISR_ENTER(ProfileISR_Stepper)
+
     if ((STEPPER_TIMER->SR & TIM_SR_UIF) != 0)                  // check interrupt source
     {
         STEPPER_TIMER->SR = ~TIM_SR_UIF; // clear UIF flag
         hal.stepper.interrupt_callback();
     }
+
+    PROFILER_ISR_EXIT(ProfileISR_Stepper)
 }
 
 /* The Stepper Port Reset Interrupt: This interrupt handles the falling edge of the step
@@ -1960,20 +2225,47 @@ void STEPPER_TIMER_IRQHandler (void)
 // This interrupt is enabled when Grbl sets the motor port bits to execute
 // a step. This ISR resets the motor port after a short period (settings.pulse_microseconds)
 // completing one step cycle.
+// NOTE: when STEP_PULSE_DMA is enabled and active the motor port is reset by DMA and this
+//       interrupt is only enabled for the delayed pulse start.
 void PULSE_TIMER_IRQHandler (void)
 {
+    PROFILER_ISR_ENTER(ProfileISR_Pulse)
+
     PULSE_TIMER->SR &= ~TIM_SR_UIF;                 // Clear UIF flag
 
     if (PULSE_TIMER->ARR == pulse_delay)            // Delayed step pulse?
     {
-        PULSE_TIMER->ARR = pulse_length;
         stepperSetStepOutputs(next_step_outbits);   // begin step pulse
+        PULSE_TIMER->ARR = pulse_length;
         PULSE_TIMER->EGR = TIM_EGR_UG;
+#if STEP_PULSE_DMA
+        if(step_dma.enabled)                        // end of pulse is handled by DMA, UG does not raise
+            PULSE_TIMER->DIER = (PULSE_TIMER->DIER & ~TIM_DIER_UIE)|TIM_DIER_UDE; // a DMA request as URS is set
+#endif
         PULSE_TIMER->CR1 |= TIM_CR1_CEN;
     } else
         stepperSetStepOutputs((axes_signals_t){0}); // end step pulse
+
+    PROFILER_ISR_EXIT(ProfileISR_Pulse)
 }
 
+#if STEP_PULSE_DMA
+
+// The stream is disabled by hardware on a transfer error, fall back to
+// ending step pulses from the pulse timer interrupt.
+void PULSE_TIMER_DMA_IRQHandler (void)
+{
+    if(DMA2->LISR & PULSE_TIMER_DMA_TEIF) {
+        DMA2->LIFCR = PULSE_TIMER_DMA_FLAGS;
+        step_dma.enabled = false;
+        PULSE_TIMER->DIER = (PULSE_TIMER->DIER & ~TIM_DIER_UDE)|TIM_DIER_UIE;
+        NVIC_DisableIRQ(PULSE_TIMER_DMA_IRQn);
+        stepperSetStepOutputs((axes_signals_t){0});
+    }
+}
+
+#endif
+
 // Debounce timer interrupt handler
 void DEBOUNCE_TIMER_IRQHandler (void)
 {
@@ -2034,6 +2326,8 @@ void RPM_COUNTER_IRQHandler (void)
 
 void EXTI0_IRQHandler(void)
 {
+    PROFILER_ISR_ENTER(ProfileISR_EXTI0)
+
     uint32_t ifg = __HAL_GPIO_EXTI_GET_IT(1<<0);
 
     if(ifg) {
@@ -2061,6 +2355,8 @@ void EXTI0_IRQHandler(void)
 #endif
 
     }
+
+    PROFILER_ISR_EXIT(ProfileISR_EXTI0)
 }
 
 #endif
@@ -2069,6 +2365,8 @@ void EXTI0_IRQHandler(void)
 
 void EXTI1_IRQHandler(void)
 {
+    PROFILER_ISR_ENTER(ProfileISR_EXTI1)
+
     uint32_t ifg = __HAL_GPIO_EXTI_GET_IT(1<<1);
 
     if(ifg) {
@@ -2093,6 +2391,8 @@ void EXTI1_IRQHandler(void)
         ioports_event(ifg);
 #endif
     }
+
+    PROFILER_ISR_EXIT(ProfileISR_EXTI1)
 }
 
 #endif
@@ -2101,6 +2401,8 @@ void EXTI1_IRQHandler(void)
 
 void EXTI2_IRQHandler(void)
 {
+    PROFILER_ISR_ENTER(ProfileISR_EXTI2)
+
     uint32_t ifg = __HAL_GPIO_EXTI_GET_IT(1<<2);
 
     if(ifg) {
@@ -2125,6 +2427,8 @@ void EXTI2_IRQHandler(void)
         ioports_event(ifg);
 #endif
     }
+
+    PROFILER_ISR_EXIT(ProfileISR_EXTI2)
 }
 
 #endif
@@ -2133,6 +2437,8 @@ void EXTI2_IRQHandler(void)
 
 void EXTI3_IRQHandler(void)
 {
+    PROFILER_ISR_ENTER(ProfileISR_EXTI3)
+
     uint32_t ifg = __HAL_GPIO_EXTI_GET_IT(1<<3);
 
     if(ifg) {
@@ -2157,6 +2463,8 @@ void EXTI3_IRQHandler(void)
         ioports_event(ifg);
 #endif
     }
+
+    PROFILER_ISR_EXIT(ProfileISR_EXTI3)
 }
 
 #endif
@@ -2165,6 +2473,8 @@ void EXTI3_IRQHandler(void)
 
 void EXTI4_IRQHandler(void)
 {
+    PROFILER_ISR_ENTER(ProfileISR_EXTI4)
+
     uint32_t ifg = __HAL_GPIO_EXTI_GET_IT(1<<4);
 
     if(ifg) {
@@ -2189,6 +2499,8 @@ void EXTI4_IRQHandler(void)
         ioports_event(ifg);
 #endif
     }
+
+    PROFILER_ISR_EXIT(ProfileISR_EXTI4)
 }
 
 #endif
@@ -2197,6 +2509,8 @@ void EXTI4_IRQHandler(void)
 
 void EXTI9_5_IRQHandler(void)
 {
+    PROFILER_ISR_ENTER(ProfileISR_EXTI9_5)
+
     uint32_t ifg = __HAL_GPIO_EXTI_GET_IT(0x03E0);
 
     if(ifg) {
@@ -2229,6 +2543,8 @@ void EXTI9_5_IRQHandler(void)
             ioports_event(ifg & aux_irq);
 #endif
     }
+
+    PROFILER_ISR_EXIT(ProfileISR_EXTI9_5)
 }
 
 #endif
@@ -2237,6 +2553,8 @@ void EXTI9_5_IRQHandler(void)
 
 void EXTI15_10_IRQHandler(void)
 {
+    PROFILER_ISR_ENTER(ProfileISR_EXTI15_10)
+
     uint32_t ifg = __HAL_GPIO_EXTI_GET_IT(0xFC00);
 
     if(ifg) {
@@ -2284,6 +2602,8 @@ void EXTI15_10_IRQHandler(void)
             ioports_event(ifg & aux_irq);
 #endif
     }
+
+    PROFILER_ISR_EXIT(ProfileISR_EXTI15_10)
 }
 
 #endif
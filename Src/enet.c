@@ -35,8 +35,14 @@
 #include "ethernetif.h"
 
 #include "grbl/report.h"
+#include "grbl/nuts_bolts.h"
 #include "grbl/nvs_buffer.h"
 
+#if SDCARD_ENABLE && SDCARD_YIELD && !FTP_ENABLE
+#include "ff.h"
+#include "diskio.h"
+#endif
+
 #include "networking/networking.h"
 
 static volatile bool linkUp = false;
@@ -61,6 +67,14 @@ static void report_options (bool newopt)
         hal.stream.write("[IP:");
         hal.stream.write(IPAddress);
         hal.stream.write("]" ASCII_EOL);
+
+        const ethernetif_stats_t *stats = ethernetif_get_stats();
+
+        hal.stream.write("[ETHRX:");
+        hal.stream.write(uitoa(stats->rx_frames));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(stats->rx_overruns));
+        hal.stream.write("]" ASCII_EOL);
     }
 }
 
@@ -107,7 +121,7 @@ static void netif_status_callback (struct netif *netif)
     }
 }
 
-static void enet_poll (sys_state_t state)
+static void enet_service (void)
 {
     static uint32_t last_ms0, last_ms1;
     uint32_t ms = hal.get_elapsed_ticks();
@@ -141,10 +155,31 @@ static void enet_poll (sys_state_t state)
     //        enet_poll();
         }
     }
+}
+
+static void enet_poll (sys_state_t state)
+{
+    enet_service();
 
     on_execute_realtime(state);
 }
 
+#if SDCARD_ENABLE && SDCARD_YIELD && !FTP_ENABLE
+
+static disk_on_yield_ptr on_disk_yield;
+
+// Keeps the network going while the SD card is busy. Not with the FTP daemon,
+// its lwIP callbacks read and write files on the card.
+static void enet_disk_yield (void)
+{
+    enet_service();
+
+    if(on_disk_yield)
+        on_disk_yield();
+}
+
+#endif
+
 bool enet_start (void)
 {
     static struct netif ethif;
@@ -155,6 +190,11 @@ bool enet_start (void)
         on_execute_realtime = grbl.on_execute_realtime;
         grbl.on_execute_realtime = enet_poll;
 
+#if SDCARD_ENABLE && SDCARD_YIELD && !FTP_ENABLE
+        on_disk_yield = disk_on_yield;
+        disk_on_yield = enet_disk_yield;
+#endif
+
         memcpy(&network, &ethernet, sizeof(network_settings_t));
 
         lwip_init();
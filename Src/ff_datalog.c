@@ -0,0 +1,140 @@
+/*
+
+  ff_datalog.c - FatFs contiguous data capture files
+
+  Part of grblHAL
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if SDCARD_ENABLE && SDCARD_DATALOG
+
+#include <stddef.h>
+#include <string.h>
+
+#include "grbl/nuts_bolts.h"
+
+#include "ff_datalog.h"
+#include "diskio.h"
+
+#if !FF_USE_EXPAND
+#error "FF_USE_EXPAND must be enabled in ffconf.h!"
+#endif
+
+#if FF_MIN_SS != FF_MAX_SS
+#error "Variable sector size is not supported!"
+#endif
+
+#define SECTOR_SIZE FF_MIN_SS
+
+// Writes the buffered sectors with a single (multi-block) disk_write() call.
+static FRESULT flush (datalog_t *log, UINT sectors)
+{
+    DRESULT res;
+
+    if(log->written + sectors > log->sectors)
+        return FR_DENIED;
+
+    if((res = disk_write(log->pdrv, log->buf, log->sector + log->written, sectors)) != RES_OK)
+        return res == RES_NOTRDY ? FR_NOT_READY : FR_DISK_ERR;
+
+    log->written += sectors;
+    log->len = 0;
+
+    return FR_OK;
+}
+
+FRESULT f_datalog_open (datalog_t *log, const TCHAR *path, FSIZE_t size)
+{
+    FRESULT res;
+    FATFS *fs;
+
+    memset(log, 0, offsetof(datalog_t, buf));
+
+    if((res = f_open(&log->file, path, FA_READ|FA_WRITE|FA_CREATE_ALWAYS)) != FR_OK)
+        return res;
+
+    // Commit the allocation with size 0, the size is set by f_datalog_close().
+    // After a power loss the file is empty rather than exposing stale data in the unwritten part.
+    if((res = f_expand(&log->file, size, 1)) == FR_OK) {
+        log->file.obj.objsize = 0;
+        res = f_sync(&log->file);
+    }
+
+    if(res == FR_OK) {
+        fs = log->file.obj.fs;
+        log->pdrv = fs->pdrv;
+        log->sector = fs->database + (DWORD)fs->csize * (log->file.obj.sclust - 2);
+        log->sectors = (DWORD)((size + SECTOR_SIZE - 1) / SECTOR_SIZE);
+        log->size = size;
+    } else {
+        f_close(&log->file);
+        f_unlink(path);
+    }
+
+    return res;
+}
+
+FRESULT f_datalog_write (datalog_t *log, const void *data, UINT len)
+{
+    UINT n;
+    FRESULT res = FR_OK;
+    const BYTE *src = data;
+
+    if((FSIZE_t)log->written * SECTOR_SIZE + log->len + len > log->size)
+        return FR_DENIED;
+
+    while(res == FR_OK && len) {
+        n = min(len, sizeof(log->buf) - log->len);
+        memcpy(log->buf + log->len, src, n);
+        log->len += n;
+        src += n;
+        len -= n;
+        if(log->len == sizeof(log->buf))
+            res = flush(log, DATALOG_SECTORS);
+    }
+
+    return res;
+}
+
+FRESULT f_datalog_close (datalog_t *log)
+{
+    FRESULT res = FR_OK;
+    FSIZE_t size = (FSIZE_t)log->written * SECTOR_SIZE + log->len;
+
+    // Pad the last sector
+    if(log->len) {
+        memset(log->buf + log->len, 0, sizeof(log->buf) - log->len);
+        res = flush(log, (log->len + SECTOR_SIZE - 1) / SECTOR_SIZE);
+    }
+
+    if(res == FR_OK && disk_ioctl(log->pdrv, CTRL_SYNC, NULL) != RES_OK)
+        res = FR_DISK_ERR;
+
+    // Set the final size, the cluster chain is followed up to it and clusters past the end of the data are released
+    if(res == FR_OK && (res = f_lseek(&log->file, size)) == FR_OK)
+        res = f_truncate(&log->file);
+
+    if(res == FR_OK)
+        res = f_close(&log->file);
+    else
+        f_close(&log->file);
+
+    return res;
+}
+
+#endif
@@ -0,0 +1,82 @@
+/*
+
+  ff_fastseek.c - FatFs fast seek (cluster link map) helpers
+
+  Part of grblHAL
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if SDCARD_ENABLE && SDCARD_FASTSEEK
+
+#include <stdlib.h>
+
+#include "ff_fastseek.h"
+
+#if !FF_USE_FASTSEEK
+#error "FF_USE_FASTSEEK must be enabled in ffconf.h!"
+#endif
+
+#define CLMT_INITIAL_SIZE 10 // items, table header + 4 fragments
+
+FRESULT f_fastseek_enable (FIL *fp)
+{
+    FRESULT res;
+    DWORD *clmt, size = CLMT_INITIAL_SIZE;
+    FSIZE_t pos = f_tell(fp);
+
+    f_fastseek_disable(fp);
+
+    // First try with a small table, on FR_NOT_ENOUGH_CORE FatFs returns the required size in the first item.
+    do {
+        if((clmt = malloc(size * sizeof(DWORD))) == NULL)
+            return FR_NOT_ENOUGH_CORE;
+
+        *clmt = size;
+        fp->cltbl = clmt;
+
+        if((res = f_lseek(fp, CREATE_LINKMAP)) == FR_NOT_ENOUGH_CORE) {
+            size = *clmt;
+            fp->cltbl = NULL;
+            free(clmt);
+            clmt = NULL;
+        }
+    } while(res == FR_NOT_ENOUGH_CORE && size > CLMT_INITIAL_SIZE);
+
+    if(res == FR_OK && *clmt < size) { // Trim table to the size used
+        DWORD *trimmed = realloc(clmt, *clmt * sizeof(DWORD));
+        if(trimmed)
+            fp->cltbl = trimmed;
+    }
+
+    if(res != FR_OK)
+        f_fastseek_disable(fp);
+    else if(pos)
+        res = f_lseek(fp, pos);
+
+    return res;
+}
+
+void f_fastseek_disable (FIL *fp)
+{
+    if(fp->cltbl) {
+        free(fp->cltbl);
+        fp->cltbl = NULL;
+    }
+}
+
+#endif
@@ -0,0 +1,248 @@
+/*
+
+  ff_jobcache.c - FatFs compacted job file cache
+
+  Part of grblHAL
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if SDCARD_ENABLE && SDCARD_JOBCACHE
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "grbl/nuts_bolts.h"
+
+#include "ff_jobcache.h"
+
+#define JOBCACHE_MAGIC 0x3143414AUL // "JAC1"
+#define COMMENT_MAX    8            // characters buffered for classifying a comment, see keep_comment()
+
+// The header is written first with size 0 and rewritten with the final size when the cache is complete,
+// a cache with a size not matching the file size is rebuilt.
+typedef struct {
+    uint32_t magic;
+    DWORD src_size;
+    WORD src_date;
+    WORD src_time;
+    DWORD size;
+} jobcache_header_t;
+
+typedef struct {
+    FIL src;
+    UINT out_len;
+    UINT comment_len;
+    bool in_comment;
+    bool eol_comment;
+    bool keep_comment;
+    bool line_empty;
+    BYTE in[512];
+    BYTE out[512];
+    char comment[COMMENT_MAX];
+    TCHAR path[FF_MAX_LFN + sizeof(JOBCACHE_SUFFIX)];
+} jobcache_build_t;
+
+static FRESULT emit (jobcache_build_t *jc, FIL *fp, const char *s, UINT len)
+{
+    UINT bw, n;
+    FRESULT res = FR_OK;
+
+    while(res == FR_OK && len) {
+        n = min(len, sizeof(jc->out) - jc->out_len);
+        memcpy(jc->out + jc->out_len, s, n);
+        jc->out_len += n;
+        s += n;
+        len -= n;
+        if(jc->out_len == sizeof(jc->out)) {
+            if((res = f_write(fp, jc->out, jc->out_len, &bw)) == FR_OK && bw != jc->out_len)
+                res = FR_DENIED; // disk full
+            jc->out_len = 0;
+        }
+    }
+
+    return res;
+}
+
+static bool keep_comment (const char *comment, UINT len)
+{
+    static const char *const keep[] = { "(MSG", "(PRINT", "(DEBUG" };
+
+    uint_fast8_t idx = sizeof(keep) / sizeof(keep[0]), n;
+
+    while(idx--) {
+        n = strlen(keep[idx]);
+        if(len >= n && !strncasecmp(comment, keep[idx], n))
+            return true;
+    }
+
+    return false;
+}
+
+// Strips a chunk of G-code the same way the protocol layer does before a block is parsed.
+static FRESULT compact (jobcache_build_t *jc, FIL *fp, const BYTE *in, UINT len)
+{
+    char c;
+    FRESULT res = FR_OK;
+
+    while(res == FR_OK && len--) {
+
+        c = (char)*in++;
+
+        if(c == '\n' || c == '\r') {
+            if(jc->in_comment && !jc->keep_comment && keep_comment(jc->comment, jc->comment_len)) {
+                res = emit(jc, fp, jc->comment, jc->comment_len); // Unterminated comment, pass on as is
+                jc->line_empty = false;
+            }
+            if(res == FR_OK && !jc->line_empty)
+                res = emit(jc, fp, "\n", 1);
+            jc->in_comment = jc->eol_comment = false;
+            jc->line_empty = true;
+        } else if(jc->eol_comment)
+            continue;
+        else if(jc->in_comment) {
+            if(jc->keep_comment)
+                res = emit(jc, fp, &c, 1);
+            else if(jc->comment_len < COMMENT_MAX) {
+                jc->comment[jc->comment_len++] = c;
+                // Classify when the comment ends or enough of it is buffered, comments not kept are dropped.
+                if((c == ')' || jc->comment_len == COMMENT_MAX) && (jc->keep_comment = keep_comment(jc->comment, jc->comment_len))) {
+                    res = emit(jc, fp, jc->comment, jc->comment_len);
+                    jc->line_empty = false;
+                }
+            }
+            if(c == ')')
+                jc->in_comment = jc->keep_comment = false;
+        } else if(c == '(') {
+            jc->in_comment = true;
+            jc->keep_comment = false;
+            jc->comment[0] = c;
+            jc->comment_len = 1;
+        } else if(c == ';')
+            jc->eol_comment = true;
+        else if(c > ' ') {
+            c = toupper(c);
+            res = emit(jc, fp, &c, 1);
+            jc->line_empty = false;
+        }
+    }
+
+    return res;
+}
+
+static FRESULT build (jobcache_build_t *jc, FIL *fp, const TCHAR *path, jobcache_header_t *hdr)
+{
+    UINT br, bw;
+    FRESULT res;
+
+    if((res = f_open(&jc->src, path, FA_READ)) != FR_OK)
+        return res;
+
+    if((res = f_open(fp, jc->path, FA_READ|FA_WRITE|FA_CREATE_ALWAYS)) == FR_OK) {
+
+        hdr->size = 0;
+        jc->line_empty = true;
+
+        if((res = f_write(fp, hdr, sizeof(jobcache_header_t), &bw)) == FR_OK) do {
+            if((res = f_read(&jc->src, jc->in, sizeof(jc->in), &br)) == FR_OK)
+                res = compact(jc, fp, jc->in, br);
+        } while(res == FR_OK && br == sizeof(jc->in));
+
+        // Terminate the last block
+        if(res == FR_OK && !jc->line_empty)
+            res = compact(jc, fp, (const BYTE *)"\n", 1);
+
+        if(res == FR_OK && jc->out_len)
+            res = f_write(fp, jc->out, jc->out_len, &bw);
+
+        // Commit
+        if(res == FR_OK) {
+            hdr->size = f_tell(fp) - sizeof(jobcache_header_t);
+            if((res = f_lseek(fp, 0)) == FR_OK)
+                res = f_write(fp, hdr, sizeof(jobcache_header_t), &bw);
+        }
+
+        if(res == FR_OK)
+            res = f_sync(fp);
+
+        if(res != FR_OK) {
+            f_close(fp);
+            f_unlink(jc->path);
+        }
+    }
+
+    f_close(&jc->src);
+
+    return res;
+}
+
+FRESULT f_jobcache_open (FIL *fp, const TCHAR *path, jobcache_info_t *info)
+{
+    FILINFO fno;
+    FRESULT res;
+    UINT br = 0;
+    jobcache_build_t *jc;
+    jobcache_header_t cached, hdr = {
+        .magic = JOBCACHE_MAGIC
+    };
+
+    if(strlen(path) + sizeof(JOBCACHE_SUFFIX) > sizeof(jc->path))
+        return FR_INVALID_NAME;
+
+    if((res = f_stat(path, &fno)) != FR_OK)
+        return res;
+
+    if((jc = calloc(1, sizeof(jobcache_build_t))) == NULL)
+        return FR_NOT_ENOUGH_CORE;
+
+    strcat(strcpy(jc->path, path), JOBCACHE_SUFFIX);
+
+    hdr.src_size = fno.fsize;
+    hdr.src_date = fno.fdate;
+    hdr.src_time = fno.ftime;
+
+    if((res = f_open(fp, jc->path, FA_READ)) == FR_OK) {
+        res = f_read(fp, &cached, sizeof(jobcache_header_t), &br);
+        if(res != FR_OK || br != sizeof(jobcache_header_t) ||
+            cached.magic != hdr.magic || cached.src_size != hdr.src_size ||
+             cached.src_date != hdr.src_date || cached.src_time != hdr.src_time ||
+              cached.size != f_size(fp) - sizeof(jobcache_header_t)) {
+            f_close(fp);
+            res = FR_NO_FILE; // stale
+        } else
+            hdr.size = cached.size;
+    }
+
+    if(info)
+        info->built = res != FR_OK;
+
+    if(res != FR_OK && (res = build(jc, fp, path, &hdr)) == FR_OK)
+        res = f_lseek(fp, sizeof(jobcache_header_t));
+
+    if(res == FR_OK && info) {
+        info->src_size = hdr.src_size;
+        info->size = hdr.size;
+    }
+
+    free(jc);
+
+    return res;
+}
+
+#endif
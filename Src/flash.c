@@ -1,12 +1,20 @@
 /*
 
-  flash.h - driver code for STM32F7xx ARM processors
+  flash.c - driver code for STM32F7xx ARM processors
 
   Part of grblHAL
 
   Copyright (c) 2019-2021 Terje Io
 
-  This code reads/writes the whole RAM-based emulated EPROM contents from/to flash
+  This code stores the RAM-based emulated EPROM contents in flash as a log of changed
+  records spread over two sectors. The image is reconstructed by replaying the log at
+  startup, the sectors are only erased when the active one is full.
+
+  Code and interrupt handlers run from flash and cannot be fetched while it is busy. A word
+  program takes 16 us, a 32 KB sector erase 250 ms typical and up to 2 s, long enough to stall
+  the stepper interrupts. Compaction, which erases a sector, is therefore deferred while the
+  machine is moving and done from the foreground loop when it has stopped. Until then changes
+  are only held in RAM and are lost on a power loss. Appending records is not deferred.
 
   Grbl is free software: you can redistribute it and/or modify
   it under the terms of the GNU General Public License as published by
@@ -23,56 +31,325 @@
 
 */
 
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "main.h"
 #include "grbl/hal.h"
+#include "grbl/nuts_bolts.h"
+#include "grbl/state_machine.h"
+
+// Sectors 1 and 2 are reserved for settings storage by the linker script.
+
+#define NVS_SECTOR_SIZE 0x8000
+#define NVS_MAGIC       0x3153564EUL // "NVS1"
+#define NVS_ERASED      0xFFFFFFFFUL
+#define NVS_NONE        0xFF
+#define NVS_PAGE_SIZE   32 // granularity of change tracking, must be a multiple of 4
+#define NVS_NO_ERASE    (STATE_HOMING|STATE_CYCLE|STATE_HOLD|STATE_JOG|STATE_SAFETY_DOOR) // states where the steppers may run
+
+// Sector layout: header followed by records.
+// Record layout: header word (offset | length << 16), data words, CRC32 of header and data.
+// A record is only applied on replay if the CRC matches, the sector header is written last on compaction.
+
+#define NVS_RECORD_HDR(offset, length) ((uint32_t)(offset) | ((uint32_t)(length) << 16))
+#define NVS_RECORD_OFFSET(hdr) ((hdr) & 0xFFFF)
+#define NVS_RECORD_LENGTH(hdr) ((hdr) >> 16)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t seq_inv;
+    uint32_t reserved;
+} nvs_sector_header_t;
+
+typedef struct {
+    uint32_t sector;
+    uint32_t addr;
+} nvs_sector_t;
+
+static const nvs_sector_t sectors[2] = {
+    { .sector = FLASH_SECTOR_1, .addr = 0x08008000 },
+    { .sector = FLASH_SECTOR_2, .addr = 0x08010000 }
+};
+
+static struct {
+    uint_fast8_t active;    // index of active sector, NVS_NONE if none
+    uint32_t seq;           // sequence number of active sector
+    uint32_t wr;            // next free address in active sector
+    uint32_t size;          // image size, rounded up to a word boundary
+    bool pending;           // image has changes that failed to program, forces a compaction
+    bool deferred;          // compaction deferred until the machine has stopped
+    uint8_t *image;         // copy of the flash contents
+} nvs = { .active = NVS_NONE };
+
+static on_execute_realtime_ptr on_execute_realtime = NULL;
+
+static uint32_t nvs_dirty[NVS_SECTOR_SIZE / NVS_PAGE_SIZE / 32]; // bitmap of changed pages
+
+static uint32_t crc32 (uint32_t crc, const uint8_t *data, uint32_t length)
+{
+    uint_fast8_t bit;
+
+    while(length--) {
+        crc ^= *data++;
+        for(bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320UL & -(crc & 1));
+    }
+
+    return crc;
+}
+
+static uint32_t record_crc (uint32_t hdr, const uint8_t *data, uint32_t length)
+{
+    return ~crc32(crc32(0xFFFFFFFFUL, (uint8_t *)&hdr, sizeof(hdr)), data, length);
+}
+
+static inline uint32_t sector_end (uint_fast8_t idx)
+{
+    return sectors[idx].addr + NVS_SECTOR_SIZE;
+}
+
+static bool sector_valid (uint_fast8_t idx)
+{
+    const nvs_sector_header_t *header = (const nvs_sector_header_t *)sectors[idx].addr;
+
+    return header->magic == NVS_MAGIC && header->seq == ~header->seq_inv;
+}
+
+// Applies all valid records in a sector to the image, returns address of first free word.
+// If a corrupt record header is found the sector is considered full, forcing a compaction on next write.
+static uint32_t sector_replay (uint_fast8_t idx, uint8_t *image)
+{
+    uint32_t addr = sectors[idx].addr + sizeof(nvs_sector_header_t), hdr, offset, length;
+
+    while(addr < sector_end(idx) && (hdr = *(uint32_t *)addr) != NVS_ERASED) {
+
+        offset = NVS_RECORD_OFFSET(hdr);
+        length = NVS_RECORD_LENGTH(hdr);
+
+        if(length == 0 || (length & 0x03) || offset + length > nvs.size || addr + length + 8 > sector_end(idx))
+            return sector_end(idx);
+
+        if(*(uint32_t *)(addr + 4 + length) == record_crc(hdr, (uint8_t *)(addr + 4), length))
+            memcpy(image + offset, (uint8_t *)(addr + 4), length);
+
+        addr += length + 8;
+    }
+
+    return addr;
+}
+
+static HAL_StatusTypeDef program_word (uint32_t addr, uint32_t data)
+{
+    return HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, addr, data);
+}
+
+static HAL_StatusTypeDef program_record (uint32_t addr, uint32_t offset, uint32_t length)
+{
+    uint32_t hdr = NVS_RECORD_HDR(offset, length), data, end = addr + 4 + length;
+    const uint8_t *src = nvs.image + offset;
+    HAL_StatusTypeDef status = program_word(addr, hdr);
+
+    addr += 4;
+
+    while(status == HAL_OK && addr < end) {
+        memcpy(&data, src, sizeof(data));
+        status = program_word(addr, data);
+        addr += 4;
+        src += 4;
+    }
+
+    if(status == HAL_OK)
+        status = program_word(addr, record_crc(hdr, nvs.image + offset, length));
+
+    return status;
+}
+
+// Writes the full image to the inactive sector and makes it the active one.
+static HAL_StatusTypeDef compact (void)
+{
+    uint32_t error;
+    uint_fast8_t idx = nvs.active == 0 ? 1 : 0;
+    HAL_StatusTypeDef status;
+    FLASH_EraseInitTypeDef erase = {
+        .Sector = sectors[idx].sector,
+        .TypeErase = FLASH_TYPEERASE_SECTORS,
+        .NbSectors = 1,
+        .VoltageRange = FLASH_VOLTAGE_RANGE_3
+    };
+
+    if((status = HAL_FLASHEx_Erase(&erase, &error)) == HAL_OK)
+        status = program_record(sectors[idx].addr + sizeof(nvs_sector_header_t), 0, nvs.size);
+
+    // Commit sector by writing its header, the previous sector stays valid until then.
+    if(status == HAL_OK)
+        status = program_word(sectors[idx].addr + offsetof(nvs_sector_header_t, seq), nvs.seq + 1);
+    if(status == HAL_OK)
+        status = program_word(sectors[idx].addr + offsetof(nvs_sector_header_t, seq_inv), ~(nvs.seq + 1));
+    if(status == HAL_OK)
+        status = program_word(sectors[idx].addr + offsetof(nvs_sector_header_t, magic), NVS_MAGIC);
+
+    if(status == HAL_OK) {
+        nvs.active = idx;
+        nvs.seq++;
+        nvs.wr = sectors[idx].addr + sizeof(nvs_sector_header_t) + nvs.size + 8;
+    }
+
+    return status;
+}
 
-#define FLASH_SECTOR 1
-#define FLASH_SECTOR_ADDR 0x8008000
+static bool nvs_init (void)
+{
+    if(nvs.image == NULL) {
+
+        nvs.size = (hal.nvs.size + 3) & ~0x03;
+
+        if(nvs.size > NVS_SECTOR_SIZE - sizeof(nvs_sector_header_t) - 8 || (nvs.image = malloc(nvs.size)) == NULL)
+            return false;
+
+        memset(nvs.image, 0xFF, nvs.size);
+
+        bool valid0 = sector_valid(0), valid1 = sector_valid(1);
+        const nvs_sector_header_t *h0 = (const nvs_sector_header_t *)sectors[0].addr,
+                                  *h1 = (const nvs_sector_header_t *)sectors[1].addr;
+
+        if(valid0 && valid1)
+            nvs.active = (int32_t)(h1->seq - h0->seq) > 0 ? 1 : 0;
+        else if(valid0 || valid1)
+            nvs.active = valid0 ? 0 : 1;
+
+        if(nvs.active != NVS_NONE) {
+            nvs.seq = nvs.active ? h1->seq : h0->seq;
+            nvs.wr = sector_replay(nvs.active, nvs.image);
+        }
+    }
 
-static const uint8_t *flash_target = (uint8_t *)FLASH_SECTOR_ADDR;
+    return true;
+}
 
 bool memcpy_from_flash (uint8_t *dest)
 {
-    memcpy(dest, flash_target, hal.nvs.size);
+    if(!nvs_init())
+        return false;
+
+    memcpy(dest, nvs.image, hal.nvs.size);
+
+    return true;
+}
+
+// Returns next run of adjacent dirty pages at or after *page, false if none.
+static bool next_dirty_run (uint32_t *page, uint32_t *offset, uint32_t *length)
+{
+    uint32_t n_pages = (nvs.size + NVS_PAGE_SIZE - 1) / NVS_PAGE_SIZE, first;
+
+    while(*page < n_pages && !(nvs_dirty[*page >> 5] & bit(*page & 0x1F)))
+        (*page)++;
+
+    if(*page == n_pages)
+        return false;
+
+    first = *page;
+
+    while(*page < n_pages && (nvs_dirty[*page >> 5] & bit(*page & 0x1F)))
+        (*page)++;
+
+    *offset = first * NVS_PAGE_SIZE;
+    *length = min(*page * NVS_PAGE_SIZE, nvs.size) - *offset;
 
     return true;
 }
 
+// Unlocks the flash, writes the full image to the inactive sector and locks it again.
+static bool nvs_compact (void)
+{
+    HAL_StatusTypeDef status;
+
+    if((status = HAL_FLASH_Unlock()) == HAL_OK) {
+        __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP|FLASH_FLAG_OPERR|FLASH_FLAG_WRPERR|FLASH_FLAG_PGAERR|FLASH_FLAG_PGPERR|FLASH_FLAG_ERSERR);
+        status = compact();
+        HAL_FLASH_Lock();
+    }
+
+    nvs.pending = status != HAL_OK;
+
+    return status == HAL_OK;
+}
+
+// Does a deferred compaction when the machine has stopped. If it fails the next write retries.
+static void nvs_poll (sys_state_t state)
+{
+    if(nvs.deferred && !(state & NVS_NO_ERASE)) {
+        nvs.deferred = false;
+        nvs_compact();
+    }
+
+    on_execute_realtime(state);
+}
+
 bool memcpy_to_flash (uint8_t *source)
 {
-   if (!memcmp(source, flash_target, hal.nvs.size))
+    if(!nvs_init())
+        return false;
+
+    uint32_t page = 0, offset, length, needed = 0;
+
+    // Mark changed pages as dirty and update the image.
+    memset(nvs_dirty, 0, sizeof(nvs_dirty));
+
+    for(offset = 0; offset < hal.nvs.size; offset += NVS_PAGE_SIZE) {
+        length = min(NVS_PAGE_SIZE, hal.nvs.size - offset);
+        if(memcmp(source + offset, nvs.image + offset, length)) {
+            nvs_dirty[(offset / NVS_PAGE_SIZE) >> 5] |= bit((offset / NVS_PAGE_SIZE) & 0x1F);
+            memcpy(nvs.image + offset, source + offset, length);
+        }
+    }
+
+    while(next_dirty_run(&page, &offset, &length))
+        needed += length + 8;
+
+    if(needed == 0 && !nvs.pending && !nvs.deferred)
         return true;
 
-    HAL_StatusTypeDef status = HAL_OK;
-/*
-    if((status = HAL_FLASH_Unlock()) == HAL_OK) {
+    if(nvs.deferred || nvs.pending || nvs.active == NVS_NONE || nvs.wr + needed > sector_end(nvs.active)) {
+
+        if(!(state_get() & NVS_NO_ERASE)) {
+            nvs.deferred = false;
+            return nvs_compact();
+        }
+
+        // The image is ahead of flash until the deferred compaction is done, later changes are held in RAM as well.
+        if(!nvs.deferred) {
+            nvs.deferred = true;
+            if(on_execute_realtime == NULL) {
+                on_execute_realtime = grbl.on_execute_realtime;
+                grbl.on_execute_realtime = nvs_poll;
+            }
+        }
 
-        static FLASH_EraseInitTypeDef erase = {
-//            .Banks = FLASH_BANK_1,
-            .Sector = FLASH_SECTOR,
-            .TypeErase = FLASH_TYPEERASE_SECTORS,
-            .NbSectors = 1,
-            .VoltageRange = FLASH_VOLTAGE_RANGE_3
-        };
+        return true;
+    }
 
-        uint32_t error;
+    HAL_StatusTypeDef status;
 
-        status = HAL_FLASHEx_Erase(&erase, &error);
+    if((status = HAL_FLASH_Unlock()) == HAL_OK) {
 
-        uint16_t *data = (uint16_t *)source;
-        uint32_t address = (uint32_t)flash_target, remaining = (uint32_t)hal.nvs.size;
+        __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP|FLASH_FLAG_OPERR|FLASH_FLAG_WRPERR|FLASH_FLAG_PGAERR|FLASH_FLAG_PGPERR|FLASH_FLAG_ERSERR);
 
-        while(remaining && status == HAL_OK) {
-            status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, address, *data++);
-            status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, address + 2, *data++);
-            address += 4;
-            remaining -= 4;
+        page = 0;
+        // One record per run of adjacent dirty pages.
+        while(status == HAL_OK && next_dirty_run(&page, &offset, &length)) {
+            if((status = program_record(nvs.wr, offset, length)) == HAL_OK)
+                nvs.wr += length + 8;
         }
 
         HAL_FLASH_Lock();
     }
-*/
+
+    // On failure the image is ahead of flash, force a compaction on next write so flash is brought in sync
+    // even if the same settings are written again.
+    nvs.pending = status != HAL_OK;
+
     return status == HAL_OK;
 }
@@ -20,6 +20,7 @@
 */
 
 #include <main.h>
+#include <string.h>
 
 #include "i2c.h"
 #include "grbl/hal.h"
@@ -28,6 +29,11 @@
 #include "keypad/keypad.h"
 #endif
 
+#if SDCARD_ENABLE && SDCARD_YIELD
+#include "ff.h"
+#include "diskio.h"
+#endif
+
 #ifdef I2C_PORT
 
 #ifdef I2C1_ALT_PINMAP
@@ -119,22 +125,237 @@ void I2C2_ER_IRQHandler(void)
 
 #if EEPROM_ENABLE
 
+// Writes are split on page boundaries and queued, the queue is run from the foreground loop and
+// the write complete interrupt. Instead of a fixed delay after each page write the device is polled
+// for ACK before the next transfer is started. A write transfer returns when its pages have been
+// sent, with the result of all of them, the write cycle of the last page runs on in the background.
+
+#ifndef EEPROM_PAGE_SIZE
+#if EEPROM_ENABLE == 1
+#define EEPROM_PAGE_SIZE 16 // 24LC16
+#else
+#define EEPROM_PAGE_SIZE 32 // 24LC32 and larger, a 64 byte page device works with this too
+#endif
+#endif
+
+#define EEPROM_QUEUE_SIZE 8 // must be a power of 2
+#define EEPROM_QUEUE_NEXT(i) (((i) + 1) & (EEPROM_QUEUE_SIZE - 1))
+#define EEPROM_RETRIES 3
+#define EEPROM_TIMEOUT 50   // ms, writes not sent within this time are dropped
+
+typedef struct {
+    uint8_t address;
+    uint8_t retries;
+    uint16_t addr_size;
+    uint16_t word_addr;
+    uint16_t count;
+    uint8_t data[EEPROM_PAGE_SIZE];
+} eeprom_write_t;
+
+static struct {
+    volatile uint_fast8_t head;
+    volatile uint_fast8_t tail;
+    volatile bool writing;      // transfer in progress
+    volatile bool failed;       // a write was dropped after retries or timeout
+    bool busy;                  // device may be in its internal write cycle
+    uint8_t busy_address;
+    eeprom_write_t job[EEPROM_QUEUE_SIZE];
+} wq = {0};
+
+static on_execute_realtime_ptr on_execute_realtime;
+
+// Removes the job at the tail of the queue as failed.
+static void eeprom_write_failed (void)
+{
+    wq.failed = true;
+    wq.tail = EEPROM_QUEUE_NEXT(wq.tail);
+}
+
+// Starts the next queued write when the bus and device are ready, never blocks.
+static void eeprom_pump (void)
+{
+    if(HAL_I2C_GetState(&i2c_port) != HAL_I2C_STATE_READY || wq.writing)
+        return;
+
+#if !EEPROM_IS_FRAM
+    if(wq.busy) {
+        if(HAL_I2C_IsDeviceReady(&i2c_port, wq.busy_address << 1, 1, 2) != HAL_OK)
+            return;
+        wq.busy = false;
+    }
+#endif
+
+    if(wq.tail != wq.head) {
+        eeprom_write_t *job = &wq.job[wq.tail];
+        wq.writing = true;
+        if(HAL_I2C_Mem_Write_IT(&i2c_port, job->address << 1, job->word_addr, job->addr_size, job->data, job->count) != HAL_OK) {
+            wq.writing = false;
+            if(++job->retries == EEPROM_RETRIES)
+                eeprom_write_failed();
+        }
+    }
+}
+
+// Waits until the queued writes have been sent, and if idle is true also for the device to end its write cycle.
+// Writes still queued when the device has not responded within the timeout are dropped as failed, returns false if so.
+static bool eeprom_wait (bool idle)
+{
+    uint32_t ms = HAL_GetTick();
+
+    while(wq.tail != wq.head || wq.writing || (idle && wq.busy)) {
+
+        eeprom_pump();
+
+        if(!wq.writing && HAL_GetTick() - ms >= EEPROM_TIMEOUT) {
+            while(wq.tail != wq.head)
+                eeprom_write_failed();
+            wq.busy = false;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void eeprom_poll (sys_state_t state)
+{
+    if(wq.tail != wq.head || wq.busy)
+        eeprom_pump();
+
+    on_execute_realtime(state);
+}
+
+#if SDCARD_ENABLE && SDCARD_YIELD
+
+static disk_on_yield_ptr on_disk_yield;
+
+// Keeps the queue going while the SD card is busy, a settings write does not wait for a long card write.
+static void eeprom_disk_yield (void)
+{
+    if(wq.tail != wq.head || wq.busy)
+        eeprom_pump();
+
+    if(on_disk_yield)
+        on_disk_yield();
+}
+
+#endif
+
+void HAL_I2C_MemTxCpltCallback (I2C_HandleTypeDef *hi2c)
+{
+    if(wq.writing) {
+#if !EEPROM_IS_FRAM
+        wq.busy_address = wq.job[wq.tail].address;
+        wq.busy = true;
+#endif
+        wq.tail = EEPROM_QUEUE_NEXT(wq.tail);
+        wq.writing = false;
+    }
+}
+
+void HAL_I2C_ErrorCallback (I2C_HandleTypeDef *hi2c)
+{
+    if(wq.writing) {
+#if !EEPROM_IS_FRAM
+        wq.busy_address = wq.job[wq.tail].address;
+        wq.busy = true; // NACK, likely still in write cycle: poll before retrying
+#endif
+        if(++wq.job[wq.tail].retries == EEPROM_RETRIES)
+            eeprom_write_failed();
+        wq.writing = false;
+    }
+}
+
+// Installs the foreground poll that ends the write cycle of the last page written.
+void i2c_nvs_queue_init (void)
+{
+    on_execute_realtime = grbl.on_execute_realtime;
+    grbl.on_execute_realtime = eeprom_poll;
+
+#if SDCARD_ENABLE && SDCARD_YIELD
+    on_disk_yield = disk_on_yield;
+    disk_on_yield = eeprom_disk_yield;
+#endif
+}
+
+// A write fails if any of its pages could not be written, the NVS layer then keeps the data dirty and retries.
+// The remaining pages are not tried when the device has stopped responding.
 nvs_transfer_result_t i2c_nvs_transfer (nvs_transfer_t *i2c, bool read)
 {
-    while (HAL_I2C_GetState(&i2c_port) != HAL_I2C_STATE_READY);
+    HAL_StatusTypeDef ret = HAL_OK;
+    uint16_t addr_size = i2c->word_addr_bytes == 2 ? I2C_MEMADD_SIZE_16BIT : I2C_MEMADD_SIZE_8BIT;
+
+    if(read) {
+        eeprom_wait(true); // pending write cycle has to complete first
+        ret = HAL_I2C_Mem_Read(&i2c_port, i2c->address << 1, i2c->word_addr, addr_size, i2c->data, i2c->count, 100);
+    } else {
+
+        uint8_t *data = i2c->data;
+        uint16_t word_addr = i2c->word_addr, remaining = i2c->count, count;
+        bool responding = true;
 
-//    while (HAL_I2C_IsDeviceReady(&i2c_port, (uint16_t)(0xA0), 3, 100) != HAL_OK);
+        wq.failed = false;
 
-    HAL_StatusTypeDef ret;
+        while(remaining && responding) {
+
+            count = EEPROM_PAGE_SIZE - (word_addr & (EEPROM_PAGE_SIZE - 1));
+            if(count > remaining)
+                count = remaining;
+
+            uint8_t *chunk = data;
+            uint16_t chunk_addr = word_addr, chunk_count = count;
+
+            data += count;
+            word_addr += count;
+            remaining -= count;
 
-    if(read)
-        ret = HAL_I2C_Mem_Read(&i2c_port, i2c->address << 1, i2c->word_addr, i2c->word_addr_bytes == 2 ? I2C_MEMADD_SIZE_16BIT : I2C_MEMADD_SIZE_8BIT, i2c->data, i2c->count, 100);
-    else {
-        ret = HAL_I2C_Mem_Write(&i2c_port, i2c->address << 1, i2c->word_addr, i2c->word_addr_bytes == 2 ? I2C_MEMADD_SIZE_16BIT : I2C_MEMADD_SIZE_8BIT, i2c->data, i2c->count, 100);
 #if !EEPROM_IS_FRAM
-        hal.delay_ms(5, NULL);
+            // Read back the page and only write the span that differs, skip the write entirely if unchanged.
+            // Pending writes, e.g. the previous page, have to complete first as they may change it.
+            uint8_t current[EEPROM_PAGE_SIZE];
+
+            if(!(responding = eeprom_wait(true)))
+                break;
+
+            if(HAL_I2C_Mem_Read(&i2c_port, i2c->address << 1, chunk_addr, addr_size, current, chunk_count, 100) == HAL_OK) {
+                uint8_t *cur = current;
+                while(chunk_count && *chunk == *cur) {
+                    chunk++;
+                    cur++;
+                    chunk_addr++;
+                    chunk_count--;
+                }
+                while(chunk_count && chunk[chunk_count - 1] == cur[chunk_count - 1])
+                    chunk_count--;
+            }
 #endif
+
+            if(chunk_count) {
+
+                if(EEPROM_QUEUE_NEXT(wq.head) == wq.tail && !(responding = eeprom_wait(false))) // queue full, wait for a slot
+                    break;
+
+                eeprom_write_t *job = &wq.job[wq.head];
+
+                job->address = i2c->address;
+                job->retries = 0;
+                job->addr_size = addr_size;
+                job->word_addr = chunk_addr;
+                job->count = chunk_count;
+                memcpy(job->data, chunk, chunk_count);
+
+                wq.head = EEPROM_QUEUE_NEXT(wq.head);
+
+                eeprom_pump();
+            }
+        }
+
+        eeprom_wait(false);
+
+        if(wq.failed)
+            ret = HAL_ERROR;
     }
+
     i2c->data += i2c->count;
 
     return ret == HAL_OK ? NVS_TransferResult_OK : NVS_TransferResult_Failed;
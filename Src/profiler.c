@@ -0,0 +1,216 @@
+/*
+
+  profiler.c - interrupt handler cycle profiler for STM32F7xx ARM processors
+
+  Part of grblHAL
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "profiler.h"
+
+#if ISR_PROFILER_ENABLE
+
+#include <string.h>
+
+#include "grbl/hal.h"
+#include "grbl/report.h"
+#include "grbl/nuts_bolts.h"
+
+static const char *isr_names[ProfileISR_N] = {
+    "STEPPER",
+    "PULSE",
+    "SERIAL",
+    "USB",
+    "EXTI0",
+    "EXTI1",
+    "EXTI2",
+    "EXTI3",
+    "EXTI4",
+    "EXTI9_5",
+    "EXTI15_10"
+};
+
+static bool report_requested = false;
+static uint32_t latency_scale = 1;
+static profiler_stats_t isr_cost[ProfileISR_N], isr_latency[ProfileISR_N];
+static on_report_options_ptr on_report_options;
+static on_realtime_report_ptr on_realtime_report;
+static on_unknown_sys_command_ptr on_unknown_sys_command;
+
+void profiler_stats_add (profiler_stats_t *stats, uint32_t cycles)
+{
+    uint_fast8_t bucket = cycles ? 32 - __CLZ(cycles) : 0;
+
+    if(cycles < stats->min)
+        stats->min = cycles;
+    if(cycles > stats->max)
+        stats->max = cycles;
+
+    stats->sum += cycles;
+    stats->count++;
+    stats->histogram[bucket >= PROFILER_BUCKETS ? PROFILER_BUCKETS - 1 : bucket]++;
+}
+
+// Called from interrupt context, an interrupt handler cannot preempt itself so no locking is needed.
+void profiler_record (profiler_isr_t isr, uint32_t cycles)
+{
+    profiler_stats_add(&isr_cost[isr], cycles);
+}
+
+// Latency is passed in timer ticks and is converted to CPU cycles.
+void profiler_record_latency (profiler_isr_t isr, uint32_t ticks)
+{
+    profiler_stats_add(&isr_latency[isr], ticks * latency_scale);
+}
+
+const profiler_stats_t *profiler_get_stats (profiler_isr_t isr, bool latency)
+{
+    return isr < ProfileISR_N ? (latency ? &isr_latency[isr] : &isr_cost[isr]) : NULL;
+}
+
+void profiler_reset (void)
+{
+    uint_fast8_t idx = ProfileISR_N;
+
+    __disable_irq();
+
+    memset(isr_cost, 0, sizeof(isr_cost));
+    memset(isr_latency, 0, sizeof(isr_latency));
+
+    do {
+        idx--;
+        isr_cost[idx].min = isr_latency[idx].min = UINT32_MAX;
+    } while(idx);
+
+    __enable_irq();
+}
+
+static void report_stats (const char *tag, const char *name, const profiler_stats_t *stats)
+{
+    uint_fast8_t idx;
+    profiler_stats_t data;
+
+    __disable_irq();
+    memcpy(&data, stats, sizeof(profiler_stats_t));
+    __enable_irq();
+
+    hal.stream.write(tag);
+    hal.stream.write(name);
+    hal.stream.write(",");
+    hal.stream.write(uitoa(data.count));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(data.min));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(data.max));
+    hal.stream.write(",");
+    hal.stream.write(uitoa((uint32_t)(data.sum / data.count)));
+
+    for(idx = 0; idx < PROFILER_BUCKETS; idx++) {
+        hal.stream.write(idx == 0 ? "|" : ",");
+        hal.stream.write(uitoa(data.histogram[idx]));
+    }
+
+    hal.stream.write("]" ASCII_EOL);
+}
+
+// $ISR - report cycle statistics, $ISRR - reset statistics.
+// Format: [ISR:<name>,<count>,<min>,<max>,<mean>|<histogram>], histogram bucket n holds cycles in the range 2^(n-1) to 2^n - 1.
+static status_code_t profiler_command (sys_state_t state, char *line)
+{
+    status_code_t retval = Status_OK;
+
+    if(!strcmp(&line[1], "ISR")) {
+
+        uint_fast8_t idx;
+
+        report_requested = true;
+
+        for(idx = 0; idx < ProfileISR_N; idx++) {
+            if(isr_cost[idx].count)
+                report_stats("[ISR:", isr_names[idx], &isr_cost[idx]);
+            if(isr_latency[idx].count)
+                report_stats("[ISRLAT:", isr_names[idx], &isr_latency[idx]);
+        }
+
+    } else if(!strcmp(&line[1], "ISRR")) {
+        report_requested = false;
+        profiler_reset();
+    } else
+        retval = on_unknown_sys_command ? on_unknown_sys_command(state, line) : Status_Unhandled;
+
+    return retval;
+}
+
+// Adds |ISR:<stepper>,<pulse>,<serial>,<usb>,<exti> maximum cycle counts to the real time report.
+// The element is only added when data has been recorded or a $ISR report has been requested.
+static void profiler_realtime_report (stream_write_ptr stream_write, report_tracking_flags_t report)
+{
+    uint_fast8_t idx;
+    uint32_t exti_max = 0;
+
+    for(idx = ProfileISR_EXTI0; idx <= ProfileISR_EXTI15_10; idx++)
+        exti_max = max(exti_max, isr_cost[idx].max);
+
+    if(report_requested || exti_max || isr_cost[ProfileISR_Stepper].max || isr_cost[ProfileISR_Pulse].max ||
+                                        isr_cost[ProfileISR_Serial].max || isr_cost[ProfileISR_USB].max) {
+        stream_write("|ISR:");
+        stream_write(uitoa(isr_cost[ProfileISR_Stepper].max));
+        stream_write(",");
+        stream_write(uitoa(isr_cost[ProfileISR_Pulse].max));
+        stream_write(",");
+        stream_write(uitoa(isr_cost[ProfileISR_Serial].max));
+        stream_write(",");
+        stream_write(uitoa(isr_cost[ProfileISR_USB].max));
+        stream_write(",");
+        stream_write(uitoa(exti_max));
+    }
+
+    if(on_realtime_report)
+        on_realtime_report(stream_write, report);
+}
+
+static void profiler_report_options (bool newopt)
+{
+    on_report_options(newopt);
+
+    if(!newopt)
+        hal.stream.write("[PLUGIN:ISR profiler v0.01]" ASCII_EOL);
+}
+
+void profiler_init (void)
+{
+    // Enable the DWT cycle counter
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->LAR = 0xC5ACCE55;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    // Stepper timer is clocked at hal.f_step_timer
+    latency_scale = max(1, SystemCoreClock / hal.f_step_timer);
+
+    profiler_reset();
+
+    on_report_options = grbl.on_report_options;
+    grbl.on_report_options = profiler_report_options;
+
+    on_realtime_report = grbl.on_realtime_report;
+    grbl.on_realtime_report = profiler_realtime_report;
+
+    on_unknown_sys_command = grbl.on_unknown_sys_command;
+    grbl.on_unknown_sys_command = profiler_command;
+}
+
+#endif // ISR_PROFILER_ENABLE
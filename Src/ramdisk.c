@@ -0,0 +1,214 @@
+/*
+
+  ramdisk.c - RAM backed FatFs volume
+
+  Part of grblHAL
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if SDCARD_ENABLE && SDCARD_RAMDISK
+
+#include <string.h>
+
+#include "ramdisk.h"
+#include "grbl/hal.h"
+
+#if SDCARD_JOBCACHE
+#include "ff_jobcache.h"
+#endif
+
+#if FF_VOLUMES <= RAMDISK_PDRV || !FF_USE_MKFS
+#error "FF_VOLUMES must be > 1 and FF_USE_MKFS enabled in ffconf.h!"
+#endif
+
+#if SDCARD_RAMDISK < 64
+#error "SDCARD_RAMDISK must be at least 64 (KBytes)!"
+#endif
+
+#define RAMDISK_SECTORS (SDCARD_RAMDISK * 2)
+
+static FATFS fs;
+static DSTATUS stat = STA_NOINIT;
+static BYTE disk[RAMDISK_SECTORS][512] __attribute__((aligned(4)));
+static bool mounted = false;
+static on_unknown_sys_command_ptr on_unknown_sys_command;
+static on_report_options_ptr on_report_options;
+
+// Copies a file from the SD card to the root directory of the RAM disk, the path may include the drive number.
+// With SDCARD_JOBCACHE enabled the compacted job cache is copied instead.
+FRESULT ramdisk_stage (const char *path)
+{
+    static FIL src, dst;
+    static BYTE buf[1024];
+    static char name[FF_MAX_LFN + 5];
+
+    FRESULT res = FR_OK;
+    UINT count, written;
+    const char *base = strrchr(path, '/');
+
+    if(base == NULL && (base = strchr(path, ':')) == NULL)
+        base = path;
+    else
+        base++;
+
+    if(!mounted || !strncmp(path, RAMDISK_PATH, 2) || strlen(base) > FF_MAX_LFN || *base == '\0')
+        return FR_INVALID_NAME;
+
+    strcpy(name, RAMDISK_PATH "/");
+    strcat(name, base);
+
+#if SDCARD_JOBCACHE
+    // Stage the compacted copy of the job, it is built on first use and the job file is read directly on failure.
+    if(f_jobcache_open(&src, path, NULL) != FR_OK)
+#endif
+    if((res = f_open(&src, path, FA_READ)) != FR_OK)
+        return res;
+
+    if((res = f_open(&dst, name, FA_WRITE|FA_CREATE_ALWAYS)) == FR_OK) {
+
+        do {
+            if((res = f_read(&src, buf, sizeof(buf), &count)) == FR_OK && count) {
+                if((res = f_write(&dst, buf, count, &written)) == FR_OK && written < count)
+                    res = FR_DENIED; // RAM disk full
+            }
+        } while(res == FR_OK && count == sizeof(buf));
+
+        if(f_close(&dst) != FR_OK && res == FR_OK)
+            res = FR_DISK_ERR;
+
+        if(res != FR_OK)
+            f_unlink(name);
+    }
+
+    f_close(&src);
+
+    return res;
+}
+
+// $RD=<file> - copy file from the SD card to the RAM disk, run it with $F=1:/<name>.
+static status_code_t ramdisk_command (sys_state_t state, char *line)
+{
+    status_code_t retval = Status_Unhandled;
+
+    if(!strncmp(&line[1], "RD=", 3))
+        retval = ramdisk_stage(&line[4]) == FR_OK ? Status_OK : Status_SDReadError;
+    else if(on_unknown_sys_command)
+        retval = on_unknown_sys_command(state, line);
+
+    return retval;
+}
+
+static void ramdisk_report_options (bool newopt)
+{
+    on_report_options(newopt);
+
+    if(!newopt)
+        hal.stream.write(mounted ? "[PLUGIN:RAM disk v0.01]" ASCII_EOL : "[PLUGIN:RAM disk v0.01 - mount failed]" ASCII_EOL);
+}
+
+bool ramdisk_init (void)
+{
+    BYTE work[FF_MAX_SS];
+
+    if(on_report_options == NULL) {
+        on_report_options = grbl.on_report_options;
+        grbl.on_report_options = ramdisk_report_options;
+    }
+
+    if(mounted || f_mkfs(RAMDISK_PATH, FM_FAT|FM_SFD, 0, work, sizeof(work)) != FR_OK || f_mount(&fs, RAMDISK_PATH, 1) != FR_OK)
+        return mounted;
+
+    mounted = true;
+
+    on_unknown_sys_command = grbl.on_unknown_sys_command;
+    grbl.on_unknown_sys_command = ramdisk_command;
+
+    return true;
+}
+
+DSTATUS ramdisk_initialize (void)
+{
+    stat &= ~STA_NOINIT;
+
+    return stat;
+}
+
+DSTATUS ramdisk_status (void)
+{
+    return stat;
+}
+
+DRESULT ramdisk_read (BYTE *buff, DWORD sector, UINT count)
+{
+    if(stat & STA_NOINIT)
+        return RES_NOTRDY;
+
+    if(sector >= RAMDISK_SECTORS || count > RAMDISK_SECTORS - sector)
+        return RES_PARERR;
+
+    memcpy(buff, disk[sector], count * 512);
+
+    return RES_OK;
+}
+
+DRESULT ramdisk_write (const BYTE *buff, DWORD sector, UINT count)
+{
+    if(stat & STA_NOINIT)
+        return RES_NOTRDY;
+
+    if(sector >= RAMDISK_SECTORS || count > RAMDISK_SECTORS - sector)
+        return RES_PARERR;
+
+    memcpy(disk[sector], buff, count * 512);
+
+    return RES_OK;
+}
+
+DRESULT ramdisk_ioctl (BYTE cmd, void *buff)
+{
+    DRESULT res = RES_OK;
+
+    if(stat & STA_NOINIT)
+        return RES_NOTRDY;
+
+    switch(cmd) {
+
+        case CTRL_SYNC:
+            break;
+
+        case GET_SECTOR_COUNT:
+            *(DWORD *)buff = RAMDISK_SECTORS;
+            break;
+
+        case GET_SECTOR_SIZE:
+            *(WORD *)buff = 512;
+            break;
+
+        case GET_BLOCK_SIZE:
+            *(DWORD *)buff = 1;
+            break;
+
+        default:
+            res = RES_PARERR;
+            break;
+    }
+
+    return res;
+}
+
+#endif
@@ -23,12 +23,15 @@
 
 #include <string.h>
 
+#include "driver.h"
 #include "serial.h"
 #include "grbl/hal.h"
 #include "grbl/protocol.h"
 
 #include "main.h"
 
+#include "profiler.h"
+
 static stream_rx_buffer_t rxbuf = {0};
 static stream_tx_buffer_t txbuf = {0};
 static enqueue_realtime_command_ptr enqueue_realtime_command = protocol_enqueue_realtime_command;
@@ -42,9 +45,50 @@ static enqueue_realtime_command_ptr enqueue_realtime_command2 = stream_buffer_al
 #if defined(NUCLEO_F756)
   #define USART USART3
   #define USART_IRQHandler USART3_IRQHandler
+  #define USART_DMA DMA1
+  #define USART_DMA_CLK_ENABLE __HAL_RCC_DMA1_CLK_ENABLE
+  #define USART_RX_DMA_STREAM DMA1_Stream1
+  #define USART_RX_DMA_CHANNEL 4
+  #define USART_RX_DMA_IRQn DMA1_Stream1_IRQn
+  #define USART_RX_DMA_IRQHandler DMA1_Stream1_IRQHandler
+  #define USART_RX_DMA_IFCR LIFCR
+  #define USART_RX_DMA_FLAGS (DMA_LIFCR_CTCIF1|DMA_LIFCR_CHTIF1|DMA_LIFCR_CTEIF1|DMA_LIFCR_CDMEIF1|DMA_LIFCR_CFEIF1)
+  #define USART_TX_DMA_STREAM DMA1_Stream3
+  #define USART_TX_DMA_CHANNEL 4
+  #define USART_TX_DMA_IRQn DMA1_Stream3_IRQn
+  #define USART_TX_DMA_IRQHandler DMA1_Stream3_IRQHandler
+  #define USART_TX_DMA_IFCR LIFCR
+  #define USART_TX_DMA_FLAGS (DMA_LIFCR_CTCIF3|DMA_LIFCR_CHTIF3|DMA_LIFCR_CTEIF3|DMA_LIFCR_CDMEIF3|DMA_LIFCR_CFEIF3)
 #else
   #define USART USART1
   #define USART_IRQHandler USART1_IRQHandler
+  #define USART_DMA DMA2
+  #define USART_DMA_CLK_ENABLE __HAL_RCC_DMA2_CLK_ENABLE
+  #define USART_RX_DMA_STREAM DMA2_Stream2
+  #define USART_RX_DMA_CHANNEL 4
+  #define USART_RX_DMA_IRQn DMA2_Stream2_IRQn
+  #define USART_RX_DMA_IRQHandler DMA2_Stream2_IRQHandler
+  #define USART_RX_DMA_IFCR LIFCR
+  #define USART_RX_DMA_FLAGS (DMA_LIFCR_CTCIF2|DMA_LIFCR_CHTIF2|DMA_LIFCR_CTEIF2|DMA_LIFCR_CDMEIF2|DMA_LIFCR_CFEIF2)
+  #define USART_TX_DMA_STREAM DMA2_Stream7
+  #define USART_TX_DMA_CHANNEL 4
+  #define USART_TX_DMA_IRQn DMA2_Stream7_IRQn
+  #define USART_TX_DMA_IRQHandler DMA2_Stream7_IRQHandler
+  #define USART_TX_DMA_IFCR HIFCR
+  #define USART_TX_DMA_FLAGS (DMA_HIFCR_CTCIF7|DMA_HIFCR_CHTIF7|DMA_HIFCR_CTEIF7|DMA_HIFCR_CDMEIF7|DMA_HIFCR_CFEIF7)
+#endif
+
+#if SERIAL_RX_DMA
+
+#define RX_DMA_BUFFER_SIZE 256 // must be a power of 2
+
+static uint8_t rxdma[RX_DMA_BUFFER_SIZE];
+static uint_fast16_t rxdma_tail = 0;
+
+#endif
+
+#if SERIAL_TX_DMA
+static volatile uint_fast16_t txdma_length = 0; // length of span being transmitted, 0 when idle
 #endif
 
 //
@@ -88,6 +132,36 @@ inline static bool serialPutCNonBlocking (const char c)
     return ok;
 }
 
+#if SERIAL_TX_DMA
+
+//
+// Starts DMA transfer of the next contiguous span of the output buffer if not already running
+// NOTE: the output buffer head must be updated before calling this.
+//
+static void serialTxDMAStart (void)
+{
+    uint_fast16_t tail = txbuf.tail, head = txbuf.head;
+
+    if(txdma_length == 0 && tail != head) {
+        txdma_length = head > tail ? head - tail : TX_BUFFER_SIZE - tail;
+        USART_TX_DMA_STREAM->M0AR = (uint32_t)&txbuf.data[tail];
+        USART_TX_DMA_STREAM->NDTR = txdma_length;
+        USART_TX_DMA_STREAM->CR |= DMA_SxCR_EN;
+    }
+}
+
+void USART_TX_DMA_IRQHandler (void)
+{
+    USART_DMA->USART_TX_DMA_IFCR = USART_TX_DMA_FLAGS;
+
+    txbuf.tail = (txbuf.tail + txdma_length) & (TX_BUFFER_SIZE - 1);
+    txdma_length = 0;
+
+    serialTxDMAStart();
+}
+
+#endif
+
 //
 // Writes a character to the serial output stream
 //
@@ -104,12 +178,59 @@ static bool serialPutC (const char c)
 
         txbuf.data[txbuf.head] = c;                                     // Add data to buffer,
         txbuf.head = next_head;                                         // update head pointer and
+#if SERIAL_TX_DMA
+        serialTxDMAStart();                                             // start transmit if idle
+#else
         USART->CR1 |= USART_CR1_TXEIE;                                  // enable TX interrupts
+#endif
 //    }
 
     return true;
 }
 
+#if SERIAL_TX_DMA
+
+//
+// Writes a number of characters from string to the serial output stream, blocks if buffer full
+//
+void serialWrite(const char *s, uint16_t length)
+{
+    uint_fast16_t head, tail, count;
+
+    while(length) {
+
+        head = txbuf.head;
+
+        while(BUFNEXT(head, txbuf) == (tail = txbuf.tail)) {            // While TX buffer full
+            if(!hal.stream_blocking_callback())                         // check if blocking for space,
+                return;                                                 // exit if not
+        }
+
+        // Copy as much as possible without wrapping or overwriting unsent data
+        count = tail > head ? tail - head - 1 : TX_BUFFER_SIZE - head - (tail == 0 ? 1 : 0);
+        if(count > length)
+            count = length;
+
+        memcpy(&txbuf.data[head], s, count);
+
+        s += count;
+        length -= count;
+        txbuf.head = (head + count) & (TX_BUFFER_SIZE - 1);
+
+        serialTxDMAStart();
+    }
+}
+
+//
+// Writes a null terminated string to the serial output stream, blocks if buffer full
+//
+static void serialWriteS (const char *s)
+{
+    serialWrite(s, (uint16_t)strlen(s));
+}
+
+#else
+
 //
 // Writes a null terminated string to the serial output stream, blocks if buffer full
 //
@@ -122,7 +243,7 @@ static void serialWriteS (const char *s)
 }
 
 //
-// Writes a number of characters from string to the serial output stream followed by EOL, blocks if buffer full
+// Writes a number of characters from string to the serial output stream, blocks if buffer full
 //
 void serialWrite(const char *s, uint16_t length)
 {
@@ -132,6 +253,8 @@ void serialWrite(const char *s, uint16_t length)
         serialPutC(*ptr++);
 }
 
+#endif
+
 //
 // serialGetC - returns -1 if no data available
 //
@@ -155,10 +278,27 @@ static bool serialSuspendInput (bool suspend)
 
 static bool serialSetBaudRate (uint32_t baud_rate)
 {
+#if SERIAL_TX_DMA
+    USART_TX_DMA_STREAM->CR &= ~DMA_SxCR_EN;
+    while(USART_TX_DMA_STREAM->CR & DMA_SxCR_EN);
+    USART_DMA->USART_TX_DMA_IFCR = USART_TX_DMA_FLAGS;
+    txdma_length = 0;
+#endif
+
     USART->CR1 = USART_CR1_RE|USART_CR1_TE;
     USART->CR3 = USART_CR3_OVRDIS;
     USART->BRR = UART_DIV_SAMPLING16(HAL_RCC_GetPCLK1Freq(), baud_rate);
+#if SERIAL_TX_DMA
+    USART->CR3 |= USART_CR3_DMAT;
+#endif
+#if SERIAL_RX_DMA
+    USART->CR3 |= USART_CR3_DMAR;
+    USART->CR1 |= (USART_CR1_UE|USART_CR1_IDLEIE);
+
+    rxdma_tail = (RX_DMA_BUFFER_SIZE - USART_RX_DMA_STREAM->NDTR) & (RX_DMA_BUFFER_SIZE - 1);
+#else
     USART->CR1 |= (USART_CR1_UE|USART_CR1_RXNEIE);
+#endif
 
     rxbuf.tail = rxbuf.head;
     txbuf.tail = txbuf.head;
@@ -168,10 +308,21 @@ static bool serialSetBaudRate (uint32_t baud_rate)
 
 static bool serialDisable (bool disable)
 {
+#if SERIAL_RX_DMA
+    if(disable) {
+        USART->CR1 &= ~USART_CR1_IDLEIE;
+        USART->CR3 &= ~USART_CR3_DMAR;
+    } else {
+        rxdma_tail = (RX_DMA_BUFFER_SIZE - USART_RX_DMA_STREAM->NDTR) & (RX_DMA_BUFFER_SIZE - 1); // discard anything received while disabled
+        USART->CR3 |= USART_CR3_DMAR;
+        USART->CR1 |= USART_CR1_IDLEIE;
+    }
+#else
     if(disable)
         USART->CR1 &= ~USART_CR1_RXNEIE;
     else
         USART->CR1 |= USART_CR1_RXNEIE;
+#endif
 
     return true;
 }
@@ -193,6 +344,7 @@ const io_stream_t *serialInit (uint32_t baud_rate)
         .connected = true,
         .read = serialGetC,
         .write = serialWriteS,
+        .write_n = serialWrite,
         .write_char = serialPutC,
         .write_all = serialWriteS,
         .get_rx_buffer_free = serialRxFree,
@@ -204,6 +356,48 @@ const io_stream_t *serialInit (uint32_t baud_rate)
         .set_enqueue_rt_handler = serialSetRtHandler
     };
 
+#if SERIAL_RX_DMA
+
+    // Circular DMA receive, received data is processed on half transfer, transfer complete and idle line events.
+
+    USART_DMA_CLK_ENABLE();
+
+    USART_RX_DMA_STREAM->CR &= ~DMA_SxCR_EN;
+    while(USART_RX_DMA_STREAM->CR & DMA_SxCR_EN);
+
+    USART_DMA->USART_RX_DMA_IFCR = USART_RX_DMA_FLAGS;
+    USART_RX_DMA_STREAM->PAR = (uint32_t)&USART->RDR;
+    USART_RX_DMA_STREAM->M0AR = (uint32_t)rxdma;
+    USART_RX_DMA_STREAM->NDTR = RX_DMA_BUFFER_SIZE;
+    USART_RX_DMA_STREAM->FCR = 0;
+    USART_RX_DMA_STREAM->CR = (USART_RX_DMA_CHANNEL << DMA_SxCR_CHSEL_Pos)|DMA_SxCR_PL_1|DMA_SxCR_MINC|DMA_SxCR_CIRC|DMA_SxCR_HTIE|DMA_SxCR_TCIE;
+    USART_RX_DMA_STREAM->CR |= DMA_SxCR_EN;
+
+    // Same preemption priority as the USART interrupt so the handlers cannot preempt each other.
+    HAL_NVIC_SetPriority(USART_RX_DMA_IRQn, 0, 1);
+    HAL_NVIC_EnableIRQ(USART_RX_DMA_IRQn);
+
+#endif
+
+#if SERIAL_TX_DMA
+
+    // DMA transmit of contiguous output buffer spans, restarted from the transfer complete interrupt.
+
+    USART_DMA_CLK_ENABLE();
+
+    USART_TX_DMA_STREAM->CR &= ~DMA_SxCR_EN;
+    while(USART_TX_DMA_STREAM->CR & DMA_SxCR_EN);
+
+    USART_DMA->USART_TX_DMA_IFCR = USART_TX_DMA_FLAGS;
+    USART_TX_DMA_STREAM->PAR = (uint32_t)&USART->TDR;
+    USART_TX_DMA_STREAM->FCR = 0;
+    USART_TX_DMA_STREAM->CR = (USART_TX_DMA_CHANNEL << DMA_SxCR_CHSEL_Pos)|DMA_SxCR_MINC|DMA_SxCR_DIR_0|DMA_SxCR_TCIE;
+
+    HAL_NVIC_SetPriority(USART_TX_DMA_IRQn, 0, 2);
+    HAL_NVIC_EnableIRQ(USART_TX_DMA_IRQn);
+
+#endif
+
 #if defined(NUCLEO_F756)
 
     __HAL_RCC_USART3_CLK_ENABLE();
@@ -246,30 +440,71 @@ const io_stream_t *serialInit (uint32_t baud_rate)
     return &stream;
 }
 
-void USART_IRQHandler (void)
+inline static void serialRxPut (char data)
 {
-    if(USART->ISR & USART_ISR_RXNE) {
-        char data = USART->RDR;
-        if(!enqueue_realtime_command(data)) {                   // Check for and strip realtime commands,
-            uint_fast16_t next_head = BUFNEXT(rxbuf.head, rxbuf);
-            if(rxbuf.tail == next_head)
-                rxbuf.overflow = 1;                             // flag overflow
-            else {
-                rxbuf.data[rxbuf.head] = data;                  // if not add data to buffer
-                rxbuf.head = next_head;                         // and update pointer
-            }
+    if(!enqueue_realtime_command(data)) {                   // Check for and strip realtime commands,
+        uint_fast16_t next_head = BUFNEXT(rxbuf.head, rxbuf);
+        if(rxbuf.tail == next_head)
+            rxbuf.overflow = 1;                             // flag overflow
+        else {
+            rxbuf.data[rxbuf.head] = data;                  // if not add data to buffer
+            rxbuf.head = next_head;                         // and update pointer
         }
     }
+}
+
+#if SERIAL_RX_DMA
+
+// Moves data received by DMA since the last call to the input buffer.
+// NOTE: called from interrupt context only, the USART and DMA interrupts have the same preemption priority.
+static void serialRxDMAProcess (void)
+{
+    uint_fast16_t tail = rxdma_tail, head = (RX_DMA_BUFFER_SIZE - USART_RX_DMA_STREAM->NDTR) & (RX_DMA_BUFFER_SIZE - 1);
+
+    while(tail != head) {
+        serialRxPut(rxdma[tail]);
+        tail = (tail + 1) & (RX_DMA_BUFFER_SIZE - 1);
+    }
+
+    rxdma_tail = tail;
+}
+
+void USART_RX_DMA_IRQHandler (void)
+{
+    USART_DMA->USART_RX_DMA_IFCR = USART_RX_DMA_FLAGS;
+
+    serialRxDMAProcess();
+}
+
+#endif
+
+void USART_IRQHandler (void)
+{
+    PROFILER_ISR_ENTER(ProfileISR_Serial)
+
+#if SERIAL_RX_DMA
+    if(USART->ISR & USART_ISR_IDLE) {
+        USART->ICR = USART_ICR_IDLECF;
+        serialRxDMAProcess();
+    }
+#else
+    if(USART->ISR & USART_ISR_RXNE)
+        serialRxPut(USART->RDR);
+#endif
 
+#if !SERIAL_TX_DMA
     if((USART->ISR & USART_ISR_TXE) && (USART->CR1 & USART_CR1_TXEIE)) {
         USART->TDR = txbuf.data[txbuf.tail];        // Send next character
         txbuf.tail = BUFNEXT(txbuf.tail, txbuf);    // and increment pointer
         if(txbuf.tail == txbuf.head)                // If buffer empty then
             USART->CR1 &= ~USART_CR1_TXEIE;         // disable UART TX interrupt
    }
+#endif
 
     if(USART->ISR & USART_ISR_ORE)
         USART->ICR &= USART_ICR_ORECF;
+
+    PROFILER_ISR_EXIT(ProfileISR_Serial)
 }
 
 #ifdef SERIAL2_MOD
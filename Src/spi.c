@@ -27,6 +27,62 @@
 
 #define SPIPORT SPIport(SPI_PORT)
 
+#if SPI_DMA_ENABLE
+
+#if SPI_PORT == 1
+  #define SPI_DMA DMA2
+  #define SPI_DMA_CLK_ENABLE __HAL_RCC_DMA2_CLK_ENABLE
+  #define SPI_DMA_CHANNEL 3
+  #define SPI_RX_DMA_STREAM DMA2_Stream0
+  #define SPI_RX_DMA_IRQn DMA2_Stream0_IRQn
+  #define SPI_RX_DMA_IRQHandler DMA2_Stream0_IRQHandler
+  #define SPI_RX_DMA_ISR LISR
+  #define SPI_RX_DMA_IFCR LIFCR
+  #define SPI_RX_DMA_TCIF DMA_LISR_TCIF0
+  #define SPI_RX_DMA_TEIF DMA_LISR_TEIF0
+  #define SPI_RX_DMA_FLAGS (DMA_LIFCR_CTCIF0|DMA_LIFCR_CHTIF0|DMA_LIFCR_CTEIF0|DMA_LIFCR_CDMEIF0|DMA_LIFCR_CFEIF0)
+  #define SPI_TX_DMA_STREAM DMA2_Stream3
+  #define SPI_TX_DMA_IFCR LIFCR
+  #define SPI_TX_DMA_FLAGS (DMA_LIFCR_CTCIF3|DMA_LIFCR_CHTIF3|DMA_LIFCR_CTEIF3|DMA_LIFCR_CDMEIF3|DMA_LIFCR_CFEIF3)
+#elif SPI_PORT == 2
+  #if SERIAL_TX_DMA && defined(NUCLEO_F756)
+    #error "SPI2 DMA conflicts with USART3 TX DMA (DMA1 stream 3)!"
+  #endif
+  #define SPI_DMA DMA1
+  #define SPI_DMA_CLK_ENABLE __HAL_RCC_DMA1_CLK_ENABLE
+  #define SPI_DMA_CHANNEL 0
+  #define SPI_RX_DMA_STREAM DMA1_Stream3
+  #define SPI_RX_DMA_IRQn DMA1_Stream3_IRQn
+  #define SPI_RX_DMA_IRQHandler DMA1_Stream3_IRQHandler
+  #define SPI_RX_DMA_ISR LISR
+  #define SPI_RX_DMA_IFCR LIFCR
+  #define SPI_RX_DMA_TCIF DMA_LISR_TCIF3
+  #define SPI_RX_DMA_TEIF DMA_LISR_TEIF3
+  #define SPI_RX_DMA_FLAGS (DMA_LIFCR_CTCIF3|DMA_LIFCR_CHTIF3|DMA_LIFCR_CTEIF3|DMA_LIFCR_CDMEIF3|DMA_LIFCR_CFEIF3)
+  #define SPI_TX_DMA_STREAM DMA1_Stream4
+  #define SPI_TX_DMA_IFCR HIFCR
+  #define SPI_TX_DMA_FLAGS (DMA_HIFCR_CTCIF4|DMA_HIFCR_CHTIF4|DMA_HIFCR_CTEIF4|DMA_HIFCR_CDMEIF4|DMA_HIFCR_CFEIF4)
+#elif SPI_PORT == 3
+  #define SPI_DMA DMA1
+  #define SPI_DMA_CLK_ENABLE __HAL_RCC_DMA1_CLK_ENABLE
+  #define SPI_DMA_CHANNEL 0
+  #define SPI_RX_DMA_STREAM DMA1_Stream2 // Stream 0 is shared with TIM4_CH1
+  #define SPI_RX_DMA_IRQn DMA1_Stream2_IRQn
+  #define SPI_RX_DMA_IRQHandler DMA1_Stream2_IRQHandler
+  #define SPI_RX_DMA_ISR LISR
+  #define SPI_RX_DMA_IFCR LIFCR
+  #define SPI_RX_DMA_TCIF DMA_LISR_TCIF2
+  #define SPI_RX_DMA_TEIF DMA_LISR_TEIF2
+  #define SPI_RX_DMA_FLAGS (DMA_LIFCR_CTCIF2|DMA_LIFCR_CHTIF2|DMA_LIFCR_CTEIF2|DMA_LIFCR_CDMEIF2|DMA_LIFCR_CFEIF2)
+  #define SPI_TX_DMA_STREAM DMA1_Stream5
+  #define SPI_TX_DMA_IFCR HIFCR
+  #define SPI_TX_DMA_FLAGS (DMA_HIFCR_CTCIF5|DMA_HIFCR_CHTIF5|DMA_HIFCR_CTEIF5|DMA_HIFCR_CDMEIF5|DMA_HIFCR_CFEIF5)
+#endif
+
+#define SPI_DMA_TIMEOUT 100 // ms, a 512 byte block takes 20 ms at the lowest clock
+
+#endif // SPI_DMA_ENABLE
+
 static SPI_HandleTypeDef spi_port = {
     .Instance = SPIPORT,
     .Init.Mode = SPI_MODE_MASTER,
@@ -89,6 +145,21 @@ void spi_init (void)
 
         HAL_SPI_Init(&spi_port);
         __HAL_SPI_ENABLE(&spi_port);
+
+#if SPI_DMA_ENABLE
+        SPI_DMA_CLK_ENABLE();
+
+        SPI_RX_DMA_STREAM->CR = 0;
+        SPI_RX_DMA_STREAM->PAR = (uint32_t)&SPIPORT->DR;
+        SPI_RX_DMA_STREAM->FCR = 0; // direct mode
+
+        SPI_TX_DMA_STREAM->CR = 0;
+        SPI_TX_DMA_STREAM->PAR = (uint32_t)&SPIPORT->DR;
+        SPI_TX_DMA_STREAM->FCR = 0; // direct mode
+
+        HAL_NVIC_SetPriority(SPI_RX_DMA_IRQn, 0, 3);
+        HAL_NVIC_EnableIRQ(SPI_RX_DMA_IRQn);
+#endif
     }
 
     init = true;
@@ -111,6 +182,24 @@ uint32_t spi_set_speed (uint32_t prescaler)
     return cur;
 }
 
+// Set the SPI clock to the highest frequency not exceeding f_max, returns the actual frequency.
+uint32_t spi_set_clock (uint32_t f_max)
+{
+#if SPI_PORT == 1
+    uint32_t f_pclk = HAL_RCC_GetPCLK2Freq(); // APB2
+#else
+    uint32_t f_pclk = HAL_RCC_GetPCLK1Freq(); // APB1
+#endif
+    uint32_t br = 0;
+
+    while(br < 7 && (f_pclk >> (br + 1)) > f_max)
+        br++;
+
+    spi_set_speed(br << SPI_CR1_BR_Pos);
+
+    return f_pclk >> (br + 1);
+}
+
 uint8_t spi_get_byte (void)
 {
     *((__IO uint8_t *)&SPIPORT->DR) = 0xFF; // Writing dummy data into Data register
@@ -131,3 +220,104 @@ uint8_t spi_put_byte (uint8_t byte)
 
     return (uint8_t)spi_port.Instance->DR;
 }
+
+#if SPI_DMA_ENABLE
+
+// The receive stream interrupt only wakes up spi_dma_transfer() from __WFI(), the transfer
+// result is taken from the stream flags.
+void SPI_RX_DMA_IRQHandler (void)
+{
+    SPI_RX_DMA_STREAM->CR &= ~(DMA_SxCR_TCIE|DMA_SxCR_TEIE);
+}
+
+// Full duplex DMA block transfer, rx or tx may be NULL.
+// When tx is NULL 0xFF is clocked out, when rx is NULL incoming data is discarded.
+// The CPU sleeps until the transfer completes, other interrupts are served meanwhile.
+// Returns false on DMA transfer error or when the transfer does not complete within SPI_DMA_TIMEOUT.
+static bool spi_dma_transfer (uint8_t *rx, const uint8_t *tx, uint16_t len)
+{
+    static const uint8_t tx_dummy = 0xFF;
+    static uint8_t rx_dummy;
+
+    bool ok;
+    uint32_t isr, ms = HAL_GetTick();
+
+    // Flush any stale data from the receive FIFO
+    while(SPIPORT->SR & SPI_SR_FRLVL)
+        (void)*((__IO uint8_t *)&SPIPORT->DR);
+    __HAL_SPI_CLEAR_OVRFLAG(&spi_port);
+
+    SPI_DMA->SPI_RX_DMA_IFCR = SPI_RX_DMA_FLAGS;
+    SPI_DMA->SPI_TX_DMA_IFCR = SPI_TX_DMA_FLAGS;
+
+    SPI_RX_DMA_STREAM->NDTR = len;
+    SPI_RX_DMA_STREAM->M0AR = (uint32_t)(rx ? rx : &rx_dummy);
+    SPI_RX_DMA_STREAM->CR = (SPI_DMA_CHANNEL << DMA_SxCR_CHSEL_Pos)|DMA_SxCR_PL_1|DMA_SxCR_TCIE|DMA_SxCR_TEIE|(rx ? DMA_SxCR_MINC : 0);
+
+    SPI_TX_DMA_STREAM->NDTR = len;
+    SPI_TX_DMA_STREAM->M0AR = (uint32_t)(tx ? tx : &tx_dummy);
+    SPI_TX_DMA_STREAM->CR = (SPI_DMA_CHANNEL << DMA_SxCR_CHSEL_Pos)|DMA_SxCR_PL_1|DMA_SxCR_DIR_0|(tx ? DMA_SxCR_MINC : 0);
+
+    // Per the reference manual: enable Rx DMA request first, then the streams and finally the Tx DMA request
+    SPIPORT->CR2 |= SPI_CR2_RXDMAEN;
+    SPI_RX_DMA_STREAM->CR |= DMA_SxCR_EN;
+    SPI_TX_DMA_STREAM->CR |= DMA_SxCR_EN;
+    SPIPORT->CR2 |= SPI_CR2_TXDMAEN;
+
+    // Interrupts are disabled around the flag check so that the completion interrupt cannot
+    // slip in between the check and __WFI(), a pending interrupt still ends the sleep.
+    do {
+        __disable_irq();
+        if(!((isr = SPI_DMA->SPI_RX_DMA_ISR) & (SPI_RX_DMA_TCIF|SPI_RX_DMA_TEIF)))
+            __WFI();
+        __enable_irq();
+    } while(!(isr & (SPI_RX_DMA_TCIF|SPI_RX_DMA_TEIF)) && HAL_GetTick() - ms < SPI_DMA_TIMEOUT);
+
+    ok = (isr & (SPI_RX_DMA_TCIF|SPI_RX_DMA_TEIF)) == SPI_RX_DMA_TCIF;
+
+    while((SPIPORT->SR & SPI_SR_BSY) && HAL_GetTick() - ms < SPI_DMA_TIMEOUT);
+
+    SPIPORT->CR2 &= ~(SPI_CR2_TXDMAEN|SPI_CR2_RXDMAEN);
+    SPI_RX_DMA_STREAM->CR &= ~(DMA_SxCR_EN|DMA_SxCR_TCIE|DMA_SxCR_TEIE);
+    SPI_TX_DMA_STREAM->CR &= ~DMA_SxCR_EN;
+    while((SPI_RX_DMA_STREAM->CR|SPI_TX_DMA_STREAM->CR) & DMA_SxCR_EN);
+
+    // Frames left by a failed transfer would offset the following byte transfers
+    while(SPIPORT->SR & SPI_SR_FRLVL)
+        (void)*((__IO uint8_t *)&SPIPORT->DR);
+    __HAL_SPI_CLEAR_OVRFLAG(&spi_port);
+
+    SPI_DMA->SPI_RX_DMA_IFCR = SPI_RX_DMA_FLAGS;
+    SPI_DMA->SPI_TX_DMA_IFCR = SPI_TX_DMA_FLAGS;
+    HAL_NVIC_ClearPendingIRQ(SPI_RX_DMA_IRQn);
+
+    return ok;
+}
+
+#endif // SPI_DMA_ENABLE
+
+// Read a block of data, 0xFF is clocked out.
+bool spi_read (uint8_t *data, uint16_t len)
+{
+#if SPI_DMA_ENABLE
+    return spi_dma_transfer(data, NULL, len);
+#else
+    while(len--)
+        *data++ = spi_get_byte();
+
+    return true;
+#endif
+}
+
+// Write a block of data, incoming data is discarded.
+bool spi_write (const uint8_t *data, uint16_t len)
+{
+#if SPI_DMA_ENABLE
+    return spi_dma_transfer(NULL, data, len);
+#else
+    while(len--)
+        spi_put_byte(*data++);
+
+    return true;
+#endif
+}
@@ -33,10 +33,34 @@
 #include "usbd_cdc_if.h"
 #include "usb_device.h"
 
-static char txdata2[BLOCK_TX_BUFFER_SIZE]; // Secondary TX buffer (for double buffering)
-static bool use_tx2data = false;
+extern USBD_HandleTypeDef hUsbDeviceFS;
+
+#define USB_TX_SLOTS 16 // must be a power of 2
+#define USB_TX_SLOTNEXT(s) (((s) + 1) & (USB_TX_SLOTS - 1))
+
+// Transmit queue of packet sized slots.
+// Slots from tail up to, but not including, head are owned by the USB stack, the head slot is filled by writers.
+// Consecutive full slots and the partial slot following them are sent as one transfer, the USB stack adds a ZLP when required.
+typedef struct {
+    volatile uint_fast8_t head;
+    volatile uint_fast8_t tail;
+    volatile uint_fast8_t sending;  // number of slots in the transfer in progress, 0 if idle
+    volatile bool retry;            // the USB stack was busy, retried from usbGetC()
+    uint16_t length[USB_TX_SLOTS];
+    uint8_t data[USB_TX_SLOTS][CDC_DATA_FS_MAX_PACKET_SIZE];
+} usb_tx_queue_t;
+
+static usb_tx_queue_t txq = {0};
 static stream_rx_buffer_t rxbuf = {0};
-static stream_block_tx_buffer_t txbuf = {0};
+#if USB_RX_FLOW_CONTROL
+static volatile bool rx_suspended = false;
+// Characters of the last packet that did not fit in the input buffer. They are kept in the packet
+// buffer of the USB stack, the OUT endpoint is not rearmed until they are added to the input buffer.
+static struct {
+    uint8_t *data;
+    volatile uint32_t length;
+} rx_pending = {0};
+#endif
 static enqueue_realtime_command_ptr enqueue_realtime_command = protocol_enqueue_realtime_command;
 
 //
@@ -48,12 +72,54 @@ static uint16_t usbRxFree (void)
     return RX_BUFFER_SIZE - BUFCOUNT(head, tail, RX_BUFFER_SIZE);
 }
 
+#if USB_RX_FLOW_CONTROL
+
+//
+// Adds the characters held back by flow control to the input buffer and rearms the OUT endpoint when
+// there is room for all of them, or unconditionally if force is set: characters that do not fit are then dropped.
+//
+static void usbRxResume (bool force)
+{
+    if(rx_pending.length && (force || usbRxFree() > rx_pending.length)) {
+
+        uint8_t *data = rx_pending.data;
+
+        HAL_NVIC_DisableIRQ(OTG_FS_IRQn);
+
+        while(rx_pending.length) {
+            uint_fast16_t next_head = (rxbuf.head + 1) & (RX_BUFFER_SIZE - 1);
+            if(rxbuf.tail == next_head)
+                rxbuf.overflow = 1;
+            else {
+                rxbuf.data[rxbuf.head] = *data;
+                rxbuf.head = next_head;
+            }
+            data++;
+            rx_pending.length--;
+        }
+
+        USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+
+        HAL_NVIC_EnableIRQ(OTG_FS_IRQn);
+    }
+}
+
+#endif
+
 //
 // Flushes the input buffer
 //
 static void usbRxFlush (void)
 {
     rxbuf.head = rxbuf.tail = 0;
+#if USB_RX_FLOW_CONTROL
+    if(rx_pending.length) {
+        HAL_NVIC_DisableIRQ(OTG_FS_IRQn);
+        rx_pending.length = 0;
+        USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+        HAL_NVIC_EnableIRQ(OTG_FS_IRQn);
+    }
+#endif
 }
 
 //
@@ -67,71 +133,154 @@ static void usbRxCancel (void)
 }
 
 //
-// Writes current buffer to the USB output stream, swaps buffers
+// Starts transmission of the queued slots if the USB stack is idle.
+// If nothing else is queued the partially filled head slot is closed and sent.
+// NOTE: must be called from the USB interrupt or with the USB interrupt disabled.
 //
-static inline bool usb_write (void)
+static void usbTxStart (void)
 {
-    static uint8_t dummy = 0;
+    uint_fast8_t slot = txq.tail, slots = 0;
+    uint_fast16_t length = 0;
+
+    if(hUsbDeviceFS.dev_state != USBD_STATE_CONFIGURED) {   // No host, discard output not handed to the USB stack
+        txq.head = (txq.tail + txq.sending) & (USB_TX_SLOTS - 1);
+        txq.length[txq.head] = 0;
+        txq.retry = false;
+        return;
+    }
 
-    txbuf.s = use_tx2data ? txdata2 : txbuf.data;
+    if(txq.sending)
+        return;
 
-    while(CDC_Transmit_FS((uint8_t *)txbuf.s, txbuf.length) == USBD_BUSY) {
-        if(!hal.stream_blocking_callback())
-            return false;
+    // Coalesce consecutive full slots, stop at a partial slot or at the end of the slot array
+    while(slot != txq.head) {
+        length += txq.length[slot];
+        slots++;
+        if(txq.length[slot] != CDC_DATA_FS_MAX_PACKET_SIZE || ++slot == USB_TX_SLOTS)
+            break;
     }
 
-    if(txbuf.length % 64 == 0) {
-        while(CDC_Transmit_FS(&dummy, 0) == USBD_BUSY) {
-            if(!hal.stream_blocking_callback())
-                return false;
-        }
+    // Close and add the head slot if it follows, the transfer is then rarely a multiple
+    // of the packet size and the USB stack does not have to send a ZLP after it.
+    if(slot == txq.head && txq.length[slot] && USB_TX_SLOTNEXT(slot) != txq.tail) {
+        length += txq.length[slot];
+        slots++;
+        txq.head = USB_TX_SLOTNEXT(slot);
+        txq.length[txq.head] = 0;
     }
 
-    use_tx2data = !use_tx2data;
-    txbuf.s = use_tx2data ? txdata2 : txbuf.data;
-    txbuf.length = 0;
+    if(slots) {
 
-    return true;
+        txq.sending = slots;
+
+        if((txq.retry = CDC_Transmit_FS(txq.data[txq.tail], length) != USBD_OK))
+            txq.sending = 0;                                // Busy, retried from usbGetC()
+    }
 }
 
 //
-// Writes a single character to the USB output stream, blocks if buffer full
+// Retries a transmit start refused by the USB stack, called when polled for input.
 //
-static bool usbPutC (const char c)
+inline static void usbTxPoll (void)
+{
+    if(txq.retry) {
+        HAL_NVIC_DisableIRQ(OTG_FS_IRQn);
+        usbTxStart();
+        HAL_NVIC_EnableIRQ(OTG_FS_IRQn);
+    }
+}
+
+//
+// Empties the transmit queue and drops input held back by flow control, called from CDC_Init_FS() and
+// CDC_DeInit_FS() in usbd_cdc_if.c since a transfer in progress is not completed when the host resets
+// or leaves the device and the OUT endpoint is rearmed by the USB stack on configuration.
+//
+void usbReset (void)
+{
+    txq.head = txq.tail = txq.sending = 0;
+    txq.length[0] = 0;
+    txq.retry = false;
+#if USB_RX_FLOW_CONTROL
+    rx_pending.length = 0;
+#endif
+}
+
+//
+// Transmit complete handler, called from CDC_TransmitCplt_FS() in usbd_cdc_if.c
+//
+void usbTxComplete (void)
+{
+    txq.tail = (txq.tail + txq.sending) & (USB_TX_SLOTS - 1);
+    txq.sending = 0;
+
+    usbTxStart();
+}
+
+//
+// Adds data to the transmit queue, blocks if the queue is full
+//
+static bool usbTxWrite (const char *s, size_t length)
 {
-    static uint8_t buf[1];
+    size_t count;
+    uint_fast8_t head;
+
+    while(length) {
+
+        HAL_NVIC_DisableIRQ(OTG_FS_IRQn);
+
+        head = txq.head;
+
+        if(txq.length[head] == CDC_DATA_FS_MAX_PACKET_SIZE) {
+
+            if(USB_TX_SLOTNEXT(head) == txq.tail) {         // Queue is full,
+                HAL_NVIC_EnableIRQ(OTG_FS_IRQn);            // wait for space
+                if(!hal.stream_blocking_callback())
+                    return false;
+                continue;
+            }
+
+            txq.head = head = USB_TX_SLOTNEXT(head);
+            txq.length[head] = 0;
+        }
 
-    *buf = c;
+        if((count = CDC_DATA_FS_MAX_PACKET_SIZE - txq.length[head]) > length)
+            count = length;
 
-    while(CDC_Transmit_FS(buf, 1) == USBD_BUSY) {
-        if(!hal.stream_blocking_callback())
-            return false;
+        memcpy(&txq.data[head][txq.length[head]], s, count);
+        txq.length[head] += count;
+        s += count;
+        length -= count;
+
+        usbTxStart();
+
+        HAL_NVIC_EnableIRQ(OTG_FS_IRQn);
     }
 
     return true;
 }
 
+//
+// Writes a single character to the USB output stream, blocks if buffer full
+//
+static bool usbPutC (const char c)
+{
+    return usbTxWrite(&c, 1);
+}
+
 //
 // Writes a null terminated string to the USB output stream, blocks if buffer full
-// Buffers string up to EOL (LF) before transmitting
 //
 static void usbWriteS (const char *s)
 {
-    size_t length = strlen(s);
-
-    if((length + txbuf.length) > txbuf.max_length) {
-        if(!usb_write())
-            return;
-    }
-
-    memcpy(txbuf.s, s, length);
-    txbuf.length += length;
-    txbuf.s += length;
+    usbTxWrite(s, strlen(s));
+}
 
-    if(s[length - 1] == ASCII_LF) {
-        if(!usb_write())
-            return;
-    }
+//
+// Writes a number of characters from a buffer to the USB output stream, blocks if buffer full
+//
+static void usbWrite (const char *s, uint16_t length)
+{
+    usbTxWrite(s, length);
 }
 
 //
@@ -141,18 +290,33 @@ static int16_t usbGetC (void)
 {
     uint16_t bptr = rxbuf.tail;
 
+    usbTxPoll();
+
     if(bptr == rxbuf.head)
         return -1; // no data available else EOF
 
     char data = rxbuf.data[bptr++];             // Get next character, increment tmp pointer
     rxbuf.tail = bptr & (RX_BUFFER_SIZE - 1);   // and update pointer
 
+#if USB_RX_FLOW_CONTROL
+    usbRxResume(false);
+#endif
+
     return (int16_t)data;
 }
 
 static bool usbSuspendInput (bool suspend)
 {
-    return stream_rx_suspend(&rxbuf, suspend);
+    bool pending = stream_rx_suspend(&rxbuf, suspend);
+
+#if USB_RX_FLOW_CONTROL
+    // Input is not read while suspended, rearm reception so that the tool change acknowledge
+    // is not blocked by a full input buffer.
+    rx_suspended = suspend;
+    usbRxResume(suspend);
+#endif
+
+    return pending;
 }
 
 static enqueue_realtime_command_ptr usbSetRtHandler (enqueue_realtime_command_ptr handler)
@@ -173,6 +337,7 @@ const io_stream_t *usbInit (void)
         .type = StreamType_Serial,
         .read = usbGetC,
         .write = usbWriteS,
+        .write_n = usbWrite,
         .write_char = usbPutC,
         .write_all = usbWriteS,
         .get_rx_buffer_free = usbRxFree,
@@ -184,32 +349,49 @@ const io_stream_t *usbInit (void)
 
     MX_USB_DEVICE_Init();
 
-    txbuf.s = txbuf.data;
-    txbuf.max_length = BLOCK_TX_BUFFER_SIZE;
-
     return &stream;
 }
 
-// NOTE: add a call to this function as the first line CDC_Receive_FS() in usbd_cdc_if.c
-void usbBufferInput (uint8_t *data, uint32_t length)
+// NOTE: add a call to this function as the first line CDC_Receive_FS() in usbd_cdc_if.c,
+//       the OUT endpoint should only be rearmed when true is returned.
+bool usbBufferInput (uint8_t *data, uint32_t length)
 {
+#if USB_RX_FLOW_CONTROL
+    rx_pending.data = data;
+#endif
+
     while(length--) {
 
         uint_fast16_t next_head = (rxbuf.head + 1)  & (RX_BUFFER_SIZE - 1); // Get and increment buffer pointer
 
-        if(rxbuf.tail == next_head) {                                       // If buffer full
-            rxbuf.overflow = 1;                                             // flag overflow
-        } else {
-            if(*data == CMD_TOOL_ACK && !rxbuf.backup) {
-                stream_rx_backup(&rxbuf);
-                hal.stream.read = usbGetC; // restore normal input
-            } else if(!enqueue_realtime_command(*data)) {                   // Check and strip realtime commands,
-                rxbuf.data[rxbuf.head] = *data;                             // if not add data to buffer
+        // Realtime commands and the tool change acknowledge do not need buffer space
+        // and are handled even when the buffer is full.
+        if(*data == CMD_TOOL_ACK && !rxbuf.backup) {
+            stream_rx_backup(&rxbuf);
+            hal.stream.read = usbGetC; // restore normal input
+        } else if(!enqueue_realtime_command(*data)) {                       // Check and strip realtime commands,
+#if USB_RX_FLOW_CONTROL
+            if(rx_pending.length || (rxbuf.tail == next_head && !rx_suspended)) // if held back or buffer full
+                rx_pending.data[rx_pending.length++] = *data;               // keep in the packet buffer, in place
+            else
+#endif
+            if(rxbuf.tail == next_head)                                     // if buffer full
+                rxbuf.overflow = 1;                                         // flag overflow
+            else {
+                rxbuf.data[rxbuf.head] = *data;                             // else add data to buffer
                 rxbuf.head = next_head;                                     // and update pointer
             }
         }
         data++;                                                             // next
     }
+
+#if USB_RX_FLOW_CONTROL
+    // Pause reception (NAK further packets) until the characters held back fit in the input buffer, usbGetC() resumes.
+    // Nothing is held back while input is suspended since nothing is read from the buffer then.
+    return rx_pending.length == 0;
+#else
+    return true;
+#endif
 }
 
 #endif
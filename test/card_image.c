@@ -0,0 +1,124 @@
+/*
+
+  card_image.c - in-memory SD card image for the FatFs host tests
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "driver.h"
+#include "card_image.h"
+
+#if SDCARD_RAMDISK
+#include "ramdisk.h"
+#define IS_RAMDISK(drv) (drv == RAMDISK_PDRV)
+#else
+#define IS_RAMDISK(drv) false
+#define ramdisk_initialize() 0
+#define ramdisk_status() 0
+#define ramdisk_read(buff, sector, count) RES_PARERR
+#define ramdisk_write(buff, sector, count) RES_PARERR
+#define ramdisk_ioctl(cmd, buff) RES_PARERR
+#endif
+
+card_stats_t card_stats = {0};
+void (*card_on_write)(DWORD sector, UINT count) = NULL;
+
+static BYTE *card = NULL;
+static DWORD card_sectors = 0;
+
+FRESULT card_init (DWORD sectors, FATFS *fs)
+{
+    static BYTE work[FF_MAX_SS];
+
+    FRESULT res;
+
+    if((card = calloc(sectors, 512)) == NULL)
+        return FR_NOT_ENOUGH_CORE;
+
+    card_sectors = sectors;
+
+    if((res = f_mkfs("0:", FM_FAT|FM_SFD, 0, work, sizeof(work))) == FR_OK)
+        res = f_mount(fs, "0:", 1);
+
+    memset(&card_stats, 0, sizeof(card_stats));
+
+    return res;
+}
+
+void card_free (void)
+{
+    free(card);
+    card = NULL;
+}
+
+DSTATUS disk_initialize (BYTE drv)
+{
+    return IS_RAMDISK(drv) ? ramdisk_initialize() : 0;
+}
+
+DSTATUS disk_status (BYTE drv)
+{
+    return IS_RAMDISK(drv) ? ramdisk_status() : 0;
+}
+
+DRESULT disk_read (BYTE drv, BYTE *buff, DWORD sector, BYTE count)
+{
+    if(IS_RAMDISK(drv))
+        return ramdisk_read(buff, sector, count);
+
+    if(sector + count > card_sectors)
+        return RES_PARERR;
+
+    card_stats.reads += count;
+    card_stats.read_calls++;
+    memcpy(buff, card + sector * 512, count * 512);
+
+    return RES_OK;
+}
+
+DRESULT disk_write (BYTE drv, const BYTE *buff, DWORD sector, BYTE count)
+{
+    if(IS_RAMDISK(drv))
+        return ramdisk_write(buff, sector, count);
+
+    if(sector + count > card_sectors)
+        return RES_PARERR;
+
+    card_stats.writes += count;
+    card_stats.write_calls++;
+    if(card_on_write)
+        card_on_write(sector, count);
+    memcpy(card + sector * 512, buff, count * 512);
+
+    return RES_OK;
+}
+
+DRESULT disk_ioctl (BYTE drv, BYTE cmd, void *buff)
+{
+    if(IS_RAMDISK(drv))
+        return ramdisk_ioctl(cmd, buff);
+
+    switch(cmd) {
+
+        case GET_SECTOR_COUNT:
+            *(DWORD *)buff = card_sectors;
+            break;
+
+        case GET_SECTOR_SIZE:
+            *(WORD *)buff = 512;
+            break;
+
+        case GET_BLOCK_SIZE:
+            *(DWORD *)buff = 1;
+            break;
+    }
+
+    return RES_OK;
+}
+
+DWORD get_fattime (void)
+{
+    return ((DWORD)(2021 - 1980) << 25) | (8 << 21) | (1 << 16);
+}
@@ -0,0 +1,26 @@
+/*
+
+  card_image.h - in-memory SD card image for the FatFs host tests
+
+  Physical drive 0 is the card image, RAMDISK_PDRV is passed on to ramdisk.c.
+
+*/
+
+#pragma once
+
+#include "ff.h"
+#include "diskio.h"
+
+typedef struct {
+    uint32_t reads;         // sectors read
+    uint32_t writes;        // sectors written
+    uint32_t read_calls;    // disk_read() calls, i.e. single or multi block commands
+    uint32_t write_calls;   // disk_write() calls
+} card_stats_t;
+
+extern card_stats_t card_stats;
+extern void (*card_on_write)(DWORD sector, UINT count);
+
+// Allocates a zeroed image and formats it with FAT, sectors is the image size.
+FRESULT card_init (DWORD sectors, FATFS *fs);
+void card_free (void);
@@ -0,0 +1,130 @@
+/*
+
+  datalog_test.c - host test for contiguous pre-allocated data capture files
+
+  Checks that writes are bounded by the requested size, that an unclosed log reads back as
+  an empty file after remounting (power loss) and that its clusters are released on delete.
+  Then 1 MByte of records is written with f_write() and with the f_datalog_*() functions,
+  the FAT and directory sector writes and data write calls are reported for both.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "driver.h"
+#include "ff_datalog.h"
+#include "card_image.h"
+
+#define LOG_SIZE 1048576
+#define RECORD_SIZE 36
+
+static FATFS fs;
+static uint32_t meta_writes, data_calls;
+static int failed = 0;
+
+#define CHECK(cond) if(!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; }
+
+static void count_write (DWORD sector, UINT count)
+{
+    if(sector < fs.database)
+        meta_writes += count;
+    else
+        data_calls++;
+}
+
+static void test_size_bound (void)
+{
+    static datalog_t log;
+    static BYTE data[1001];
+
+    FILINFO info;
+
+    CHECK(f_datalog_open(&log, "0:/bound.log", 1000) == FR_OK);
+    CHECK(f_datalog_write(&log, data, 600) == FR_OK);
+    CHECK(f_datalog_write(&log, data, 401) == FR_DENIED);
+    CHECK(f_datalog_write(&log, data, 400) == FR_OK);
+    CHECK(f_datalog_write(&log, data, 1) == FR_DENIED);
+    CHECK(f_datalog_close(&log) == FR_OK);
+    CHECK(f_stat("0:/bound.log", &info) == FR_OK && info.fsize == 1000);
+}
+
+static void test_power_loss (void)
+{
+    static datalog_t log;
+    static BYTE data[8192];
+
+    FATFS *pfs;
+    FILINFO info;
+    DWORD free_before, free_after;
+
+    CHECK(f_getfree("0:", &free_before, &pfs) == FR_OK);
+
+    memset(data, 'x', sizeof(data));
+    CHECK(f_datalog_open(&log, "0:/lost.log", 65536) == FR_OK);
+    CHECK(f_datalog_write(&log, data, sizeof(data)) == FR_OK);
+
+    // Remount without closing the log
+    CHECK(f_mount(NULL, "0:", 0) == FR_OK);
+    CHECK(f_mount(&fs, "0:", 1) == FR_OK);
+
+    CHECK(f_stat("0:/lost.log", &info) == FR_OK && info.fsize == 0);
+    CHECK(f_unlink("0:/lost.log") == FR_OK);
+    CHECK(f_getfree("0:", &free_after, &pfs) == FR_OK && free_after == free_before);
+}
+
+static void test_fat_writes (void)
+{
+    static datalog_t log;
+    static char a[LOG_SIZE], b[LOG_SIZE];
+
+    FIL file[2];
+    UINT idx, bw, br[2];
+    char record[RECORD_SIZE + 1];
+
+    card_on_write = count_write;
+
+    meta_writes = data_calls = 0;
+    CHECK(f_open(&file[0], "0:/a.log", FA_WRITE|FA_CREATE_ALWAYS) == FR_OK);
+    for(idx = 0; idx < LOG_SIZE / RECORD_SIZE; idx++) {
+        sprintf(record, "%08u,%08u,%08u,%08u\n", idx, idx * 3, idx * 7, idx * 11);
+        CHECK(f_write(&file[0], record, RECORD_SIZE, &bw) == FR_OK && bw == RECORD_SIZE);
+    }
+    CHECK(f_close(&file[0]) == FR_OK);
+    printf("f_write():      %u FAT/directory sector writes, %u data write calls per MByte\n", meta_writes, data_calls);
+
+    meta_writes = data_calls = 0;
+    CHECK(f_datalog_open(&log, "0:/b.log", LOG_SIZE) == FR_OK);
+    for(idx = 0; idx < LOG_SIZE / RECORD_SIZE; idx++) {
+        sprintf(record, "%08u,%08u,%08u,%08u\n", idx, idx * 3, idx * 7, idx * 11);
+        CHECK(f_datalog_write(&log, record, RECORD_SIZE) == FR_OK);
+    }
+    CHECK(f_datalog_close(&log) == FR_OK);
+    printf("f_datalog_*():  %u FAT/directory sector writes, %u data write calls per MByte\n", meta_writes, data_calls);
+
+    card_on_write = NULL;
+
+    CHECK(f_open(&file[0], "0:/a.log", FA_READ) == FR_OK);
+    CHECK(f_open(&file[1], "0:/b.log", FA_READ) == FR_OK);
+    CHECK(f_read(&file[0], a, sizeof(a), &br[0]) == FR_OK);
+    CHECK(f_read(&file[1], b, sizeof(b), &br[1]) == FR_OK);
+    CHECK(br[0] == br[1] && br[0] == LOG_SIZE / RECORD_SIZE * RECORD_SIZE && !memcmp(a, b, br[0]));
+    f_close(&file[0]);
+    f_close(&file[1]);
+}
+
+int main (int argc, char **argv)
+{
+    CHECK(card_init(8192, &fs) == FR_OK);
+
+    test_size_bound();
+    test_power_loss();
+    test_fat_writes();
+
+    printf("datalog_test: %s\n", failed ? "FAILED" : "OK");
+
+    card_free();
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,283 @@
+/*
+  driver_sim_test.c - step and direction output timing of driver.c on the simulated MCU
+
+  driver.c, serial.c and ioports.c are built unchanged for the host and run against the
+  register file in sim/. The stepper interrupt callback below stands in for the grbl stepper
+  driver: it outputs a step on every stepper timer interrupt and changes direction every
+  DIR_CHANGE_STEPS steps. The step and direction pin changes are taken from the GPIO log.
+
+  Built twice, with step pulses ended by the pulse timer interrupt and with STEP_PULSE_DMA.
+  Both builds check the pulse train against the same expectations, so they are equivalent:
+
+    - every step is output with the direction and axes requested by the callback, with a
+      pulse width of at least the programmed width less STEP_PULSE_LATENCY and at most
+      STEP_PULSE_LATENCY longer than the pulse timer period.
+    - direction outputs are set before the step pulse, and at least the step pulse delay
+      ahead of it when one is configured.
+    - the instruction count of the pulse and stepper timer interrupt handlers.
+    - with STEP_PULSE_DMA, pulses are ended by DMA only and the pulse timer interrupt is only
+      taken to start delayed pulses.
+
+  Also checks that a line written to and one read from the serial stream pass through USART1.
+
+  NOTE: handler costs are counted in host instructions, which are comparable to but not the
+        same as Cortex-M7 cycles.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sim.h"
+#include "driver.h"
+#include "i2c.h"
+#include "flash.h"
+
+#define CHECK(cond) if(!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; }
+
+#define DIR_CHANGE_STEPS 16
+#define STEP_RATE        20000 // steps/s
+#define MAX_STEPS        1000
+
+#if STEP_PULSE_DMA
+#define TEST_NAME "driver_sim_dma_test"
+#else
+#define TEST_NAME "driver_sim_test"
+#endif
+
+// Not under test.
+
+void i2c_init (void)
+{
+}
+
+bool memcpy_from_flash (uint8_t *dest)
+{
+    return false;
+}
+
+bool memcpy_to_flash (uint8_t *source)
+{
+    return false;
+}
+
+typedef struct {
+    uint8_t axes;   // X = bit 0, Y = bit 1
+    bool dir_x;
+} step_t;
+
+static int failed = 0;
+static stepper_t stepper;
+static uint32_t steps, n_steps;
+static step_t expected[MAX_STEPS], observed[MAX_STEPS];
+
+static void stepper_interrupt (void)
+{
+    if(steps == n_steps) {
+        hal.stepper.go_idle(false);
+        return;
+    }
+
+    if((stepper.dir_change = steps % DIR_CHANGE_STEPS == 0))
+        stepper.dir_outbits.x = !stepper.dir_outbits.x;
+    stepper.step_outbits.x = On;
+    stepper.step_outbits.y = steps & 1;
+
+    expected[steps].axes = stepper.step_outbits.mask & 0x03;
+    expected[steps].dir_x = stepper.dir_outbits.x;
+    steps++;
+
+    hal.stepper.cycles_per_tick(hal.f_step_timer / STEP_RATE);
+    hal.stepper.pulse_start(&stepper);
+}
+
+static bool done (void)
+{
+    return steps == n_steps && !(SIM_REG(STEPPER_TIMER->CR1) & TIM_CR1_CEN) && !(SIM_REG(PULSE_TIMER->CR1) & TIM_CR1_CEN);
+}
+
+typedef struct {
+    uint32_t pulses;
+    uint32_t mismatches;        // steps not matching the expected axes or direction
+    uint32_t dma_ends;          // pulses ended by DMA
+    uint64_t width_min, width_max;
+    uint32_t dir_changes;
+    int64_t setup_min;
+    uint32_t pulse_isr_count, pulse_isr_max, stepper_isr_max;
+} result_t;
+
+static result_t run (float pulse_us, float delay_us, uint32_t n)
+{
+    result_t r = { .width_min = UINT64_MAX, .setup_min = INT64_MAX };
+    const sim_gpio_event_t *ev;
+    uint32_t idx, count;
+    int64_t t_step = -1, t_dir = -1;
+    bool dir_x = false, y_high = false;
+
+    settings.steppers.pulse_microseconds = pulse_us;
+    settings.steppers.pulse_delay_microseconds = delay_us;
+    hal.settings_changed(&settings);
+
+    memset(&stepper, 0, sizeof(stepper_t));
+    steps = 0;
+    n_steps = n;
+
+    sim_gpio_clear_events();
+    sim_irq_stats_reset();
+
+    hal.stepper.wake_up();
+    sim_run_until(done, (uint64_t)SIM_HCLK);
+
+    count = sim_gpio_events(&ev);
+
+    for(idx = 0; idx < count; idx++) {
+
+        if(ev[idx].port == X_DIRECTION_PORT && (ev[idx].changed & X_DIRECTION_BIT)) {
+            r.dir_changes++;
+            t_dir = (int64_t)ev[idx].time;
+            dir_x = !!(ev[idx].odr & X_DIRECTION_BIT);
+        }
+
+        // Y is output after X by the same pulse start and must end before the next one.
+        if(ev[idx].port == Y_STEP_PORT && (ev[idx].changed & Y_STEP_BIT)) {
+            if((y_high = !!(ev[idx].odr & Y_STEP_BIT)) && t_step >= 0 && r.pulses < n)
+                observed[r.pulses].axes |= 0x02;
+        }
+
+        if(ev[idx].port == X_STEP_PORT && (ev[idx].changed & X_STEP_BIT)) {
+            if(ev[idx].odr & X_STEP_BIT) {
+                if(y_high)
+                    r.mismatches++;
+                t_step = (int64_t)ev[idx].time;
+                if(r.pulses < n) {
+                    observed[r.pulses].axes = 0x01;
+                    observed[r.pulses].dir_x = dir_x;
+                }
+                if(t_dir >= 0) {
+                    if(t_step - t_dir < r.setup_min)
+                        r.setup_min = t_step - t_dir;
+                    t_dir = -1;
+                }
+            } else if(t_step >= 0) {
+                uint64_t width = (uint64_t)ev[idx].time - (uint64_t)t_step;
+                if(ev[idx].dma)
+                    r.dma_ends++;
+                r.pulses++;
+                r.width_min = min(r.width_min, width);
+                r.width_max = max(r.width_max, width);
+                t_step = -1;
+            }
+        }
+    }
+
+    if(y_high)
+        r.mismatches++;
+
+    for(idx = 0; idx < min(r.pulses, n); idx++) {
+        if(observed[idx].axes != expected[idx].axes || observed[idx].dir_x != expected[idx].dir_x)
+            r.mismatches++;
+    }
+
+    r.pulse_isr_count = sim_irq_stats(PULSE_TIMER_IRQn)->count;
+    r.pulse_isr_max = sim_irq_stats(PULSE_TIMER_IRQn)->max;
+    r.stepper_isr_max = sim_irq_stats(STEPPER_TIMER_IRQn)->max;
+
+    return r;
+}
+
+// Pulse timer ticks per microsecond.
+static uint32_t ticks_us (void)
+{
+    return hal.f_step_timer * PULSE_TIMER_CLOCK_MUL / (SIM_REG(PULSE_TIMER->PSC) + 1) / 1000000UL;
+}
+
+// Pulse timer period in CPU cycles for an ARR value.
+static uint64_t pulse_timer_cycles (uint32_t arr)
+{
+    return (uint64_t)(arr + 1) * SIM_CYCLES_PER_US / ticks_us();
+}
+
+static void check_train (result_t *r, float pulse_us, uint32_t n)
+{
+    uint64_t period = pulse_timer_cycles(SIM_REG(PULSE_TIMER->ARR));
+
+    CHECK(r->pulses == n);
+    CHECK(r->mismatches == 0);
+    CHECK(r->dir_changes == (n + DIR_CHANGE_STEPS - 1) / DIR_CHANGE_STEPS);
+    CHECK(r->width_min >= (uint64_t)((pulse_us - STEP_PULSE_LATENCY) * SIM_CYCLES_PER_US));
+    CHECK(r->width_min >= period);
+    CHECK(r->width_max <= period + (uint64_t)(STEP_PULSE_LATENCY * SIM_CYCLES_PER_US));
+    CHECK(r->setup_min > 0);
+#if STEP_PULSE_DMA
+    CHECK(r->dma_ends == n);
+#else
+    CHECK(r->dma_ends == 0);
+#endif
+}
+
+int main (void)
+{
+    result_t r;
+
+    hal.version = 8;
+    CHECK(driver_init());
+    hal.stepper.interrupt_callback = stepper_interrupt;
+    CHECK(hal.driver_setup(&settings));
+
+    sim_time_isrs(true);
+
+    // No step pulse delay: direction is output ahead of the step in the same interrupt.
+
+    r = run(5.0f, 0.0f, 200);
+
+    printf("5 us pulse: %.2f - %.2f us, dir setup %.3f us, ISR pulse %u (%u), stepper %u instructions\n",
+            (double)r.width_min / SIM_CYCLES_PER_US, (double)r.width_max / SIM_CYCLES_PER_US,
+             (double)r.setup_min / SIM_CYCLES_PER_US, r.pulse_isr_max, r.pulse_isr_count, r.stepper_isr_max);
+
+    check_train(&r, 5.0f, 200);
+    CHECK(r.pulse_isr_max < 100);
+    CHECK(r.stepper_isr_max < 400);
+#if STEP_PULSE_DMA
+    CHECK(r.pulse_isr_count == 0);
+#else
+    CHECK(r.pulse_isr_count == 200);
+#endif
+
+    // Step pulse delay: the step is started from the pulse timer interrupt after the delay.
+
+    r = run(5.0f, 3.0f, 200);
+
+    printf("5 us pulse, 3 us delay: %.2f - %.2f us, dir setup %.3f us, ISR pulse %u (%u), stepper %u instructions\n",
+            (double)r.width_min / SIM_CYCLES_PER_US, (double)r.width_max / SIM_CYCLES_PER_US,
+             (double)r.setup_min / SIM_CYCLES_PER_US, r.pulse_isr_max, r.pulse_isr_count, r.stepper_isr_max);
+
+    check_train(&r, 5.0f, 200);
+    CHECK(r.setup_min >= (int64_t)pulse_timer_cycles((uint32_t)(ticks_us() * (3.0f - 1.0f))));
+    CHECK(r.pulse_isr_max < 100);
+#if STEP_PULSE_DMA
+    CHECK(r.pulse_isr_count == r.dir_changes);
+#else
+    CHECK(r.pulse_isr_count == 200 + r.dir_changes);
+#endif
+
+    // Serial stream: output is sent from the TX interrupt, input is received from the RX interrupt.
+
+    const uint8_t *tx;
+    char line[8] = {0};
+    uint_fast8_t len = 0;
+    int16_t c;
+
+    sim_usart_tx_clear(USART1);
+    hal.stream.write("ok" ASCII_EOL);
+    sim_run(10 * sim_usart_char_time(USART1));
+    CHECK(sim_usart_tx(USART1, &tx) == 4 && !memcmp(tx, "ok" ASCII_EOL, 4));
+
+    sim_usart_rx(USART1, "G0X1\n", 5);
+    sim_run(10 * sim_usart_char_time(USART1));
+    while(len < sizeof(line) - 1 && (c = hal.stream.read()) != -1)
+        line[len++] = (char)c;
+    CHECK(!strcmp(line, "G0X1\n"));
+
+    printf(TEST_NAME ": %s\n", failed ? "FAILED" : "OK");
+
+    return failed ? 1 : 0;
+}
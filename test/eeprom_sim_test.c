@@ -0,0 +1,192 @@
+/*
+  eeprom_sim_test.c - I2C EEPROM settings storage of i2c.c on the simulated MCU
+
+  The 24LC32 model in sim/sim_eeprom.c replaces the HAL I2C driver and counts the page writes,
+  each of which starts a 5 ms internal write cycle.
+
+    - a settings image written to an erased device takes one page write per page.
+    - writing it again unchanged takes no page writes.
+    - changes in a few pages of a multi-page write only write those pages, each trimmed to the
+      span of changed bytes.
+    - the device content and the data read back are the image written.
+    - a write crossing page boundaries is split so that the device never wraps around within a
+      page, the next transfer polls the device for the end of the write cycle.
+    - a page write not acknowledged is retried, after three attempts the write transfer returns
+      a failure to the caller, with the other pages written.
+    - a device that does not respond fails writes and reads within the timeout.
+
+  Also reports the time taken by the full, unchanged and partial writes.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sim.h"
+#include "i2c.h"
+
+#define CHECK(cond) if(!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; }
+
+#define TEST_NAME "eeprom_sim_test"
+#define MS (SIM_HCLK / 1000UL)
+#define EEPROM_SIZE 4096                    // 24LC32
+#define PAGE 32
+#define IMAGE_SIZE 1024
+
+static int failed = 0;
+static uint8_t image[IMAGE_SIZE];
+
+static void foreground (sys_state_t state)
+{
+}
+
+static bool transfer (uint16_t word_addr, uint8_t *data, uint16_t count, bool read)
+{
+    nvs_transfer_t i2c = {
+        .address = 0x50,
+        .word_addr_bytes = 2,
+        .word_addr = word_addr,
+        .count = count,
+        .data = data
+    };
+
+    return i2c_nvs_transfer(&i2c, read) == NVS_TransferResult_OK;
+}
+
+// Writes the image, returns the time taken.
+static uint64_t write_image (void)
+{
+    uint64_t t = sim_now;
+
+    CHECK(transfer(0, image, IMAGE_SIZE, false));
+
+    return sim_now - t;
+}
+
+static void check_image (void)
+{
+    static uint8_t buf[IMAGE_SIZE];
+
+    memset(buf, 0, sizeof(buf));
+    CHECK(transfer(0, buf, IMAGE_SIZE, true));
+    CHECK(!memcmp(buf, image, IMAGE_SIZE));
+    CHECK(!memcmp(sim_eeprom_data(), image, IMAGE_SIZE));
+}
+
+int main (void)
+{
+    const sim_eeprom_stats_t *stats = sim_eeprom_stats();
+    uint32_t idx;
+    uint64_t t;
+
+    grbl.on_execute_realtime = foreground;
+
+    i2c_init();
+    i2c_nvs_queue_init();
+
+    sim_eeprom_insert(EEPROM_SIZE, PAGE);
+
+    for(idx = 0; idx < IMAGE_SIZE; idx++)
+        image[idx] = idx % 251;             // no erased (0xFF) bytes
+
+    // Erased device: every page is written in full.
+
+    t = write_image();
+    check_image();
+    CHECK(stats->write_cycles == IMAGE_SIZE / PAGE);
+    CHECK(stats->bytes_written == IMAGE_SIZE);
+    CHECK(stats->wraps == 0);
+    printf(TEST_NAME ": full write, %u page writes, %u ms\n", stats->write_cycles, (uint32_t)(t / MS));
+
+    // Unchanged: nothing is written.
+
+    sim_run(10 * MS);
+    sim_eeprom_stats_reset();
+    t = write_image();
+    CHECK(stats->write_cycles == 0);
+    CHECK(stats->bytes_written == 0);
+    printf(TEST_NAME ": unchanged, %u page writes, %u ms\n", stats->write_cycles, (uint32_t)(t / MS));
+
+    // Changes in three pages, the first page and the last two of the image.
+
+    image[5]++;
+    image[IMAGE_SIZE - 2 * PAGE + 3]++;
+    image[IMAGE_SIZE - 2 * PAGE + 20]++;    // bytes 3 - 20 of the page written
+    image[IMAGE_SIZE - 1]++;
+
+    sim_eeprom_stats_reset();
+    t = write_image();
+    CHECK(stats->write_cycles == 3);
+    CHECK(stats->bytes_written == 1 + 18 + 1);
+    CHECK(stats->wraps == 0);
+    printf(TEST_NAME ": 4 bytes changed, %u page writes, %u bytes, %u ms\n", stats->write_cycles, stats->bytes_written, (uint32_t)(t / MS));
+
+    // An unaligned write of a few bytes within a page.
+
+    image[100] = image[101] = 0;
+    sim_eeprom_stats_reset();
+    CHECK(transfer(99, &image[99], 4, false));
+    CHECK(stats->write_cycles == 1);
+    CHECK(stats->bytes_written == 2);
+    check_image();
+
+    // Unaligned write over four page boundaries: 2, 3 x 32 and 2 bytes.
+
+    for(idx = 30; idx < 130; idx++)
+        image[idx] ^= 0x5A;
+
+    sim_eeprom_stats_reset();
+    t = sim_now;
+    CHECK(transfer(30, &image[30], 100, false));
+    t = sim_now - t;
+    CHECK(stats->write_cycles == 5);
+    CHECK(stats->bytes_written == 100);
+    CHECK(stats->wraps == 0);
+    CHECK(stats->polls > 0);                // ACK polling instead of a fixed delay
+    CHECK(t < 5 * 6 * MS);
+    check_image();
+
+    // Failed page writes are retried.
+
+    image[200]++;
+    sim_eeprom_stats_reset();
+    sim_eeprom_fail_writes(2);
+    CHECK(transfer(0, image, IMAGE_SIZE, false));
+    CHECK(stats->nacks == 2);
+    CHECK(stats->write_cycles == 1);
+    check_image();
+
+    // A page that fails three times fails the transfer, the other changed pages are written.
+
+    image[300]++;
+    image[400]++;
+    sim_eeprom_stats_reset();
+    sim_eeprom_fail_writes(3);
+    CHECK(!transfer(0, image, IMAGE_SIZE, false));
+    CHECK(stats->nacks == 3);
+    CHECK(stats->write_cycles == 1);
+    CHECK(sim_eeprom_data()[300] != image[300]);
+    CHECK(sim_eeprom_data()[400] == image[400]);
+
+    // Written when the caller retries, the failure is not reported again.
+
+    CHECK(transfer(0, image, IMAGE_SIZE, false));
+    CHECK(stats->write_cycles == 2);
+    CHECK(transfer(0, image, IMAGE_SIZE, false));
+    check_image();
+    printf(TEST_NAME ": failed page write, %u NACKs\n", stats->nacks);
+
+    // No device: writes and reads fail within the timeout.
+
+    image[500]++;
+    sim_eeprom_insert(0, PAGE);
+    t = sim_now;
+    CHECK(!transfer(0, image, IMAGE_SIZE, false));
+    CHECK(!transfer(0, image, IMAGE_SIZE, true));
+    t = sim_now - t;
+    CHECK(t < 200 * MS);
+    printf(TEST_NAME ": no device, failed in %u ms\n", (uint32_t)(t / MS));
+
+    printf(TEST_NAME ": %s\n", failed ? "FAILED" : "OK");
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,141 @@
+/*
+  eth_budget_test.c - frames lost versus ETH_RX_BUDGET on the simulated ETH DMA
+
+  A sender bursts frames back to back at 100 Mbit/s while the foreground loop calls
+  ethernetif_input() every 100 us, the receive ring has ETH_RXBUFNB descriptors. Built for
+  budgets of 1, 2, 4 and 8 frames per call, and with ETH_RX_INTERRUPT for a budget of 8.
+
+    - every frame sent is either passed up to lwIP, in order, or counted as lost by the DMA.
+    - frames are lost only when the ring overruns, each overrun is recovered and counted.
+    - with a budget of 1 a burst of full TCP segments (about 2 per poll) overruns the ring,
+      with a budget of 2 or more it does not.
+    - with ETH_RX_INTERRUPT frames are passed up after the receive interrupt, and the frames
+      left in the ring when the budget runs out are passed up by the next calls.
+
+  Also reports the frames lost to bursts of full TCP segments and of minimum size frames.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sim.h"
+#include "lwip/init.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "ethernetif.h"
+
+#define CHECK(cond) if(!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; }
+
+#define US SIM_CYCLES_PER_US
+#define POLL_INTERVAL (100 * US)
+#define BURST 200
+#define SEGMENT_SIZE 590        // full TCP segment of the default MSS
+#define MIN_SIZE 60
+
+static int failed = 0;
+static char test_name[32];
+static struct netif netif;
+static uint32_t passed_up, next_seq, out_of_order;
+
+void SysTick_Handler (void)
+{
+}
+
+static err_t input (struct pbuf *p, struct netif *inp)
+{
+    uint32_t seq;
+
+    pbuf_copy_partial(p, &seq, sizeof(seq), 14);
+
+    if(seq < next_seq)
+        out_of_order++;
+    next_seq = seq + 1;
+    passed_up++;
+    pbuf_free(p);
+
+    return ERR_OK;
+}
+
+// Sends a burst of frames and polls until it has been received, returns the frames lost.
+static uint32_t burst (uint32_t length)
+{
+    static uint8_t frame[SEGMENT_SIZE];
+    static uint32_t seq = 0;
+
+    const sim_eth_stats_t *stats = sim_eth_stats();
+    const ethernetif_stats_t *if_stats = ethernetif_get_stats();
+    uint32_t idx, overruns = if_stats->rx_overruns, frames = if_stats->rx_frames;
+
+    sim_eth_stats_reset();
+    passed_up = out_of_order = 0;
+
+    memset(frame, 0xFF, 6);
+    memset(&frame[6], 0x02, 6);
+    frame[12] = 0x08;
+    frame[13] = 0x00;
+
+    for(idx = 0; idx < BURST; idx++) {
+        memcpy(&frame[14], &seq, sizeof(seq));
+        seq++;
+        sim_eth_rx(frame, length);
+    }
+
+    while(sim_eth_rx_pending()) {
+        sim_run(POLL_INTERVAL);
+        ethernetif_input(&netif);
+    }
+
+    for(idx = 0; idx < ETH_RXBUFNB; idx++) {
+        sim_run(POLL_INTERVAL);
+        ethernetif_input(&netif);
+    }
+
+    CHECK(passed_up + stats->rx_missed == BURST);
+    CHECK(stats->rx_frames == passed_up);
+    CHECK(if_stats->rx_frames - frames == passed_up);
+    CHECK(out_of_order == 0);
+    CHECK((if_stats->rx_overruns > overruns) == (stats->rx_missed > 0));
+    CHECK(if_stats->rx_overruns - overruns <= stats->rx_missed);
+
+    return stats->rx_missed;
+}
+
+int main (void)
+{
+    uint32_t lost_segments, lost_min;
+
+#if ETH_RX_INTERRUPT
+    sprintf(test_name, "eth_budget_test_irq");
+#else
+    sprintf(test_name, "eth_budget_test_%u", (uint32_t)ETH_RX_BUDGET);
+#endif
+
+    SysTick_Config(SIM_HCLK / 1000); // lets HAL_Delay() skip ahead
+
+    lwip_init();
+    netif_add(&netif, NULL, NULL, NULL, NULL, ethernetif_init, input);
+    netif_set_up(&netif);
+
+    lost_segments = burst(SEGMENT_SIZE);
+
+#if ETH_RX_BUDGET == 1
+    CHECK(lost_segments > 0);
+#else
+    CHECK(lost_segments == 0);
+#endif
+
+    lost_min = burst(MIN_SIZE);
+
+    CHECK(lost_min >= lost_segments);
+
+#if ETH_RX_INTERRUPT
+    CHECK(sim_irq_stats(ETH_IRQn)->count > 0);
+#endif
+
+    printf("%s: budget %u, %u of %u frames of %u bytes lost, %u of %u frames of %u bytes lost\n", test_name, (uint32_t)ETH_RX_BUDGET,
+            lost_segments, BURST, SEGMENT_SIZE, lost_min, BURST, MIN_SIZE);
+
+    printf("%s: %s\n", test_name, failed ? "FAILED" : "OK");
+
+    return failed ? 1 : 0;
+}
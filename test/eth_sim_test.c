@@ -0,0 +1,468 @@
+/*
+  eth_sim_test.c - Ethernet receive path of ethernetif.c on the simulated ETH DMA
+
+  lwIP is initialised without the networking plugin, the netif input function is the test's
+  own: it checks each frame passed up and either frees it or holds it, as TCP does with out of
+  sequence segments. Frames arrive back to back at 100 Mbit/s from the ETH model in sim/sim_eth.c.
+  Built with the default copy paths and with ETH_ZEROCOPY_RX and ETH_ZEROCOPY_TX.
+
+    - every frame of a burst is passed up once, in order and unchanged, none are lost when
+      polled often enough.
+    - frames held by lwIP are not overwritten by later traffic: no descriptor owned by the DMA
+      points at a buffer referenced by a held pbuf, and the receive ring keeps running.
+    - with ETH_ZEROCOPY_RX frames are passed up in the DMA buffers while spare buffers are
+      available, and copied to pool pbufs when all spares are held.
+    - after a burst overrunning the ring the frames lost are counted, the RBUS recovery is
+      counted and reception resumes.
+    - no pool pbufs or spare buffers are leaked: when all frames are freed the pool is full,
+      every receive descriptor is owned by the DMA and all spares are used again.
+    - every frame transmitted is sent once, in order and unchanged, from single pbufs, pbuf
+      chains, PBUF_REF payloads changed by the caller after return and PBUF_ROM payloads in
+      flash. No descriptor is changed while owned by the DMA.
+    - with ETH_ZEROCOPY_TX a pbuf transmitted in place holds a reference until the DMA has
+      released it, chains are gathered from one descriptor per pbuf, PBUF_REF and flash payloads
+      are copied and not referenced.
+    - frames queued faster than the wire takes them are sent when descriptors are released, no
+      pool pbufs are leaked.
+
+  Also reports the frames lost to the unpolled burst and the time taken by back to back frames.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sim.h"
+#include "lwip/init.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/priv/memp_priv.h"
+#include "ethernetif.h"
+
+#define CHECK(cond) if(!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; }
+
+#if ETH_ZEROCOPY_RX
+#define TEST_NAME "eth_sim_zc_test"
+#else
+#define TEST_NAME "eth_sim_test"
+#endif
+#define US SIM_CYCLES_PER_US
+#define FRAME_SIZE 590          // a full TCP segment of the default MSS, fits a single pool pbuf
+#define MAX_HELD 16
+#define TX_BURST 16
+#define ROM_FRAME (FLASH_BASE + 0xC0000) // in flash, out of reach of the ETH DMA
+
+extern ETH_DMADescTypeDef DMARxDscrTab[ETH_RXBUFNB], DMATxDscrTab[ETH_TXBUFNB];
+
+static int failed = 0;
+static struct netif netif;
+
+static struct {
+    uint32_t frames;
+    uint32_t next_seq;
+    uint32_t out_of_order;
+    uint32_t corrupt;
+    uint32_t zero_copy;
+    bool hold;
+    uint32_t held;
+    struct pbuf *p[MAX_HELD];
+    uint32_t seq[MAX_HELD];
+} rx;
+
+static struct {
+    uint32_t frames;
+    uint32_t next_seq;
+    uint32_t out_of_order;
+    uint32_t corrupt;
+} tx;
+
+void SysTick_Handler (void)
+{
+}
+
+static void make_frame (uint8_t *frame, uint32_t length, uint32_t seq)
+{
+    static const uint8_t header[14] = { 0x00, 0x80, 0xE1, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x01, 0x08, 0x00 };
+
+    uint32_t idx;
+
+    memcpy(frame, header, sizeof(header));
+    memcpy(&frame[14], &seq, sizeof(seq));
+    for(idx = 18; idx < length; idx++)
+        frame[idx] = (uint8_t)(seq * 7 + idx);
+}
+
+static bool tx_frame_ok (const uint8_t *frame, uint32_t length, uint32_t seq)
+{
+    static uint8_t expected[FRAME_SIZE];
+
+    make_frame(expected, FRAME_SIZE, seq);
+
+    return length == FRAME_SIZE && !memcmp(frame, expected, FRAME_SIZE);
+}
+
+static bool frame_ok (struct pbuf *p, uint32_t seq)
+{
+    static uint8_t expected[FRAME_SIZE], received[FRAME_SIZE];
+
+    make_frame(expected, FRAME_SIZE, seq);
+
+    return p->tot_len == FRAME_SIZE && pbuf_copy_partial(p, received, FRAME_SIZE, 0) == FRAME_SIZE && !memcmp(received, expected, FRAME_SIZE);
+}
+
+static err_t input (struct pbuf *p, struct netif *inp)
+{
+    uint32_t seq;
+
+    pbuf_copy_partial(p, &seq, sizeof(seq), 14);
+
+    rx.frames++;
+    if(seq != rx.next_seq)
+        rx.out_of_order++;
+    rx.next_seq = seq + 1;
+    if(!frame_ok(p, seq))
+        rx.corrupt++;
+    if(p->flags & PBUF_FLAG_IS_CUSTOM)
+        rx.zero_copy++;
+
+    if(rx.hold && rx.held < MAX_HELD) {
+        rx.seq[rx.held] = seq;
+        rx.p[rx.held++] = p;
+    } else
+        pbuf_free(p);
+
+    return ERR_OK;
+}
+
+static void on_tx (const uint8_t *frame, uint32_t length)
+{
+    uint32_t seq;
+
+    memcpy(&seq, &frame[14], sizeof(seq));
+
+    tx.frames++;
+    if(seq != tx.next_seq)
+        tx.out_of_order++;
+    tx.next_seq = seq + 1;
+    if(!tx_frame_ok(frame, length, seq))
+        tx.corrupt++;
+}
+
+static void receive (uint32_t frames)
+{
+    static uint8_t frame[FRAME_SIZE];
+    static uint32_t seq = 0;
+
+    while(frames--) {
+        make_frame(frame, FRAME_SIZE, seq++);
+        sim_eth_rx(frame, FRAME_SIZE);
+    }
+}
+
+// Polls as the foreground loop does until all queued frames have arrived and are passed up.
+static void poll (uint64_t interval)
+{
+    do {
+        sim_run(interval);
+        ethernetif_input(&netif);
+    } while(sim_eth_rx_pending());
+
+    ethernetif_input(&netif);
+}
+
+static void release_held (void)
+{
+    while(rx.held)
+        pbuf_free(rx.p[--rx.held]);
+}
+
+static uint32_t pool_free (void)
+{
+    const struct memp_desc *pool = memp_pools[MEMP_PBUF_POOL];
+    struct memp *m = *pool->tab;
+    uint32_t n = 0;
+
+    for(; m; m = m->next)
+        n++;
+
+    return n;
+}
+
+static uint32_t dma_owned (void)
+{
+    uint32_t idx, n = 0;
+
+    for(idx = 0; idx < ETH_RXBUFNB; idx++) {
+        if(DMARxDscrTab[idx].Status & ETH_DMARXDESC_OWN)
+            n++;
+    }
+
+    return n;
+}
+
+// Returns true if a descriptor owned by the DMA points into the payload of a held frame.
+static bool held_buffer_owned_by_dma (void)
+{
+    uint32_t idx, h;
+
+    for(h = 0; h < rx.held; h++) {
+        uint32_t payload = (uint32_t)(uintptr_t)rx.p[h]->payload;
+        for(idx = 0; idx < ETH_RXBUFNB; idx++) {
+            uint32_t buffer = DMARxDscrTab[idx].Buffer1Addr;
+            if((DMARxDscrTab[idx].Status & ETH_DMARXDESC_OWN) && payload >= buffer && payload < buffer + ETH_RX_BUF_SIZE)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+// Returns true if a transmit descriptor points into flash.
+static bool tx_desc_in_flash (void)
+{
+    uint32_t idx;
+
+    for(idx = 0; idx < ETH_TXBUFNB; idx++) {
+        if(DMATxDscrTab[idx].Buffer1Addr >= FLASH_BASE && DMATxDscrTab[idx].Buffer1Addr < FLASH_END)
+            return true;
+    }
+
+    return false;
+}
+
+static struct pbuf *tx_frame (pbuf_type type, uint32_t seq)
+{
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, FRAME_SIZE, type);
+
+    if(p) {
+        static uint8_t frame[FRAME_SIZE];
+        make_frame(frame, FRAME_SIZE, seq);
+        pbuf_take(p, frame, FRAME_SIZE);
+    }
+
+    return p;
+}
+
+// Waits for the end of transmission, then lets the driver reclaim the descriptors.
+static void tx_flush (void)
+{
+    while(sim_eth_tx_busy())
+        sim_run(sim_eth_frame_time(FRAME_SIZE));
+
+    ethernetif_input(&netif);
+}
+
+static void check_no_leak (uint32_t pool)
+{
+    CHECK(rx.held == 0);
+    CHECK(pool_free() == pool);
+    CHECK(dma_owned() == ETH_RXBUFNB);
+}
+
+int main (void)
+{
+    const sim_eth_stats_t *stats = sim_eth_stats();
+    const ethernetif_stats_t *if_stats = ethernetif_get_stats();
+    static uint8_t frame_buf[FRAME_SIZE];
+
+    uint32_t pool, idx, spares;
+
+    SysTick_Config(SIM_HCLK / 1000); // lets HAL_Delay() skip ahead
+
+    lwip_init();
+    netif_add(&netif, NULL, NULL, NULL, NULL, ethernetif_init, input);
+    netif_set_up(&netif);
+
+    CHECK(netif.flags & NETIF_FLAG_LINK_UP);
+    CHECK(dma_owned() == ETH_RXBUFNB);
+
+    pool = pool_free();
+
+    // A burst freed as passed up, polled every 10 us.
+
+    receive(64);
+    poll(10 * US);
+    CHECK(rx.frames == 64);
+    CHECK(rx.out_of_order == 0);
+    CHECK(rx.corrupt == 0);
+    CHECK(stats->rx_missed == 0);
+    CHECK(if_stats->rx_overruns == 0);
+#if ETH_ZEROCOPY_RX
+    CHECK(rx.zero_copy == 64);
+#else
+    CHECK(rx.zero_copy == 0);
+#endif
+    CHECK(stats->desc_changed == 0);
+    check_no_leak(pool);
+
+    // Frames held by lwIP while traffic continues.
+
+    memset(&rx, 0, offsetof(typeof(rx), p));
+    rx.next_seq = 64;
+    rx.hold = true;
+    receive(12);
+    poll(10 * US);
+    CHECK(rx.held == 12);
+#if ETH_ZEROCOPY_RX
+    spares = rx.zero_copy;
+    CHECK(spares > 0 && spares < 12);
+    for(idx = 0; idx < rx.held; idx++)
+        CHECK(!!(rx.p[idx]->flags & PBUF_FLAG_IS_CUSTOM) == (idx < spares)); // copied when the spares run out
+#else
+    spares = 0;
+    CHECK(rx.zero_copy == 0);
+#endif
+    CHECK(!held_buffer_owned_by_dma());
+    CHECK(dma_owned() == ETH_RXBUFNB);
+
+    rx.hold = false;
+    receive(32);
+    poll(10 * US);
+    CHECK(rx.frames == 12 + 32);
+    CHECK(rx.out_of_order == 0);
+    CHECK(rx.corrupt == 0);
+    CHECK(stats->rx_missed == 0);
+    CHECK(!held_buffer_owned_by_dma());
+    for(idx = 0; idx < rx.held; idx++)
+        CHECK(frame_ok(rx.p[idx], rx.seq[idx]));   // not overwritten by the DMA
+
+    release_held();
+    check_no_leak(pool);
+
+    // All spares are available again.
+
+    memset(&rx, 0, offsetof(typeof(rx), p));
+    rx.next_seq = 64 + 12 + 32;
+    rx.hold = true;
+    receive(spares);
+    poll(10 * US);
+    CHECK(rx.zero_copy == spares);
+    release_held();
+    rx.hold = false;
+
+    // A burst arriving while not polled: the frames beyond the ring are lost and reception
+    // resumes after RBUS recovery.
+
+    memset(&rx, 0, offsetof(typeof(rx), p));
+    rx.next_seq = 64 + 12 + 32 + spares;
+    sim_eth_stats_reset();
+    receive(40);
+    sim_run(40 * sim_eth_frame_time(FRAME_SIZE));
+    CHECK(sim_eth_rx_pending() == 0);
+    CHECK(stats->rx_frames == ETH_RXBUFNB);
+    CHECK(stats->rx_missed == 40 - ETH_RXBUFNB);
+    printf(TEST_NAME ": unpolled burst of 40 frames, %u lost\n", stats->rx_missed);
+
+    poll(10 * US);
+    CHECK(rx.frames == ETH_RXBUFNB);
+    CHECK(if_stats->rx_overruns == 1);
+
+    receive(16);
+    poll(10 * US);
+    CHECK(rx.frames == ETH_RXBUFNB + 16);
+    CHECK(rx.out_of_order == 1);           // the gap of the frames lost
+    CHECK(rx.corrupt == 0);
+    CHECK(stats->rx_missed == 40 - ETH_RXBUFNB);
+    check_no_leak(pool);
+
+    // Transmit, a single pbuf.
+
+    sim_eth_stats_reset();
+    sim_eth_on_tx(on_tx);
+
+    struct pbuf *p = tx_frame(PBUF_POOL, 0), *q;
+    CHECK(p && p->next == NULL);
+    CHECK(netif.linkoutput(&netif, p) == ERR_OK);
+    CHECK(sim_eth_tx_busy());
+#if ETH_ZEROCOPY_TX
+    CHECK(p->ref == 2);                     // referenced by the driver while in flight
+#else
+    CHECK(p->ref == 1);
+#endif
+    tx_flush();
+    CHECK(p->ref == 1);
+    pbuf_free(p);
+    CHECK(tx.frames == 1);
+
+    // A chain, as a header and a data pbuf.
+
+    p = pbuf_alloc(PBUF_RAW, 14, PBUF_RAM);
+    q = pbuf_alloc(PBUF_RAW, FRAME_SIZE - 14, PBUF_RAM);
+    pbuf_cat(p, q);
+    make_frame(frame_buf, FRAME_SIZE, 1);
+    pbuf_take(p, frame_buf, FRAME_SIZE);
+    CHECK(netif.linkoutput(&netif, p) == ERR_OK);
+#if ETH_ZEROCOPY_TX
+    CHECK(p->ref == 2);
+#endif
+    tx_flush();
+    CHECK(p->ref == 1);
+    pbuf_free(p);
+    CHECK(tx.frames == 2);
+#if ETH_ZEROCOPY_TX
+    CHECK(stats->tx_gathered == 1);
+#else
+    CHECK(stats->tx_gathered == 0);
+#endif
+
+    // A PBUF_REF payload changed by the caller as soon as the driver returns.
+
+    p = pbuf_alloc(PBUF_RAW, FRAME_SIZE, PBUF_REF);
+    make_frame(frame_buf, FRAME_SIZE, 2);
+    p->payload = frame_buf;
+    CHECK(netif.linkoutput(&netif, p) == ERR_OK);
+    CHECK(p->ref == 1);                     // copied, not referenced
+    memset(frame_buf, 0, FRAME_SIZE);
+    pbuf_free(p);
+    tx_flush();
+    CHECK(tx.frames == 3);
+
+    // A PBUF_ROM payload in flash.
+
+    make_frame((uint8_t *)sim_alias((void *)ROM_FRAME), FRAME_SIZE, 3);
+    p = pbuf_alloc(PBUF_RAW, FRAME_SIZE, PBUF_ROM);
+    p->payload = (void *)ROM_FRAME;
+    CHECK(netif.linkoutput(&netif, p) == ERR_OK);
+    CHECK(p->ref == 1);
+    CHECK(!tx_desc_in_flash());
+    pbuf_free(p);
+    tx_flush();
+    CHECK(tx.frames == 4);
+
+    // Back to back frames, queued as fast as the descriptors are released.
+
+    struct pbuf *burst[TX_BURST];
+    uint32_t retries = 0;
+    uint64_t t = sim_now;
+
+    for(idx = 0; idx < TX_BURST; idx++) {
+        burst[idx] = tx_frame(PBUF_POOL, 4 + idx);
+        while(netif.linkoutput(&netif, burst[idx]) == ERR_USE) {
+            retries++;
+            sim_run(US);
+            ethernetif_input(&netif);
+        }
+    }
+    tx_flush();
+    t = sim_now - t;
+
+    for(idx = 0; idx < TX_BURST; idx++) {
+        CHECK(burst[idx]->ref == 1);
+        pbuf_free(burst[idx]);
+    }
+
+    CHECK(retries > 0);
+    CHECK(tx.frames == 4 + TX_BURST);
+    CHECK(tx.out_of_order == 0);
+    CHECK(tx.corrupt == 0);
+    CHECK(stats->tx_frames == tx.frames);
+    CHECK(stats->tx_underflows == 0);
+    CHECK(stats->desc_changed == 0);
+    CHECK(stats->bus_errors == 0);
+    CHECK(pool_free() == pool);
+    printf(TEST_NAME ": %u frames of %u bytes back to back in %u us, %u us on the wire\n", TX_BURST, FRAME_SIZE,
+            (uint32_t)(t / US), (uint32_t)(TX_BURST * sim_eth_frame_time(FRAME_SIZE) / US));
+
+    printf(TEST_NAME ": %s\n", failed ? "FAILED" : "OK");
+
+    return failed ? 1 : 0;
+}
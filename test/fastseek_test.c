@@ -0,0 +1,163 @@
+/*
+
+  fastseek_test.c - host test for the FatFs fast seek (cluster link map) helpers
+
+  Builds a deliberately fragmented job file by interleaving its clusters with those of
+  filler files that are then deleted, checks that f_open() builds the CLMT for files opened
+  for reading only, that it is sized from the fragment count, that f_close() releases it and
+  that reads after random seeks return the right data with and without the CLMT.
+  Sectors read from the card image for the seeks are reported for both.
+
+  Usage: fastseek_test [seeks]
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "driver.h"
+#include "ff_fastseek.h"
+#include "card_image.h"
+
+#define FILE_CLUSTERS 512
+#define FILLERS 2
+
+static FATFS fs;
+static int failed = 0;
+
+#define CHECK(cond) if(!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; }
+
+static inline BYTE pattern (FSIZE_t pos)
+{
+    return (BYTE)(pos * 7 + (pos >> 9));
+}
+
+// Writes the job file one cluster at a time, each followed by a cluster for every filler file.
+static FSIZE_t make_fragmented (const char *path)
+{
+    static FIL job, filler[FILLERS];
+
+    UINT idx, bw, csize = fs.csize * FF_MIN_SS;
+    FSIZE_t pos = 0;
+    BYTE *buf = malloc(csize);
+    char name[16];
+    int f;
+
+    CHECK(f_open(&job, path, FA_WRITE|FA_CREATE_ALWAYS) == FR_OK);
+    for(f = 0; f < FILLERS; f++) {
+        sprintf(name, "0:/fill%d", f);
+        CHECK(f_open(&filler[f], name, FA_WRITE|FA_CREATE_ALWAYS) == FR_OK);
+    }
+
+    for(idx = 0; idx < FILE_CLUSTERS; idx++) {
+        UINT i;
+        for(i = 0; i < csize; i++)
+            buf[i] = pattern(pos + i);
+        CHECK(f_write(&job, buf, csize, &bw) == FR_OK && bw == csize);
+        CHECK(f_sync(&job) == FR_OK);
+        pos += csize;
+        for(f = 0; f < FILLERS; f++) {
+            CHECK(f_write(&filler[f], buf, csize, &bw) == FR_OK && bw == csize);
+            CHECK(f_sync(&filler[f]) == FR_OK);
+        }
+    }
+
+    f_close(&job);
+    for(f = 0; f < FILLERS; f++) {
+        f_close(&filler[f]);
+        sprintf(name, "0:/fill%d", f);
+        CHECK(f_unlink(name) == FR_OK);
+    }
+
+    free(buf);
+
+    return pos;
+}
+
+// Seeks to pseudo random positions and reads a few bytes, returns sectors read from the card image.
+static uint32_t seek_read (FIL *fp, FSIZE_t size, uint32_t seeks)
+{
+    uint32_t idx, reads = card_stats.reads, seed = 12345;
+    FSIZE_t pos;
+    BYTE data[4];
+    UINT br;
+
+    for(idx = 0; idx < seeks; idx++) {
+        seed = seed * 1103515245 + 12345;
+        pos = (FSIZE_t)(seed >> 8) % (size - sizeof(data));
+        CHECK(f_lseek(fp, pos) == FR_OK && f_tell(fp) == pos);
+        CHECK(f_read(fp, data, sizeof(data), &br) == FR_OK && br == sizeof(data));
+        CHECK(data[0] == pattern(pos) && data[3] == pattern(pos + 3));
+    }
+
+    return card_stats.reads - reads;
+}
+
+static void test_contiguous (void)
+{
+    static BYTE buf[4096];
+
+    FIL file;
+    UINT bw;
+
+    CHECK(f_open(&file, "0:/small.nc", FA_WRITE|FA_CREATE_ALWAYS) == FR_OK);
+    CHECK(file.cltbl == NULL); // not for files opened for writing
+    CHECK(f_write(&file, buf, sizeof(buf), &bw) == FR_OK);
+    f_close(&file);
+
+    CHECK(f_open(&file, "0:/small.nc", FA_READ|FA_WRITE) == FR_OK);
+    CHECK(file.cltbl == NULL);
+    f_close(&file);
+
+    CHECK(f_open(&file, "0:/small.nc", FA_READ) == FR_OK);
+    CHECK(file.cltbl && file.cltbl[0] == 4); // size, one fragment and terminator
+    CHECK(f_close(&file) == FR_OK);
+    CHECK(file.cltbl == NULL);
+
+    // Rebuilding keeps the file position.
+
+    CHECK(f_open(&file, "0:/small.nc", FA_READ) == FR_OK);
+    CHECK(f_lseek(&file, 100) == FR_OK);
+    CHECK(f_fastseek_enable(&file) == FR_OK);
+    CHECK(file.cltbl && file.cltbl[0] == 4 && f_tell(&file) == 100);
+    f_fastseek_disable(&file);
+    CHECK(file.cltbl == NULL);
+    f_close(&file);
+}
+
+static void test_fragmented (uint32_t seeks)
+{
+    FIL file;
+    FSIZE_t size = make_fragmented("0:/job.nc");
+    uint32_t reads[2];
+
+    CHECK(f_open(&file, "0:/job.nc", FA_READ) == FR_OK && f_size(&file) == size);
+    CHECK(file.cltbl && file.cltbl[0] == FILE_CLUSTERS * 2 + 2);
+    reads[1] = seek_read(&file, size, seeks);
+
+    f_fastseek_disable(&file);
+    reads[0] = seek_read(&file, size, seeks);
+
+    CHECK(f_close(&file) == FR_OK);
+    CHECK(file.cltbl == NULL);
+
+    CHECK(reads[1] < reads[0]);
+
+    printf("%u fragments, %u seeks: %u sectors read without CLMT, %u with CLMT (%u bytes)\n",
+            FILE_CLUSTERS, seeks, reads[0], reads[1], (FILE_CLUSTERS * 2 + 2) * (unsigned)sizeof(DWORD));
+}
+
+int main (int argc, char **argv)
+{
+    CHECK(card_init(32768, &fs) == FR_OK);
+
+    test_contiguous();
+    test_fragmented(argc > 1 ? (uint32_t)atoi(argv[1]) : 1000);
+
+    printf("fastseek_test: %s\n", failed ? "FAILED" : "OK");
+
+    card_free();
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,227 @@
+/*
+
+  jobcache_test.c - host test and benchmark for the compacted job file cache
+
+  Checks the compacted output for comments, blank lines and whitespace, that the cache is
+  reused until the job file changes and that $RD stages the compacted copy to the RAM disk.
+  Then a generated CAM style program is read and parsed from the job file and from the cache,
+  sectors read from the card image and the time taken is reported for both.
+
+  Usage: jobcache_test [lines]
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "driver.h"
+#include "ramdisk.h"
+#include "ff_jobcache.h"
+#include "grbl/hal.h"
+#include "card_image.h"
+
+grbl_t grbl = {0};
+hal_t hal = {0};
+
+static int failed = 0;
+
+#define CHECK(cond) if(!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; }
+
+static const char job[] =
+    "%\r\n"
+    "(header comment)\r\n"
+    "G21 g90 ; metric\r\n"
+    "\r\n"
+    "N10 G0 x1.5 Y-2 (move)\r\n"
+    "(MSG, Hello world)\r\n"
+    "(This is a long comment from the CAM post processor that is well over the eighty characters of the old limit)\r\n"
+    "G1 X1 (another comment that is not kept, longer than the classification buffer) Y2\r\n"
+    "(PRINT, a long message that has to be kept in full although it is longer than eighty characters)\r\n"
+    "(unterminated\r\n"
+    "(debug\r\n"
+    "G1 X2 F100\r\n"
+    "%";
+
+static const char expected[] =
+    "%\n"
+    "G21G90\n"
+    "N10G0X1.5Y-2\n"
+    "(MSG, Hello world)\n"
+    "G1X1Y2\n"
+    "(PRINT, a long message that has to be kept in full although it is longer than eighty characters)\n"
+    "(debug\n"
+    "G1X2F100\n"
+    "%\n";
+
+static FRESULT write_file (const char *path, const char *data, UINT size, BYTE mode)
+{
+    FIL file;
+    UINT bw;
+    FRESULT res;
+
+    if((res = f_open(&file, path, FA_WRITE|mode)) == FR_OK) {
+        res = f_write(&file, data, size, &bw);
+        f_close(&file);
+    }
+
+    return res;
+}
+
+static UINT read_all (FIL *fp, char *buf, UINT size)
+{
+    UINT br = 0;
+
+    f_read(fp, buf, size - 1, &br);
+    buf[br] = '\0';
+
+    return br;
+}
+
+static void test_compact (void)
+{
+    static char buf[4096];
+
+    FIL file;
+    jobcache_info_t info;
+    char cmd[] = "$RD=0:/job.nc";
+
+    CHECK(write_file("0:/job.nc", job, sizeof(job) - 1, FA_CREATE_ALWAYS) == FR_OK);
+
+    CHECK(f_jobcache_open(&file, "0:/job.nc", &info) == FR_OK);
+    CHECK(info.built && info.src_size == sizeof(job) - 1 && info.size == sizeof(expected) - 1);
+    read_all(&file, buf, sizeof(buf));
+    CHECK(!strcmp(buf, expected));
+    f_close(&file);
+
+    if(strcmp(buf, expected))
+        printf("---\n%s---\n", buf);
+
+    // Reused
+    CHECK(f_jobcache_open(&file, "0:/job.nc", &info) == FR_OK);
+    CHECK(!info.built && info.size == sizeof(expected) - 1);
+    f_close(&file);
+
+    // Rebuilt when the job file changes
+    CHECK(write_file("0:/job.nc", "\r\nM30\r\n", 7, FA_OPEN_APPEND) == FR_OK);
+    CHECK(f_jobcache_open(&file, "0:/job.nc", &info) == FR_OK);
+    CHECK(info.built && info.size == sizeof(expected) - 1 + 4);
+    f_close(&file);
+
+    // Staged to the RAM disk in compacted form
+    CHECK(grbl.on_unknown_sys_command(0, cmd) == Status_OK);
+    CHECK(f_open(&file, "1:/job.nc", FA_READ) == FR_OK);
+    read_all(&file, buf, sizeof(buf));
+    CHECK(!strncmp(buf, expected, sizeof(expected) - 1) && !strcmp(buf + sizeof(expected) - 1, "M30\n"));
+    f_close(&file);
+}
+
+// Line assembly as done by the protocol layer followed by a word parse, returns number of words.
+static uint32_t parse (FIL *fp, uint32_t *bytes)
+{
+    static char buf[512], line[256];
+
+    UINT br, idx, len = 0;
+    uint32_t words = 0;
+    bool comment = false, eol_comment = false;
+    char c, *s;
+
+    do {
+        f_read(fp, buf, sizeof(buf), &br);
+        *bytes += br;
+        for(idx = 0; idx < br; idx++) {
+            c = buf[idx];
+            if(c == '\n' || c == '\r') {
+                line[len] = '\0';
+                for(s = line; *s;) {
+                    if(isalpha((unsigned char)*s)) {
+                        strtof(s + 1, &s);
+                        words++;
+                    } else
+                        s++;
+                }
+                len = 0;
+                comment = eol_comment = false;
+            } else if(eol_comment)
+                continue;
+            else if(comment)
+                comment = c != ')';
+            else if(c == '(')
+                comment = true;
+            else if(c == ';')
+                eol_comment = true;
+            else if(c > ' ' && len < sizeof(line) - 1)
+                line[len++] = toupper(c);
+        }
+    } while(br == sizeof(buf));
+
+    return words;
+}
+
+static void benchmark (uint32_t lines)
+{
+    static const char *const comments[] = { "", " (contour 1)", "", "", " ; lead in", "" };
+
+    FIL file;
+    char *program, *p;
+    uint32_t idx, length, bytes[2] = {0}, reads[2], words[2];
+    clock_t t[2];
+    jobcache_info_t info;
+
+    if((program = malloc(lines * 64)) == NULL)
+        return;
+
+    p = program;
+    p += sprintf(p, "(Generated by a CAM post processor, tool T1 6 mm flat end mill)\n");
+    for(idx = 0; idx < lines; idx++)
+        p += sprintf(p, "N%u G1 X%.4f Y%.4f Z%.4f F1500%s\n", idx, idx * 0.013f, idx * 0.021f, -(idx % 100) * 0.01f, comments[idx % 6]);
+    length = p - program;
+
+    CHECK(write_file("0:/big.nc", program, length, FA_CREATE_ALWAYS) == FR_OK);
+
+    // Build the cache before measuring, it is a one time cost
+    CHECK(f_jobcache_open(&file, "0:/big.nc", &info) == FR_OK && info.built);
+    f_close(&file);
+
+    reads[0] = card_stats.reads;
+    t[0] = clock();
+    CHECK(f_open(&file, "0:/big.nc", FA_READ) == FR_OK);
+    words[0] = parse(&file, &bytes[0]);
+    f_close(&file);
+    t[0] = clock() - t[0];
+    reads[0] = card_stats.reads - reads[0];
+
+    reads[1] = card_stats.reads;
+    t[1] = clock();
+    CHECK(f_jobcache_open(&file, "0:/big.nc", &info) == FR_OK && !info.built);
+    words[1] = parse(&file, &bytes[1]);
+    f_close(&file);
+    t[1] = clock() - t[1];
+    reads[1] = card_stats.reads - reads[1];
+
+    CHECK(words[0] == words[1]);
+
+    printf("%u lines: job file %u bytes, %u sectors, %.1f ms; cache %u bytes, %u sectors, %.1f ms\n", lines,
+            bytes[0], reads[0], t[0] * 1000.0 / CLOCKS_PER_SEC, bytes[1], reads[1], t[1] * 1000.0 / CLOCKS_PER_SEC);
+
+    free(program);
+}
+
+int main (int argc, char **argv)
+{
+    static FATFS fs;
+
+    CHECK(card_init(65536, &fs) == FR_OK);
+    CHECK(ramdisk_init());
+
+    test_compact();
+    benchmark(argc > 1 ? (uint32_t)atoi(argv[1]) : 100000);
+
+    printf("jobcache_test: %s\n", failed ? "FAILED" : "OK");
+
+    card_free();
+
+    return failed ? 1 : 0;
+}
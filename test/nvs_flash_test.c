@@ -0,0 +1,402 @@
+/*
+  nvs_flash_test.c - settings storage in flash by flash.c on the simulated MCU
+
+  The flash controller model in sim/sim_flash.c times program and erase operations and can
+  cut the power at any of them. Each boot runs in a forked process so that flash.c starts
+  from scratch, the flash contents are shared with the parent.
+
+    - only the changed pages are programmed, a run of adjacent changed pages as one record, an
+      unchanged image is not programmed at all.
+    - small changes are appended as records, the two sectors are erased in turn and only when
+      the active one is full, no word is programmed twice between erases.
+    - a write needing a compaction while the machine is moving does not erase and does not stall
+      code fetch for more than a word program, the compaction is done by the foreground poll
+      when the machine has stopped.
+    - a power loss at any operation of a write leaves each changed page with either the old or
+      the new contents, a power loss at any operation of a compaction leaves the old image.
+      Later writes and reboots work normally.
+
+  Also reports the number of words programmed and erases for the writes done.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "sim.h"
+#include "grbl/hal.h"
+#include "grbl/state_machine.h"
+
+#define CHECK(cond) if(!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; }
+
+#define TEST_NAME "nvs_flash_test"
+#define NVS_SIZE 1024
+#define PAGE 32                             // change tracking granularity of flash.c
+#define NVS_BASE 0x08008000UL               // sectors 1 and 2
+#define NVS_AREA 0x10000UL
+#define SECTOR_RECORDS ((0x8000 - 16 - (NVS_SIZE + 8)) / (PAGE + 8))
+#define WRITES 1700                         // fills the sectors twice
+
+bool memcpy_from_flash (uint8_t *dest);
+bool memcpy_to_flash (uint8_t *source);
+
+static int failed = 0;
+static uint8_t image_a[NVS_SIZE], image_b[NVS_SIZE], image_c[NVS_SIZE], snapshot[NVS_AREA];
+static uint32_t realtime_calls;
+
+static uint8_t *nvs_area (void)
+{
+    return (uint8_t *)sim_alias((const volatile void *)NVS_BASE);
+}
+
+static void realtime (sys_state_t state)
+{
+    realtime_calls++;
+}
+
+// Applies the changes of the small write tests, one byte each at varying pages.
+static void change (uint8_t *image, uint32_t idx)
+{
+    image[(idx * 97) % NVS_SIZE]++;
+}
+
+static void fill (uint8_t *image, uint32_t seed)
+{
+    uint32_t idx;
+
+    for(idx = 0; idx < NVS_SIZE; idx++) {
+        seed = seed * 1103515245 + 12345;
+        image[idx] = seed >> 16;
+    }
+}
+
+// Resets the MCU, the flash contents survive.
+static void power_on (void)
+{
+    static uint8_t area[NVS_AREA];
+
+    memcpy(area, nvs_area(), NVS_AREA);
+    sim_init();
+    memcpy(nvs_area(), area, NVS_AREA);
+
+    hal.nvs.size = NVS_SIZE;
+    sys.state = STATE_IDLE;
+    grbl.on_execute_realtime = realtime;
+}
+
+// Runs fn in a new process after a reset, returns the exit code of fn.
+static int boot (int (*fn)(void))
+{
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+
+    if((pid = fork()) == 0) {
+        power_on();
+        status = fn();
+        fflush(stdout);
+        _exit(status);
+    }
+
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) ? WEXITSTATUS(status) : 255;
+}
+
+static int read_b (void)
+{
+    static uint8_t buf[NVS_SIZE];
+
+    return memcpy_from_flash(buf) && !memcmp(buf, image_b, NVS_SIZE) ? 0 : 1;
+}
+
+static int read_c (void)
+{
+    static uint8_t buf[NVS_SIZE];
+
+    return memcpy_from_flash(buf) && !memcmp(buf, image_c, NVS_SIZE) ? 0 : 1;
+}
+
+static int small_writes (void)
+{
+    static uint8_t buf[NVS_SIZE];
+
+    const sim_flash_stats_t *stats = sim_flash_stats();
+    uint32_t idx, sector, erases, expected = 1 + WRITES / SECTOR_RECORDS;
+
+    CHECK(memcpy_from_flash(buf));
+    memcpy(buf, image_a, NVS_SIZE);
+    CHECK(memcpy_to_flash(buf));
+
+    for(idx = 0; idx < WRITES; idx++) {
+        change(buf, idx);
+        CHECK(memcpy_to_flash(buf));
+    }
+
+    erases = stats->erases[1] + stats->erases[2];
+    CHECK(erases >= expected && erases <= expected + 1);
+    CHECK(stats->erases[1] - stats->erases[2] <= 1);
+    for(sector = 0; sector < 8; sector++)
+        CHECK(sector == 1 || sector == 2 || stats->erases[sector] == 0);
+    CHECK(stats->overwrites == 0);
+    CHECK(stats->errors == 0);
+
+    printf(TEST_NAME ": %u writes, %u erases, %u words programmed\n", WRITES + 1, erases, stats->programs);
+
+    return failed ? 1 : 0;
+}
+
+// Changes in single, adjacent and separate pages, returns the words programmed for each.
+
+static void change_pages (uint8_t *image, uint32_t step)
+{
+    switch(step) {
+        case 1:
+            image[5]++;
+            break;
+        case 2:
+            image[3 * PAGE + 31]++;
+            image[4 * PAGE]++;
+            break;
+        case 3:
+            image[10 * PAGE + 7]++;
+            image[12 * PAGE + 7]++;
+            break;
+        case 4:
+            image[NVS_SIZE - 1]++;
+            break;
+    }
+}
+
+static int page_writes (void)
+{
+    static uint8_t buf[NVS_SIZE];
+    static const uint32_t words[] = {
+        0,                      // unchanged
+        PAGE / 4 + 2,           // one page: header, data and CRC
+        2 * PAGE / 4 + 2,       // two adjacent pages in one record
+        2 * (PAGE / 4 + 2),     // two records
+        PAGE / 4 + 2            // last page
+    };
+
+    const sim_flash_stats_t *stats = sim_flash_stats();
+    uint32_t step, programs;
+
+    CHECK(memcpy_from_flash(buf));
+    CHECK(!memcmp(buf, image_a, NVS_SIZE));
+
+    for(step = 0; step < sizeof(words) / sizeof(uint32_t); step++) {
+        change_pages(buf, step);
+        programs = stats->programs;
+        CHECK(memcpy_to_flash(buf));
+        CHECK(stats->programs - programs == words[step]);
+    }
+
+    CHECK(stats->erases[1] + stats->erases[2] == 0);
+    CHECK(stats->overwrites == 0);
+
+    printf(TEST_NAME ": 6 bytes in 6 pages changed, %u words programmed\n", stats->programs);
+
+    return failed ? 1 : 0;
+}
+
+// Writes while moving until a compaction is needed, then stops.
+
+static int deferred_writes (void)
+{
+    static uint8_t buf[NVS_SIZE];
+
+    const sim_flash_stats_t *stats = sim_flash_stats();
+    uint32_t idx, programs = 0;
+
+    CHECK(memcpy_from_flash(buf));
+    CHECK(!memcmp(buf, image_a, NVS_SIZE));
+
+    sys.state = STATE_CYCLE;
+
+    for(idx = 0; idx < SECTOR_RECORDS + 10; idx++) {
+        change(buf, idx);
+        CHECK(memcpy_to_flash(buf));
+        if(idx == SECTOR_RECORDS)
+            programs = stats->programs;
+    }
+
+    CHECK(stats->erases[1] + stats->erases[2] == 0);
+    CHECK(stats->programs == programs);         // nothing appended once deferred
+    CHECK(stats->max_busy <= 16 * SIM_CYCLES_PER_US);
+    CHECK(grbl.on_execute_realtime != realtime);
+
+    grbl.on_execute_realtime(STATE_HOLD);
+    CHECK(stats->erases[1] + stats->erases[2] == 0);
+
+    printf(TEST_NAME ": compaction deferred, longest operation while moving %u us\n", (uint32_t)(stats->max_busy / SIM_CYCLES_PER_US));
+
+    grbl.on_execute_realtime(STATE_IDLE);
+    CHECK(stats->erases[1] + stats->erases[2] == 1);
+    CHECK(realtime_calls == 2);
+    CHECK(stats->errors == 0);
+
+    grbl.on_execute_realtime(STATE_IDLE);
+    CHECK(stats->erases[1] + stats->erases[2] == 1);
+
+    return failed ? 1 : 0;
+}
+
+// Power loss test steps, the power fails after the given number of operations.
+
+static uint32_t power_fail_ops;
+static bool fail_compaction;
+
+static int setup_a (void)
+{
+    static uint8_t buf[NVS_SIZE];
+
+    uint32_t idx;
+
+    CHECK(memcpy_from_flash(buf));
+    memcpy(buf, image_a, NVS_SIZE);
+    CHECK(memcpy_to_flash(buf));
+
+    // Fill the active sector so that the full image no longer fits, ends with image A.
+    if(fail_compaction) for(idx = 0; idx < SECTOR_RECORDS - 10; idx += 2) {
+        buf[1000] ^= 0x55;
+        CHECK(memcpy_to_flash(buf));
+        buf[1000] ^= 0x55;
+        CHECK(memcpy_to_flash(buf));
+    }
+
+    CHECK(!memcmp(buf, image_a, NVS_SIZE));
+    CHECK(sim_flash_stats()->erases[1] + sim_flash_stats()->erases[2] == 1);
+
+    return failed ? 1 : 0;
+}
+
+static int write_b (void)
+{
+    static uint8_t buf[NVS_SIZE];
+
+    CHECK(memcpy_from_flash(buf));
+    sim_flash_power_fail(power_fail_ops);
+    CHECK(memcpy_to_flash(image_b));
+
+    return failed ? 2 : sim_flash_powered() ? 0 : 1;
+}
+
+// Checks the image after the power loss, returns 0 if it is image A, 1 if image B, 3 if pages of both.
+static int check_b (void)
+{
+    static uint8_t buf[NVS_SIZE];
+
+    uint32_t page;
+    bool a, b;
+
+    CHECK(memcpy_from_flash(buf));
+
+    a = !memcmp(buf, image_a, NVS_SIZE);
+    b = !memcmp(buf, image_b, NVS_SIZE);
+    CHECK(a || b || !fail_compaction);
+
+    for(page = 0; page < NVS_SIZE; page += PAGE)
+        CHECK(!memcmp(buf + page, image_a + page, PAGE) || !memcmp(buf + page, image_b + page, PAGE));
+
+    CHECK(memcpy_to_flash(image_c));
+
+    return failed ? 2 : a ? 0 : b ? 1 : 3;
+}
+
+// Cuts the power at each of the ops operations of writing image B, in a compaction only at the first
+// and last few and every 16th since the data words in between are programmed alike.
+static void power_loss (bool compaction, uint32_t ops)
+{
+    uint32_t mixed = 0, tested = 0;
+    int written, result;
+
+    fail_compaction = compaction;
+
+    memset(nvs_area(), 0xFF, NVS_AREA);
+    CHECK(boot(setup_a) == 0);
+    memcpy(snapshot, nvs_area(), NVS_AREA);
+
+    for(power_fail_ops = 0; power_fail_ops <= ops && !failed; power_fail_ops++) {
+
+        if(compaction && power_fail_ops >= 4 && power_fail_ops + 8 < ops && power_fail_ops % 16)
+            continue;
+
+        memcpy(nvs_area(), snapshot, NVS_AREA);
+
+        written = boot(write_b);
+        CHECK(written == (power_fail_ops < ops ? 1 : 0));
+        if(written > 1)
+            break;
+
+        result = boot(check_b);
+        CHECK(result == 0 || result == 1 || (result == 3 && !compaction));
+        CHECK(written == 1 || result == 1);             // all new when the power did not fail
+        CHECK(!compaction || written == 0 || result == 0);
+        if(result == 3)
+            mixed++;
+
+        CHECK(boot(read_c) == 0);
+
+        tested++;
+    }
+
+    printf(TEST_NAME ": %s, power lost at %u of %u operations, %u with old and new pages\n",
+            compaction ? "compaction" : "append", tested - 1, ops, mixed);
+}
+
+int main (void)
+{
+    uint32_t idx;
+
+    fill(image_a, 1);
+    fill(image_c, 3);
+
+    // Erase count for small writes.
+
+    memcpy(image_b, image_a, NVS_SIZE);
+    for(idx = 0; idx < WRITES; idx++)
+        change(image_b, idx);
+
+    memset(nvs_area(), 0xFF, NVS_AREA);
+    failed += boot(small_writes);
+    failed += boot(read_b);
+
+    // Words programmed per changed page.
+
+    memcpy(image_b, image_a, NVS_SIZE);
+    for(idx = 0; idx < 5; idx++)
+        change_pages(image_b, idx);
+
+    memset(nvs_area(), 0xFF, NVS_AREA);
+    failed += boot(setup_a);
+    failed += boot(page_writes);
+    failed += boot(read_b);
+
+    // Compaction deferred while moving.
+
+    memcpy(image_b, image_a, NVS_SIZE);
+    for(idx = 0; idx < SECTOR_RECORDS + 10; idx++)
+        change(image_b, idx);
+
+    memset(nvs_area(), 0xFF, NVS_AREA);
+    failed += boot(setup_a);
+    failed += boot(deferred_writes);
+    failed += boot(read_b);
+
+    // Power loss while appending a few pages and while compacting.
+
+    memcpy(image_b, image_a, NVS_SIZE);
+    image_b[5]++;
+    image_b[PAGE * 10 + 3]++;
+    image_b[PAGE * 20]++;
+    image_b[PAGE * 21]++;
+    power_loss(false, 10 + 10 + 18);                // three records, pages 20 and 21 in one
+
+    fill(image_b, 2);
+    power_loss(true, 1 + (NVS_SIZE / 4 + 2) + 3);   // erase, image record and sector header
+
+    printf(TEST_NAME ": %s\n", failed ? "FAILED" : "OK");
+
+    return failed ? 1 : 0;
+}
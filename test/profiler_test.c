@@ -0,0 +1,160 @@
+/*
+
+  profiler_test.c - host test for the interrupt handler cycle profiler
+
+  DWT->CYCCNT is a plain variable here and serves as the fake cycle counter, a handler
+  wrapped with PROFILER_ISR_ENTER/PROFILER_ISR_EXIT advances it by a known number of cycles.
+  Checks the histogram buckets, min/max/mean, counter wraparound, latency scaling and the
+  $ISR, $ISRR and realtime report output.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "profiler.h"
+#include "grbl/hal.h"
+
+DWT_Type dwt;
+CoreDebug_Type core_debug;
+uint32_t SystemCoreClock = 216000000;
+
+grbl_t grbl = {0};
+hal_t hal = {0};
+
+static char output[2048];
+static bool chained_report = false;
+static int failed = 0;
+
+#define CHECK(cond) if(!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; }
+
+char *uitoa (uint32_t n)
+{
+    static char buf[11];
+
+    sprintf(buf, "%u", n);
+
+    return buf;
+}
+
+static void write_output (const char *s)
+{
+    strcat(output, s);
+}
+
+static void realtime_report (stream_write_ptr stream_write, report_tracking_flags_t report)
+{
+    chained_report = true;
+}
+
+static status_code_t sys_command (char *cmd)
+{
+    char line[16];
+
+    strcpy(line, cmd);
+    *output = '\0';
+
+    return grbl.on_unknown_sys_command(0, line);
+}
+
+static const char *report (void)
+{
+    *output = '\0';
+    chained_report = false;
+    grbl.on_realtime_report(write_output, 0);
+
+    return output;
+}
+
+static void fake_isr (profiler_isr_t isr, uint32_t cycles)
+{
+    PROFILER_ISR_ENTER(isr);
+    dwt.CYCCNT += cycles;
+    PROFILER_ISR_EXIT(isr);
+}
+
+static void test_stats (void)
+{
+    profiler_stats_t stats = { .min = UINT32_MAX };
+
+    profiler_stats_add(&stats, 0);
+    profiler_stats_add(&stats, 1);
+    profiler_stats_add(&stats, 3);
+    profiler_stats_add(&stats, 4);
+    profiler_stats_add(&stats, 100000);
+
+    CHECK(stats.count == 5 && stats.min == 0 && stats.max == 100000 && stats.sum == 100008);
+    CHECK(stats.histogram[0] == 1 && stats.histogram[1] == 1 && stats.histogram[2] == 1 && stats.histogram[3] == 1);
+    CHECK(stats.histogram[PROFILER_BUCKETS - 1] == 1); // 2^16 < 100000, clamped to the last bucket
+}
+
+static void test_isr (void)
+{
+    const profiler_stats_t *stats = profiler_get_stats(ProfileISR_Stepper, false);
+
+    fake_isr(ProfileISR_Stepper, 200);
+    fake_isr(ProfileISR_Stepper, 600);
+    dwt.CYCCNT = UINT32_MAX - 50;
+    fake_isr(ProfileISR_Stepper, 100); // counter wraps during the handler
+
+    CHECK(stats->count == 3 && stats->min == 100 && stats->max == 600 && stats->sum == 900);
+    CHECK(stats->histogram[7] == 1 && stats->histogram[8] == 1 && stats->histogram[10] == 1);
+
+    // Latency is recorded in step timer ticks, 216 MHz / 108 MHz = 2 cycles per tick
+    PROFILER_ISR_LATENCY(ProfileISR_Pulse, 20);
+    stats = profiler_get_stats(ProfileISR_Pulse, true);
+    CHECK(stats->count == 1 && stats->max == 40);
+
+    CHECK(profiler_get_stats(ProfileISR_N, false) == NULL);
+}
+
+static void test_reports (void)
+{
+    char line[16];
+
+    // Nothing recorded and no report requested: no element added, chained handler called
+    CHECK(!strcmp(report(), "") && chained_report);
+
+    fake_isr(ProfileISR_Stepper, 500);
+    fake_isr(ProfileISR_EXTI4, 30);
+    fake_isr(ProfileISR_EXTI15_10, 70);
+    CHECK(!strcmp(report(), "|ISR:500,0,0,0,70") && chained_report);
+
+    CHECK(sys_command("$ISR") == Status_OK);
+    CHECK(!strcmp(output, "[ISR:STEPPER,1,500,500,500|0,0,0,0,0,0,0,0,0,1,0,0,0,0,0,0]\r\n"
+                          "[ISR:EXTI4,1,30,30,30|0,0,0,0,0,1,0,0,0,0,0,0,0,0,0,0]\r\n"
+                          "[ISR:EXTI15_10,1,70,70,70|0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,0]\r\n"));
+
+    // Reset clears the data and the request, the element is dropped again
+    CHECK(sys_command("$ISRR") == Status_OK);
+    CHECK(profiler_get_stats(ProfileISR_Stepper, false)->count == 0);
+    CHECK(!strcmp(report(), ""));
+
+    // Requested with no data recorded yet: reported with zero maximums
+    CHECK(sys_command("$ISR") == Status_OK && !strcmp(output, ""));
+    CHECK(!strcmp(report(), "|ISR:0,0,0,0,0"));
+    sys_command("$ISRR");
+
+    strcpy(line, "$XYZ");
+    CHECK(grbl.on_unknown_sys_command(0, line) == Status_Unhandled);
+}
+
+int main (int argc, char **argv)
+{
+    hal.stream.write = write_output;
+    hal.f_step_timer = 108000000;
+    grbl.on_realtime_report = realtime_report;
+
+    profiler_init();
+
+    CHECK(dwt.CTRL & DWT_CTRL_CYCCNTENA_Msk);
+
+    test_stats();
+    test_isr();
+    profiler_reset();
+    test_reports();
+
+    printf("profiler_test: %s\n", failed ? "FAILED" : "OK");
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,176 @@
+/*
+
+  ramdisk_test.c - host test for the RAM disk FatFs volume
+
+  Volume 0: is an in-memory SD card image, volume 1: the RAM disk from ramdisk.c.
+  Files are copied between the volumes with $RD and f_read/f_write and compared, a drive
+  prefix without a directory is stripped from the staged name, $I reports the mounted RAM disk.
+  Host throughput is reported for both volumes along with the number of sectors read
+  from the card image and the SPI transfer time for those, which staging saves on later runs.
+
+  Usage: ramdisk_test [file size in KBytes]
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "driver.h"
+#include "ramdisk.h"
+#include "grbl/hal.h"
+#include "card_image.h"
+
+#define CARD_SECTORS 16384 // 8 MByte
+
+grbl_t grbl = {0};
+hal_t hal = {0};
+
+static char output[256];
+
+static void write_output (const char *s)
+{
+    strncat(output, s, sizeof(output) - strlen(output) - 1);
+}
+
+static void report_options (bool newopt)
+{
+}
+
+static int failed = 0;
+
+#define CHECK(cond) if(!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; }
+
+static FRESULT write_file (const char *path, const BYTE *data, UINT size)
+{
+    FIL file;
+    UINT bw;
+    FRESULT res;
+
+    if((res = f_open(&file, path, FA_WRITE|FA_CREATE_ALWAYS)) == FR_OK) {
+        res = f_write(&file, data, size, &bw);
+        f_close(&file);
+        if(res == FR_OK && bw != size)
+            res = FR_DENIED;
+    }
+
+    return res;
+}
+
+static FRESULT copy_file (const char *src_path, const char *dst_path)
+{
+    static FIL src, dst;
+    static BYTE buf[1024];
+
+    UINT br, bw;
+    FRESULT res;
+
+    if((res = f_open(&src, src_path, FA_READ)) != FR_OK)
+        return res;
+
+    if((res = f_open(&dst, dst_path, FA_WRITE|FA_CREATE_ALWAYS)) == FR_OK) {
+        do {
+            if((res = f_read(&src, buf, sizeof(buf), &br)) == FR_OK)
+                res = f_write(&dst, buf, br, &bw);
+        } while(res == FR_OK && br == sizeof(buf));
+        f_close(&dst);
+    }
+
+    f_close(&src);
+
+    return res;
+}
+
+// Reads a file 10 times, returns MBytes/s and checks the content on the first pass.
+static double read_file (const char *path, const BYTE *expected, UINT size)
+{
+    static BYTE buf[4096];
+
+    FIL file;
+    UINT br, pos;
+    int pass;
+    clock_t t = clock();
+
+    for(pass = 0; pass < 10; pass++) {
+        CHECK(f_open(&file, path, FA_READ) == FR_OK);
+        pos = 0;
+        do {
+            CHECK(f_read(&file, buf, sizeof(buf), &br) == FR_OK);
+            if(pass == 0)
+                CHECK(pos + br <= size && !memcmp(buf, expected + pos, br));
+            pos += br;
+        } while(br == sizeof(buf));
+        CHECK(pos == size);
+        f_close(&file);
+    }
+
+    t = clock() - t;
+
+    return t ? 10.0 * size / 1048576.0 / ((double)t / CLOCKS_PER_SEC) : 0.0;
+}
+
+int main (int argc, char **argv)
+{
+    static FATFS fs;
+
+    UINT idx, size = (argc > 1 ? atoi(argv[1]) : 32) * 1024;
+    BYTE *data = malloc(size);
+    char cmd[] = "$RD=0:/job.nc";
+    uint32_t reads;
+    double card_rate, ram_rate;
+
+    for(idx = 0; idx < size; idx++)
+        data[idx] = "G1X10Y20F100\n"[idx % 13];
+
+    hal.stream.write = write_output;
+    grbl.on_report_options = report_options;
+
+    CHECK(card_init(CARD_SECTORS, &fs) == FR_OK);
+    CHECK(ramdisk_init());
+    CHECK(ramdisk_init()); // already mounted, not formatted again
+
+    grbl.on_report_options(false);
+    CHECK(!strcmp(output, "[PLUGIN:RAM disk v0.01]" ASCII_EOL));
+    CHECK(write_file("0:/job.nc", data, size) == FR_OK);
+
+    // Stage with the $RD command, then copy back with a different name
+    CHECK(grbl.on_unknown_sys_command(0, cmd) == Status_OK);
+    CHECK(ramdisk_stage("1:/job.nc") == FR_INVALID_NAME);
+    CHECK(ramdisk_stage("0:/missing.nc") == FR_NO_FILE);
+
+    // The drive prefix of a path without a directory is not part of the name
+    CHECK(write_file("0:/short.nc", data, 100) == FR_OK);
+    CHECK(ramdisk_stage("0:short.nc") == FR_OK);
+    CHECK(f_stat("1:/short.nc", NULL) == FR_OK);
+    CHECK(f_stat("1:/0:short.nc", NULL) != FR_OK);
+    CHECK(copy_file("1:/job.nc", "0:/copy.nc") == FR_OK);
+    read_file("0:/copy.nc", data, size);
+
+    reads = card_stats.reads;
+    card_rate = read_file("0:/job.nc", data, size);
+    reads = card_stats.reads - reads;
+    ram_rate = read_file("1:/job.nc", data, size);
+
+    // A file larger than the RAM disk must fail and not leave a partial copy
+    {
+        UINT big = SDCARD_RAMDISK * 1024;
+        BYTE *bigdata = calloc(big, 1);
+        FILINFO info;
+        CHECK(write_file("0:/big.nc", bigdata, big) == FR_OK);
+        CHECK(ramdisk_stage("0:/big.nc") != FR_OK);
+        CHECK(f_stat("1:/big.nc", &info) == FR_NO_FILE);
+        free(bigdata);
+    }
+
+    // SPI transfer time at 21 MHz, ignoring command overhead and card latency
+    printf("%u bytes: card image %.1f MB/s host, %u sectors per pass = %.1f ms at 21 MHz SPI; RAM disk %.1f MB/s host, no SPI traffic\n",
+            size, card_rate, reads / 10, reads / 10 * 512 * 8 / 21000.0, ram_rate);
+
+    printf("ramdisk_test: %s\n", failed ? "FAILED" : "OK");
+
+    free(data);
+    card_free();
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,271 @@
+/*
+  sdcard_crc_test.c - CRC checked SD card transfers in SPI mode by diskio.c with SDCARD_CRC
+
+  Built with SPI_DMA_ENABLE. The data block CRC16 is computed by the CRC unit, modelled in
+  sim/sim_crc.c, and checked by the card model in sim/sim_sdcard.c, which checks the CRC7 of
+  every command once CMD59 has enabled CRC checking. Bit errors are injected by the card model.
+
+    - the CRC unit computes the CRC-16/XMODEM and CRC-32/MPEG-2 check values with byte, half
+      word and word writes.
+    - CRC checking is enabled with CMD59, every command carries a valid CRC7 and single and
+      multiple block writes and reads carry valid CRC16s.
+    - a read block with a bit error is read again, a written block with a bit error is rejected
+      by the card and sent again, also within multiple block transfers. The data is unchanged.
+    - a transfer failing with more bit errors than CRC_RETRIES fails, the next one succeeds.
+    - with a card that does not accept CMD59 transfers are not CRC checked.
+
+  Also reports the read and write rates with CRC checking, and the instructions, register
+  accesses and time the CRC16 of a block adds to a block read, against the block transfer time.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sim.h"
+#include "driver.h"
+#include "ff.h"
+#include "diskio.h"
+
+#define CHECK(cond) if(!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; }
+
+#define TEST_NAME "sdcard_crc_test"
+#define SECTORS 8192
+#define RETRIES 3           // CRC_RETRIES in diskio.c
+
+static int failed = 0;
+static uint32_t ticks;
+static uint8_t data[32 * 512], buf[32 * 512];
+
+typedef struct {
+    uint32_t instructions;
+    uint32_t accesses;
+    uint64_t cycles;
+} cost_t;
+
+void SysTick_Handler (void)
+{
+    if(++ticks % 10 == 0)
+        disk_timerproc();
+}
+
+static void fill (uint8_t *buf, uint32_t sectors, uint32_t seed)
+{
+    uint32_t idx;
+
+    for(idx = 0; idx < sectors * 512; idx++) {
+        seed = seed * 1103515245 + 12345;
+        buf[idx] = seed >> 16;
+    }
+}
+
+static void check_protocol (void)
+{
+    const sim_sd_stats_t *stats = sim_sd_stats();
+
+    CHECK(stats->protocol_errors == 0);
+    CHECK(stats->cmd_crc_errors == 0);
+    CHECK(sim_spi_lost(SPI3) == 0);
+}
+
+static void check_crc_unit (void)
+{
+    static const uint8_t check[] = "123456789";
+
+    uint32_t idx;
+
+    // CRC-16/XMODEM as set up by diskio.c: polynomial 0x1021, initial value 0.
+
+    CRC->POL = 0x1021;
+    CRC->INIT = 0;
+    CRC->CR = CRC_CR_POLYSIZE_0 | CRC_CR_RESET;
+    for(idx = 0; idx < 9; idx++)
+        *(__IO uint8_t *)&CRC->DR = check[idx];
+    CHECK((uint16_t)CRC->DR == 0x31C3);
+
+    CRC->CR |= CRC_CR_RESET;
+    CRC->DR = __REV(__UNALIGNED_UINT32_READ(check));
+    *(__IO uint16_t *)&CRC->DR = __REV16(__UNALIGNED_UINT16_READ(&check[4]));
+    *(__IO uint16_t *)&CRC->DR = __REV16(__UNALIGNED_UINT16_READ(&check[6]));
+    *(__IO uint8_t *)&CRC->DR = check[8];
+    CHECK((uint16_t)CRC->DR == 0x31C3);
+
+    // CRC-32/MPEG-2: the reset polynomial and initial value.
+
+    CRC->POL = 0x04C11DB7;
+    CRC->INIT = 0xFFFFFFFF;
+    CRC->CR = CRC_CR_RESET;
+    CRC->DR = __REV(__UNALIGNED_UINT32_READ(check));
+    CRC->DR = __REV(__UNALIGNED_UINT32_READ(&check[4]));
+    *(__IO uint8_t *)&CRC->DR = check[8];
+    CHECK(CRC->DR == 0x0376E6E7);
+}
+
+static void read_block (void *arg)
+{
+    CHECK(disk_read(0, buf, 100, 1) == RES_OK);
+}
+
+// Instructions, register accesses and time of a single block read, after one that waited
+// for the card to end any write.
+static cost_t read_cost (void)
+{
+    cost_t cost;
+    uint32_t accesses;
+    uint64_t t;
+
+    read_block(NULL);
+
+    accesses = sim_reads + sim_writes;
+    t = sim_now;
+
+    cost.instructions = sim_count_instructions(read_block, NULL);
+    cost.accesses = sim_reads + sim_writes - accesses;
+    cost.cycles = sim_now - t;
+
+    return cost;
+}
+
+// Runs on a low stack, diskio.c reads the CSD into a buffer on the stack.
+static void test (void)
+{
+    const sim_sd_stats_t *stats = sim_sd_stats();
+    cost_t with, without;
+    uint64_t t, block_time;
+
+    GPIO_InitTypeDef cs = {
+        .Pin = SD_CS_BIT,
+        .Mode = GPIO_MODE_OUTPUT_PP,
+        .Pull = GPIO_NOPULL,
+        .Speed = GPIO_SPEED_FREQ_VERY_HIGH
+    };
+
+    HAL_GPIO_Init(SD_CS_PORT, &cs);
+    DIGITAL_OUT(SD_CS_PORT, SD_CS_BIT, 1);
+    SysTick_Config(SIM_HCLK / 1000);
+
+    __HAL_RCC_CRC_CLK_ENABLE();
+    check_crc_unit();
+
+    sim_sd_insert(SPI3, SD_CS_PORT, SD_CS_BIT, SIM_SD_HC, SECTORS);
+
+    CHECK(disk_initialize(0) == 0);
+    CHECK(stats->cmds[59] == 1);
+    check_protocol();
+
+    // Multiple block write and read, CRC checked.
+
+    sim_sd_stats_reset();
+    sim_crc_stats_reset();
+    fill(data, 32, 1);
+    t = sim_now;
+    CHECK(disk_write(0, data, 100, 32) == RES_OK);
+    t = sim_now - t;
+    CHECK(!memcmp(sim_sd_data() + 100 * 512, data, 32 * 512));
+    CHECK(stats->data_crc_errors == 0);
+    CHECK(sim_crc_stats()->bytes == 32 * 512 && sim_crc_stats()->resets == 32);
+    check_protocol();
+    printf(TEST_NAME ": write %u KB/s\n", (uint32_t)(32 * 512 * (uint64_t)SIM_HCLK / 1024 / t));
+
+    sim_sd_stats_reset();
+    sim_crc_stats_reset();
+    memset(buf, 0, sizeof(buf));
+    t = sim_now;
+    CHECK(disk_read(0, buf, 100, 32) == RES_OK);
+    t = sim_now - t;
+    CHECK(!memcmp(buf, data, 32 * 512));
+    CHECK(stats->cmds[18] == 1);
+    CHECK(sim_crc_stats()->bytes == 32 * 512);
+    check_protocol();
+    printf(TEST_NAME ": read %u KB/s\n", (uint32_t)(32 * 512 * (uint64_t)SIM_HCLK / 1024 / t));
+
+    // A read block with a bit error is read again.
+
+    sim_sd_stats_reset();
+    sim_sd_corrupt_reads(1);
+    memset(buf, 0, 512);
+    CHECK(disk_read(0, buf, 105, 1) == RES_OK);
+    CHECK(!memcmp(buf, data + 5 * 512, 512));
+    CHECK(stats->cmds[17] == 2);
+    check_protocol();
+
+    sim_sd_stats_reset();
+    sim_sd_corrupt_reads(1);
+    memset(buf, 0, sizeof(buf));
+    CHECK(disk_read(0, buf, 100, 8) == RES_OK);
+    CHECK(!memcmp(buf, data, 8 * 512));
+    CHECK(stats->cmds[18] == 2 && stats->stops == 2);
+    check_protocol();
+
+    // More bit errors than retries fail the read, the next read succeeds.
+
+    sim_sd_stats_reset();
+    sim_sd_corrupt_reads(RETRIES + 1);
+    CHECK(disk_read(0, buf, 105, 1) == RES_ERROR);
+    CHECK(stats->cmds[17] == RETRIES + 1);
+    memset(buf, 0, 512);
+    CHECK(disk_read(0, buf, 105, 1) == RES_OK);
+    CHECK(!memcmp(buf, data + 5 * 512, 512));
+    check_protocol();
+
+    // A written block with a bit error is rejected by the card and sent again.
+
+    sim_sd_stats_reset();
+    fill(data, 8, 2);
+    sim_sd_corrupt_writes(1);
+    CHECK(disk_write(0, data, 200, 1) == RES_OK);
+    CHECK(!memcmp(sim_sd_data() + 200 * 512, data, 512));
+    CHECK(stats->data_crc_errors == 1 && stats->cmds[24] == 2 && stats->blocks_written == 1);
+    check_protocol();
+
+    // In a multiple block write the sectors from the rejected one on are sent again.
+
+    sim_sd_stats_reset();
+    sim_sd_corrupt_writes(1);
+    CHECK(disk_write(0, data, 300, 8) == RES_OK);
+    CHECK(!memcmp(sim_sd_data() + 300 * 512, data, 8 * 512));
+    CHECK(stats->data_crc_errors == 1 && stats->cmds[25] == 2 && stats->blocks_written == 8);
+    CHECK(stats->stop_tokens == 2);
+    check_protocol();
+
+    // More bit errors than retries fail the write, the next write succeeds.
+
+    sim_sd_stats_reset();
+    sim_sd_corrupt_writes(RETRIES + 1);
+    CHECK(disk_write(0, data + 512, 201, 1) == RES_ERROR);
+    CHECK(stats->data_crc_errors == RETRIES + 1 && stats->blocks_written == 0);
+    CHECK(disk_write(0, data + 512, 201, 1) == RES_OK);
+    CHECK(!memcmp(sim_sd_data() + 201 * 512, data + 512, 512));
+    check_protocol();
+
+    // The cost of the CRC16 of a block, against a card without CRC checking.
+
+    block_time = 512 * sim_spi_frame_time(SPI3);
+    with = read_cost();
+
+    sim_sd_insert(SPI3, SD_CS_PORT, SD_CS_BIT, SIM_SD_HC, SECTORS);
+    sim_sd_crc_support(false);
+    CHECK(disk_initialize(0) == 0);
+    sim_crc_stats_reset();
+    without = read_cost();
+    CHECK(sim_crc_stats()->bytes == 0);
+
+    sim_sd_stats_reset();
+    sim_sd_corrupt_reads(1);
+    CHECK(disk_read(0, buf, 100, 1) == RES_OK); // not detected
+    CHECK(stats->cmds[17] == 1);
+
+    CHECK(with.cycles > without.cycles && with.cycles - without.cycles < block_time / 10);
+
+    printf(TEST_NAME ": CRC16 of a block: %u instructions, %u register accesses, %u cycles, block transfer %u cycles\n",
+            with.instructions - without.instructions, with.accesses - without.accesses,
+             (uint32_t)(with.cycles - without.cycles), (uint32_t)block_time);
+}
+
+int main (void)
+{
+    sim_call_on_low_stack(test);
+
+    printf(TEST_NAME ": %s\n", failed ? "FAILED" : "OK");
+
+    return failed ? 1 : 0;
+}
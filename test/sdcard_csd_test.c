@@ -0,0 +1,151 @@
+/*
+  sdcard_csd_test.c - SD card identification and CSD decoding by diskio.c on the simulated MCU
+
+  The card model in sim/sim_sdcard.c answers the identification sequence of each card type
+  and builds its CSD from the card size: CSD version 1.0 layout (C_SIZE, C_SIZE_MULT and
+  READ_BL_LEN) for MMC, SD v1 and standard capacity SD v2 cards, version 2.0 for SDHC.
+
+    - each card type is identified and addressed correctly: a block written to the last sector
+      is stored there by the model and read back unchanged.
+    - GET_SECTOR_COUNT returns the card size for every CSD layout, including an SDXC size that
+      needs all 22 bits of the version 2.0 C_SIZE field.
+    - the SPI clock is the highest APB1 clock division not exceeding TRAN_SPEED, capped at 25 MHz,
+      a reserved TRAN_SPEED unit keeps the legacy clock setting without verifying it.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sim.h"
+#include "driver.h"
+#include "ff.h"
+#include "diskio.h"
+
+#define CHECK(cond) if(!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; }
+
+#define TEST_NAME "sdcard_csd_test"
+
+// SPI frame time in CPU cycles: 8 bits at APB1 54 MHz / prescaler.
+#define FRAME_13M5 (8 * 16)
+#define FRAME_6M75 (8 * 32)
+
+typedef struct {
+    const char *name;
+    sim_sd_type_t type;
+    uint32_t sectors;
+    uint32_t frame_time;    // for the default TRAN_SPEED of the model
+} card_t;
+
+static const card_t cards[] = {
+    { "MMC",   SIM_SD_MMC, 8192,  FRAME_13M5 },    // 20 MHz
+    { "SD v1", SIM_SD_V1,  65536, FRAME_13M5 },    // 25 MHz
+    { "SD v2", SIM_SD_V2,  65536, FRAME_13M5 },
+    { "SDHC",  SIM_SD_HC,  65536, FRAME_13M5 }
+};
+
+static int failed = 0;
+static uint32_t ticks;
+
+void SysTick_Handler (void)
+{
+    if(++ticks % 10 == 0)
+        disk_timerproc();
+}
+
+static void check_card (const card_t *card)
+{
+    static uint8_t data[512], buf[512];
+
+    const sim_sd_stats_t *stats = sim_sd_stats();
+    uint32_t idx, count = 0;
+
+    sim_sd_insert(SPI3, SD_CS_PORT, SD_CS_BIT, card->type, card->sectors);
+
+    CHECK(disk_initialize(0) == 0);
+    CHECK(disk_ioctl(0, GET_SECTOR_COUNT, &count) == RES_OK);
+    CHECK(count == card->sectors);
+    CHECK(sim_spi_frame_time(SPI3) == card->frame_time);
+    CHECK(card->type != SIM_SD_MMC || stats->cmds[1] > 0);
+    CHECK(card->type == SIM_SD_MMC || stats->cmds[41] > 0);
+
+    // Byte addressing for all but SDHC, the model fails reads and writes with a misaligned address.
+
+    for(idx = 0; idx < sizeof(data); idx++)
+        data[idx] = idx * 13 + card->type;
+
+    CHECK(disk_write(0, data, card->sectors - 1, 1) == RES_OK);
+    CHECK(!memcmp(sim_sd_data() + (card->sectors - 1) * 512, data, sizeof(data)));
+    CHECK(disk_read(0, buf, card->sectors - 1, 1) == RES_OK);
+    CHECK(!memcmp(buf, data, sizeof(buf)));
+
+    CHECK(stats->protocol_errors == 0);
+    CHECK(stats->cmd_crc_errors == 0);
+
+    printf(TEST_NAME ": %s, %u sectors, SPI frame %u cycles\n", card->name, count, (uint32_t)sim_spi_frame_time(SPI3));
+}
+
+// Changes the TRAN_SPEED of the card, returns the SPI frame time after initialization.
+static uint32_t tran_speed (uint8_t tran_speed)
+{
+    sim_sd_insert(SPI3, SD_CS_PORT, SD_CS_BIT, SIM_SD_HC, 8192);
+    sim_sd_csd()[3] = tran_speed;
+    sim_sd_update_csd();
+
+    return disk_initialize(0) == 0 ? (uint32_t)sim_spi_frame_time(SPI3) : 0;
+}
+
+// Runs on a low stack, diskio.c reads the CSD into a buffer on the stack.
+static void test (void)
+{
+    const sim_sd_stats_t *stats = sim_sd_stats();
+    uint32_t idx, count = 0;
+    uint8_t *csd;
+
+    GPIO_InitTypeDef cs = {
+        .Pin = SD_CS_BIT,
+        .Mode = GPIO_MODE_OUTPUT_PP,
+        .Pull = GPIO_NOPULL,
+        .Speed = GPIO_SPEED_FREQ_VERY_HIGH
+    };
+
+    HAL_GPIO_Init(SD_CS_PORT, &cs);
+    DIGITAL_OUT(SD_CS_PORT, SD_CS_BIT, 1);
+    SysTick_Config(SIM_HCLK / 1000);
+
+    for(idx = 0; idx < sizeof(cards) / sizeof(card_t); idx++)
+        check_card(&cards[idx]);
+
+    // SDXC, 64 GB: C_SIZE 0x1FFFF has bits set in the upper 6 bits of the field.
+
+    sim_sd_insert(SPI3, SD_CS_PORT, SD_CS_BIT, SIM_SD_HC, 8192);
+    csd = sim_sd_csd();
+    csd[7] = 0x01;
+    csd[8] = 0xFF;
+    csd[9] = 0xFF;
+    sim_sd_update_csd();
+    CHECK(disk_initialize(0) == 0);
+    CHECK(disk_ioctl(0, GET_SECTOR_COUNT, &count) == RES_OK);
+    CHECK(count == 0x20000UL * 1024);
+
+    // TRAN_SPEED: unit bits 2:0, multiplier bits 6:3.
+
+    CHECK(tran_speed(0x32) == FRAME_13M5);  // 25 MHz -> 13.5 MHz
+    CHECK(tran_speed(0x5A) == FRAME_13M5);  // 50 MHz, high speed card -> capped at 25 MHz
+    CHECK(tran_speed(0x0A) == FRAME_6M75);  // 10 MHz -> 6.75 MHz
+    CHECK(tran_speed(0x2A) == FRAME_13M5);  // 20 MHz -> 13.5 MHz
+    CHECK(tran_speed(0x12) == FRAME_6M75);  // 12 MHz -> 6.75 MHz
+    CHECK(tran_speed(0x0B) == FRAME_13M5);  // 100 MHz -> capped at 25 MHz
+    CHECK(stats->cmds[9] == 2);             // read and verified at the new clock
+
+    CHECK(tran_speed(0x36) == FRAME_13M5);  // reserved unit: legacy prescaler 4
+    CHECK(stats->cmds[9] == 1);             // not verified
+}
+
+int main (void)
+{
+    sim_call_on_low_stack(test);
+
+    printf(TEST_NAME ": %s\n", failed ? "FAILED" : "OK");
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,197 @@
+/*
+  sdcard_readahead_test.c - SD card read-ahead cache of diskio.c on the simulated MCU
+
+  A job file on a FAT formatted card model (sim/sim_sdcard.c) is read in short chunks as when
+  streaming G-code, with simulated time passing between the reads as the planner consumes them.
+
+    - with the foreground poll hook called between reads the cache is refilled in the background,
+      nearly all sector reads by FatFs are hits and the time f_read() blocks drops to the misses.
+    - without the poll hook every RA sectors miss, each miss fills the ring with one CMD18.
+    - the file data is unchanged in both cases.
+    - a sector written while cached is read back with the new data.
+
+  Also reports the hit and miss counters and the time blocked in f_read() for both cases.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sim.h"
+#include "driver.h"
+#include "ff.h"
+#include "diskio.h"
+
+#define CHECK(cond) if(!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; }
+
+#define TEST_NAME "sdcard_readahead_test"
+#define SECTORS 8192
+#define FILE_SIZE (64 * 1024)
+#define CHUNK 128                           // bytes read per f_read() call
+#define CHUNK_CYCLES (100 * SIM_CYCLES_PER_US) // foreground time between reads
+#define RA SDCARD_READAHEAD
+
+typedef struct {
+    uint32_t reads;
+    uint32_t mismatches;
+    uint64_t blocked;       // time spent in f_read()
+    uint64_t polled;        // time spent in the poll hook
+    disk_readahead_stats_t ra;
+} result_t;
+
+static int failed = 0;
+static uint32_t ticks;
+
+void SysTick_Handler (void)
+{
+    if(++ticks % 10 == 0)
+        disk_timerproc();
+}
+
+// Not under test.
+
+static void foreground (sys_state_t state)
+{
+}
+
+static char content (uint32_t pos)
+{
+    return pos % 32 == 31 ? '\n' : "G1X0123456789.Y-F"[(pos * 7 + pos / 32) % 17];
+}
+
+static result_t stream_file (bool poll)
+{
+    static char buf[CHUNK];
+
+    FIL file;
+    UINT idx, br = 0;
+    uint32_t pos = 0;
+    uint64_t t;
+    result_t r = {0};
+
+    memset(disk_readahead_stats(), 0, sizeof(disk_readahead_stats_t));
+
+    CHECK(f_open(&file, "job.nc", FA_READ) == FR_OK);
+
+    do {
+        t = sim_now;
+        CHECK(f_read(&file, buf, CHUNK, &br) == FR_OK);
+        r.blocked += sim_now - t;
+        r.reads++;
+
+        for(idx = 0; idx < br; idx++) {
+            if(buf[idx] != content(pos++))
+                r.mismatches++;
+        }
+
+        if(poll) {
+            t = sim_now;
+            grbl.on_execute_realtime(STATE_CYCLE);
+            r.polled += sim_now - t;
+        }
+
+        sim_run(CHUNK_CYCLES);
+    } while(br == CHUNK);
+
+    f_close(&file);
+
+    CHECK(pos == FILE_SIZE);
+
+    r.ra = *disk_readahead_stats();
+
+    return r;
+}
+
+static void report (const char *name, result_t *r)
+{
+    printf(TEST_NAME ": %s: %u hits, %u misses, %u prefetched, blocked %u us (%u us per read), poll %u us\n",
+            name, (uint32_t)r->ra.hits, (uint32_t)r->ra.misses, (uint32_t)r->ra.prefetched,
+             (uint32_t)(r->blocked / SIM_CYCLES_PER_US), (uint32_t)(r->blocked / SIM_CYCLES_PER_US / r->reads),
+              (uint32_t)(r->polled / SIM_CYCLES_PER_US));
+}
+
+// Runs on a low stack, FatFs and diskio.c have buffers on the stack.
+static void test (void)
+{
+    static BYTE work[FF_MAX_SS];
+    static char buf[4096];
+    static BYTE sector[512], update[512];
+    static FATFS fs;
+
+    const sim_sd_stats_t *stats = sim_sd_stats();
+    FIL file;
+    UINT idx, bw;
+    uint32_t pos = 0;
+    result_t bg, fg;
+
+    GPIO_InitTypeDef cs = {
+        .Pin = SD_CS_BIT,
+        .Mode = GPIO_MODE_OUTPUT_PP,
+        .Pull = GPIO_NOPULL,
+        .Speed = GPIO_SPEED_FREQ_VERY_HIGH
+    };
+
+    HAL_GPIO_Init(SD_CS_PORT, &cs);
+    DIGITAL_OUT(SD_CS_PORT, SD_CS_BIT, 1);
+    SysTick_Config(SIM_HCLK / 1000);
+
+    grbl.on_execute_realtime = foreground;
+    disk_readahead_init();
+
+    sim_sd_insert(SPI3, SD_CS_PORT, SD_CS_BIT, SIM_SD_HC, SECTORS);
+
+    CHECK(f_mkfs("0:", FM_FAT|FM_SFD, 0, work, sizeof(work)) == FR_OK);
+    CHECK(f_mount(&fs, "0:", 1) == FR_OK);
+
+    CHECK(f_open(&file, "job.nc", FA_WRITE|FA_CREATE_ALWAYS) == FR_OK);
+    while(pos < FILE_SIZE) {
+        for(idx = 0; idx < sizeof(buf); idx++)
+            buf[idx] = content(pos++);
+        CHECK(f_write(&file, buf, sizeof(buf), &bw) == FR_OK && bw == sizeof(buf));
+    }
+    CHECK(f_close(&file) == FR_OK);
+
+    // Refilled from the foreground loop: only the first file sector and the FAT and directory reads miss.
+
+    sim_sd_stats_reset();
+    bg = stream_file(true);
+    report("poll", &bg);
+
+    CHECK(bg.mismatches == 0);
+    CHECK(bg.ra.hits >= FILE_SIZE / 512 - 8);
+    CHECK(bg.ra.misses <= 8);
+    CHECK(stats->multiple_reads > 0 && stats->stops == stats->multiple_reads);
+    CHECK(stats->protocol_errors == 0);
+
+    // Without the poll hook each miss fills the ring.
+
+    sim_sd_stats_reset();
+    fg = stream_file(false);
+    report("no poll", &fg);
+
+    CHECK(fg.mismatches == 0);
+    CHECK(fg.ra.misses >= FILE_SIZE / 512 / RA);
+    CHECK(fg.ra.hits >= FILE_SIZE / 512 - FILE_SIZE / 512 / RA - 8);
+    CHECK(stats->protocol_errors == 0);
+
+    // The time f_read() blocks is reduced to the misses.
+
+    CHECK(bg.blocked * 4 < fg.blocked);
+
+    // A write invalidates the cache.
+
+    CHECK(disk_read(0, sector, 1000, 1) == RES_OK);
+    CHECK(disk_read(0, sector, 1001, 1) == RES_OK);     // sequential: 1002 - 1008 are cached
+    memset(update, 0xA5, sizeof(update));
+    CHECK(disk_write(0, update, 1002, 1) == RES_OK);
+    CHECK(disk_read(0, sector, 1002, 1) == RES_OK);
+    CHECK(!memcmp(sector, update, sizeof(update)));
+}
+
+int main (void)
+{
+    sim_call_on_low_stack(test);
+
+    printf(TEST_NAME ": %s\n", failed ? "FAILED" : "OK");
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,193 @@
+/*
+  sdcard_sim_test.c - SD card access in SPI mode by diskio.c and spi.c on the simulated MCU
+
+  Built twice, with byte transfers and with SPI_DMA_ENABLE. The card model in sim/sim_sdcard.c
+  checks the protocol: command CRCs where required, data tokens, that the CRC bytes of each
+  data block are transferred, the CMD12 stop sequence of multiple block reads and the stop token
+  of multiple block writes, and that no command is sent while the card is busy.
+
+    - the card is identified as SDHC and the SPI clock is set from the CSD TRAN_SPEED.
+    - single and multiple block writes and reads transfer the data unchanged.
+    - the card busy time after writes is waited for.
+    - with SPI_DMA_ENABLE the CPU sleeps in __WFI() until the receive DMA stream interrupt,
+      and a transfer that does not complete times out instead of hanging, later transfers succeed.
+
+  Also reports the multiple block read and write rates.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sim.h"
+#include "driver.h"
+#include "ff.h"
+#include "diskio.h"
+
+#define CHECK(cond) if(!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; }
+
+#if SPI_DMA_ENABLE
+#define TEST_NAME "sdcard_sim_dma_test"
+#else
+#define TEST_NAME "sdcard_sim_test"
+#endif
+
+#define MS (SIM_HCLK / 1000UL)
+#define SECTORS 8192
+
+static int failed = 0;
+static uint32_t ticks;
+
+void SysTick_Handler (void)
+{
+    if(++ticks % 10 == 0)
+        disk_timerproc();
+}
+
+static void fill (uint8_t *buf, uint32_t sectors, uint32_t seed)
+{
+    uint32_t idx;
+
+    for(idx = 0; idx < sectors * 512; idx++) {
+        seed = seed * 1103515245 + 12345;
+        buf[idx] = seed >> 16;
+    }
+}
+
+static void check_protocol (void)
+{
+    const sim_sd_stats_t *stats = sim_sd_stats();
+
+    CHECK(stats->protocol_errors == 0);
+    CHECK(stats->cmd_crc_errors == 0);
+    CHECK(stats->data_crc_errors == 0);
+    CHECK(sim_spi_lost(SPI3) == 0);
+}
+
+// Runs on a low stack, diskio.c reads the CSD into a buffer on the stack.
+static void test (void)
+{
+    static uint8_t data[32 * 512], buf[32 * 512];
+
+    const sim_sd_stats_t *stats = sim_sd_stats();
+    uint64_t t;
+
+    GPIO_InitTypeDef cs = {
+        .Pin = SD_CS_BIT,
+        .Mode = GPIO_MODE_OUTPUT_PP,
+        .Pull = GPIO_NOPULL,
+        .Speed = GPIO_SPEED_FREQ_VERY_HIGH
+    };
+
+    HAL_GPIO_Init(SD_CS_PORT, &cs);
+    DIGITAL_OUT(SD_CS_PORT, SD_CS_BIT, 1);
+    SysTick_Config(SIM_HCLK / 1000);
+
+    sim_sd_insert(SPI3, SD_CS_PORT, SD_CS_BIT, SIM_SD_HC, SECTORS);
+
+    // Identification: CMD0, CMD8, ACMD41 until ready, CMD58, then the CSD for the clock setting.
+
+    CHECK(disk_initialize(0) == 0);
+    CHECK(stats->cmds[0] == 1);
+    CHECK(stats->cmds[8] == 1);
+    CHECK(stats->cmds[41] >= 3 && stats->cmds[55] == stats->cmds[41]);
+    CHECK(stats->cmds[58] == 1);
+    CHECK(stats->cmds[9] == 2);
+    check_protocol();
+
+    // TRAN_SPEED 25 MHz: the highest APB1 clock division not exceeding it is 54 / 4 = 13.5 MHz.
+    CHECK(sim_spi_frame_time(SPI3) == 8 * 16);
+
+    // Single block write and read.
+
+    sim_sd_stats_reset();
+    fill(data, 1, 1);
+    CHECK(disk_write(0, data, 10, 1) == RES_OK);
+    CHECK(!memcmp(sim_sd_data() + 10 * 512, data, 512));
+    CHECK(stats->cmds[24] == 1 && stats->blocks_written == 1);
+    CHECK(stats->busy_periods == 1);
+
+    memset(buf, 0, 512);
+    CHECK(disk_read(0, buf, 10, 1) == RES_OK);
+    CHECK(!memcmp(buf, data, 512));
+    CHECK(stats->cmds[17] == 1 && stats->blocks_read == 1);
+    CHECK(stats->busy_frames > 0);  // the read waited for the end of the write
+    check_protocol();
+
+    // Multiple block write: ACMD23, CMD25, data tokens 0xFC and the stop token 0xFD.
+
+    sim_sd_stats_reset();
+    fill(data, 32, 2);
+    t = sim_now;
+    CHECK(disk_write(0, data, 100, 32) == RES_OK);
+    t = sim_now - t;
+    CHECK(!memcmp(sim_sd_data() + 100 * 512, data, 32 * 512));
+    CHECK(stats->cmds[55] == 1 && stats->cmds[23] == 1);
+    CHECK(stats->cmds[25] == 1 && stats->multiple_writes == 1);
+    CHECK(stats->blocks_written == 32 && stats->stop_tokens == 1);
+    check_protocol();
+    printf(TEST_NAME ": write %u KB/s\n", (uint32_t)(32 * 512 * (uint64_t)SIM_HCLK / 1024 / t));
+
+    // Multiple block read: CMD18, the data blocks and CMD12, the card may have started the next block.
+
+    sim_sd_stats_reset();
+    memset(buf, 0, sizeof(buf));
+    t = sim_now;
+    CHECK(disk_read(0, buf, 100, 32) == RES_OK);
+    t = sim_now - t;
+    CHECK(!memcmp(buf, data, 32 * 512));
+    CHECK(stats->cmds[18] == 1 && stats->multiple_reads == 1);
+    CHECK(stats->stops == 1);
+    CHECK(stats->blocks_read >= 32 && stats->blocks_read <= 33);
+    check_protocol();
+    printf(TEST_NAME ": read %u KB/s\n", (uint32_t)(32 * 512 * (uint64_t)SIM_HCLK / 1024 / t));
+
+    // The card accepts commands after the stop.
+
+    sim_sd_stats_reset();
+    CHECK(disk_read(0, buf, 110, 1) == RES_OK);
+    CHECK(!memcmp(buf, data + 10 * 512, 512));
+    check_protocol();
+
+    // Reads beyond the end of the card fail.
+
+    CHECK(disk_read(0, buf, SECTORS, 1) == RES_ERROR);
+
+#if SPI_DMA_ENABLE
+
+    // Blocks are transferred while the CPU sleeps, woken by the receive stream interrupt.
+
+    sim_irq_stats_reset();
+    CHECK(disk_read(0, buf, 100, 4) == RES_OK);
+    CHECK(sim_irq_stats(DMA1_Stream2_IRQn)->count == 4);
+
+    // A block transfer that does not complete times out, the next transfers succeed.
+
+    sim_sd_stats_reset();
+    sim_spi_mask_rx_dma(SPI3, true);
+    t = sim_now;
+    CHECK(disk_read(0, buf, 100, 1) == RES_ERROR);
+    t = sim_now - t;
+    sim_spi_mask_rx_dma(SPI3, false);
+    CHECK(t >= 99 * MS && t < 110 * MS);
+    CHECK(stats->protocol_errors == 1); // deselected before the CRC was read
+
+    sim_sd_stats_reset();
+
+    memset(buf, 0, 512);
+    CHECK(disk_read(0, buf, 101, 1) == RES_OK);
+    CHECK(!memcmp(buf, data + 512, 512));
+    CHECK(disk_write(0, data, 200, 2) == RES_OK);
+    CHECK(!memcmp(sim_sd_data() + 200 * 512, data, 2 * 512));
+    CHECK(stats->protocol_errors == 0);
+
+#endif
+}
+
+int main (void)
+{
+    sim_call_on_low_stack(test);
+
+    printf(TEST_NAME ": %s\n", failed ? "FAILED" : "OK");
+
+    return failed ? 1 : 0;
+}
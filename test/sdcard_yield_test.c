@@ -0,0 +1,205 @@
+/*
+  sdcard_yield_test.c - SD card busy waits of diskio.c with SDCARD_YIELD on the simulated MCU
+
+  The card model in sim/sim_sdcard.c is made busy before and during transfers. Its TRAN_SPEED
+  is set to 100 kHz, the lowest SPI clock of 211 kHz keeps the number of polls simulated low.
+
+    - while the card is busy the disk_on_yield handlers run, chained, with the card deselected.
+    - the grbl.on_execute_realtime chain is not run from inside the disk functions.
+    - disk calls from a handler are rejected with RES_NOTRDY and do not disturb the transfer.
+    - the data is transferred unchanged after the busy periods, without protocol errors.
+    - a card busy for longer than the 500 ms ready timeout fails the call, handlers keep running
+      until the timeout, and the card is usable when no longer busy.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sim.h"
+#include "driver.h"
+#include "ff.h"
+#include "diskio.h"
+
+#define CHECK(cond) if(!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; }
+
+#define TEST_NAME "sdcard_yield_test"
+#define MS (SIM_HCLK / 1000UL)
+#define SECTORS 8192
+
+typedef struct {
+    uint32_t calls;
+    uint32_t chained;
+    uint32_t selected;      // calls with the card selected
+    uint32_t nested_ok;     // disk calls from the handler that were not rejected
+    uint32_t realtime;      // grbl.on_execute_realtime calls
+    uint64_t first, last;
+} yields_t;
+
+static int failed = 0;
+static uint32_t ticks;
+static yields_t yields;
+static disk_on_yield_ptr on_disk_yield;
+
+void SysTick_Handler (void)
+{
+    if(++ticks % 10 == 0)
+        disk_timerproc();
+}
+
+static void realtime (sys_state_t state)
+{
+    yields.realtime++;
+}
+
+static void chained (void)
+{
+    yields.chained++;
+}
+
+static void handler (void)
+{
+    static BYTE buf[512];
+
+    DWORD count;
+
+    if(yields.calls++ == 0)
+        yields.first = sim_now;
+    yields.last = sim_now;
+
+    if(!(SD_CS_PORT->ODR & SD_CS_BIT))
+        yields.selected++;
+
+    if(disk_read(0, buf, 0, 1) != RES_NOTRDY)
+        yields.nested_ok++;
+    if(disk_write(0, buf, 0, 1) != RES_NOTRDY)
+        yields.nested_ok++;
+    if(disk_ioctl(0, GET_SECTOR_COUNT, &count) != RES_NOTRDY)
+        yields.nested_ok++;
+
+    if(on_disk_yield)
+        on_disk_yield();
+
+    sim_dispatch(); // the simulator does not take interrupts asynchronously, SysTick runs the diskio timers
+}
+
+static void fill (uint8_t *buf, uint32_t sectors, uint32_t seed)
+{
+    uint32_t idx;
+
+    for(idx = 0; idx < sectors * 512; idx++) {
+        seed = seed * 1103515245 + 12345;
+        buf[idx] = seed >> 16;
+    }
+}
+
+static void check_yields (void)
+{
+    const sim_sd_stats_t *stats = sim_sd_stats();
+
+    CHECK(yields.calls > 0);
+    CHECK(yields.chained == yields.calls);
+    CHECK(yields.selected == 0);
+    CHECK(yields.nested_ok == 0);
+    CHECK(yields.realtime == 0);
+    CHECK(stats->protocol_errors == 0);
+    CHECK(stats->cmd_crc_errors == 0);
+}
+
+// Runs on a low stack, diskio.c reads the CSD into a buffer on the stack.
+static void test (void)
+{
+    static uint8_t data[8 * 512], buf[8 * 512];
+
+    uint64_t t;
+
+    GPIO_InitTypeDef cs = {
+        .Pin = SD_CS_BIT,
+        .Mode = GPIO_MODE_OUTPUT_PP,
+        .Pull = GPIO_NOPULL,
+        .Speed = GPIO_SPEED_FREQ_VERY_HIGH
+    };
+
+    HAL_GPIO_Init(SD_CS_PORT, &cs);
+    DIGITAL_OUT(SD_CS_PORT, SD_CS_BIT, 1);
+    SysTick_Config(SIM_HCLK / 1000);
+
+    grbl.on_execute_realtime = realtime;
+
+    sim_sd_insert(SPI3, SD_CS_PORT, SD_CS_BIT, SIM_SD_HC, SECTORS);
+    sim_sd_csd()[3] = 0x08;
+    sim_sd_update_csd();
+
+    // Without handlers the busy wait just polls.
+
+    CHECK(disk_initialize(0) == 0);
+    sim_sd_busy_now(20 * MS);
+    CHECK(disk_read(0, buf, 10, 1) == RES_OK);
+
+    disk_on_yield = chained;
+    on_disk_yield = disk_on_yield;
+    disk_on_yield = handler;
+
+    // A read waits for the end of a 200 ms busy period.
+
+    memset(&yields, 0, sizeof(yields));
+    fill(data, 1, 1);
+    memcpy(sim_sd_data() + 20 * 512, data, 512);
+    sim_sd_stats_reset();
+    sim_sd_busy_now(200 * MS);
+    t = sim_now;
+    CHECK(disk_read(0, buf, 20, 1) == RES_OK);
+    t = sim_now - t;
+    CHECK(!memcmp(buf, data, 512));
+    CHECK(t >= 200 * MS && t < 250 * MS);   // a block takes 20 ms
+    CHECK(yields.last - yields.first > 190 * MS);
+    check_yields();
+    printf(TEST_NAME ": 200 ms busy, %u handler calls\n", yields.calls);
+
+    // A multiple block write with a 20 ms busy period after each block.
+
+    memset(&yields, 0, sizeof(yields));
+    fill(data, 8, 2);
+    sim_sd_stats_reset();
+    sim_sd_busy_time(20 * MS);
+    t = sim_now;
+    CHECK(disk_write(0, data, 100, 8) == RES_OK);
+    CHECK(disk_ioctl(0, CTRL_SYNC, NULL) == RES_OK);
+    t = sim_now - t;
+    CHECK(!memcmp(sim_sd_data() + 100 * 512, data, 8 * 512));
+    CHECK(sim_sd_stats()->busy_periods == 8);
+    CHECK(t >= 9 * 20 * MS);                    // and the busy period after the stop token
+    check_yields();
+
+    memset(buf, 0, sizeof(buf));
+    CHECK(disk_read(0, buf, 100, 8) == RES_OK);
+    CHECK(!memcmp(buf, data, 8 * 512));
+    printf(TEST_NAME ": 8 block write, %u handler calls\n", yields.calls);
+
+    sim_sd_busy_time(100 * SIM_CYCLES_PER_US);
+
+    // Busy beyond the ready timeout.
+
+    memset(&yields, 0, sizeof(yields));
+    sim_sd_stats_reset();
+    sim_sd_busy_now(800 * MS);
+    t = sim_now;
+    CHECK(disk_read(0, buf, 20, 1) == RES_ERROR);
+    t = sim_now - t;
+    CHECK(t >= 490 * MS && t < 520 * MS);
+    CHECK(yields.last - yields.first > 480 * MS);
+    check_yields();
+
+    sim_run(300 * MS);
+    memset(buf, 0, 512);
+    CHECK(disk_read(0, buf, 100, 1) == RES_OK);
+    CHECK(!memcmp(buf, data, 512));
+}
+
+int main (void)
+{
+    sim_call_on_low_stack(test);
+
+    printf(TEST_NAME ": %s\n", failed ? "FAILED" : "OK");
+
+    return failed ? 1 : 0;
+}
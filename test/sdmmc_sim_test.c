@@ -0,0 +1,232 @@
+/*
+  sdmmc_sim_test.c - SD card access in 4-bit SD bus mode by diskio_sdmmc.c on the simulated MCU
+
+  The SDMMC1 model in sim/sim_sdmmc.c runs the command and data path state machines, the card
+  checks the command sequence of each state, the clock rate, that the host bus width matches the
+  width set on the card and that read blocks are not sent before the data path is ready.
+
+    - an SDHC card is identified at 400 kHz, switched to the 4-bit bus and to high speed, then
+      clocked at 48 MHz. The sector count is read from the CSD.
+    - single and multiple block writes and reads transfer the data unchanged by DMA, multiple
+      block transfers are stopped with CMD12 and the card busy time after writes is waited for.
+    - buffers not aligned to a word are transferred.
+    - a read beyond the end of the card fails, later transfers succeed.
+    - a data block with a CRC error fails the read or write, the card content is not changed by
+      the failed write and later transfers succeed.
+    - a card without high speed support is clocked at 24 MHz, SD v2 and v1 cards with byte
+      addressing are read and written at the right sectors.
+
+  Also reports the multiple block read and write rates.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sim.h"
+#include "driver.h"
+#include "ff.h"
+#include "diskio.h"
+
+#define CHECK(cond) if(!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; }
+
+#define TEST_NAME "sdmmc_sim_test"
+#define MS (SIM_HCLK / 1000UL)
+#define SECTORS 8192
+
+static int failed = 0;
+static uint32_t ticks;
+
+void SysTick_Handler (void)
+{
+    if(++ticks % 10 == 0)
+        disk_timerproc();
+}
+
+static void fill (uint8_t *buf, uint32_t sectors, uint32_t seed)
+{
+    uint32_t idx;
+
+    for(idx = 0; idx < sectors * 512; idx++) {
+        seed = seed * 1103515245 + 12345;
+        buf[idx] = seed >> 16;
+    }
+}
+
+static void check_protocol (void)
+{
+    const sim_sdmmc_stats_t *stats = sim_sdmmc_stats();
+
+    CHECK(stats->protocol_errors == 0);
+    CHECK(stats->overruns == 0);
+    CHECK(stats->underruns == 0);
+    CHECK(stats->timeouts == 0);
+}
+
+// Runs on a low stack, diskio_sdmmc.c reads the CMD6 status into a buffer on the stack.
+static void test (void)
+{
+    static uint8_t data[33 * 512], buf[33 * 512];
+
+    const sim_sdmmc_stats_t *stats = sim_sdmmc_stats();
+    DWORD sectors = 0;
+    uint64_t t;
+
+    SysTick_Config(SIM_HCLK / 1000);
+
+    sim_sdmmc_insert(SIM_SD_HC, SECTORS);
+
+    // Identification: CMD0, CMD8, ACMD41 until ready, CMD2, CMD3, CMD9, then CMD7, ACMD6,
+    // CMD16 and the CMD6 switch to high speed.
+
+    CHECK(disk_initialize(0) == 0);
+    CHECK(stats->cmds[0] == 1);
+    CHECK(stats->cmds[8] == 1);
+    CHECK(stats->acmds[41] >= 3 && stats->cmds[55] == stats->acmds[41] + 1);
+    CHECK(stats->cmds[2] == 1 && stats->cmds[3] == 1 && stats->cmds[9] == 1);
+    CHECK(stats->cmds[7] == 1 && stats->acmds[6] == 1 && stats->cmds[16] == 1);
+    CHECK(stats->cmds[6] == 1);
+    CHECK(stats->overclocks == 0);
+    check_protocol();
+
+    CHECK(sim_sdmmc_bus_width() == 4);
+    CHECK(sim_sdmmc_clock() == 48000000UL);
+
+    CHECK(disk_ioctl(0, GET_SECTOR_COUNT, &sectors) == RES_OK);
+    CHECK(sectors == SECTORS);
+
+    // Single block write and read.
+
+    sim_sdmmc_stats_reset();
+    fill(data, 1, 1);
+    CHECK(disk_write(0, data, 10, 1) == RES_OK);
+    CHECK(!memcmp(sim_sdmmc_data() + 10 * 512, data, 512));
+    CHECK(stats->cmds[24] == 1 && stats->blocks_written == 1);
+    CHECK(stats->busy_periods == 1);
+    CHECK(stats->cmds[13] == 1);    // DATAEND follows the busy time
+
+    memset(buf, 0, 512);
+    CHECK(disk_read(0, buf, 10, 1) == RES_OK);
+    CHECK(!memcmp(buf, data, 512));
+    CHECK(stats->cmds[17] == 1 && stats->blocks_read == 1);
+    CHECK(stats->cmds[12] == 0);
+    check_protocol();
+
+    // Multiple block write, stopped by CMD12.
+
+    sim_sdmmc_stats_reset();
+    fill(data, 32, 2);
+    t = sim_now;
+    CHECK(disk_write(0, data, 100, 32) == RES_OK);
+    t = sim_now - t;
+    CHECK(!memcmp(sim_sdmmc_data() + 100 * 512, data, 32 * 512));
+    CHECK(stats->cmds[25] == 1 && stats->multiple_writes == 1);
+    CHECK(stats->blocks_written == 32 && stats->busy_periods == 32);
+    CHECK(stats->cmds[12] == 1 && stats->stops == 1);
+    check_protocol();
+    printf(TEST_NAME ": write %u KB/s\n", (uint32_t)(32 * 512 * (uint64_t)SIM_HCLK / 1024 / t));
+
+    // Multiple block read, the card may have started the next block when stopped.
+
+    sim_sdmmc_stats_reset();
+    memset(buf, 0, sizeof(buf));
+    t = sim_now;
+    CHECK(disk_read(0, buf, 100, 32) == RES_OK);
+    t = sim_now - t;
+    CHECK(!memcmp(buf, data, 32 * 512));
+    CHECK(stats->cmds[18] == 1 && stats->multiple_reads == 1);
+    CHECK(stats->blocks_read == 32);
+    CHECK(stats->cmds[12] == 1 && stats->stops == 1);
+    check_protocol();
+    printf(TEST_NAME ": read %u KB/s\n", (uint32_t)(32 * 512 * (uint64_t)SIM_HCLK / 1024 / t));
+
+    // Unaligned buffers.
+
+    sim_sdmmc_stats_reset();
+    fill(data + 1, 3, 3);
+    CHECK(disk_write(0, data + 1, 300, 3) == RES_OK);
+    CHECK(!memcmp(sim_sdmmc_data() + 300 * 512, data + 1, 3 * 512));
+    memset(buf, 0, sizeof(buf));
+    CHECK(disk_read(0, buf + 3, 300, 3) == RES_OK);
+    CHECK(!memcmp(buf + 3, data + 1, 3 * 512));
+    check_protocol();
+
+    // Reads beyond the end of the card fail, the next read succeeds.
+
+    CHECK(disk_read(0, buf, SECTORS, 1) == RES_ERROR);
+    CHECK(disk_read(0, buf, SECTORS - 1, 2) == RES_ERROR);
+    sim_sdmmc_stats_reset();
+    CHECK(disk_read(0, buf, SECTORS - 2, 2) == RES_OK);
+    CHECK(disk_read(0, buf, 110, 1) == RES_OK);
+    CHECK(!memcmp(buf, data + 10 * 512, 512));
+    check_protocol();
+
+    // Data CRC errors fail the transfer, the failed write leaves the card content unchanged.
+
+    sim_sdmmc_stats_reset();
+    memcpy(data, sim_sdmmc_data() + 100 * 512, 4 * 512);
+    sim_sdmmc_corrupt_reads(1);
+    CHECK(disk_read(0, buf, 100, 4) == RES_ERROR);
+    CHECK(stats->crc_errors == 1);
+    memset(buf, 0, 4 * 512);
+    CHECK(disk_read(0, buf, 100, 4) == RES_OK);
+    CHECK(!memcmp(buf, data, 4 * 512));
+
+    sim_sdmmc_corrupt_writes(1);
+    fill(buf, 1, 4);
+    CHECK(disk_write(0, buf, 100, 1) == RES_ERROR);
+    CHECK(stats->crc_errors == 2);
+    CHECK(!memcmp(sim_sdmmc_data() + 100 * 512, data, 512));
+    CHECK(disk_write(0, buf, 100, 1) == RES_OK);
+    CHECK(!memcmp(sim_sdmmc_data() + 100 * 512, buf, 512));
+    check_protocol();
+
+    // A card without high speed mode stays at 24 MHz.
+
+    sim_sdmmc_insert(SIM_SD_HC, SECTORS);
+    sim_sdmmc_high_speed(false);
+    CHECK(disk_initialize(0) == 0);
+    CHECK(sim_sdmmc_clock() == 24000000UL);
+    fill(data, 8, 5);
+    CHECK(disk_write(0, data, 20, 8) == RES_OK);
+    CHECK(disk_read(0, buf, 20, 8) == RES_OK);
+    CHECK(!memcmp(buf, data, 8 * 512));
+    check_protocol();
+
+    // SD v2 standard capacity, byte addressing.
+
+    sim_sdmmc_insert(SIM_SD_V2, SECTORS);
+    CHECK(disk_initialize(0) == 0);
+    CHECK(disk_ioctl(0, GET_SECTOR_COUNT, &sectors) == RES_OK);
+    CHECK(sectors == SECTORS);
+    fill(data, 2, 6);
+    CHECK(disk_write(0, data, 10, 2) == RES_OK);
+    CHECK(!memcmp(sim_sdmmc_data() + 10 * 512, data, 2 * 512));
+    memset(buf, 0, 2 * 512);
+    CHECK(disk_read(0, buf, 10, 2) == RES_OK);
+    CHECK(!memcmp(buf, data, 2 * 512));
+    check_protocol();
+
+    // SD v1: no answer to CMD8, byte addressing and no CMD6, clocked at 24 MHz.
+
+    sim_sdmmc_insert(SIM_SD_V1, SECTORS);
+    sim_sdmmc_stats_reset();
+    CHECK(disk_initialize(0) == 0);
+    CHECK(stats->cmds[8] == 1 && stats->cmds[6] == 0);
+    CHECK(sim_sdmmc_clock() == 24000000UL);
+    fill(data, 2, 7);
+    CHECK(disk_write(0, data, 30, 2) == RES_OK);
+    CHECK(!memcmp(sim_sdmmc_data() + 30 * 512, data, 2 * 512));
+    memset(buf, 0, 2 * 512);
+    CHECK(disk_read(0, buf, 30, 2) == RES_OK);
+    CHECK(!memcmp(buf, data, 2 * 512));
+    check_protocol();
+}
+
+int main (void)
+{
+    sim_call_on_low_stack(test);
+
+    printf(TEST_NAME ": %s\n", failed ? "FAILED" : "OK");
+
+    return failed ? 1 : 0;
+}
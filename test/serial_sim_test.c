@@ -0,0 +1,318 @@
+/*
+  serial_sim_test.c - serial stream input and output of serial.c on the simulated MCU
+
+  Built twice, with one interrupt per character and with SERIAL_RX_DMA and SERIAL_TX_DMA.
+  Both builds check the data against the same expectations, so they are equivalent:
+
+    - realtime commands are passed to the realtime handler and all other characters to the
+      input buffer, each in the order received, across several wraps of the DMA buffer.
+    - a short burst that does not fill half the DMA buffer is delivered by the idle line event.
+    - when the input buffer overflows the characters that do not fit are dropped, and realtime
+      commands received after the overflow are still handled.
+    - no characters are lost by the USART.
+    - output written in lines is transmitted unchanged and in order at the line rate, also
+      when writes block on a full output buffer.
+
+  Also reports the receive interrupts per KB and the realtime command latency in characters,
+  which is bounded by half the DMA buffer with SERIAL_RX_DMA, and the transmit rate,
+  interrupts per KB and interrupt handler instructions per KB.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sim.h"
+#include "driver.h"
+#include "i2c.h"
+#include "flash.h"
+
+#define CHECK(cond) if(!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; }
+
+#if SERIAL_RX_DMA
+#define TEST_NAME "serial_sim_dma_test"
+#define RX_DMA_HALF 128 // half of RX_DMA_BUFFER_SIZE in serial.c
+#define TX_INTERRUPTS_KB 32
+#else
+#define TX_INTERRUPTS_KB 1024
+#define TEST_NAME "serial_sim_test"
+#endif
+
+#define STREAM_LENGTH 4000
+#define MAX_RT 200
+#define TX_LENGTH (8 * 1024)
+
+// Not under test.
+
+void i2c_init (void)
+{
+}
+
+bool memcpy_from_flash (uint8_t *dest)
+{
+    return false;
+}
+
+bool memcpy_to_flash (uint8_t *source)
+{
+    return false;
+}
+
+static int failed = 0;
+static char rt_log[MAX_RT];
+static uint64_t rt_time[MAX_RT];
+static uint32_t n_rt;
+
+static bool is_realtime (char c)
+{
+    return c == '?' || c == '!' || c == '~' || c == ASCII_CAN;
+}
+
+static bool enqueue_realtime_command (char c)
+{
+    if(!is_realtime(c))
+        return false;
+
+    if(n_rt < MAX_RT) {
+        rt_time[n_rt] = sim_now;
+        rt_log[n_rt++] = c;
+    }
+
+    return true;
+}
+
+typedef struct {
+    uint32_t sent;              // characters sent to the USART
+    uint32_t received;          // characters read from the input buffer
+    uint32_t mismatches;        // characters not matching the expected input or realtime command
+    uint32_t rt;                // realtime commands handled
+    uint32_t rt_latency_max;    // in characters
+    uint32_t lost;              // characters lost by the USART
+    uint32_t interrupts;
+} result_t;
+
+// Waits for output buffer space.
+static bool tx_blocking (void)
+{
+    sim_wfi();
+
+    return true;
+}
+
+static uint32_t interrupts (void)
+{
+    uint32_t count = sim_irq_stats(USART1_IRQn)->count;
+#if SERIAL_RX_DMA
+    count += sim_irq_stats(DMA2_Stream2_IRQn)->count;
+#endif
+    return count;
+}
+
+// Sends length characters of data, reading the input buffer every read_interval character
+// times, 0 to read only after the line has been idle. capacity is the number of characters
+// expected in the input buffer, characters beyond it are expected to be dropped.
+static result_t receive (const char *data, uint32_t length, uint32_t read_interval, uint32_t capacity)
+{
+    static char expected[STREAM_LENGTH], expected_rt[MAX_RT];
+    static uint32_t arrival[MAX_RT];
+
+    result_t r = { .sent = length };
+    uint32_t idx, n_expected = 0, n_expected_rt = 0, lost = sim_usart_rx_lost(USART1);
+    uint64_t t0 = sim_now, char_time = sim_usart_char_time(USART1);
+    int16_t c;
+
+    for(idx = 0; idx < length; idx++) {
+        if(is_realtime(data[idx])) {
+            arrival[n_expected_rt] = idx;
+            expected_rt[n_expected_rt++] = data[idx];
+        } else if(n_expected < capacity)
+            expected[n_expected++] = data[idx];
+    }
+
+    n_rt = 0;
+    sim_irq_stats_reset();
+    sim_usart_rx(USART1, data, length);
+
+    do {
+        sim_run((read_interval ? read_interval : length + 2) * char_time);
+        while((c = hal.stream.read()) != -1) {
+            if(r.received >= n_expected || c != expected[r.received])
+                r.mismatches++;
+            r.received++;
+        }
+    } while(sim_usart_rx_pending(USART1));
+
+    sim_run(2 * char_time); // idle line
+    while((c = hal.stream.read()) != -1) {
+        if(r.received >= n_expected || c != expected[r.received])
+            r.mismatches++;
+        r.received++;
+    }
+
+    if(r.received != n_expected)
+        r.mismatches++;
+
+    r.rt = n_rt;
+    if(n_rt != n_expected_rt)
+        r.mismatches++;
+
+    for(idx = 0; idx < min(n_rt, n_expected_rt); idx++) {
+        // The character is received at the end of its character time.
+        uint32_t latency = (uint32_t)((rt_time[idx] - t0) / char_time) - arrival[idx];
+        if(rt_log[idx] != expected_rt[idx])
+            r.mismatches++;
+        r.rt_latency_max = max(r.rt_latency_max, latency);
+    }
+
+    r.lost = sim_usart_rx_lost(USART1) - lost;
+    r.interrupts = interrupts();
+
+    return r;
+}
+
+static void report (const char *what, result_t *r)
+{
+    printf("%s: %u characters, %u realtime, latency %u characters, %u interrupts/KB\n",
+            what, r->received, r->rt, r->rt_latency_max, r->interrupts * 1024 / r->sent);
+}
+
+typedef struct {
+    uint32_t sent;
+    uint64_t cycles;            // from the first write to the last character transmitted
+    uint32_t interrupts;
+    uint64_t isr_instructions;
+} tx_result_t;
+
+// Writes length characters of data in lines of line_length characters.
+static tx_result_t transmit (const char *data, uint32_t length, uint32_t line_length)
+{
+    static char line[128];
+
+    tx_result_t r = {0};
+    uint32_t idx;
+    uint64_t t0 = sim_now;
+    const uint8_t *tx;
+
+    sim_usart_tx_clear(USART1);
+    sim_irq_stats_reset();
+    sim_time_isrs(true);
+
+    for(idx = 0; idx < length; idx += line_length) {
+        memcpy(line, &data[idx], line_length);
+        line[line_length] = '\0';
+        hal.stream.write(line);
+    }
+
+    while(sim_usart_tx(USART1, NULL) < length && sim_now - t0 < (uint64_t)SIM_HCLK)
+        sim_wfi();
+
+    r.cycles = sim_now - t0;
+    r.sent = sim_usart_tx(USART1, &tx);
+    if(r.sent != length || memcmp(tx, data, length))
+        r.sent = 0;
+
+    r.interrupts = sim_irq_stats(USART1_IRQn)->count;
+    r.isr_instructions = sim_irq_stats(USART1_IRQn)->cycles;
+#if SERIAL_TX_DMA
+    r.interrupts += sim_irq_stats(DMA2_Stream7_IRQn)->count;
+    r.isr_instructions += sim_irq_stats(DMA2_Stream7_IRQn)->cycles;
+#endif
+
+    sim_time_isrs(false);
+
+    return r;
+}
+
+static void check_latency (result_t *r)
+{
+#if SERIAL_RX_DMA
+    CHECK(r->rt_latency_max <= RX_DMA_HALF + 1);
+#else
+    CHECK(r->rt_latency_max <= 1);
+#endif
+}
+
+int main (void)
+{
+    static char data[STREAM_LENGTH];
+
+    uint32_t idx, seed = 1;
+    result_t r;
+
+    hal.version = 8;
+    CHECK(driver_init());
+    CHECK(hal.driver_setup(&settings));
+
+    hal.stream.set_enqueue_rt_handler(enqueue_realtime_command);
+
+    // G-code like input with a realtime command about every 40 characters, read while receiving.
+
+    for(idx = 0; idx < STREAM_LENGTH; idx++) {
+        seed = seed * 1103515245 + 12345;
+        if(idx % 40 == 39)
+            data[idx] = "?!~?"[(seed >> 16) & 3];
+        else if(idx % 20 == 19)
+            data[idx] = ASCII_LF;
+        else
+            data[idx] = "GXYZ0123456789.-"[(seed >> 16) & 0xF];
+    }
+
+    r = receive(data, STREAM_LENGTH, 64, STREAM_LENGTH);
+    report("stream", &r);
+
+    CHECK(r.mismatches == 0);
+    CHECK(r.received == STREAM_LENGTH - STREAM_LENGTH / 40);
+    CHECK(r.lost == 0);
+    check_latency(&r);
+
+    // Short burst, less than half the DMA buffer.
+
+    r = receive("G1X10F100\n?", 11, 0, 11);
+    report("burst", &r);
+
+    CHECK(r.mismatches == 0);
+    CHECK(r.received == 10 && r.rt == 1);
+    CHECK(r.lost == 0);
+
+    // Overflow: the input buffer is not read until the line is idle.
+
+    r = receive(data, RX_BUFFER_SIZE + 600, 0, RX_BUFFER_SIZE - 1);
+    report("overflow", &r);
+
+    CHECK(r.mismatches == 0);
+    CHECK(r.received == RX_BUFFER_SIZE - 1);
+    CHECK(r.rt == (RX_BUFFER_SIZE + 600) / 40);
+    CHECK(r.lost == 0);
+    check_latency(&r);
+
+    // Input is received normally after the overflow.
+
+    r = receive(data, 200, 16, 200);
+
+    CHECK(r.mismatches == 0);
+    CHECK(r.received == 200 - 200 / 40);
+
+    // Output in lines, four times the output buffer size.
+
+    static char text[TX_LENGTH];
+    tx_result_t t;
+    uint64_t line_rate = (uint64_t)SIM_HCLK / sim_usart_char_time(USART1);
+
+    for(idx = 0; idx < TX_LENGTH; idx++)
+        text[idx] = idx % 32 == 31 ? ASCII_LF : data[idx % STREAM_LENGTH];
+
+    hal.stream_blocking_callback = tx_blocking;
+
+    t = transmit(text, TX_LENGTH, 32);
+
+    printf("output: %u characters, %llu characters/s (line %llu), %u interrupts/KB, %llu ISR instructions/KB\n",
+            t.sent, (unsigned long long)((uint64_t)t.sent * SIM_HCLK / t.cycles), (unsigned long long)line_rate,
+             t.interrupts * 1024 / TX_LENGTH, (unsigned long long)(t.isr_instructions * 1024 / TX_LENGTH));
+
+    CHECK(t.sent == TX_LENGTH);
+    CHECK((uint64_t)t.sent * SIM_HCLK / t.cycles >= line_rate * 99 / 100);
+    CHECK(t.interrupts * 1024 / TX_LENGTH <= TX_INTERRUPTS_KB);
+
+    printf(TEST_NAME ": %s\n", failed ? "FAILED" : "OK");
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+/*
+
+  core_cm7.h - Cortex-M7 core header for the host simulator builds
+
+  Found ahead of the CMSIS header via the include path of the simulator builds. Replaces the
+  compiler specific part of CMSIS (cmsis_gcc.h, ARM inline assembly) with host versions of the
+  intrinsics and then includes the CMSIS header for the core register definitions.
+
+  Interrupt masking is forwarded to the simulator, barriers are compiler barriers and __WFI()
+  lets simulated time pass until an interrupt is taken.
+
+*/
+
+#ifndef __SIM_CORE_CM7_H
+#define __SIM_CORE_CM7_H
+
+#include <stdint.h>
+
+// Include guards of the CMSIS compiler headers, nothing from them is used.
+#define __CMSIS_COMPILER_H
+#define __CMSIS_GCC_H
+
+#define __ASM                   __asm
+#define __INLINE                inline
+#define __STATIC_INLINE         static inline
+#define __STATIC_FORCEINLINE    __attribute__((always_inline)) static inline
+#define __NO_RETURN             __attribute__((__noreturn__))
+#define __USED                  __attribute__((used))
+#define __WEAK                  __attribute__((weak))
+#define __PACKED                __attribute__((packed, aligned(1)))
+#define __PACKED_STRUCT         struct __attribute__((packed, aligned(1)))
+#define __PACKED_UNION          union __attribute__((packed, aligned(1)))
+#define __ALIGNED(x)            __attribute__((aligned(x)))
+#define __RESTRICT              __restrict
+#define __COMPILER_BARRIER()    __asm volatile("" ::: "memory")
+
+#define __UNALIGNED_UINT32(x)                   (*(uint32_t *)(x))
+#define __UNALIGNED_UINT16_WRITE(addr, val)     (void)(*(uint16_t *)(void *)(addr) = (val))
+#define __UNALIGNED_UINT16_READ(addr)           (*(const uint16_t *)(const void *)(addr))
+#define __UNALIGNED_UINT32_WRITE(addr, val)     (void)(*(uint32_t *)(void *)(addr) = (val))
+#define __UNALIGNED_UINT32_READ(addr)           (*(const uint32_t *)(const void *)(addr))
+
+extern volatile uint32_t sim_primask;
+extern void sim_wfi (void);
+extern void sim_dispatch (void);
+
+// Interrupts that became pending while masked are taken when unmasked, e.g. the one that ended __WFI().
+__STATIC_FORCEINLINE void __enable_irq (void)
+{
+    __COMPILER_BARRIER();
+    sim_primask = 0;
+    sim_dispatch();
+}
+
+__STATIC_FORCEINLINE void __disable_irq (void)
+{
+    sim_primask = 1;
+    __COMPILER_BARRIER();
+}
+
+__STATIC_FORCEINLINE uint32_t __get_PRIMASK (void)
+{
+    return sim_primask;
+}
+
+__STATIC_FORCEINLINE void __set_PRIMASK (uint32_t priMask)
+{
+    __COMPILER_BARRIER();
+    sim_primask = priMask & 1;
+    __COMPILER_BARRIER();
+    if(!sim_primask)
+        sim_dispatch();
+}
+
+__STATIC_FORCEINLINE uint32_t __get_IPSR (void)
+{
+    return 0;
+}
+
+__STATIC_FORCEINLINE void __NOP (void)
+{
+    __COMPILER_BARRIER();
+}
+
+__STATIC_FORCEINLINE void __WFI (void)
+{
+    sim_wfi();
+}
+
+__STATIC_FORCEINLINE void __ISB (void)
+{
+    __COMPILER_BARRIER();
+}
+
+__STATIC_FORCEINLINE void __DSB (void)
+{
+    __COMPILER_BARRIER();
+}
+
+__STATIC_FORCEINLINE void __DMB (void)
+{
+    __COMPILER_BARRIER();
+}
+
+__STATIC_FORCEINLINE uint32_t __REV (uint32_t value)
+{
+    return __builtin_bswap32(value);
+}
+
+__STATIC_FORCEINLINE uint32_t __REV16 (uint32_t value)
+{
+    return ((value & 0xFF00FF00UL) >> 8) | ((value & 0x00FF00FFUL) << 8);
+}
+
+__STATIC_FORCEINLINE uint32_t __RBIT (uint32_t value)
+{
+    uint32_t result = 0;
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < 32; idx++) {
+        result = (result << 1) | (value & 1);
+        value >>= 1;
+    }
+
+    return result;
+}
+
+__STATIC_FORCEINLINE uint8_t __CLZ (uint32_t value)
+{
+    return value ? (uint8_t)__builtin_clz(value) : 32U;
+}
+
+#include_next "core_cm7.h"
+
+#endif
@@ -0,0 +1,70 @@
+/*
+  my_machine_map.h - board map for the step output benchmark, see stepout_bench.c
+
+  All step and direction outputs are on GPIOE so that every output mode can be used, the output
+  mode is set from the command line. Other pins are as in reference_map.h.
+*/
+
+#define BOARD_NAME "step output benchmark"
+
+#define STEPPERS_ENABLE_PORT    GPIOF
+#define STEPPERS_ENABLE_PIN     12
+#define STEPPERS_ENABLE_BIT     (1<<STEPPERS_ENABLE_PIN)
+
+#define STEP_PORT               GPIOE
+#define X_STEP_PIN              0
+#define Y_STEP_PIN              1
+#define Z_STEP_PIN              2
+#define A_STEP_PIN              3
+#define B_STEP_PIN              4
+#define C_STEP_PIN              5
+#ifndef STEP_OUTMODE
+#define STEP_OUTMODE            GPIO_SINGLE
+#endif
+
+#define DIRECTION_PORT          GPIOE
+#define X_DIRECTION_PIN         8
+#define Y_DIRECTION_PIN         9
+#define Z_DIRECTION_PIN         10
+#define A_DIRECTION_PIN         11
+#define B_DIRECTION_PIN         12
+#define C_DIRECTION_PIN         13
+#ifndef DIRECTION_OUTMODE
+#define DIRECTION_OUTMODE       GPIO_SINGLE
+#endif
+
+#define LIMIT_PORT              GPIOD
+#define X_LIMIT_PIN             15
+#define Y_LIMIT_PIN             14
+#define Z_LIMIT_PIN             13
+#define LIMIT_INMODE            GPIO_SINGLE
+
+#define SPINDLE_ENABLE_PORT     GPIOA
+#define SPINDLE_ENABLE_PIN      6
+#define SPINDLE_ENABLE_BIT      (1<<SPINDLE_ENABLE_PIN)
+#define SPINDLE_DIRECTION_PORT  GPIOA
+#define SPINDLE_DIRECTION_PIN   5
+#define SPINDLE_DIRECTION_BIT   (1<<SPINDLE_DIRECTION_PIN)
+
+#define COOLANT_FLOOD_PORT      GPIOF
+#define COOLANT_FLOOD_PIN       3
+#define COOLANT_FLOOD_BIT       (1<<COOLANT_FLOOD_PIN)
+#define COOLANT_MIST_PORT       GPIOF
+#define COOLANT_MIST_PIN        5
+#define COOLANT_MIST_BIT        (1<<COOLANT_MIST_PIN)
+
+#define RESET_PORT              GPIOA
+#define RESET_PIN               3
+#define RESET_BIT               (1<<RESET_PIN)
+#define FEED_HOLD_PORT          GPIOC
+#define FEED_HOLD_PIN           0
+#define FEED_HOLD_BIT           (1<<FEED_HOLD_PIN)
+#define CYCLE_START_PORT        GPIOC
+#define CYCLE_START_PIN         3
+#define CYCLE_START_BIT         (1<<CYCLE_START_PIN)
+#define CONTROL_MASK            (RESET_BIT|FEED_HOLD_BIT|CYCLE_START_BIT)
+#define CONTROL_INMODE          GPIO_SINGLE
+
+#define PROBE_PORT              GPIOF
+#define PROBE_PIN               10
+#define PROBE_BIT               (1<<PROBE_PIN)
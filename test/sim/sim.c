@@ -0,0 +1,740 @@
+/*
+
+  sim.c - STM32F756 register level simulator, register file, time and interrupt dispatch
+
+  The NVIC, SysTick and DWT cycle counter models are here, the other peripheral models are
+  in sim_*.c and attach themselves from constructors.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+
+#include "sim.h"
+
+#define PAGE_SIZE       4096
+#define MAX_PERIPHS     64
+#define EFLAGS_TF       0x100
+#define N_VECTORS       (16 + 98)
+
+typedef struct {
+    uint32_t base;
+    uint32_t size;
+    int prot;
+    uint8_t *alias;
+} region_t;
+
+static region_t regions[] = {
+    { PERIPH_BASE,            0x00080000, PROT_NONE }, // APB1, APB2 and AHB1 peripherals
+    { AHB2PERIPH_BASE,        0x00061000, PROT_NONE }, // USB OTG FS, DCMI, RNG
+    { 0xE0000000UL,           0x00100000, PROT_NONE }, // Cortex-M7 private peripherals
+    { FLASH_BASE,             0x00100000, PROT_READ }  // flash array, written by the flash controller model
+};
+
+#define N_REGIONS (sizeof(regions) / sizeof(region_t))
+
+static struct {
+    bool pending;
+    bool write;
+    uint32_t addr;
+    uint32_t old;
+    uint_fast8_t size;
+    void *page;
+    region_t *region;
+    sim_periph_t *periph;
+} fault;
+
+static sim_periph_t *periphs[MAX_PERIPHS];
+static uint_fast8_t n_periphs = 0;
+static bool mapped = false, in_handler = false, timed = false;
+static volatile bool counting = false;
+static volatile uint32_t instructions;
+static uint32_t last_read = 0, count_overhead = 0;
+
+uint_fast8_t sim_access_size = 4;
+
+static uint8_t irq_line[N_VECTORS], irq_pending[N_VECTORS], irq_enabled[N_VECTORS];
+static sim_irq_stats_t irq_stats[N_VECTORS];
+static uint64_t systick_last, dwt_base;
+
+static sim_gpio_event_t *gpio_events = NULL;
+static uint32_t n_gpio_events = 0, gpio_events_size = 0;
+
+uint64_t sim_now = 0;
+uint32_t sim_reads = 0, sim_writes = 0;
+volatile uint32_t sim_primask = 0;
+
+extern void (* const sim_vectors[N_VECTORS])(void);
+
+static region_t *region_of (uint32_t addr)
+{
+    uint_fast8_t idx = N_REGIONS;
+
+    while(idx--) {
+        if(addr >= regions[idx].base && addr - regions[idx].base < regions[idx].size)
+            return &regions[idx];
+    }
+
+    return NULL;
+}
+
+static sim_periph_t *periph_of (uint32_t addr)
+{
+    uint_fast8_t idx = n_periphs;
+
+    while(idx--) {
+        if(addr >= periphs[idx]->base && addr - periphs[idx]->base < periphs[idx]->size)
+            return periphs[idx];
+    }
+
+    return NULL;
+}
+
+const volatile void *sim_alias (const volatile void *reg)
+{
+    uint32_t addr = (uint32_t)(uintptr_t)reg;
+    region_t *region = (uintptr_t)reg >> 32 ? NULL : region_of(addr);
+
+    return region ? region->alias + (addr - region->base) : reg;
+}
+
+static inline uint32_t *alias32 (uint32_t addr)
+{
+    return (uint32_t *)sim_alias((const volatile void *)(uintptr_t)(addr & ~3));
+}
+
+void sim_attach (sim_periph_t *periph)
+{
+    if(n_periphs < MAX_PERIPHS)
+        periphs[n_periphs++] = periph;
+}
+
+// Processes model events that are due, each at its own time.
+static void process_events (void)
+{
+    uint_fast8_t idx;
+    uint64_t now = sim_now, t;
+    sim_periph_t *first;
+
+    do {
+        first = NULL;
+        t = UINT64_MAX;
+        for(idx = 0; idx < n_periphs; idx++) {
+            uint64_t e;
+            if(periphs[idx]->next_event && (e = periphs[idx]->next_event(periphs[idx])) < t) {
+                t = e;
+                first = periphs[idx];
+            }
+        }
+        if(first && t <= now) {
+            sim_now = t;
+            first->event(first);
+            sim_now = now;
+            sim_dma_service();
+        }
+    } while(first && t <= now);
+}
+
+static uint64_t next_event (void)
+{
+    uint_fast8_t idx;
+    uint64_t t = UINT64_MAX, e;
+
+    for(idx = 0; idx < n_periphs; idx++) {
+        if(periphs[idx]->next_event && (e = periphs[idx]->next_event(periphs[idx])) < t)
+            t = e;
+    }
+
+    return t;
+}
+
+void sim_advance (uint64_t cycles)
+{
+    sim_now += cycles;
+    process_events();
+}
+
+// Size of the store by the faulting instruction, decoded from its prefixes and opcode: the
+// byte forms of mov, the ALU and unary read-modify-write instructions, xchg, stos, movs and setcc.
+static uint_fast8_t store_size (const uint8_t *ip)
+{
+    uint_fast8_t size = 4;
+
+    for(;; ip++) {
+        if(*ip == 0x66)
+            size = 2;
+        else if((*ip & 0xF0) == 0x40) { // REX
+            if(*ip & 0x08)
+                size = 8;
+        } else if(*ip != 0xF0 && *ip != 0xF2 && *ip != 0xF3 && *ip != 0x64 && *ip != 0x65)
+            break;
+    }
+
+    if(*ip == 0x0F)
+        return (ip[1] & 0xF0) == 0x90 ? 1 : size;
+
+    if((*ip < 0x40 && (*ip & 0x07) == 0) || *ip == 0x80 || *ip == 0x86 || *ip == 0x88 || *ip == 0xC6 ||
+        *ip == 0xF6 || *ip == 0xFE || *ip == 0xA4 || *ip == 0xAA)
+        return 1;
+
+    return size;
+}
+
+static void on_segv (int sig, siginfo_t *si, void *context)
+{
+    ucontext_t *uc = (ucontext_t *)context;
+    uint32_t addr = (uint32_t)(uintptr_t)si->si_addr;
+    region_t *region = (uintptr_t)si->si_addr >> 32 ? NULL : region_of(addr);
+
+    if(region == NULL || fault.pending) {
+        signal(SIGSEGV, SIG_DFL); // not ours, fault again with the default action
+        return;
+    }
+
+    fault.write = !!(uc->uc_mcontext.gregs[REG_ERR] & 2);
+    fault.addr = addr;
+    fault.region = region;
+    fault.periph = periph_of(addr);
+    fault.old = *alias32(addr);
+    fault.page = (void *)(uintptr_t)(addr & ~(PAGE_SIZE - 1));
+
+    if(fault.write) {
+        fault.size = store_size((const uint8_t *)uc->uc_mcontext.gregs[REG_RIP]);
+        sim_writes++;
+        last_read = 0;
+    } else {
+        sim_reads++;
+        // Status register polled in a loop: skip ahead to the next event.
+        if(addr == last_read && (!fault.periph || !fault.periph->polled || fault.periph->polled(fault.periph, addr - fault.periph->base))) {
+            uint64_t t = next_event();
+            if(t != UINT64_MAX && t > sim_now)
+                sim_now = t;
+        }
+        last_read = addr;
+    }
+
+    sim_now += SIM_ACCESS_CYCLES;
+    process_events();
+
+    if(!fault.write && fault.periph && fault.periph->read)
+        fault.periph->read(fault.periph, addr - fault.periph->base);
+
+    mprotect(fault.page, PAGE_SIZE, PROT_READ|PROT_WRITE);
+    fault.pending = true;
+    uc->uc_mcontext.gregs[REG_EFL] |= EFLAGS_TF;
+}
+
+static void on_trap (int sig, siginfo_t *si, void *context)
+{
+    ucontext_t *uc = (ucontext_t *)context;
+
+    if(fault.pending) {
+        fault.pending = false;
+        mprotect(fault.page, PAGE_SIZE, fault.region->prot);
+        if(fault.periph) {
+            if(fault.write && fault.periph->write) {
+                sim_access_size = fault.size;
+                fault.periph->write(fault.periph, (fault.addr & ~3) - fault.periph->base, fault.old);
+            } else if(!fault.write && fault.periph->after_read)
+                fault.periph->after_read(fault.periph, fault.addr - fault.periph->base);
+        }
+        sim_dma_service();
+    }
+
+    if(counting) {
+        instructions++;
+        if(timed)
+            sim_now++;
+    } else
+        uc->uc_mcontext.gregs[REG_EFL] &= ~EFLAGS_TF;
+}
+
+static inline void trace_on (void)
+{
+    __asm volatile("pushfq; orq $0x100, (%%rsp); popfq" ::: "memory", "cc");
+}
+
+static inline void trace_off (void)
+{
+    __asm volatile("pushfq; andq $~0x100, (%%rsp); popfq" ::: "memory", "cc");
+}
+
+static __attribute__((noinline)) void traced (void (*fn)(void *arg), void *arg)
+{
+    instructions = 0;
+    counting = true;
+    trace_on();
+    fn(arg);
+    trace_off();
+    counting = false;
+}
+
+uint32_t sim_count_instructions (void (*fn)(void *arg), void *arg)
+{
+    traced(fn, arg);
+
+    return instructions > count_overhead ? instructions - count_overhead : 0;
+}
+
+static void nothing (void *arg)
+{
+}
+
+void sim_time_isrs (bool on)
+{
+    timed = on;
+}
+
+static void call_handler (void *arg)
+{
+    ((void (*)(void))arg)();
+}
+
+//
+// NVIC, SysTick, SCB and DWT
+//
+
+static inline uint_fast8_t vector (IRQn_Type irq)
+{
+    return (uint_fast8_t)((int)irq + 16);
+}
+
+static uint32_t priority (uint_fast8_t vec)
+{
+    if(vec >= 16)
+        return SIM_REG(NVIC->IP[vec - 16]) >> (8U - __NVIC_PRIO_BITS);
+
+    return vec >= 4 ? SIM_REG(SCB->SHPR[vec - 4]) >> (8U - __NVIC_PRIO_BITS) : 0;
+}
+
+void sim_irq_line (IRQn_Type irq, bool level)
+{
+    irq_line[vector(irq)] = level;
+    if(level)
+        irq_pending[vector(irq)] = 1;
+}
+
+bool sim_irq_enabled (IRQn_Type irq)
+{
+    return irq_enabled[vector(irq)];
+}
+
+static void scs_mirror (void)
+{
+    uint_fast8_t idx, bit;
+
+    for(idx = 0; idx < 4; idx++) {
+        uint32_t enabled = 0, pending = 0;
+        for(bit = 0; bit < 32 && idx * 32 + bit + 16 < N_VECTORS; bit++) {
+            enabled |= (uint32_t)irq_enabled[idx * 32 + bit + 16] << bit;
+            pending |= (uint32_t)irq_pending[idx * 32 + bit + 16] << bit;
+        }
+        SIM_REG(NVIC->ISER[idx]) = SIM_REG(NVIC->ICER[idx]) = enabled;
+        SIM_REG(NVIC->ISPR[idx]) = SIM_REG(NVIC->ICPR[idx]) = pending;
+    }
+}
+
+static uint64_t systick_period (void)
+{
+    uint64_t period = (SIM_REG(SysTick->LOAD) & SysTick_LOAD_RELOAD_Msk) + 1;
+
+    return SIM_REG(SysTick->CTRL) & SysTick_CTRL_CLKSOURCE_Msk ? period : period * 8;
+}
+
+static void scs_read (sim_periph_t *p, uint32_t offset)
+{
+    uint32_t addr = p->base + offset;
+
+    if(addr == (uint32_t)(uintptr_t)&DWT->CYCCNT)
+        SIM_REG(DWT->CYCCNT) = SIM_REG(DWT->CTRL) & DWT_CTRL_CYCCNTENA_Msk ? (uint32_t)(sim_now - dwt_base) : 0;
+    else if(addr == (uint32_t)(uintptr_t)&SysTick->VAL && (SIM_REG(SysTick->CTRL) & SysTick_CTRL_ENABLE_Msk)) {
+        uint64_t period = systick_period();
+        SIM_REG(SysTick->VAL) = (uint32_t)((period - 1 - (sim_now - systick_last) % period) / (period / ((SIM_REG(SysTick->LOAD) & SysTick_LOAD_RELOAD_Msk) + 1)));
+    }
+}
+
+static void scs_after_read (sim_periph_t *p, uint32_t offset)
+{
+    if(p->base + offset == (uint32_t)(uintptr_t)&SysTick->CTRL)
+        SIM_REG(SysTick->CTRL) &= ~SysTick_CTRL_COUNTFLAG_Msk;
+}
+
+static void scs_write (sim_periph_t *p, uint32_t offset, uint32_t old)
+{
+    uint32_t addr = p->base + offset, value = *alias32(addr), idx, bit;
+
+    if(addr >= (uint32_t)(uintptr_t)&NVIC->ISER[0] && addr < (uint32_t)(uintptr_t)&NVIC->IABR[0]) {
+        uint32_t reg = (addr - (uint32_t)(uintptr_t)&NVIC->ISER[0]) / 4;
+        idx = reg & 0x1F;
+        for(bit = 0; bit < 32; bit++) {
+            if((value & (1UL << bit)) && idx * 32 + bit + 16 < N_VECTORS) switch(reg >> 5) {
+                case 0: irq_enabled[idx * 32 + bit + 16] = 1; break;
+                case 1: irq_enabled[idx * 32 + bit + 16] = 0; break;
+                case 2: irq_pending[idx * 32 + bit + 16] = 1; break;
+                case 3: irq_pending[idx * 32 + bit + 16] = 0; break;
+            }
+        }
+        scs_mirror();
+    } else if(addr == (uint32_t)(uintptr_t)&SysTick->CTRL) {
+        if((value & SysTick_CTRL_ENABLE_Msk) && !(old & SysTick_CTRL_ENABLE_Msk))
+            systick_last = sim_now;
+    } else if(addr == (uint32_t)(uintptr_t)&SysTick->VAL) {
+        SIM_REG(SysTick->VAL) = 0;
+        systick_last = sim_now;
+    } else if(addr == (uint32_t)(uintptr_t)&DWT->CYCCNT)
+        dwt_base = sim_now - value;
+    else if(addr == (uint32_t)(uintptr_t)&SCB->ICSR && (value & SCB_ICSR_PENDSTSET_Msk))
+        irq_pending[vector(SysTick_IRQn)] = 1;
+}
+
+static uint64_t systick_next (sim_periph_t *p)
+{
+    return SIM_REG(SysTick->CTRL) & SysTick_CTRL_ENABLE_Msk ? systick_last + systick_period() : UINT64_MAX;
+}
+
+static void systick_event (sim_periph_t *p)
+{
+    systick_last = sim_now;
+    SIM_REG(SysTick->CTRL) |= SysTick_CTRL_COUNTFLAG_Msk;
+    if(SIM_REG(SysTick->CTRL) & SysTick_CTRL_TICKINT_Msk)
+        irq_pending[vector(SysTick_IRQn)] = 1;
+}
+
+static void scs_reset (sim_periph_t *p)
+{
+    memset(irq_line, 0, sizeof(irq_line));
+    memset(irq_pending, 0, sizeof(irq_pending));
+    memset(irq_enabled, 0, sizeof(irq_enabled));
+    irq_enabled[vector(SysTick_IRQn)] = 1;
+    irq_enabled[vector(PendSV_IRQn)] = 1;
+    systick_last = dwt_base = 0;
+    *(volatile uint32_t *)sim_alias(&SCB->CPUID) = 0x411FC270; // Cortex-M7 r1p0, read-only register
+}
+
+static sim_periph_t scs = {
+    .name = "SCS",
+    .base = 0xE0000000UL,
+    .size = 0x00100000,
+    .reset = scs_reset,
+    .read = scs_read,
+    .after_read = scs_after_read,
+    .write = scs_write,
+    .next_event = systick_next,
+    .event = systick_event
+};
+
+//
+// Interrupt dispatch
+//
+
+static void take (uint_fast8_t vec)
+{
+    sim_irq_stats_t *stats = &irq_stats[vec];
+    uint64_t start = sim_now;
+
+    irq_pending[vec] = 0;
+    in_handler = true;
+    last_read = 0; // a status read at handler entry is not a poll
+
+    if(timed) {
+        traced(call_handler, (void *)sim_vectors[vec]);
+        stats->last = instructions - count_overhead;
+        stats->cycles += stats->last;
+    } else {
+        sim_vectors[vec]();
+        stats->last = (uint32_t)(sim_now - start);
+    }
+
+    if(stats->last > stats->max)
+        stats->max = stats->last;
+    stats->count++;
+
+    in_handler = false;
+    last_read = 0;
+
+    process_events();
+
+    if(irq_line[vec])
+        irq_pending[vec] = 1;
+}
+
+static bool take_pending (void)
+{
+    uint_fast8_t vec, best = 0;
+    uint32_t best_priority = UINT32_MAX;
+
+    if(sim_primask || in_handler)
+        return false;
+
+    process_events();
+
+    for(vec = 0; vec < N_VECTORS; vec++) {
+        if(irq_line[vec])
+            irq_pending[vec] = 1;
+        if(irq_pending[vec] && irq_enabled[vec] && priority(vec) < best_priority) {
+            best = vec;
+            best_priority = priority(vec);
+        }
+    }
+
+    if(best_priority != UINT32_MAX)
+        take(best);
+
+    return best_priority != UINT32_MAX;
+}
+
+void sim_dispatch (void)
+{
+    while(take_pending());
+}
+
+void sim_wfi (void)
+{
+    uint64_t t;
+
+    if(!take_pending()) {
+        if((t = next_event()) != UINT64_MAX && t > sim_now)
+            sim_now = t;
+        else
+            sim_now += SIM_ACCESS_CYCLES;
+        sim_dispatch();
+    } else
+        sim_dispatch();
+}
+
+void sim_run (uint64_t cycles)
+{
+    uint64_t end = sim_now + cycles, t;
+
+    sim_dispatch();
+
+    while(sim_now < end) {
+        t = next_event();
+        sim_now = t < end ? t : end;
+        sim_dispatch();
+    }
+}
+
+bool sim_run_until (bool (*cond)(void), uint64_t timeout)
+{
+    uint64_t end = sim_now + timeout, t;
+    bool ok;
+
+    sim_dispatch();
+
+    while(!(ok = cond()) && sim_now < end) {
+        t = next_event();
+        sim_now = t < end ? t : end;
+        sim_dispatch();
+    }
+
+    return ok;
+}
+
+const sim_irq_stats_t *sim_irq_stats (IRQn_Type irq)
+{
+    return &irq_stats[vector(irq)];
+}
+
+void sim_irq_stats_reset (void)
+{
+    memset(irq_stats, 0, sizeof(irq_stats));
+}
+
+//
+// Bus access for DMA
+//
+
+bool sim_bus_valid (uint32_t addr, uint32_t length)
+{
+    return addr >= 0x00400000UL && length <= 0xFFFFFFFFUL - addr;
+}
+
+uint32_t sim_bus_read (uint32_t addr, uint_fast8_t size)
+{
+    region_t *region = region_of(addr);
+    sim_periph_t *periph;
+    const volatile void *src = region ? sim_alias((void *)(uintptr_t)addr) : (void *)(uintptr_t)addr;
+    uint32_t value;
+
+    if(region && (periph = periph_of(addr)) && periph->read)
+        periph->read(periph, addr - periph->base);
+
+    value = size == 1 ? *(uint8_t *)src : (size == 2 ? *(uint16_t *)src : *(uint32_t *)src);
+
+    if(region && periph && periph->after_read)
+        periph->after_read(periph, addr - periph->base);
+
+    return value;
+}
+
+void sim_bus_write (uint32_t addr, uint32_t value, uint_fast8_t size)
+{
+    region_t *region = region_of(addr);
+    sim_periph_t *periph = region ? periph_of(addr) : NULL;
+    volatile void *dst = region ? (void *)sim_alias((void *)(uintptr_t)addr) : (void *)(uintptr_t)addr;
+    uint32_t old = region ? *alias32(addr) : 0;
+
+    if(size == 1)
+        *(uint8_t *)dst = (uint8_t)value;
+    else if(size == 2)
+        *(uint16_t *)dst = (uint16_t)value;
+    else
+        *(uint32_t *)dst = value;
+
+    if(periph && periph->write) {
+        sim_access_size = size;
+        periph->write(periph, (addr & ~3) - periph->base, old);
+    }
+}
+
+//
+// GPIO output log, written by the GPIO model
+//
+
+void sim_gpio_log (GPIO_TypeDef *port, uint32_t odr, uint32_t changed, bool dma)
+{
+    if(n_gpio_events == gpio_events_size) {
+        gpio_events_size = gpio_events_size ? gpio_events_size * 2 : 4096;
+        gpio_events = realloc(gpio_events, gpio_events_size * sizeof(sim_gpio_event_t));
+    }
+
+    gpio_events[n_gpio_events].time = sim_now;
+    gpio_events[n_gpio_events].port = port;
+    gpio_events[n_gpio_events].odr = odr;
+    gpio_events[n_gpio_events].changed = changed;
+    gpio_events[n_gpio_events].dma = dma;
+    n_gpio_events++;
+}
+
+uint32_t sim_gpio_events (const sim_gpio_event_t **events)
+{
+    *events = gpio_events;
+
+    return n_gpio_events;
+}
+
+void sim_gpio_clear_events (void)
+{
+    n_gpio_events = 0;
+}
+
+int64_t sim_gpio_edge (GPIO_TypeDef *port, uint32_t pin, bool level, uint32_t n)
+{
+    uint32_t idx;
+
+    for(idx = 0; idx < n_gpio_events; idx++) {
+        if(gpio_events[idx].port == port && (gpio_events[idx].changed & pin) && !!(gpio_events[idx].odr & pin) == level && n-- == 0)
+            return (int64_t)gpio_events[idx].time;
+    }
+
+    return -1;
+}
+
+//
+// Initialisation
+//
+
+static void map_regions (void)
+{
+    uint_fast8_t idx;
+    struct sigaction sa = {0};
+
+    for(idx = 0; idx < N_REGIONS; idx++) {
+        int fd = memfd_create("sim", 0);
+        void *addr = (void *)(uintptr_t)regions[idx].base;
+        if(fd < 0 || ftruncate(fd, regions[idx].size) ||
+            mmap(addr, regions[idx].size, regions[idx].prot, MAP_SHARED|MAP_FIXED_NOREPLACE, fd, 0) != addr ||
+             (regions[idx].alias = mmap(NULL, regions[idx].size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+            fprintf(stderr, "sim: cannot map register file at 0x%08X\n", regions[idx].base);
+            exit(2);
+        }
+        close(fd);
+    }
+
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_sigaction = on_segv;
+    sigaction(SIGSEGV, &sa, NULL);
+    sa.sa_sigaction = on_trap;
+    sigaction(SIGTRAP, &sa, NULL);
+
+    mapped = true;
+
+    traced(nothing, NULL);
+    count_overhead = instructions;
+}
+
+void sim_init (void)
+{
+    uint_fast8_t idx;
+
+    if(!mapped)
+        map_regions();
+
+    for(idx = 0; idx < N_REGIONS; idx++)
+        memset(regions[idx].alias, regions[idx].prot == PROT_READ ? 0xFF : 0, regions[idx].size);
+
+    sim_now = 0;
+    sim_reads = sim_writes = 0;
+    sim_primask = 0;
+    last_read = 0;
+    n_gpio_events = 0;
+    timed = false;
+
+    // HCLK 216 MHz, APB1 54 MHz, APB2 108 MHz, PLL and HSE ready.
+    SIM_REG(RCC->CR) = RCC_CR_HSION|RCC_CR_HSIRDY|RCC_CR_HSEON|RCC_CR_HSERDY|RCC_CR_PLLON|RCC_CR_PLLRDY;
+    SIM_REG(RCC->CFGR) = RCC_CFGR_SWS_PLL|RCC_CFGR_PPRE1_DIV4|RCC_CFGR_PPRE2_DIV2;
+    SystemCoreClock = SIM_HCLK;
+
+    for(idx = 0; idx < n_periphs; idx++) {
+        if(periphs[idx]->reset)
+            periphs[idx]->reset(periphs[idx]);
+    }
+
+    sim_irq_stats_reset();
+}
+
+__attribute__((constructor(200))) static void sim_constructor (void)
+{
+    sim_attach(&scs);
+    sim_init();
+}
+
+// HAL time base from simulated time, waits let time pass.
+
+uint32_t HAL_GetTick (void)
+{
+    return (uint32_t)(sim_now / (SIM_HCLK / 1000UL));
+}
+
+void HAL_Delay (uint32_t ms)
+{
+    uint64_t end = sim_now + (uint64_t)ms * (SIM_HCLK / 1000UL);
+
+    while(sim_now < end)
+        sim_wfi();
+}
+
+// Runs fn on a stack in the low 4 GB of the address space, for code under test that has DMA
+// transfer to or from buffers on the stack.
+
+void sim_call_on_low_stack (void (*fn)(void))
+{
+    static uint8_t stack[1024 * 1024] __attribute__((aligned(16)));
+    static ucontext_t caller, callee;
+
+    getcontext(&callee);
+    callee.uc_stack.ss_sp = stack;
+    callee.uc_stack.ss_size = sizeof(stack);
+    callee.uc_link = &caller;
+    makecontext(&callee, fn, 0);
+    swapcontext(&caller, &callee);
+}
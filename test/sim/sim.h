@@ -0,0 +1,336 @@
+/*
+
+  sim.h - STM32F756 register level simulator for host builds of the driver code
+
+  The peripheral address ranges are mapped at their real addresses without access rights, each
+  access from the code under test faults, is single stepped and handed to the peripheral models.
+  The models see every register read and write with a simulated cycle timestamp, registers without
+  a model behave as memory. The flash array is readable, writes to it are handled by the flash
+  controller model.
+
+  Simulated time advances with register accesses, and with the executed instructions while
+  interrupt handlers are timed. Interrupts are taken in sim_run(), sim_wfi() (__WFI()) and when
+  unmasked by __enable_irq(), not asynchronously, in priority order with tail chaining and no
+  preemption.
+
+  Test code and models access registers through SIM_REG(), which does not fault.
+
+  NOTE: x86-64 Linux only, test binaries must be linked non-PIE so that the addresses of static
+        buffers written to DMA address registers fit in 32 bits. Code with DMA to buffers on the
+        stack must run on a low stack, see sim_call_on_low_stack().
+
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "main.h"
+
+#define SIM_HCLK            216000000UL
+#define SIM_CYCLES_PER_US   (SIM_HCLK / 1000000UL)
+#define SIM_ACCESS_CYCLES   2           // cost of a register access
+
+// Register access without faulting, e.g. SIM_REG(GPIOE->IDR) = 0.
+#define SIM_REG(reg) (*(__typeof__(reg) *)sim_alias((const volatile void *)&(reg)))
+
+typedef struct sim_periph sim_periph_t;
+
+// Peripheral model, registered with sim_attach(). All hooks are optional and run in signal
+// handler context: they may only use the SIM_REG() view of the registers and the model state.
+struct sim_periph {
+    const char *name;
+    uint32_t base;
+    uint32_t size;
+    void (*reset)(sim_periph_t *p);
+    void (*read)(sim_periph_t *p, uint32_t offset);                 // before a read, may update the register
+    void (*after_read)(sim_periph_t *p, uint32_t offset);           // after a read, e.g. clear on read
+    void (*write)(sim_periph_t *p, uint32_t offset, uint32_t old);  // after a write, old is the previous register word
+    uint64_t (*next_event)(sim_periph_t *p);                        // time of the next internal event, UINT64_MAX if none
+    void (*event)(sim_periph_t *p);                                 // process events due at the current time
+    bool (*dma_request)(sim_periph_t *p, uint32_t request);          // true while the request line is asserted
+    bool (*polled)(sim_periph_t *p, uint32_t offset);               // true if read in wait loops, NULL for all registers
+    void *state;
+};
+
+typedef struct {
+    uint64_t time;
+    GPIO_TypeDef *port;
+    uint32_t odr;           // output data register after the change
+    uint32_t changed;       // pins changed
+    bool dma;               // written by DMA
+} sim_gpio_event_t;
+
+typedef struct {
+    uint32_t count;         // number of handler invocations
+    uint64_t cycles;        // total instructions executed, only when handlers are timed
+    uint32_t max;
+    uint32_t last;
+} sim_irq_stats_t;
+
+extern uint64_t sim_now;
+extern volatile uint32_t sim_primask;
+
+// Maps the register file, installs the fault handlers and resets all models. Called from a
+// constructor, call again to reset the simulator between tests.
+void sim_init (void);
+void sim_attach (sim_periph_t *periph);
+const volatile void *sim_alias (const volatile void *reg);
+
+// Runs simulated time forward by cycles, taking interrupts as they become pending.
+void sim_run (uint64_t cycles);
+// Runs until cond() returns true or timeout cycles have passed, returns the last cond() value.
+bool sim_run_until (bool (*cond)(void), uint64_t timeout);
+// Takes pending interrupts, then runs time forward to the next event if none was taken.
+void sim_wfi (void);
+// Takes any pending interrupts.
+void sim_dispatch (void);
+// Advances time by cycles without taking interrupts, events are processed.
+void sim_advance (uint64_t cycles);
+
+// Runs fn on a stack in the low 4 GB so that DMA can reach buffers on the stack.
+void sim_call_on_low_stack (void (*fn)(void));
+
+// Handler timing: when enabled interrupt handlers are single stepped and each instruction counts
+// as one cycle, register accesses add SIM_ACCESS_CYCLES.
+void sim_time_isrs (bool on);
+// Counts the instructions executed by fn(arg), register accesses not included.
+uint32_t sim_count_instructions (void (*fn)(void *arg), void *arg);
+const sim_irq_stats_t *sim_irq_stats (IRQn_Type irq);
+void sim_irq_stats_reset (void);
+
+// DMA request lines, see the request mapping in sim_dma.c.
+typedef enum {
+    SIM_DMA_NONE = 0,
+    SIM_DMA_TIM8_UP,
+    SIM_DMA_USART1_RX,
+    SIM_DMA_USART1_TX,
+    SIM_DMA_USART3_RX,
+    SIM_DMA_USART3_TX,
+    SIM_DMA_SPI1_RX,
+    SIM_DMA_SPI1_TX,
+    SIM_DMA_SPI2_RX,
+    SIM_DMA_SPI2_TX,
+    SIM_DMA_SPI3_RX,
+    SIM_DMA_SPI3_TX,
+    SIM_DMA_SDMMC1,
+    SIM_DMA_N
+} sim_dma_request_t;
+
+// Set while the DMA model accesses the bus.
+extern bool sim_dma_access;
+
+// Interrupt request lines driven by the peripheral models, level sensitive.
+void sim_irq_line (IRQn_Type irq, bool level);
+bool sim_irq_enabled (IRQn_Type irq);
+// DMA requests: peripheral models call this when a request is raised, see sim_dma.c.
+void sim_dma_request (uint32_t request);
+// Registers the model whose dma_request hook reports a level sensitive request.
+void sim_dma_source (uint32_t request, sim_periph_t *periph);
+void sim_dma_service (void);
+
+// Bus access from models (DMA), goes through the peripheral models for register addresses.
+uint32_t sim_bus_read (uint32_t addr, uint_fast8_t size);
+void sim_bus_write (uint32_t addr, uint32_t value, uint_fast8_t size);
+bool sim_bus_valid (uint32_t addr, uint32_t length);
+
+// Size in bytes of the register write handed to a write hook, by the CPU or by DMA.
+extern uint_fast8_t sim_access_size;
+
+// Register access counters, reset by sim_init().
+extern uint32_t sim_reads, sim_writes;
+
+// GPIO output log, all ODR changes are recorded with the simulated time.
+void sim_gpio_log (GPIO_TypeDef *port, uint32_t odr, uint32_t changed, bool dma);
+uint32_t sim_gpio_events (const sim_gpio_event_t **events);
+void sim_gpio_clear_events (void);
+// Returns the time of the n'th (from 0) change of pin(s) to level, -1 if not found.
+int64_t sim_gpio_edge (GPIO_TypeDef *port, uint32_t pin, bool level, uint32_t n);
+// Drives input pins, edges are passed on to EXTI.
+void sim_gpio_input (GPIO_TypeDef *port, uint32_t pins, bool level);
+
+// USART1/USART3: received characters arrive back to back from now, transmitted characters are captured.
+void sim_usart_rx (USART_TypeDef *usart, const void *data, uint32_t length);
+uint32_t sim_usart_rx_pending (USART_TypeDef *usart);
+// Characters lost to overrun.
+uint32_t sim_usart_rx_lost (USART_TypeDef *usart);
+uint32_t sim_usart_tx (USART_TypeDef *usart, const uint8_t **data);
+void sim_usart_tx_clear (USART_TypeDef *usart);
+uint64_t sim_usart_char_time (USART_TypeDef *usart);
+
+// USB OTG FS device, see sim_usb.c. Replaces the PCD driver, only linked with USB tests.
+typedef struct {
+    uint32_t in_transfers;
+    uint32_t in_packets;
+    uint32_t zlps;
+    uint32_t out_packets;
+} sim_usb_stats_t;
+
+void sim_usb_connect (void);
+void sim_usb_disconnect (void);
+// Host latency in cycles: time from a transfer being started or an OUT endpoint armed to the host serving it.
+void sim_usb_latency (uint64_t cycles);
+void sim_usb_out (const void *data, uint32_t length);
+uint32_t sim_usb_out_pending (void);
+uint32_t sim_usb_in (const uint8_t **data);
+void sim_usb_in_clear (void);
+const sim_usb_stats_t *sim_usb_stats (void);
+void sim_usb_stats_reset (void);
+
+// SPI1-SPI3, see sim_spi.c. The device is called with each frame shifted out and returns the frame shifted in.
+void sim_spi_device (SPI_TypeDef *spi, uint8_t (*exchange)(uint8_t mosi));
+// Masks the receive DMA request while mask is true.
+void sim_spi_mask_rx_dma (SPI_TypeDef *spi, bool mask);
+uint32_t sim_spi_frames (SPI_TypeDef *spi);
+// Frames lost to receive FIFO overrun.
+uint32_t sim_spi_lost (SPI_TypeDef *spi);
+uint64_t sim_spi_frame_time (SPI_TypeDef *spi);
+
+// CRC calculation unit, see sim_crc.c.
+typedef struct {
+    uint32_t bytes;             // data bytes written to DR
+    uint32_t resets;            // CR RESET writes
+} sim_crc_stats_t;
+
+const sim_crc_stats_t *sim_crc_stats (void);
+void sim_crc_stats_reset (void);
+
+// Embedded flash, see sim_flash.c.
+typedef struct {
+    uint32_t erases[8];         // sector erases by sector number
+    uint32_t programs;          // program operations
+    uint32_t overwrites;        // programs to a word that was not erased
+    uint32_t errors;            // operations rejected
+    uint64_t max_busy;          // longest operation in cycles, code in flash cannot be fetched meanwhile
+} sim_flash_stats_t;
+
+// The power fails when ops more program or erase operations have been started.
+void sim_flash_power_fail (uint32_t ops);
+bool sim_flash_powered (void);
+const sim_flash_stats_t *sim_flash_stats (void);
+void sim_flash_stats_reset (void);
+
+// 24LC series I2C EEPROM on I2C1 or I2C2, see sim_eeprom.c. Replaces the HAL I2C driver, only linked with EEPROM tests.
+typedef struct {
+    uint32_t write_cycles;      // page writes, each starts an internal write cycle
+    uint32_t bytes_written;
+    uint32_t wraps;             // writes that wrapped around to the start of the page
+    uint32_t reads;
+    uint32_t nacks;             // transfers not acknowledged, device busy or failing
+    uint32_t polls;             // ready polls not acknowledged
+} sim_eeprom_stats_t;
+
+// Resets the device to erased, sizes up to 2 KB use the 24LC16 block addressing with a single word address byte.
+void sim_eeprom_insert (uint32_t size, uint32_t page_size);
+uint8_t *sim_eeprom_data (void);
+// The next writes transfers fail, not acknowledged by the device.
+void sim_eeprom_fail_writes (uint32_t writes);
+uint64_t sim_eeprom_byte_time (void);
+const sim_eeprom_stats_t *sim_eeprom_stats (void);
+void sim_eeprom_stats_reset (void);
+
+// SD card in SPI mode, see sim_sdcard.c.
+typedef enum {
+    SIM_SD_MMC = 0,
+    SIM_SD_V1,
+    SIM_SD_V2,              // SD v2 standard capacity, byte addressing
+    SIM_SD_HC               // SDHC, block addressing
+} sim_sd_type_t;
+
+typedef struct {
+    uint32_t cmds[64];          // commands executed by index
+    uint32_t cmd_crc_errors;
+    uint32_t data_crc_errors;   // written blocks rejected with a CRC error
+    uint32_t blocks_read;
+    uint32_t blocks_written;
+    uint32_t multiple_reads;    // CMD18
+    uint32_t multiple_writes;   // CMD25
+    uint32_t stops;             // multiple block reads stopped by CMD12
+    uint32_t stop_tokens;       // multiple block writes stopped by the stop token
+    uint32_t busy_periods;
+    uint32_t busy_frames;       // frames clocked while busy
+    uint32_t protocol_errors;
+} sim_sd_stats_t;
+
+// Inserts a card of sectors 512 byte blocks on spi, selected by cs_pin low, the card is erased.
+void sim_sd_insert (SPI_TypeDef *spi, GPIO_TypeDef *cs_port, uint32_t cs_pin, sim_sd_type_t type, uint32_t sectors);
+uint8_t *sim_sd_data (void);
+// The CSD may be changed, sim_sd_update_csd() updates its CRC.
+uint8_t *sim_sd_csd (void);
+void sim_sd_update_csd (void);
+// Busy time after each written block and the stop token.
+void sim_sd_busy_time (uint64_t cycles);
+// Makes the card busy for cycles from now.
+void sim_sd_busy_now (uint64_t cycles);
+// 0xFF frames before a read data token.
+void sim_sd_read_latency (uint32_t frames);
+// The next blocks read are sent with a bit error, the next blocks written are received with one.
+void sim_sd_corrupt_reads (uint32_t blocks);
+void sim_sd_corrupt_writes (uint32_t blocks);
+// CRC checking enabled by CMD59 supported, default on. When off CMD59 is an illegal command.
+void sim_sd_crc_support (bool supported);
+const sim_sd_stats_t *sim_sd_stats (void);
+void sim_sd_stats_reset (void);
+
+// SDMMC1 with an SD card in SD bus mode, see sim_sdmmc.c. The card types are those of the SPI mode model.
+typedef struct {
+    uint32_t cmds[64];          // commands executed by index
+    uint32_t acmds[64];         // application commands executed by index
+    uint32_t blocks_read;       // blocks received by the host
+    uint32_t blocks_written;
+    uint32_t multiple_reads;    // CMD18
+    uint32_t multiple_writes;   // CMD25
+    uint32_t stops;             // CMD12
+    uint32_t busy_periods;
+    uint32_t crc_errors;        // data blocks failing the CRC check
+    uint32_t overruns;          // receive FIFO full, or written while not transmitting
+    uint32_t underruns;         // transmit FIFO empty
+    uint32_t timeouts;          // data timer expired
+    uint32_t overclocks;        // commands or blocks at a clock above the card's maximum
+    uint32_t width_errors;      // blocks with a host bus width different from the card's
+    uint32_t protocol_errors;
+} sim_sdmmc_stats_t;
+
+// Inserts a card of sectors 512 byte blocks, the card is erased. No card if sectors is 0.
+void sim_sdmmc_insert (sim_sd_type_t type, uint32_t sectors);
+uint8_t *sim_sdmmc_data (void);
+// High speed mode supported by CMD6, default on for SD v2 and SDHC cards.
+void sim_sdmmc_high_speed (bool supported);
+// Card busy time after each block written.
+void sim_sdmmc_busy_time (uint64_t cycles);
+// Time from the read command response to the first data block.
+void sim_sdmmc_read_latency (uint64_t cycles);
+// The next blocks read are sent with a bit error, the next blocks written are received with one.
+void sim_sdmmc_corrupt_reads (uint32_t blocks);
+void sim_sdmmc_corrupt_writes (uint32_t blocks);
+// SDMMC_CK frequency, 0 if the clock is off.
+uint32_t sim_sdmmc_clock (void);
+// Bus width set on the card by ACMD6.
+uint32_t sim_sdmmc_bus_width (void);
+const sim_sdmmc_stats_t *sim_sdmmc_stats (void);
+void sim_sdmmc_stats_reset (void);
+
+// ETH MAC and DMA with the PHY on a 100 Mbit/s link, see sim_eth.c.
+typedef struct {
+    uint32_t tx_frames;
+    uint32_t tx_bytes;
+    uint32_t tx_gathered;       // frames transmitted from more than one descriptor
+    uint32_t tx_underflows;     // frames not completely owned by the DMA when fetched
+    uint32_t rx_frames;         // frames written to receive descriptors
+    uint32_t rx_missed;         // frames lost, no descriptor available
+    uint32_t desc_changed;      // descriptors changed by the CPU while owned by the DMA
+    uint32_t bus_errors;        // buffer addresses outside memory
+} sim_eth_stats_t;
+
+// Queues a frame, without FCS, to arrive back to back after those already queued.
+void sim_eth_rx (const void *frame, uint32_t length);
+uint32_t sim_eth_rx_pending (void);
+// Called with each frame transmitted, at the end of its transmission.
+void sim_eth_on_tx (void (*on_tx)(const uint8_t *frame, uint32_t length));
+bool sim_eth_tx_busy (void);
+// Wire time of a frame of length bytes, without FCS.
+uint64_t sim_eth_frame_time (uint32_t length);
+const sim_eth_stats_t *sim_eth_stats (void);
+void sim_eth_stats_reset (void);
@@ -0,0 +1,107 @@
+/*
+
+  sim_crc.c - CRC calculation unit model
+
+  DR holds the CRC of the data written to it since the last reset by CR RESET, which loads it
+  from INIT, as does a write to INIT. Data is shifted in MSB first through the POL polynomial of
+  the POLYSIZE width, 8, 16 or 32 bits per write depending on the access size. The reversal of
+  the input and output bit order by CR REV_IN and REV_OUT is not modelled.
+
+*/
+
+#include <string.h>
+
+#include "sim.h"
+
+static struct {
+    uint32_t crc;
+    sim_crc_stats_t stats;
+} unit;
+
+static sim_periph_t periph;
+
+static uint_fast8_t poly_bits (void)
+{
+    static const uint_fast8_t bits[] = { 32, 16, 8, 7 };
+
+    return bits[(SIM_REG(CRC->CR) & CRC_CR_POLYSIZE_Msk) >> CRC_CR_POLYSIZE_Pos];
+}
+
+static uint32_t poly_mask (void)
+{
+    return poly_bits() == 32 ? 0xFFFFFFFFUL : (1UL << poly_bits()) - 1;
+}
+
+static void crc_update (uint32_t data, uint_fast8_t size)
+{
+    uint_fast8_t bits = poly_bits(), bit = size * 8;
+    uint32_t pol = SIM_REG(CRC->POL) & poly_mask(), crc = unit.crc;
+
+    while(bit--) {
+        bool feedback = ((crc >> (bits - 1)) ^ (data >> bit)) & 1;
+        crc = (crc << 1) & poly_mask();
+        if(feedback)
+            crc ^= pol;
+    }
+
+    unit.crc = crc;
+    unit.stats.bytes += size;
+}
+
+static void crc_write (sim_periph_t *p, uint32_t offset, uint32_t old)
+{
+    switch(offset) {
+
+        case offsetof(CRC_TypeDef, DR):;
+            uint32_t dr = SIM_REG(CRC->DR);
+            if(sim_access_size == 1)
+                crc_update(dr & 0xFF, 1);
+            else if(sim_access_size == 2)
+                crc_update(dr & 0xFFFF, 2);
+            else
+                crc_update(dr, 4);
+            break;
+
+        case offsetof(CRC_TypeDef, CR):
+            if(SIM_REG(CRC->CR) & CRC_CR_RESET) {
+                SIM_REG(CRC->CR) &= ~CRC_CR_RESET; // cleared by hardware
+                unit.crc = SIM_REG(CRC->INIT) & poly_mask();
+                unit.stats.resets++;
+            }
+            break;
+
+        case offsetof(CRC_TypeDef, INIT):
+            unit.crc = SIM_REG(CRC->INIT) & poly_mask();
+            break;
+    }
+
+    SIM_REG(CRC->DR) = unit.crc;
+}
+
+static void crc_reset (sim_periph_t *p)
+{
+    memset(&unit, 0, sizeof(unit));
+
+    SIM_REG(CRC->DR) = SIM_REG(CRC->INIT) = unit.crc = 0xFFFFFFFFUL;
+    SIM_REG(CRC->POL) = 0x04C11DB7UL;
+}
+
+const sim_crc_stats_t *sim_crc_stats (void)
+{
+    return &unit.stats;
+}
+
+void sim_crc_stats_reset (void)
+{
+    memset(&unit.stats, 0, sizeof(sim_crc_stats_t));
+}
+
+__attribute__((constructor(150))) static void sim_crc_attach (void)
+{
+    periph.name = "CRC";
+    periph.base = CRC_BASE;
+    periph.size = 0x400;
+    periph.reset = crc_reset;
+    periph.write = crc_write;
+    sim_attach(&periph);
+}
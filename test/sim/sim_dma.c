@@ -0,0 +1,276 @@
+/*
+
+  sim_dma.c - DMA1/DMA2 stream model
+
+  Peripheral to memory and memory to peripheral transfers in direct mode, one data item of
+  the peripheral size per request, normal and circular mode, half transfer, transfer complete
+  and transfer error flags and interrupts. Memory to memory transfers complete when enabled.
+  Clearing EN of an active stream sets the transfer complete flag as on the real controller.
+
+  Requests are either pulses, e.g. a timer update, raised with sim_dma_request(), or levels
+  reported by the dma_request hook of the peripheral model registered for the request.
+
+*/
+
+#include <string.h>
+
+#include "sim.h"
+
+typedef struct {
+    uint32_t request;
+    DMA_TypeDef *dma;
+    uint8_t stream;
+    uint8_t channel;
+} dma_map_t;
+
+static const dma_map_t map[] = {
+    { SIM_DMA_TIM8_UP,   DMA2, 1, 7 },
+    { SIM_DMA_USART1_RX, DMA2, 2, 4 },
+    { SIM_DMA_USART1_RX, DMA2, 5, 4 },
+    { SIM_DMA_USART1_TX, DMA2, 7, 4 },
+    { SIM_DMA_USART3_RX, DMA1, 1, 4 },
+    { SIM_DMA_USART3_TX, DMA1, 3, 4 },
+    { SIM_DMA_USART3_TX, DMA1, 4, 7 },
+    { SIM_DMA_SPI1_RX,   DMA2, 0, 3 },
+    { SIM_DMA_SPI1_RX,   DMA2, 2, 3 },
+    { SIM_DMA_SPI1_TX,   DMA2, 3, 3 },
+    { SIM_DMA_SPI1_TX,   DMA2, 5, 3 },
+    { SIM_DMA_SPI2_RX,   DMA1, 3, 0 },
+    { SIM_DMA_SPI2_TX,   DMA1, 4, 0 },
+    { SIM_DMA_SPI3_RX,   DMA1, 0, 0 },
+    { SIM_DMA_SPI3_RX,   DMA1, 2, 0 },
+    { SIM_DMA_SPI3_TX,   DMA1, 5, 0 },
+    { SIM_DMA_SPI3_TX,   DMA1, 7, 0 },
+    { SIM_DMA_SDMMC1,    DMA2, 3, 4 },
+    { SIM_DMA_SDMMC1,    DMA2, 6, 4 }
+};
+
+#define N_MAP (sizeof(map) / sizeof(dma_map_t))
+
+typedef struct {
+    bool active;
+    uint32_t par, mar;      // current addresses
+    uint32_t total;         // NDTR at enable
+} stream_state_t;
+
+static stream_state_t streams[2][8];
+static uint32_t pulses[SIM_DMA_N];
+static sim_periph_t *sources[SIM_DMA_N];
+
+static const uint8_t flag_shift[4] = { 0, 6, 16, 22 };
+
+static const IRQn_Type stream_irq[2][8] = {
+    { DMA1_Stream0_IRQn, DMA1_Stream1_IRQn, DMA1_Stream2_IRQn, DMA1_Stream3_IRQn,
+      DMA1_Stream4_IRQn, DMA1_Stream5_IRQn, DMA1_Stream6_IRQn, DMA1_Stream7_IRQn },
+    { DMA2_Stream0_IRQn, DMA2_Stream1_IRQn, DMA2_Stream2_IRQn, DMA2_Stream3_IRQn,
+      DMA2_Stream4_IRQn, DMA2_Stream5_IRQn, DMA2_Stream6_IRQn, DMA2_Stream7_IRQn }
+};
+
+bool sim_dma_access = false;
+
+static inline uint_fast8_t ctrl (DMA_TypeDef *dma)
+{
+    return dma == DMA2 ? 1 : 0;
+}
+
+static inline DMA_Stream_TypeDef *stream_regs (DMA_TypeDef *dma, uint_fast8_t stream)
+{
+    return (DMA_Stream_TypeDef *)((uintptr_t)dma + 0x10 + 0x18 * stream);
+}
+
+static inline volatile uint32_t *isr (DMA_TypeDef *dma, uint_fast8_t stream)
+{
+    return stream < 4 ? &SIM_REG(dma->LISR) : &SIM_REG(dma->HISR);
+}
+
+static void dma_irq_line (DMA_TypeDef *dma, uint_fast8_t stream)
+{
+    DMA_Stream_TypeDef *s = stream_regs(dma, stream);
+    uint32_t flags = (*isr(dma, stream) >> flag_shift[stream & 3]) & 0x3D, cr = SIM_REG(s->CR), enabled = 0;
+
+    if(cr & DMA_SxCR_TCIE)
+        enabled |= DMA_LISR_TCIF0;
+    if(cr & DMA_SxCR_HTIE)
+        enabled |= DMA_LISR_HTIF0;
+    if(cr & DMA_SxCR_TEIE)
+        enabled |= DMA_LISR_TEIF0;
+    if(cr & DMA_SxCR_DMEIE)
+        enabled |= DMA_LISR_DMEIF0;
+    if(SIM_REG(s->FCR) & DMA_SxFCR_FEIE)
+        enabled |= DMA_LISR_FEIF0;
+
+    sim_irq_line(stream_irq[ctrl(dma)][stream], !!(flags & enabled));
+}
+
+static inline void set_flags (DMA_TypeDef *dma, uint_fast8_t stream, uint32_t flags)
+{
+    *isr(dma, stream) |= flags << flag_shift[stream & 3];
+}
+
+static void stream_stop (DMA_TypeDef *dma, uint_fast8_t stream)
+{
+    SIM_REG(stream_regs(dma, stream)->CR) &= ~DMA_SxCR_EN;
+    streams[ctrl(dma)][stream].active = false;
+}
+
+// Transfers one data item, returns false on a transfer error.
+static bool transfer (DMA_TypeDef *dma, uint_fast8_t stream)
+{
+    stream_state_t *st = &streams[ctrl(dma)][stream];
+    DMA_Stream_TypeDef *s = stream_regs(dma, stream);
+    uint32_t cr = SIM_REG(s->CR), ndtr = SIM_REG(s->NDTR), value;
+    uint_fast8_t psize = 1 << ((cr & DMA_SxCR_PSIZE) >> DMA_SxCR_PSIZE_Pos); // memory side is packed to the peripheral size
+    uint32_t src, dst, dir = cr & DMA_SxCR_DIR;
+
+    src = dir == 0 ? st->par : st->mar;
+    dst = dir == 0 ? st->mar : st->par;
+
+    if(!sim_bus_valid(src, psize) || !sim_bus_valid(dst, psize)) {
+        set_flags(dma, stream, DMA_LISR_TEIF0);
+        stream_stop(dma, stream);
+        dma_irq_line(dma, stream);
+        return false;
+    }
+
+    sim_dma_access = true;
+    value = sim_bus_read(src, psize);
+    sim_bus_write(dst, value, psize);
+    sim_dma_access = false;
+
+    if(cr & DMA_SxCR_PINC)
+        st->par += psize;
+    if(cr & DMA_SxCR_MINC)
+        st->mar += psize;
+
+    SIM_REG(s->NDTR) = --ndtr;
+
+    if(ndtr == st->total / 2)
+        set_flags(dma, stream, DMA_LISR_HTIF0);
+
+    if(ndtr == 0) {
+        set_flags(dma, stream, DMA_LISR_TCIF0);
+        if(cr & DMA_SxCR_CIRC) {
+            SIM_REG(s->NDTR) = st->total;
+            st->par = SIM_REG(s->PAR);
+            st->mar = SIM_REG(s->M0AR);
+        } else
+            stream_stop(dma, stream);
+    }
+
+    dma_irq_line(dma, stream);
+
+    return true;
+}
+
+static void stream_enable (DMA_TypeDef *dma, uint_fast8_t stream)
+{
+    stream_state_t *st = &streams[ctrl(dma)][stream];
+    DMA_Stream_TypeDef *s = stream_regs(dma, stream);
+
+    st->active = true;
+    st->par = SIM_REG(s->PAR);
+    st->mar = SIM_REG(s->M0AR);
+    st->total = SIM_REG(s->NDTR);
+
+    if(st->total == 0)
+        stream_stop(dma, stream);
+    else if((SIM_REG(s->CR) & DMA_SxCR_DIR) == DMA_SxCR_DIR_1) {
+        // Memory to memory: PAR is the source.
+        while(st->active && transfer(dma, stream));
+    }
+}
+
+void sim_dma_request (uint32_t request)
+{
+    if(request < SIM_DMA_N)
+        pulses[request]++;
+}
+
+void sim_dma_source (uint32_t request, sim_periph_t *periph)
+{
+    if(request < SIM_DMA_N)
+        sources[request] = periph;
+}
+
+void sim_dma_service (void)
+{
+    static bool busy = false;
+
+    bool progress;
+    uint_fast8_t idx;
+
+    if(busy)
+        return;
+
+    busy = true;
+
+    do {
+        progress = false;
+        for(idx = 0; idx < N_MAP; idx++) {
+            const dma_map_t *m = &map[idx];
+            DMA_Stream_TypeDef *s = stream_regs(m->dma, m->stream);
+            uint32_t cr = SIM_REG(s->CR);
+            if(!(cr & DMA_SxCR_EN) || ((cr & DMA_SxCR_CHSEL) >> DMA_SxCR_CHSEL_Pos) != m->channel || !streams[ctrl(m->dma)][m->stream].active)
+                continue;
+            if(pulses[m->request]) {
+                pulses[m->request]--;
+                progress |= transfer(m->dma, m->stream);
+            } else if(sources[m->request] && sources[m->request]->dma_request(sources[m->request], m->request))
+                progress |= transfer(m->dma, m->stream);
+        }
+    } while(progress);
+
+    // Pulses without an enabled stream are lost.
+    memset(pulses, 0, sizeof(pulses));
+
+    busy = false;
+}
+
+static void dma_write (sim_periph_t *p, uint32_t offset, uint32_t old)
+{
+    DMA_TypeDef *dma = (DMA_TypeDef *)(uintptr_t)p->base;
+    uint_fast8_t stream;
+
+    if(offset == offsetof(DMA_TypeDef, LIFCR) || offset == offsetof(DMA_TypeDef, HIFCR)) {
+        volatile uint32_t *ifcr = (volatile uint32_t *)((uint8_t *)&SIM_REG(*dma) + offset);
+        if(offset == offsetof(DMA_TypeDef, LIFCR))
+            SIM_REG(dma->LISR) &= ~*ifcr;
+        else
+            SIM_REG(dma->HISR) &= ~*ifcr;
+        *ifcr = 0;
+        for(stream = 0; stream < 8; stream++)
+            dma_irq_line(dma, stream);
+    } else if(offset == offsetof(DMA_TypeDef, LISR) || offset == offsetof(DMA_TypeDef, HISR)) {
+        *(volatile uint32_t *)((uint8_t *)&SIM_REG(*dma) + offset) = old; // read only
+    } else if(offset >= 0x10 && offset < 0x10 + 8 * 0x18) {
+        stream = (offset - 0x10) / 0x18;
+        if((offset - 0x10) % 0x18 == offsetof(DMA_Stream_TypeDef, CR)) {
+            uint32_t cr = SIM_REG(stream_regs(dma, stream)->CR);
+            if((cr & DMA_SxCR_EN) && !(old & DMA_SxCR_EN))
+                stream_enable(dma, stream);
+            else if(!(cr & DMA_SxCR_EN) && (old & DMA_SxCR_EN) && streams[ctrl(dma)][stream].active) {
+                streams[ctrl(dma)][stream].active = false;
+                set_flags(dma, stream, DMA_LISR_TCIF0);
+            }
+        } else if((offset - 0x10) % 0x18 == offsetof(DMA_Stream_TypeDef, NDTR) && (SIM_REG(stream_regs(dma, stream)->CR) & DMA_SxCR_EN))
+            SIM_REG(stream_regs(dma, stream)->NDTR) = old; // read only while enabled
+        dma_irq_line(dma, stream);
+    }
+}
+
+static void dma_reset (sim_periph_t *p)
+{
+    memset(streams[ctrl((DMA_TypeDef *)(uintptr_t)p->base)], 0, sizeof(streams[0]));
+    memset(pulses, 0, sizeof(pulses));
+}
+
+static sim_periph_t dma[2] = {
+    { .name = "DMA1", .base = DMA1_BASE, .size = 0x400, .reset = dma_reset, .write = dma_write },
+    { .name = "DMA2", .base = DMA2_BASE, .size = 0x400, .reset = dma_reset, .write = dma_write }
+};
+
+__attribute__((constructor(150))) static void sim_dma_attach (void)
+{
+    sim_attach(&dma[0]);
+    sim_attach(&dma[1]);
+}
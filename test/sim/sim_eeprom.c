@@ -0,0 +1,316 @@
+/*
+
+  sim_eeprom.c - 24LC series I2C EEPROM model at the HAL I2C driver interface
+
+  Replaces stm32f7xx_hal_i2c.c: the HAL_I2C_* functions called by the driver are implemented
+  here against a simulated EEPROM on a 400 kHz bus. Interrupt mode transfers complete from
+  I2C1/I2C2_EV_IRQHandler() or, when not acknowledged, I2C1/I2C2_ER_IRQHandler(), blocking
+  functions let simulated time pass for the bus transfer and take pending interrupts.
+
+  Device model:
+  - a write stores the data at the addressed page, bytes past the end of the page wrap around
+    to its start as on the real device. Each write starts a 5 ms internal write cycle during
+    which the device does not acknowledge its address.
+  - devices of up to 2 KB (24LC16 and smaller) are addressed by blocks of 256 bytes with the
+    low three bits of the device address and a single word address byte, larger devices with
+    two word address bytes at device address 0x50.
+
+*/
+
+#include <string.h>
+
+#include "sim.h"
+
+#define DEVICE_ADDRESS  0x50
+#define BUS_BYTE_CYCLES (9 * SIM_HCLK / 400000UL)  // 8 bits and ACK at 400 kHz
+#define WRITE_CYCLES    (5 * SIM_HCLK / 1000UL)
+#define MAX_SIZE        65536
+
+typedef struct {
+    bool active;
+    bool irq;
+    bool nack;
+    uint64_t done;
+    uint32_t addr;
+    uint8_t *data;
+    uint16_t count;
+} xfer_t;
+
+static struct {
+    I2C_HandleTypeDef *hi2c;
+    uint32_t size, page;
+    uint64_t write_until;       // end of internal write cycle
+    uint32_t fail_writes;
+    xfer_t xfer;                // interrupt mode transfer
+    sim_eeprom_stats_t stats;
+    uint8_t mem[MAX_SIZE];
+} eeprom;
+
+static sim_periph_t periph;
+
+static IRQn_Type ev_irq (I2C_HandleTypeDef *hi2c)
+{
+    return hi2c->Instance == I2C1 ? I2C1_EV_IRQn : I2C2_EV_IRQn;
+}
+
+static IRQn_Type er_irq (I2C_HandleTypeDef *hi2c)
+{
+    return hi2c->Instance == I2C1 ? I2C1_ER_IRQn : I2C2_ER_IRQn;
+}
+
+static uint32_t addr_bytes (void)
+{
+    return eeprom.size > 2048 ? 2 : 1;
+}
+
+// Returns true if the device acknowledges the 8 bit device address.
+static bool ack (uint16_t dev)
+{
+    dev >>= 1;
+
+    if(eeprom.size == 0 || sim_now < eeprom.write_until)
+        return false;
+
+    return addr_bytes() == 2 ? dev == DEVICE_ADDRESS : (dev & 0x78) == DEVICE_ADDRESS && (uint32_t)(dev & 0x07) << 8 < eeprom.size;
+}
+
+static uint32_t mem_addr (uint16_t dev, uint16_t word_addr)
+{
+    return addr_bytes() == 2 ? word_addr & (eeprom.size - 1) : ((uint32_t)((dev >> 1) & 0x07) << 8) | (word_addr & 0xFF);
+}
+
+// Returns true if the write is to be failed.
+static bool fail_write (void)
+{
+    if(eeprom.fail_writes) {
+        eeprom.fail_writes--;
+        return true;
+    }
+
+    return false;
+}
+
+static void write (uint32_t addr, const uint8_t *data, uint16_t count)
+{
+    uint32_t base = addr & ~(eeprom.page - 1), idx;
+
+    if((addr - base) + count > eeprom.page)
+        eeprom.stats.wraps++;
+
+    for(idx = 0; idx < count; idx++)
+        eeprom.mem[base + (addr - base + idx) % eeprom.page] = data[idx];
+
+    eeprom.stats.write_cycles++;
+    eeprom.stats.bytes_written += count;
+    eeprom.write_until = sim_now + WRITE_CYCLES;
+}
+
+static uint64_t eeprom_next (sim_periph_t *p)
+{
+    return eeprom.xfer.active && !eeprom.xfer.irq ? eeprom.xfer.done : UINT64_MAX;
+}
+
+static void eeprom_event (sim_periph_t *p)
+{
+    if(eeprom.xfer.active && !eeprom.xfer.irq && eeprom.xfer.done <= sim_now) {
+        eeprom.xfer.irq = true;
+        sim_irq_line(eeprom.xfer.nack ? er_irq(eeprom.hi2c) : ev_irq(eeprom.hi2c), true);
+    }
+}
+
+static void eeprom_reset (sim_periph_t *p)
+{
+    memset(&eeprom, 0, offsetof(typeof(eeprom), mem));
+}
+
+void sim_eeprom_insert (uint32_t size, uint32_t page_size)
+{
+    eeprom.size = size;
+    eeprom.page = page_size;
+    eeprom.write_until = 0;
+    eeprom.fail_writes = 0;
+    memset(eeprom.mem, 0xFF, size);
+    memset(&eeprom.stats, 0, sizeof(sim_eeprom_stats_t));
+}
+
+uint8_t *sim_eeprom_data (void)
+{
+    return eeprom.mem;
+}
+
+void sim_eeprom_fail_writes (uint32_t writes)
+{
+    eeprom.fail_writes = writes;
+}
+
+uint64_t sim_eeprom_byte_time (void)
+{
+    return BUS_BYTE_CYCLES;
+}
+
+const sim_eeprom_stats_t *sim_eeprom_stats (void)
+{
+    return &eeprom.stats;
+}
+
+void sim_eeprom_stats_reset (void)
+{
+    memset(&eeprom.stats, 0, sizeof(sim_eeprom_stats_t));
+}
+
+// HAL I2C driver interface
+
+HAL_StatusTypeDef HAL_I2C_Init (I2C_HandleTypeDef *hi2c)
+{
+    eeprom.hi2c = hi2c;
+    hi2c->State = HAL_I2C_STATE_READY;
+    hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+
+    return HAL_OK;
+}
+
+// The state changes from interrupt handlers, let time pass so that a polling loop sees it.
+HAL_I2C_StateTypeDef HAL_I2C_GetState (I2C_HandleTypeDef *hi2c)
+{
+    sim_run(SIM_ACCESS_CYCLES);
+
+    return hi2c->State;
+}
+
+uint32_t HAL_I2C_GetError (I2C_HandleTypeDef *hi2c)
+{
+    return hi2c->ErrorCode;
+}
+
+HAL_StatusTypeDef HAL_I2C_IsDeviceReady (I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint32_t Trials, uint32_t Timeout)
+{
+    if(hi2c->State != HAL_I2C_STATE_READY)
+        return HAL_BUSY;
+
+    while(Trials--) {
+        bool ready = ack(DevAddress);
+        sim_run(BUS_BYTE_CYCLES);
+        if(ready)
+            return HAL_OK;
+        eeprom.stats.polls++;
+    }
+
+    return HAL_ERROR;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read (I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize,
+                                     uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+    uint32_t addr, idx;
+
+    if(hi2c->State != HAL_I2C_STATE_READY)
+        return HAL_BUSY;
+
+    if(!ack(DevAddress)) {
+        sim_run(BUS_BYTE_CYCLES);
+        eeprom.stats.nacks++;
+        hi2c->ErrorCode = HAL_I2C_ERROR_AF;
+        return HAL_ERROR;
+    }
+
+    sim_run((2 + addr_bytes() + Size) * BUS_BYTE_CYCLES);
+
+    addr = mem_addr(DevAddress, MemAddress);
+    for(idx = 0; idx < Size; idx++)
+        pData[idx] = eeprom.mem[(addr + idx) % eeprom.size];
+
+    eeprom.stats.reads++;
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write (I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize,
+                                      uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+    if(hi2c->State != HAL_I2C_STATE_READY)
+        return HAL_BUSY;
+
+    if(!ack(DevAddress) || fail_write()) {
+        sim_run(BUS_BYTE_CYCLES);
+        eeprom.stats.nacks++;
+        hi2c->ErrorCode = HAL_I2C_ERROR_AF;
+        return HAL_ERROR;
+    }
+
+    sim_run((1 + addr_bytes() + Size) * BUS_BYTE_CYCLES);
+    write(mem_addr(DevAddress, MemAddress), pData, Size);
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write_IT (I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize,
+                                         uint8_t *pData, uint16_t Size)
+{
+    xfer_t *xfer = &eeprom.xfer;
+
+    if(hi2c->State != HAL_I2C_STATE_READY)
+        return HAL_BUSY;
+
+    eeprom.hi2c = hi2c;
+    hi2c->State = HAL_I2C_STATE_BUSY_TX;
+    hi2c->Mode = HAL_I2C_MODE_MEM;
+    hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+
+    xfer->active = true;
+    xfer->irq = false;
+    xfer->nack = !ack(DevAddress) || fail_write();
+    xfer->addr = mem_addr(DevAddress, MemAddress);
+    xfer->data = pData;
+    xfer->count = Size;
+    xfer->done = sim_now + (xfer->nack ? 1 : 1 + addr_bytes() + Size) * BUS_BYTE_CYCLES;
+
+    if(xfer->nack)
+        eeprom.stats.nacks++;
+
+    return HAL_OK;
+}
+
+void HAL_I2C_EV_IRQHandler (I2C_HandleTypeDef *hi2c)
+{
+    xfer_t *xfer = &eeprom.xfer;
+
+    if(xfer->active && xfer->irq && !xfer->nack) {
+        sim_irq_line(ev_irq(hi2c), false);
+        xfer->active = false;
+        write(xfer->addr, xfer->data, xfer->count);
+        hi2c->State = HAL_I2C_STATE_READY;
+        HAL_I2C_MemTxCpltCallback(hi2c);
+    }
+}
+
+void HAL_I2C_ER_IRQHandler (I2C_HandleTypeDef *hi2c)
+{
+    xfer_t *xfer = &eeprom.xfer;
+
+    if(xfer->active && xfer->irq && xfer->nack) {
+        sim_irq_line(er_irq(hi2c), false);
+        xfer->active = false;
+        hi2c->ErrorCode = HAL_I2C_ERROR_AF;
+        hi2c->State = HAL_I2C_STATE_READY;
+        HAL_I2C_ErrorCallback(hi2c);
+    }
+}
+
+__attribute__((weak)) void HAL_I2C_MemTxCpltCallback (I2C_HandleTypeDef *hi2c)
+{
+}
+
+__attribute__((weak)) void HAL_I2C_ErrorCallback (I2C_HandleTypeDef *hi2c)
+{
+}
+
+__attribute__((constructor(150))) static void sim_eeprom_attach (void)
+{
+    periph.name = "I2C EEPROM";
+    periph.base = I2C2_BASE;
+    periph.size = 0; // no register level model
+    periph.reset = eeprom_reset;
+    periph.next_event = eeprom_next;
+    periph.event = eeprom_event;
+    sim_attach(&periph);
+}
@@ -0,0 +1,502 @@
+/*
+
+  sim_eth.c - ETH MAC and DMA model with a LAN8742A PHY on a 100 Mbit/s full duplex link
+
+  The DMA walks the transmit and receive descriptor lists in memory, chained (TCH/RCH) or as
+  a ring. A frame occupies the wire for its length plus FCS, preamble and interframe gap,
+  minimum frame size 64 bytes.
+
+  Transmit: on DMAOMR ST or a transmit poll demand the DMA fetches the descriptors of the next
+  frame, FS to LS, all of which must be owned by the DMA. The frame data is read from the
+  buffers when transmission ends, then OWN is cleared in each descriptor and the next frame
+  is fetched. A descriptor not owned by the DMA suspends transmission with TBUS set until
+  the next poll demand. Descriptors changed by the CPU while owned by the DMA are counted.
+
+  Receive: frames queued by the test arrive back to back at wire speed and are written to the
+  buffers of the descriptors owned by the DMA, with the FCS. There is no receive FIFO: a frame
+  arriving while no descriptor is available is lost (counted), sets RBUS and suspends
+  reception until a receive poll demand.
+
+  The MII management interface completes PHY register accesses immediately, the PHY reports
+  link up with auto-negotiation complete, 100 Mbit/s full duplex.
+
+*/
+
+#include <string.h>
+
+#include "sim.h"
+
+#define WIRE_OVERHEAD   (4 + 8 + 12)    // FCS, preamble and SFD, interframe gap
+#define MIN_FRAME       60
+#define RX_QUEUE        256
+#define MAX_FRAME       1536
+#define MAX_SEGMENTS    32
+
+#define DMASR_W1C       0x0001E7FFUL    // TS - NIS, write 1 to clear
+#define DMASR_NORMAL    (ETH_DMASR_TS|ETH_DMASR_TBUS|ETH_DMASR_RS|ETH_DMASR_ERS)
+#define DMASR_ABNORMAL  (ETH_DMASR_TPSS|ETH_DMASR_TJTS|ETH_DMASR_ROS|ETH_DMASR_TUS|ETH_DMASR_RBUS|ETH_DMASR_RPSS|ETH_DMASR_RWTS|ETH_DMASR_ETS|ETH_DMASR_FBES)
+
+typedef struct {
+    uint32_t length;
+    uint8_t data[MAX_FRAME];
+} frame_t;
+
+typedef struct {
+    ETH_DMADescTypeDef *desc;
+    uint32_t buffer, size;      // as fetched
+} segment_t;
+
+static struct {
+    // transmitter
+    bool tx_on, tx_busy, tx_suspended;
+    uint32_t tx_desc;
+    uint64_t tx_done;
+    segment_t tx_seg[MAX_SEGMENTS];
+    uint32_t tx_segs, tx_len;
+    void (*on_tx)(const uint8_t *frame, uint32_t length);
+    // receiver
+    bool rx_on, rx_suspended;
+    uint32_t rx_desc;
+    uint32_t rx_head, rx_count;
+    uint64_t rx_next;           // arrival time of the next frame, end of its last byte
+    // PHY
+    uint16_t phy[32];
+    sim_eth_stats_t stats;
+    frame_t rx[RX_QUEUE];
+} eth;
+
+static sim_periph_t periph;
+
+static uint64_t wire_cycles (uint32_t length)
+{
+    return (uint64_t)((length < MIN_FRAME ? MIN_FRAME : length) + WIRE_OVERHEAD) * 8 * SIM_CYCLES_PER_US / 100;
+}
+
+static uint32_t crc32 (const uint8_t *data, uint32_t length)
+{
+    uint32_t crc = 0xFFFFFFFFUL;
+    uint_fast8_t bit;
+
+    while(length--) {
+        crc ^= *data++;
+        for(bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320UL & -(crc & 1));
+    }
+
+    return ~crc;
+}
+
+static ETH_DMADescTypeDef *desc_at (uint32_t addr)
+{
+    return (ETH_DMADescTypeDef *)(uintptr_t)addr;
+}
+
+static uint32_t next_desc (uint32_t addr, bool chained, bool end, uint32_t base)
+{
+    ETH_DMADescTypeDef *desc = desc_at(addr);
+
+    if(chained)
+        return desc->Buffer2NextDescAddr;
+
+    return end ? base : addr + (SIM_REG(ETH->DMABMR) & ETH_DMABMR_EDE ? 32 : 16);
+}
+
+static uint32_t next_tx (uint32_t addr)
+{
+    uint32_t status = desc_at(addr)->Status;
+
+    return next_desc(addr, !!(status & ETH_DMATXDESC_TCH), !!(status & ETH_DMATXDESC_TER), SIM_REG(ETH->DMATDLAR));
+}
+
+static uint32_t next_rx (uint32_t addr)
+{
+    uint32_t control = desc_at(addr)->ControlBufferSize;
+
+    return next_desc(addr, !!(control & ETH_DMARXDESC_RCH), !!(control & ETH_DMARXDESC_RER), SIM_REG(ETH->DMARDLAR));
+}
+
+static void update_irq (void)
+{
+    uint32_t sr = SIM_REG(ETH->DMASR), ier = SIM_REG(ETH->DMAIER);
+
+    if(sr & DMASR_NORMAL)
+        sr |= ETH_DMASR_NIS;
+    if(sr & DMASR_ABNORMAL)
+        sr |= ETH_DMASR_AIS;
+
+    SIM_REG(ETH->DMASR) = sr;
+
+    sim_irq_line(ETH_IRQn, !!(sr & ier & (ETH_DMASR_NIS|ETH_DMASR_AIS)) &&
+                            (((ier & ETH_DMAIER_NISE) && (sr & ier & DMASR_NORMAL)) ||
+                              ((ier & ETH_DMAIER_AISE) && (sr & ier & DMASR_ABNORMAL))));
+}
+
+static void bus_error (void)
+{
+    eth.stats.bus_errors++;
+    eth.tx_on = eth.rx_on = false;
+    SIM_REG(ETH->DMASR) |= ETH_DMASR_FBES;
+    update_irq();
+}
+
+//
+// Transmitter
+//
+
+// Fetches the descriptors of the next frame and starts transmitting it.
+static void tx_fetch (void)
+{
+    uint32_t addr = eth.tx_desc, status;
+    ETH_DMADescTypeDef *desc;
+
+    eth.tx_segs = eth.tx_len = 0;
+
+    do {
+        desc = desc_at(addr);
+        status = desc->Status;
+
+        if(!(status & ETH_DMATXDESC_OWN) || eth.tx_segs == MAX_SEGMENTS) {
+            if(eth.tx_segs)
+                eth.stats.tx_underflows++; // frame incomplete when fetched
+            eth.tx_suspended = true;
+            SIM_REG(ETH->DMASR) |= ETH_DMASR_TBUS;
+            update_irq();
+            return;
+        }
+
+        if(eth.tx_segs == 0 && !(status & ETH_DMATXDESC_FS)) {
+            eth.stats.tx_underflows++;
+            eth.tx_suspended = true;
+            SIM_REG(ETH->DMASR) |= ETH_DMASR_TBUS;
+            update_irq();
+            return;
+        }
+
+        eth.tx_seg[eth.tx_segs].desc = desc;
+        eth.tx_seg[eth.tx_segs].buffer = desc->Buffer1Addr;
+        eth.tx_seg[eth.tx_segs].size = desc->ControlBufferSize & ETH_DMATXDESC_TBS1;
+        eth.tx_len += eth.tx_seg[eth.tx_segs++].size;
+
+        addr = next_tx(addr);
+
+    } while(!(status & ETH_DMATXDESC_LS));
+
+    eth.tx_busy = true;
+    eth.tx_suspended = false;
+    eth.tx_done = sim_now + wire_cycles(eth.tx_len);
+}
+
+static void tx_complete (void)
+{
+    static uint8_t frame[MAX_SEGMENTS * 0x2000];
+
+    uint32_t idx, length = 0;
+    bool ic = false;
+
+    eth.tx_busy = false;
+
+    for(idx = 0; idx < eth.tx_segs; idx++) {
+        segment_t *seg = &eth.tx_seg[idx];
+        if(seg->desc->Buffer1Addr != seg->buffer || (seg->desc->ControlBufferSize & ETH_DMATXDESC_TBS1) != seg->size ||
+            !(seg->desc->Status & ETH_DMATXDESC_OWN))
+            eth.stats.desc_changed++;
+        if(!sim_bus_valid(seg->buffer, seg->size)) {
+            bus_error();
+            return;
+        }
+        memcpy(frame + length, (const void *)(uintptr_t)seg->buffer, seg->size);
+        length += seg->size;
+    }
+
+    for(idx = 0; idx < eth.tx_segs; idx++) {
+        ic = !!(eth.tx_seg[idx].desc->Status & ETH_DMATXDESC_IC);
+        eth.tx_seg[idx].desc->Status &= ~ETH_DMATXDESC_OWN;
+        eth.tx_desc = next_tx(eth.tx_desc);
+    }
+
+    eth.stats.tx_frames++;
+    eth.stats.tx_bytes += length;
+    if(eth.tx_segs > 1)
+        eth.stats.tx_gathered++;
+
+    if(eth.on_tx)
+        eth.on_tx(frame, length);
+
+    if(ic) {
+        SIM_REG(ETH->DMASR) |= ETH_DMASR_TS;
+        update_irq();
+    }
+
+    if(eth.tx_on)
+        tx_fetch();
+}
+
+static void tx_poll (void)
+{
+    if(eth.tx_on && !eth.tx_busy)
+        tx_fetch();
+}
+
+//
+// Receiver
+//
+
+static void rx_deliver (frame_t *frame)
+{
+    uint32_t addr = eth.rx_desc, length = frame->length + 4, offset = 0, size, crc;
+    ETH_DMADescTypeDef *desc, *first;
+    uint8_t *data = frame->data;
+
+    crc = crc32(frame->data, frame->length);
+    memcpy(&frame->data[frame->length], &crc, 4);
+
+    // All descriptors needed must be available, there is no FIFO to hold the frame.
+
+    do {
+        desc = desc_at(addr);
+        if(!(desc->Status & ETH_DMARXDESC_OWN)) {
+            eth.stats.rx_missed++;
+            eth.rx_suspended = true;
+            SIM_REG(ETH->DMASR) |= ETH_DMASR_RBUS;
+            update_irq();
+            return;
+        }
+        offset += desc->ControlBufferSize & ETH_DMARXDESC_RBS1;
+        addr = next_rx(addr);
+    } while(offset < length);
+
+    first = desc_at(eth.rx_desc);
+    offset = 0;
+
+    do {
+        desc = desc_at(eth.rx_desc);
+        size = desc->ControlBufferSize & ETH_DMARXDESC_RBS1;
+        if(size > length - offset)
+            size = length - offset;
+        if(!sim_bus_valid(desc->Buffer1Addr, size)) {
+            bus_error();
+            return;
+        }
+        memcpy((void *)(uintptr_t)desc->Buffer1Addr, data + offset, size);
+        offset += size;
+        desc->Status = (desc == first ? ETH_DMARXDESC_FS : 0) |
+                        (offset == length ? ETH_DMARXDESC_LS | (length << ETH_DMARXDESC_FRAMELENGTHSHIFT) : 0);
+        eth.rx_desc = next_rx(eth.rx_desc);
+    } while(offset < length);
+
+    eth.stats.rx_frames++;
+
+    SIM_REG(ETH->DMASR) |= ETH_DMASR_RS;
+    update_irq();
+}
+
+static void rx_arrived (void)
+{
+    frame_t *frame = &eth.rx[eth.rx_head];
+
+    eth.rx_head = (eth.rx_head + 1) % RX_QUEUE;
+    eth.rx_count--;
+
+    if(!eth.rx_on || eth.rx_suspended) {
+        eth.stats.rx_missed++;
+        return;
+    }
+
+    rx_deliver(frame);
+}
+
+//
+// Registers
+//
+
+static void phy_reset (void)
+{
+    memset(eth.phy, 0, sizeof(eth.phy));
+    eth.phy[PHY_BCR] = PHY_AUTONEGOTIATION;
+    eth.phy[PHY_BSR] = 0x7809 | PHY_LINKED_STATUS | PHY_AUTONEGO_COMPLETE;
+    eth.phy[PHY_SR] = PHY_DUPLEX_STATUS; // 100 Mbit/s full duplex
+}
+
+static void mac_reset (void)
+{
+    memset((void *)sim_alias(ETH), 0, sizeof(ETH_TypeDef));
+    SIM_REG(ETH->MACCR) = 0x00008000UL;
+    SIM_REG(ETH->DMABMR) = 0x00020100UL;    // reset done
+
+    eth.tx_on = eth.tx_busy = eth.tx_suspended = false;
+    eth.rx_on = eth.rx_suspended = false;
+    eth.tx_desc = eth.rx_desc = 0;
+
+    update_irq();
+}
+
+static uint64_t eth_next (sim_periph_t *p)
+{
+    uint64_t t = eth.tx_busy ? eth.tx_done : UINT64_MAX;
+
+    if(eth.rx_count && eth.rx_next < t)
+        t = eth.rx_next;
+
+    return t;
+}
+
+static void eth_event (sim_periph_t *p)
+{
+    if(eth.tx_busy && eth.tx_done <= sim_now)
+        tx_complete();
+
+    while(eth.rx_count && eth.rx_next <= sim_now) {
+        rx_arrived();
+        if(eth.rx_count)
+            eth.rx_next += wire_cycles(eth.rx[eth.rx_head].length);
+    }
+}
+
+static void eth_write (sim_periph_t *p, uint32_t offset, uint32_t old)
+{
+    uint32_t value;
+
+    switch(offset) {
+
+        case offsetof(ETH_TypeDef, MACMIIAR):
+            value = SIM_REG(ETH->MACMIIAR);
+            if(value & ETH_MACMIIAR_MB) {
+                uint32_t reg = (value & ETH_MACMIIAR_MR) >> 6;
+                bool phy = ((value & ETH_MACMIIAR_PA) >> 11) == LAN8742A_PHY_ADDRESS;
+                if(value & ETH_MACMIIAR_MW) {
+                    if(phy) {
+                        eth.phy[reg] = (uint16_t)SIM_REG(ETH->MACMIIDR);
+                        if(reg == PHY_BCR && (eth.phy[PHY_BCR] & PHY_RESET))
+                            phy_reset();
+                    }
+                } else
+                    SIM_REG(ETH->MACMIIDR) = phy ? eth.phy[reg] : 0xFFFF;
+                SIM_REG(ETH->MACMIIAR) = value & ~ETH_MACMIIAR_MB;
+            }
+            break;
+
+        case offsetof(ETH_TypeDef, DMABMR):
+            if(SIM_REG(ETH->DMABMR) & ETH_DMABMR_SR)
+                mac_reset();
+            break;
+
+        case offsetof(ETH_TypeDef, DMATPDR):
+            if(eth.tx_suspended)
+                tx_poll();
+            break;
+
+        case offsetof(ETH_TypeDef, DMARPDR):
+            eth.rx_suspended = false;
+            break;
+
+        case offsetof(ETH_TypeDef, DMARDLAR):
+            if(!eth.rx_on)
+                eth.rx_desc = SIM_REG(ETH->DMARDLAR);
+            break;
+
+        case offsetof(ETH_TypeDef, DMATDLAR):
+            if(!eth.tx_on)
+                eth.tx_desc = SIM_REG(ETH->DMATDLAR);
+            break;
+
+        case offsetof(ETH_TypeDef, DMASR):
+            value = SIM_REG(ETH->DMASR);
+            SIM_REG(ETH->DMASR) = old & ~(value & DMASR_W1C);
+            if(!(SIM_REG(ETH->DMASR) & DMASR_NORMAL))
+                SIM_REG(ETH->DMASR) &= ~ETH_DMASR_NIS;
+            if(!(SIM_REG(ETH->DMASR) & DMASR_ABNORMAL))
+                SIM_REG(ETH->DMASR) &= ~ETH_DMASR_AIS;
+            update_irq();
+            break;
+
+        case offsetof(ETH_TypeDef, DMAOMR):
+            value = SIM_REG(ETH->DMAOMR);
+            SIM_REG(ETH->DMAOMR) = value & ~ETH_DMAOMR_FTF;
+            if((value & ETH_DMAOMR_SR) && !eth.rx_on) {
+                eth.rx_on = true;
+                eth.rx_suspended = false;
+            } else if(!(value & ETH_DMAOMR_SR))
+                eth.rx_on = false;
+            if((value & ETH_DMAOMR_ST) && !eth.tx_on) {
+                eth.tx_on = true;
+                tx_poll();
+            } else if(!(value & ETH_DMAOMR_ST))
+                eth.tx_on = false;
+            break;
+
+        case offsetof(ETH_TypeDef, DMAIER):
+            update_irq();
+            break;
+    }
+}
+
+// DMASR is read once per received frame, not in a wait loop.
+static bool eth_polled (sim_periph_t *p, uint32_t offset)
+{
+    return offset != offsetof(ETH_TypeDef, DMASR);
+}
+
+static void eth_reset (sim_periph_t *p)
+{
+    memset(&eth, 0, offsetof(typeof(eth), rx));
+    mac_reset();
+    phy_reset();
+}
+
+void sim_eth_rx (const void *frame, uint32_t length)
+{
+    frame_t *f;
+
+    if(eth.rx_count == RX_QUEUE || length > MAX_FRAME - 4)
+        return;
+
+    f = &eth.rx[(eth.rx_head + eth.rx_count) % RX_QUEUE];
+    f->length = length;
+    memcpy(f->data, frame, length);
+
+    if(eth.rx_count++ == 0)
+        eth.rx_next = sim_now + wire_cycles(length);
+}
+
+uint32_t sim_eth_rx_pending (void)
+{
+    return eth.rx_count;
+}
+
+void sim_eth_on_tx (void (*on_tx)(const uint8_t *frame, uint32_t length))
+{
+    eth.on_tx = on_tx;
+}
+
+bool sim_eth_tx_busy (void)
+{
+    return eth.tx_busy;
+}
+
+uint64_t sim_eth_frame_time (uint32_t length)
+{
+    return wire_cycles(length);
+}
+
+const sim_eth_stats_t *sim_eth_stats (void)
+{
+    return &eth.stats;
+}
+
+void sim_eth_stats_reset (void)
+{
+    memset(&eth.stats, 0, sizeof(sim_eth_stats_t));
+}
+
+__attribute__((constructor(150))) static void sim_eth_attach (void)
+{
+    periph.name = "ETH";
+    periph.base = ETH_BASE;
+    periph.size = 0x1400;
+    periph.reset = eth_reset;
+    periph.write = eth_write;
+    periph.next_event = eth_next;
+    periph.event = eth_event;
+    periph.polled = eth_polled;
+    sim_attach(&periph);
+}
@@ -0,0 +1,242 @@
+/*
+
+  sim_flash.c - embedded flash controller model, sectors 0 - 7 of a single bank 1 MB device
+
+  The flash array is readable memory, a write to it is a program operation: it is only accepted
+  with the controller unlocked, CR PG set and no operation in progress, and can only clear bits.
+  A program operation keeps BSY set for 16 us, a sector erase started by CR SER and STRT for the
+  typical erase time of the sector size: 250 ms for the 32 KB sectors 0 - 3, 1 s for the 128 KB
+  sector 4 and 2 s for the 256 KB sectors 5 - 7. Rejected operations set PGPERR.
+
+  On the MCU code in flash cannot be fetched while an operation is in progress, the longest
+  operation is recorded as the worst case interrupt latency it adds.
+
+  sim_flash_power_fail() simulates a power loss: the operation started after the given number
+  of operations is left incomplete, an erase clears about half the words of the sector and
+  a program only clears the bits of the lower half word, later operations have no effect.
+
+*/
+
+#include <string.h>
+
+#include "sim.h"
+
+#define KEY1            0x45670123UL
+#define KEY2            0xCDEF89ABUL
+#define N_SECTORS       8
+#define PROGRAM_CYCLES  (16 * SIM_CYCLES_PER_US)
+
+static struct {
+    uint_fast8_t keys;      // key sequence progress
+    bool busy, off;
+    uint64_t busy_until;
+    int32_t sector;         // sector being erased, -1 if none
+    int64_t power_fail;     // operations left before the power fails, -1 if not scheduled
+    sim_flash_stats_t stats;
+} flash;
+
+static sim_periph_t regs, array;
+
+static uint32_t sector_base (uint_fast8_t sector)
+{
+    return FLASH_BASE + (sector < 4 ? sector * 0x8000 : sector == 4 ? 0x20000 : 0x40000 * (sector - 4));
+}
+
+static uint32_t sector_size (uint_fast8_t sector)
+{
+    return sector < 4 ? 0x8000 : sector == 4 ? 0x20000 : 0x40000;
+}
+
+static uint64_t erase_cycles (uint_fast8_t sector)
+{
+    return (uint64_t)(sector < 4 ? 250 : sector == 4 ? 1000 : 2000) * (SIM_HCLK / 1000UL);
+}
+
+static void start (uint64_t cycles)
+{
+    if(cycles > flash.stats.max_busy)
+        flash.stats.max_busy = cycles;
+
+    flash.busy = true;
+    flash.busy_until = sim_now + cycles;
+    SIM_REG(FLASH->SR) |= FLASH_SR_BSY;
+}
+
+static void reject (void)
+{
+    flash.stats.errors++;
+    SIM_REG(FLASH->SR) |= FLASH_SR_PGPERR;
+}
+
+// Counts down to the scheduled power loss, returns true if the operation starting now is interrupted.
+static bool power_lost (void)
+{
+    if(flash.power_fail < 0)
+        return false;
+
+    if(flash.power_fail-- == 0) {
+        flash.off = true;
+        return true;
+    }
+
+    return false;
+}
+
+static void erase (uint_fast8_t sector)
+{
+    uint32_t *words = (uint32_t *)sim_alias((const volatile void *)(uintptr_t)sector_base(sector)), idx;
+
+    if(flash.off) {
+        for(idx = 0; idx < sector_size(sector) / 4; idx++) {
+            if((idx * 2654435761UL) & 0x80000000UL)
+                words[idx] = 0xFFFFFFFFUL;
+        }
+    } else
+        memset(words, 0xFF, sector_size(sector));
+}
+
+static uint64_t flash_next (sim_periph_t *p)
+{
+    return flash.busy ? flash.busy_until : UINT64_MAX;
+}
+
+static void flash_event (sim_periph_t *p)
+{
+    if(flash.busy && flash.busy_until <= sim_now) {
+        flash.busy = false;
+        if(flash.sector >= 0) {
+            erase(flash.sector);
+            flash.stats.erases[flash.sector]++;
+            flash.sector = -1;
+            SIM_REG(FLASH->CR) &= ~FLASH_CR_STRT;
+        }
+        SIM_REG(FLASH->SR) &= ~FLASH_SR_BSY;
+        if(SIM_REG(FLASH->CR) & FLASH_CR_EOPIE)
+            SIM_REG(FLASH->SR) |= FLASH_SR_EOP;
+    }
+}
+
+static void flash_write (sim_periph_t *p, uint32_t offset, uint32_t old)
+{
+    uint32_t value;
+
+    switch(offset) {
+
+        case offsetof(FLASH_TypeDef, KEYR):
+            value = SIM_REG(FLASH->KEYR);
+            SIM_REG(FLASH->KEYR) = 0;
+            if(flash.keys == 0 && value == KEY1)
+                flash.keys = 1;
+            else if(flash.keys == 1 && value == KEY2) {
+                flash.keys = 0;
+                SIM_REG(FLASH->CR) &= ~FLASH_CR_LOCK;
+            } else
+                flash.keys = 0;
+            break;
+
+        case offsetof(FLASH_TypeDef, SR):
+            value = SIM_REG(FLASH->SR);
+            SIM_REG(FLASH->SR) = old & ~(value & (FLASH_SR_EOP|FLASH_SR_OPERR|FLASH_SR_WRPERR|FLASH_SR_PGAERR|FLASH_SR_PGPERR|FLASH_SR_ERSERR));
+            break;
+
+        case offsetof(FLASH_TypeDef, CR):
+            value = SIM_REG(FLASH->CR);
+            if(old & FLASH_CR_LOCK) {
+                SIM_REG(FLASH->CR) = old;
+                break;
+            }
+            if(flash.busy) {
+                SIM_REG(FLASH->CR) = (value & ~FLASH_CR_STRT) | (old & FLASH_CR_STRT);
+                if((value & FLASH_CR_STRT) && !(old & FLASH_CR_STRT))
+                    reject();
+                break;
+            }
+            if((value & FLASH_CR_STRT) && !(old & FLASH_CR_STRT)) {
+                uint_fast8_t sector = (value & FLASH_CR_SNB) >> FLASH_CR_SNB_Pos;
+                if(!(value & FLASH_CR_SER) || (value & FLASH_CR_MER) || sector >= N_SECTORS) {
+                    SIM_REG(FLASH->CR) &= ~FLASH_CR_STRT;
+                    reject();
+                } else if(flash.off || power_lost()) {
+                    erase(sector);
+                    SIM_REG(FLASH->CR) &= ~FLASH_CR_STRT;
+                } else {
+                    flash.sector = sector;
+                    start(erase_cycles(sector));
+                }
+            }
+            break;
+    }
+}
+
+static void array_write (sim_periph_t *p, uint32_t offset, uint32_t old)
+{
+    uint32_t *word = (uint32_t *)sim_alias((const volatile void *)(uintptr_t)(FLASH_BASE + offset)), value = *word;
+
+    *word = old;
+
+    if((SIM_REG(FLASH->CR) & (FLASH_CR_LOCK|FLASH_CR_PG)) != FLASH_CR_PG || flash.busy) {
+        reject();
+        return;
+    }
+
+    if(flash.off)
+        return;
+
+    if(power_lost())
+        value |= 0xFFFF0000UL;
+
+    flash.stats.programs++;
+    if(old != 0xFFFFFFFFUL)
+        flash.stats.overwrites++;
+
+    *word = old & value;
+
+    if(!flash.off)
+        start(PROGRAM_CYCLES);
+}
+
+static void flash_reset (sim_periph_t *p)
+{
+    memset(&flash, 0, sizeof(flash));
+    flash.sector = -1;
+    flash.power_fail = -1;
+    SIM_REG(FLASH->CR) = FLASH_CR_LOCK;
+}
+
+void sim_flash_power_fail (uint32_t ops)
+{
+    flash.power_fail = ops;
+}
+
+bool sim_flash_powered (void)
+{
+    return !flash.off;
+}
+
+const sim_flash_stats_t *sim_flash_stats (void)
+{
+    return &flash.stats;
+}
+
+void sim_flash_stats_reset (void)
+{
+    memset(&flash.stats, 0, sizeof(flash.stats));
+}
+
+__attribute__((constructor(150))) static void sim_flash_attach (void)
+{
+    regs.name = "FLASH";
+    regs.base = FLASH_R_BASE;
+    regs.size = 0x400;
+    regs.reset = flash_reset;
+    regs.write = flash_write;
+    regs.next_event = flash_next;
+    regs.event = flash_event;
+    sim_attach(&regs);
+
+    array.name = "FLASH array";
+    array.base = FLASH_BASE;
+    array.size = 0x00100000;
+    array.write = array_write;
+    sim_attach(&array);
+}
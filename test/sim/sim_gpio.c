@@ -0,0 +1,182 @@
+/*
+
+  sim_gpio.c - GPIO and EXTI models
+
+  Output data register changes, from BSRR or ODR writes by the CPU or by DMA, are logged with
+  the simulated time. Input levels are driven by the test, undriven inputs follow the pull
+  configuration, output pins read back their output level. Input edges are passed on to EXTI.
+
+*/
+
+#include <string.h>
+
+#include "sim.h"
+
+#define N_PORTS 11 // GPIOA - GPIOK
+
+typedef struct {
+    uint32_t driven;    // pins driven by the test
+    uint32_t level;     // levels of driven pins
+} gpio_input_t;
+
+static gpio_input_t input[N_PORTS];
+
+static inline GPIO_TypeDef *port_of (sim_periph_t *p)
+{
+    return (GPIO_TypeDef *)(uintptr_t)p->base;
+}
+
+static inline uint_fast8_t port_index (GPIO_TypeDef *port)
+{
+    return (uint_fast8_t)(((uint32_t)(uintptr_t)port - GPIOA_BASE) / 0x400);
+}
+
+static void exti_edges (uint_fast8_t port, uint32_t rising, uint32_t falling);
+
+static void gpio_update_idr (GPIO_TypeDef *port)
+{
+    uint_fast8_t idx = port_index(port), pin;
+    uint32_t moder = SIM_REG(port->MODER), pupdr = SIM_REG(port->PUPDR), outputs = 0, pullups = 0, idr, old = SIM_REG(port->IDR);
+
+    for(pin = 0; pin < 16; pin++) {
+        if(((moder >> (pin * 2)) & 3) == 1)
+            outputs |= 1UL << pin;
+        if(((pupdr >> (pin * 2)) & 3) == 1)
+            pullups |= 1UL << pin;
+    }
+
+    idr = (SIM_REG(port->ODR) & outputs) |
+           (input[idx].level & input[idx].driven & ~outputs) |
+            (pullups & ~input[idx].driven & ~outputs);
+
+    SIM_REG(port->IDR) = idr & 0xFFFF;
+
+    if((old ^ idr) & 0xFFFF)
+        exti_edges(idx, ~old & idr & 0xFFFF, old & ~idr & 0xFFFF);
+}
+
+static void gpio_set_odr (GPIO_TypeDef *port, uint32_t old, uint32_t odr)
+{
+    SIM_REG(port->ODR) = odr & 0xFFFF;
+
+    if((old ^ odr) & 0xFFFF) {
+        sim_gpio_log(port, odr & 0xFFFF, (old ^ odr) & 0xFFFF, sim_dma_access);
+        gpio_update_idr(port);
+    }
+}
+
+static void gpio_write (sim_periph_t *p, uint32_t offset, uint32_t old)
+{
+    GPIO_TypeDef *port = port_of(p);
+
+    switch(offset) {
+
+        case offsetof(GPIO_TypeDef, BSRR):;
+            uint32_t bsrr = SIM_REG(port->BSRR), odr = SIM_REG(port->ODR);
+            SIM_REG(port->BSRR) = 0; // write only
+            gpio_set_odr(port, odr, (odr & ~(bsrr >> 16)) | (bsrr & 0xFFFF));
+            break;
+
+        case offsetof(GPIO_TypeDef, ODR):
+            gpio_set_odr(port, old, SIM_REG(port->ODR));
+            break;
+
+        case offsetof(GPIO_TypeDef, IDR):
+            SIM_REG(port->IDR) = old; // read only
+            break;
+
+        case offsetof(GPIO_TypeDef, MODER):
+        case offsetof(GPIO_TypeDef, PUPDR):
+            gpio_update_idr(port);
+            break;
+    }
+}
+
+static void gpio_reset (sim_periph_t *p)
+{
+    memset(&input[port_index(port_of(p))], 0, sizeof(gpio_input_t));
+}
+
+void sim_gpio_input (GPIO_TypeDef *port, uint32_t pins, bool level)
+{
+    gpio_input_t *in = &input[port_index(port)];
+
+    in->driven |= pins;
+    in->level = level ? (in->level | pins) : (in->level & ~pins);
+
+    gpio_update_idr(port);
+}
+
+#define GPIO_PERIPH(n) { .name = "GPIO" #n, .base = GPIO ## n ## _BASE, .size = 0x400, .reset = gpio_reset, .write = gpio_write }
+
+static sim_periph_t gpio[N_PORTS] = {
+    GPIO_PERIPH(A), GPIO_PERIPH(B), GPIO_PERIPH(C), GPIO_PERIPH(D), GPIO_PERIPH(E), GPIO_PERIPH(F),
+    GPIO_PERIPH(G), GPIO_PERIPH(H), GPIO_PERIPH(I), GPIO_PERIPH(J), GPIO_PERIPH(K)
+};
+
+//
+// EXTI
+//
+
+static void exti_irq_lines (void)
+{
+    uint32_t pr = SIM_REG(EXTI->PR) & SIM_REG(EXTI->IMR);
+
+    sim_irq_line(EXTI0_IRQn, pr & (1 << 0));
+    sim_irq_line(EXTI1_IRQn, pr & (1 << 1));
+    sim_irq_line(EXTI2_IRQn, pr & (1 << 2));
+    sim_irq_line(EXTI3_IRQn, pr & (1 << 3));
+    sim_irq_line(EXTI4_IRQn, pr & (1 << 4));
+    sim_irq_line(EXTI9_5_IRQn, pr & 0x03E0);
+    sim_irq_line(EXTI15_10_IRQn, pr & 0xFC00);
+}
+
+static void exti_edges (uint_fast8_t port, uint32_t rising, uint32_t falling)
+{
+    uint_fast8_t line;
+    uint32_t pending = 0;
+
+    for(line = 0; line < 16; line++) {
+        if(((SIM_REG(SYSCFG->EXTICR[line >> 2]) >> ((line & 3) * 4)) & 0xF) == port)
+            pending |= ((rising & SIM_REG(EXTI->RTSR)) | (falling & SIM_REG(EXTI->FTSR))) & (1UL << line);
+    }
+
+    if(pending) {
+        SIM_REG(EXTI->PR) |= pending;
+        exti_irq_lines();
+    }
+}
+
+static void exti_write (sim_periph_t *p, uint32_t offset, uint32_t old)
+{
+    switch(offset) {
+
+        case offsetof(EXTI_TypeDef, PR):
+            SIM_REG(EXTI->PR) = old & ~SIM_REG(EXTI->PR);   // rc_w1
+            SIM_REG(EXTI->SWIER) &= SIM_REG(EXTI->PR);
+            break;
+
+        case offsetof(EXTI_TypeDef, SWIER):
+            SIM_REG(EXTI->PR) |= SIM_REG(EXTI->SWIER) & ~old & SIM_REG(EXTI->IMR);
+            break;
+    }
+
+    exti_irq_lines();
+}
+
+static sim_periph_t exti = {
+    .name = "EXTI",
+    .base = EXTI_BASE,
+    .size = 0x400,
+    .write = exti_write
+};
+
+__attribute__((constructor(150))) static void sim_gpio_attach (void)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < N_PORTS; idx++)
+        sim_attach(&gpio[idx]);
+
+    sim_attach(&exti);
+}
@@ -0,0 +1,540 @@
+/*
+
+  sim_sdcard.c - SD/MMC card model in SPI mode, attached to a SPI model as its device
+
+  Card types MMC, SD v1, SD v2 with byte addressing and SDHC with block addressing, each with
+  its own identification sequence and CSD layout. Commands are answered one frame after the
+  command (N_CR), read data blocks follow the R1 response after the read latency. Data blocks
+  carry a CRC16, command and data CRCs are checked after CMD59 enabled checking, CMD0 and CMD8
+  are always checked. Written blocks are answered with a data response token and followed by
+  the busy time, during which the card outputs 0x00.
+
+  The card checks the protocol and counts what it does not expect as a protocol error:
+  - a command before the 74 initial clocks with CS high or while the card is busy.
+  - a command or a data token before the previous response, data block or CRC has been read,
+    except CMD12 during a multiple block read.
+  - a data token other than 0xFE for CMD24 and 0xFC or 0xFD (stop) for CMD25.
+  - CS raised before a response, a data block and its CRC have been read, while a data block
+    is being written or before a multiple block read is stopped.
+
+  Errors can be injected: read blocks are sent with a bit flipped after the CRC was computed,
+  written blocks are received with a bit flipped, so that the card answers with a CRC error.
+  A card without CRC support answers CMD59 as an illegal command.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define OUT_SIZE 1024
+#define INIT_POLLS 3        // ACMD41/CMD1 polls until the card leaves the idle state
+
+typedef enum {
+    Data_None = 0,
+    Data_ReadMultiple,      // blocks are sent until CMD12
+    Data_WriteToken,        // waiting for a data or stop token
+    Data_WriteBlock         // receiving a data block and its CRC
+} data_state_t;
+
+static struct {
+    bool inserted;
+    GPIO_TypeDef *cs_port;
+    uint32_t cs_pin;
+    sim_sd_type_t type;
+    uint8_t *data;
+    uint32_t sectors;
+    uint8_t csd[16], cid[16];
+    uint32_t init_clocks;   // frames clocked with CS high before CMD0
+    bool spi_mode, idle, app_cmd, crc_on, selected;
+    bool no_crc;            // CMD59 not supported
+    uint32_t init_polls;
+    uint8_t cmd[6];
+    uint_fast8_t cmd_len;
+    uint8_t out[OUT_SIZE];
+    uint32_t out_head, out_len;
+    data_state_t data_state;
+    bool multiple;
+    uint32_t block;
+    uint8_t wbuf[514];
+    uint32_t wlen;
+    uint64_t busy_until, busy_cycles;
+    uint32_t read_latency;
+    uint32_t corrupt_reads, corrupt_writes;
+    sim_sd_stats_t stats;
+} card;
+
+static uint8_t crc7 (const uint8_t *data, uint32_t length)
+{
+    uint8_t crc = 0, bit;
+
+    while(length--) {
+        crc ^= *data++;
+        for(bit = 0; bit < 8; bit++)
+            crc = crc & 0x80 ? (crc << 1) ^ 0x12 : crc << 1;
+    }
+
+    return crc | 0x01;
+}
+
+static uint16_t crc16 (const uint8_t *data, uint32_t length)
+{
+    uint16_t crc = 0;
+    uint_fast8_t bit;
+
+    while(length--) {
+        crc ^= (uint16_t)*data++ << 8;
+        for(bit = 0; bit < 8; bit++)
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+
+    return crc;
+}
+
+static void out (uint8_t byte)
+{
+    if(card.out_len < OUT_SIZE)
+        card.out[card.out_len++] = byte;
+}
+
+static void out_block (const uint8_t *data, uint32_t length)
+{
+    uint32_t idx, start;
+    uint16_t crc = crc16(data, length);
+
+    for(idx = 0; idx < card.read_latency; idx++)
+        out(0xFF);
+
+    out(0xFE);
+    start = card.out_len;
+    for(idx = 0; idx < length; idx++)
+        out(data[idx]);
+    out(crc >> 8);
+    out(crc & 0xFF);
+
+    if(card.corrupt_reads) {
+        card.corrupt_reads--;
+        card.out[start + length / 3] ^= 0x10;
+    }
+}
+
+static bool busy (void)
+{
+    return sim_now < card.busy_until;
+}
+
+static void card_reset (void)
+{
+    card.spi_mode = card.idle = card.app_cmd = card.crc_on = false;
+    card.init_clocks = card.init_polls = card.cmd_len = 0;
+    card.out_head = card.out_len = 0;
+    card.data_state = Data_None;
+    card.busy_until = 0;
+}
+
+// Returns the byte address or block number of arg as a block number, UINT32_MAX if not addressable.
+static uint32_t block_of (uint32_t arg)
+{
+    if(card.type != SIM_SD_HC) {
+        if(arg & 511)
+            return UINT32_MAX;
+        arg >>= 9;
+    }
+
+    return arg < card.sectors ? arg : UINT32_MAX;
+}
+
+static void execute (void)
+{
+    uint_fast8_t idx = card.cmd[0] & 0x3F;
+    uint32_t arg = ((uint32_t)card.cmd[1] << 24) | ((uint32_t)card.cmd[2] << 16) | ((uint32_t)card.cmd[3] << 8) | card.cmd[4];
+    bool app = card.app_cmd;
+    uint8_t r1;
+
+    card.app_cmd = false;
+
+    if(!card.spi_mode) {
+        if(idx != 0 || card.init_clocks < 10) {
+            card.stats.protocol_errors++;
+            return;
+        }
+        card.spi_mode = card.idle = true;
+    }
+
+    if((card.crc_on || idx == 0 || idx == 8) && crc7(card.cmd, 5) != card.cmd[5]) {
+        card.stats.cmd_crc_errors++;
+        out(0xFF);
+        out(0x08 | (card.idle ? 0x01 : 0x00));
+        return;
+    }
+
+    card.stats.cmds[idx]++;
+    r1 = card.idle ? 0x01 : 0x00;
+
+    out(0xFF); // N_CR
+
+    switch(idx) {
+
+        case 0: // GO_IDLE_STATE
+            card.idle = true;
+            card.crc_on = false;
+            card.init_polls = 0;
+            out(0x01);
+            break;
+
+        case 1: // SEND_OP_COND, MMC only
+            if(card.type == SIM_SD_MMC) {
+                if(++card.init_polls >= INIT_POLLS)
+                    card.idle = false;
+                out(card.idle ? 0x01 : 0x00);
+            } else
+                out(r1 | 0x04);
+            break;
+
+        case 8: // SEND_IF_COND, SD v2 and later
+            if(card.type >= SIM_SD_V2) {
+                out(r1);
+                out(0x00);
+                out(0x00);
+                out((arg >> 8) & 0x0F);
+                out(arg & 0xFF);
+            } else
+                out(r1 | 0x04);
+            break;
+
+        case 9: // SEND_CSD
+        case 10: // SEND_CID
+            out(r1);
+            out_block(idx == 9 ? card.csd : card.cid, 16);
+            break;
+
+        case 12: // STOP_TRANSMISSION, outside a multiple block read
+            out(r1);
+            break;
+
+        case 16: // SET_BLOCKLEN
+            out(arg == 512 ? r1 : (r1 | 0x40));
+            break;
+
+        case 17: // READ_SINGLE_BLOCK
+        case 18: // READ_MULTIPLE_BLOCK
+            if(card.idle)
+                out(r1 | 0x04);
+            else if((card.block = block_of(arg)) == UINT32_MAX)
+                out(0x40); // parameter error
+            else {
+                out(r1);
+                out_block(&card.data[card.block * 512], 512);
+                card.stats.blocks_read++;
+                if(idx == 18) {
+                    card.block++;
+                    card.data_state = Data_ReadMultiple;
+                    card.stats.multiple_reads++;
+                }
+            }
+            break;
+
+        case 23: // SET_BLOCK_COUNT (ACMD23 for SD, CMD23 for MMC)
+            out(r1);
+            break;
+
+        case 24: // WRITE_BLOCK
+        case 25: // WRITE_MULTIPLE_BLOCK
+            if(card.idle)
+                out(r1 | 0x04);
+            else if((card.block = block_of(arg)) == UINT32_MAX)
+                out(0x40);
+            else {
+                out(r1);
+                card.multiple = idx == 25;
+                card.data_state = Data_WriteToken;
+                if(card.multiple)
+                    card.stats.multiple_writes++;
+            }
+            break;
+
+        case 41: // SD_SEND_OP_COND, as application command
+            if(app && card.type != SIM_SD_MMC) {
+                // An SDHC card does not leave the idle state unless the host supports high capacity (HCS).
+                if(++card.init_polls >= INIT_POLLS && (card.type != SIM_SD_HC || (arg & (1UL << 30))))
+                    card.idle = false;
+                out(card.idle ? 0x01 : 0x00);
+            } else
+                out(r1 | 0x04);
+            break;
+
+        case 55: // APP_CMD
+            if(card.type == SIM_SD_MMC)
+                out(r1 | 0x04);
+            else {
+                card.app_cmd = true;
+                out(r1);
+            }
+            break;
+
+        case 58: // READ_OCR
+            out(r1);
+            out((card.idle ? 0x00 : 0x80) | (!card.idle && card.type == SIM_SD_HC ? 0x40 : 0x00));
+            out(0xFF);
+            out(0x80);
+            out(0x00);
+            break;
+
+        case 59: // CRC_ON_OFF
+            if(card.no_crc) {
+                out(r1 | 0x04);
+                break;
+            }
+            card.crc_on = arg & 1;
+            out(r1);
+            break;
+
+        default:
+            out(r1 | 0x04);
+            break;
+    }
+}
+
+static void write_block (void)
+{
+    bool crc_ok = !card.crc_on || crc16(card.wbuf, 512) == (((uint16_t)card.wbuf[512] << 8) | card.wbuf[513]);
+
+    if(!crc_ok) {
+        card.stats.data_crc_errors++;
+        out(0x0B); // data rejected, CRC error
+    } else if(card.block >= card.sectors)
+        out(0x0D); // data rejected, write error
+    else {
+        memcpy(&card.data[card.block * 512], card.wbuf, 512);
+        card.stats.blocks_written++;
+        card.block++;
+        out(0x05); // data accepted
+        card.busy_until = sim_now + card.busy_cycles;
+        card.stats.busy_periods++;
+    }
+
+    card.data_state = card.multiple ? Data_WriteToken : Data_None;
+}
+
+static void receive (uint8_t mosi)
+{
+    bool pending = card.out_head < card.out_len;
+
+    switch(card.data_state) {
+
+        case Data_WriteToken:
+            if(mosi == 0xFF)
+                break;
+            if(pending || busy())
+                card.stats.protocol_errors++;
+            if(mosi == (card.multiple ? 0xFC : 0xFE)) {
+                card.data_state = Data_WriteBlock;
+                card.wlen = 0;
+            } else if(card.multiple && mosi == 0xFD) {
+                card.stats.stop_tokens++;
+                card.data_state = Data_None;
+                card.busy_until = sim_now + card.busy_cycles;
+            } else {
+                card.stats.protocol_errors++;
+                card.data_state = Data_None;
+            }
+            break;
+
+        case Data_WriteBlock:
+            card.wbuf[card.wlen++] = mosi;
+            if(card.wlen == sizeof(card.wbuf)) {
+                if(card.corrupt_writes) {
+                    card.corrupt_writes--;
+                    card.wbuf[100] ^= 0x01;
+                }
+                write_block();
+            }
+            break;
+
+        default:
+            if(card.cmd_len == 0) {
+                if((mosi & 0xC0) != 0x40)
+                    break;
+                if((pending && !(card.data_state == Data_ReadMultiple && mosi == 0x4C)) || busy())
+                    card.stats.protocol_errors++;
+            }
+            card.cmd[card.cmd_len++] = mosi;
+            if(card.cmd_len == 6) {
+                card.cmd_len = 0;
+                if(card.data_state == Data_ReadMultiple) {
+                    if((card.cmd[0] & 0x3F) == 12) {
+                        // The transfer stops, a stuff byte is followed by the R1 response.
+                        card.out_head = card.out_len = 0;
+                        card.data_state = Data_None;
+                        card.stats.stops++;
+                        out(0xFF);
+                        out(0x00);
+                    } else
+                        card.stats.protocol_errors++;
+                } else if(busy())
+                    break; // ignored
+                else {
+                    card.out_head = card.out_len = 0;
+                    execute();
+                }
+            }
+            break;
+    }
+}
+
+static uint8_t exchange (uint8_t mosi)
+{
+    uint8_t miso = 0xFF;
+    bool selected = !(SIM_REG(card.cs_port->ODR) & card.cs_pin);
+
+    if(!card.inserted)
+        return 0xFF;
+
+    if(!selected) {
+        if(card.selected && (card.data_state == Data_ReadMultiple || card.data_state == Data_WriteBlock ||
+                              card.out_head < card.out_len))
+            card.stats.protocol_errors++;   // deselected with a transfer in progress or a response not read
+        if(card.selected && card.data_state != Data_WriteToken)
+            card.out_head = card.out_len = 0;
+        card.selected = false;
+        card.cmd_len = 0;
+        if(!card.spi_mode)
+            card.init_clocks++;
+        return 0xFF;
+    }
+
+    card.selected = true;
+
+    if(card.out_head < card.out_len) {
+        miso = card.out[card.out_head++];
+        if(card.out_head == card.out_len)
+            card.out_head = card.out_len = 0;
+    } else if(busy()) {
+        miso = 0x00;
+        card.stats.busy_frames++;
+    } else if(card.data_state == Data_ReadMultiple) {
+        if(card.block < card.sectors) {
+            out_block(&card.data[card.block++ * 512], 512);
+            card.stats.blocks_read++;
+        } else
+            out(0x08); // data error token, out of range
+        miso = card.out[card.out_head++];
+    }
+
+    receive(mosi);
+
+    return miso;
+}
+
+static void make_csd (void)
+{
+    uint8_t *csd = card.csd;
+    uint32_t c_size, mult = 0;
+
+    memset(csd, 0, sizeof(card.csd));
+
+    csd[1] = 0x0E;          // TAAC
+    csd[3] = 0x32;          // TRAN_SPEED 25 MHz
+    csd[4] = 0x5B;          // CCC
+    csd[5] = 0x50 | 9;      // READ_BL_LEN 512
+
+    if(card.type == SIM_SD_HC) {
+        csd[0] = 0x40;      // CSD version 2.0
+        c_size = card.sectors / 1024 - 1;
+        csd[7] = (c_size >> 16) & 0x3F;
+        csd[8] = (c_size >> 8) & 0xFF;
+        csd[9] = c_size & 0xFF;
+    } else {
+        csd[0] = card.type == SIM_SD_MMC ? 0x90 : 0x00; // MMC: CSD structure 2 (v1.2), spec version 4
+        if(card.type == SIM_SD_MMC)
+            csd[3] = 0x2A;  // 20 MHz
+        while(card.sectors >> (mult + 2) > 4096)
+            mult++;
+        c_size = (card.sectors >> (mult + 2)) - 1;
+        csd[6] = (c_size >> 10) & 0x03;
+        csd[7] = (c_size >> 2) & 0xFF;
+        csd[8] = (c_size & 0x03) << 6;
+        csd[9] = (mult >> 1) & 0x03;
+        csd[10] = (mult & 0x01) << 7;
+    }
+
+    csd[15] = crc7(csd, 15);
+}
+
+void sim_sd_insert (SPI_TypeDef *spi, GPIO_TypeDef *cs_port, uint32_t cs_pin, sim_sd_type_t type, uint32_t sectors)
+{
+    free(card.data);
+    memset(&card, 0, sizeof(card));
+
+    card.inserted = true;
+    card.cs_port = cs_port;
+    card.cs_pin = cs_pin;
+    card.type = type;
+    card.sectors = sectors;
+    card.data = calloc(sectors, 512);
+    card.read_latency = 2;
+    card.busy_cycles = 100 * SIM_CYCLES_PER_US;
+
+    make_csd();
+    memcpy(card.cid, "\x03SDSIMCARD\x10\x12\x34\x56\x78", 15);
+    card.cid[15] = crc7(card.cid, 15);
+
+    card_reset();
+    sim_spi_device(spi, exchange);
+}
+
+uint8_t *sim_sd_data (void)
+{
+    return card.data;
+}
+
+uint8_t *sim_sd_csd (void)
+{
+    return card.csd;
+}
+
+void sim_sd_update_csd (void)
+{
+    card.csd[15] = crc7(card.csd, 15);
+}
+
+void sim_sd_busy_time (uint64_t cycles)
+{
+    card.busy_cycles = cycles;
+}
+
+void sim_sd_busy_now (uint64_t cycles)
+{
+    card.busy_until = sim_now + cycles;
+}
+
+void sim_sd_read_latency (uint32_t frames)
+{
+    card.read_latency = frames;
+}
+
+void sim_sd_corrupt_reads (uint32_t blocks)
+{
+    card.corrupt_reads = blocks;
+}
+
+void sim_sd_corrupt_writes (uint32_t blocks)
+{
+    card.corrupt_writes = blocks;
+}
+
+void sim_sd_crc_support (bool supported)
+{
+    card.no_crc = !supported;
+}
+
+const sim_sd_stats_t *sim_sd_stats (void)
+{
+    return &card.stats;
+}
+
+void sim_sd_stats_reset (void)
+{
+    memset(&card.stats, 0, sizeof(sim_sd_stats_t));
+}
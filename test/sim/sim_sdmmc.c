@@ -0,0 +1,1095 @@
+/*
+
+  sim_sdmmc.c - SDMMC1 model with an SD card in SD bus mode
+
+  The command path state machine (CPSM) sends the command at the SDMMC_CK frequency set by
+  CLKCR, the card answers N_CR clocks later. Short responses set CMDREND, R3 sets CCRCFAIL as
+  its CRC field is all ones, commands without response set CMDSENT and a card that does not
+  answer CTIMEOUT after 64 clocks. Long responses are the CID or CSD in RESP1-RESP4.
+
+  The data path state machine (DPSM) moves data 32 bits at a time over the 1 or 4 bit bus set
+  by CLKCR WIDBUS, through a FIFO of 32 words. The DMA request of the FIFO is a level served by
+  the DMA model, DMA2 stream 3 or 6 channel 4. Received blocks are followed by their CRC16,
+  DBCKEND is set at the end of each block and DATAEND when DLEN bytes have been transferred,
+  after the card busy time of the last block written. A full FIFO when a word is received flags
+  RXOVERR, an empty FIFO when a word is to be sent TXUNDERR. The data timer starts when the DPSM
+  is enabled and at the end of each block, it flags DTIMEOUT if no data block starts in time.
+
+  The card is SD v1, SD v2 with byte addressing or SDHC with block addressing, identified by
+  CMD0, CMD8, ACMD41, CMD2, CMD3, then selected with CMD7. It supports the 4-bit bus (ACMD6) and
+  high speed mode by CMD6 when enabled with sim_sdmmc_high_speed(). Read data blocks start after
+  the read latency, multiple block reads continue until CMD12. Each written block is followed by
+  the busy time, the card reports the programming state to CMD13 meanwhile.
+
+  The card checks the protocol and counts what it does not expect as a protocol error:
+  - a command not valid in the current state, the card does not answer.
+  - a command sent while the previous one is active.
+  - a clock above 400 kHz during identification, above 25 MHz or 50 MHz in high speed mode.
+  - a data transfer with the host bus width different from that set by ACMD6, or with a
+    different block size than the card's. The data is corrupted, which fails the CRC check.
+  - a read data block starting while the DPSM is not ready to receive it.
+  - a data block sent while the card is not receiving.
+
+  Errors can be injected: read blocks are sent with a bit flipped, written blocks are received
+  with a bit flipped and answered with a negative CRC status, both set DCRCFAIL.
+
+  NOTE: The DMA model transfers single data items, bursts and peripheral flow control are not
+        modelled. The stream stops when NDTR reaches zero, the driver sets it to the data length.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+// Read only registers as seen by the model.
+#define SIM_REG_RO(reg) (*(volatile uint32_t *)&SIM_REG(reg))
+
+// Read only registers as seen by the model.
+#define SIM_REG_RO(reg) (*(volatile uint32_t *)&SIM_REG(reg))
+
+#define FIFO_SIZE 32            // words
+#define INIT_POLLS 3            // ACMD41 polls until the card leaves the idle state
+#define SDMMC_CK 48000000UL     // kernel clock
+
+#define RESP_NONE  0
+#define RESP_SHORT 1
+#define RESP_LONG  2
+#define RESP_R3    3            // short, without a valid CRC
+
+#define R1_OUT_OF_RANGE     (1UL << 31)
+#define R1_ADDRESS_ERROR    (1UL << 30)
+#define R1_BLOCK_LEN_ERROR  (1UL << 29)
+#define R1_READY_FOR_DATA   (1UL << 8)
+#define R1_APP_CMD          (1UL << 5)
+
+typedef enum {
+    Card_Idle = 0,
+    Card_Ready,
+    Card_Ident,
+    Card_Stby,
+    Card_Tran,
+    Card_Data,
+    Card_Rcv,
+    Card_Prg
+} card_state_t;
+
+typedef enum {
+    Line_Idle = 0,
+    Line_ReadStart,     // waiting for the next read block to start
+    Line_ReadWord,
+    Line_ReadCrc,
+    Line_WriteStart,
+    Line_WriteWord,
+    Line_WriteCrc,      // CRC, end bit and CRC status
+    Line_WriteBusy      // last block programmed, DATAEND at the end of busy
+} line_state_t;
+
+static struct {
+    // Card
+    bool inserted, high_speed_supported;
+    sim_sd_type_t type;
+    uint8_t *data;
+    uint32_t sectors;
+    uint8_t csd[16], cid[16];
+    card_state_t state;
+    uint32_t rca, status_errors;
+    uint32_t init_polls;
+    bool app_cmd, high_speed, wide;
+    bool multiple;
+    uint32_t block, block_len, blocks_sent;
+    uint8_t block_buf[512];
+    bool block_corrupt;
+    uint8_t switch_status[64];
+    uint64_t busy_until, busy_cycles, read_latency;
+    uint32_t corrupt_reads, corrupt_writes;
+    // CPSM
+    bool cmd_active;
+    uint64_t cmd_done;
+    uint32_t cmd_flag;
+    uint32_t resp[4], respcmd;
+    // DPSM and data line
+    bool dpsm_active, dpsm_read, block_capture;
+    uint32_t dpsm_block_len, dcount, fetch;
+    uint64_t dtimeout_at;
+    line_state_t line;
+    uint64_t line_time;
+    uint32_t word;
+    uint32_t fifo[FIFO_SIZE];
+    uint_fast8_t fifo_head, fifo_count;
+    // STA flags, the status bits are added on read
+    uint32_t flags;
+    sim_sdmmc_stats_t stats;
+} sd;
+
+static sim_periph_t periph;
+
+static uint8_t crc7 (const uint8_t *data, uint32_t length)
+{
+    uint8_t crc = 0, bit;
+
+    while(length--) {
+        crc ^= *data++;
+        for(bit = 0; bit < 8; bit++)
+            crc = crc & 0x80 ? (crc << 1) ^ 0x12 : crc << 1;
+    }
+
+    return crc | 0x01;
+}
+
+static inline bool powered (void)
+{
+    return (SIM_REG(SDMMC1->POWER) & SDMMC_POWER_PWRCTRL) == SDMMC_POWER_PWRCTRL && (SIM_REG(SDMMC1->CLKCR) & SDMMC_CLKCR_CLKEN);
+}
+
+static uint32_t clock_hz (void)
+{
+    uint32_t clkcr = SIM_REG(SDMMC1->CLKCR);
+
+    return clkcr & SDMMC_CLKCR_BYPASS ? SDMMC_CK : SDMMC_CK / ((clkcr & SDMMC_CLKCR_CLKDIV) + 2);
+}
+
+// CPU cycles for n SDMMC_CK clocks.
+static inline uint64_t clocks (uint32_t n)
+{
+    return ((uint64_t)n * SIM_HCLK + clock_hz() - 1) / clock_hz();
+}
+
+static inline bool host_wide (void)
+{
+    return (SIM_REG(SDMMC1->CLKCR) & SDMMC_CLKCR_WIDBUS) == SDMMC_CLKCR_WIDBUS_0;
+}
+
+static inline bool busy (void)
+{
+    return sim_now < sd.busy_until;
+}
+
+static void update_irq (void)
+{
+    sim_irq_line(SDMMC1_IRQn, !!(sd.flags & SIM_REG(SDMMC1->MASK)));
+}
+
+static void set_flags (uint32_t flags)
+{
+    sd.flags |= flags;
+    update_irq();
+}
+
+static void check_clock (void)
+{
+    uint32_t max = sd.state <= Card_Ident ? 400000UL : (sd.high_speed ? 50000000UL : 25000000UL);
+
+    if(clock_hz() > max) {
+        sd.stats.overclocks++;
+        sd.stats.protocol_errors++;
+    }
+}
+
+//
+// Card
+//
+
+static void card_reset (void)
+{
+    sd.state = Card_Idle;
+    sd.rca = sd.status_errors = sd.init_polls = 0;
+    sd.app_cmd = sd.high_speed = sd.wide = sd.multiple = false;
+    sd.busy_until = 0;
+}
+
+static uint32_t card_status (void)
+{
+    uint32_t status = sd.status_errors | (sd.app_cmd ? R1_APP_CMD : 0);
+    card_state_t state = sd.state;
+
+    if(busy() && (state == Card_Tran || state == Card_Rcv))
+        state = Card_Prg;
+    if(state == Card_Tran || (state == Card_Rcv && !busy()))
+        status |= R1_READY_FOR_DATA;
+
+    sd.status_errors = 0; // clear on read
+
+    return status | ((uint32_t)state << 9);
+}
+
+// Returns the block number of a data command argument, UINT32_MAX and an error bit set if not valid.
+static uint32_t block_of (uint32_t arg)
+{
+    if(sd.type != SIM_SD_HC) {
+        if(arg & 511) {
+            sd.status_errors |= R1_ADDRESS_ERROR;
+            return UINT32_MAX;
+        }
+        arg >>= 9;
+    }
+
+    if(arg >= sd.sectors) {
+        sd.status_errors |= R1_OUT_OF_RANGE;
+        return UINT32_MAX;
+    }
+
+    return arg;
+}
+
+static void long_resp (const uint8_t *reg)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < 4; idx++)
+        sd.resp[idx] = ((uint32_t)reg[idx * 4] << 24) | ((uint32_t)reg[idx * 4 + 1] << 16) | ((uint32_t)reg[idx * 4 + 2] << 8) | reg[idx * 4 + 3];
+
+    sd.resp[3] &= ~1UL; // bit 0 is not received
+    sd.respcmd = 0x3F;
+}
+
+static void short_resp (uint32_t idx, uint32_t value)
+{
+    sd.resp[0] = value;
+    sd.resp[1] = sd.resp[2] = sd.resp[3] = 0;
+    sd.respcmd = idx;
+}
+
+static void read_start (uint32_t block_len)
+{
+    sd.block_len = block_len;
+    sd.blocks_sent = 0;
+    sd.line = Line_ReadStart;
+    sd.line_time = sd.cmd_done + sd.read_latency;
+}
+
+static void switch_func (uint32_t arg)
+{
+    bool hs = sd.high_speed_supported && (arg & 0x0F) == 1;
+
+    memset(sd.switch_status, 0, sizeof(sd.switch_status));
+    sd.switch_status[1] = 100;                                  // max current, mA
+    sd.switch_status[13] = sd.high_speed_supported ? 0x03 : 0x01;  // group 1 functions supported
+    sd.switch_status[16] = (arg & 0x0F) == 0x0F ? (sd.high_speed ? 1 : 0) : (hs ? 1 : 0x0F);
+
+    if((arg & 0x80000000UL) && hs)
+        sd.high_speed = true;
+}
+
+// Executes a command at the end of its transmission, returns the response type, RESP_NONE if the card does not answer.
+static uint_fast8_t card_command (uint32_t idx, uint32_t arg)
+{
+    bool app = sd.app_cmd, selected = (arg >> 16) == sd.rca >> 16;
+    uint_fast8_t resp = RESP_NONE;
+
+    sd.app_cmd = false;
+
+    if(!sd.inserted)
+        return RESP_NONE;
+
+    if(busy() && idx != 13 && idx != 12 && idx != 0) {
+        sd.stats.protocol_errors++;
+        return RESP_NONE;
+    }
+
+    if(app)
+        sd.stats.acmds[idx]++;
+    else
+        sd.stats.cmds[idx]++;
+
+    switch(app ? idx | 0x40 : idx) {
+
+        case 0: // GO_IDLE_STATE
+            sd.line = Line_Idle;
+            card_reset();
+            break;
+
+        case 2: // ALL_SEND_CID
+            if(sd.state == Card_Ready) {
+                sd.state = Card_Ident;
+                long_resp(sd.cid);
+                resp = RESP_LONG;
+            }
+            break;
+
+        case 3: // SEND_RELATIVE_ADDR
+            if(sd.state == Card_Ident || sd.state == Card_Stby) {
+                sd.state = Card_Stby;
+                sd.rca = 0x1234UL << 16;
+                short_resp(idx, sd.rca | ((uint32_t)sd.state << 9) | R1_READY_FOR_DATA);
+                resp = RESP_SHORT;
+            }
+            break;
+
+        case 6: // SWITCH_FUNC
+            if(sd.state == Card_Tran && sd.type >= SIM_SD_V2) {
+                switch_func(arg);
+                short_resp(idx, card_status());
+                sd.state = Card_Data;
+                sd.multiple = false;
+                read_start(sizeof(sd.switch_status));
+                resp = RESP_SHORT;
+            }
+            break;
+
+        case 0x46: // ACMD6, SET_BUS_WIDTH
+            if(sd.state == Card_Tran) {
+                sd.wide = (arg & 0x03) == 2;
+                short_resp(idx, card_status());
+                resp = RESP_SHORT;
+            }
+            break;
+
+        case 7: // SELECT_CARD
+            if(sd.state == Card_Stby && selected) {
+                sd.state = Card_Tran;
+                short_resp(idx, card_status());
+                resp = RESP_SHORT;
+            } else if(sd.state >= Card_Stby && !selected)
+                sd.state = Card_Stby;
+            break;
+
+        case 8: // SEND_IF_COND
+            if(sd.state == Card_Idle && sd.type >= SIM_SD_V2) {
+                short_resp(idx, arg & 0xFFF);
+                resp = RESP_SHORT;
+            } else if(sd.type >= SIM_SD_V2)
+                sd.stats.protocol_errors++;
+            return resp;
+
+        case 9: // SEND_CSD
+            if(sd.state == Card_Stby && selected) {
+                long_resp(sd.csd);
+                resp = RESP_LONG;
+            }
+            break;
+
+        case 12: // STOP_TRANSMISSION
+            if(sd.state == Card_Data || sd.state == Card_Rcv) {
+                if(sd.state == Card_Data)
+                    sd.line = Line_Idle;
+                sd.stats.stops++;
+                sd.state = Card_Tran;
+                short_resp(idx, card_status());
+                resp = RESP_SHORT;
+            }
+            break;
+
+        case 13: // SEND_STATUS
+        case 0x4D: // ACMD13, not used
+            if(sd.state >= Card_Stby && selected) {
+                short_resp(idx, card_status());
+                resp = RESP_SHORT;
+            }
+            break;
+
+        case 16: // SET_BLOCKLEN
+            if(sd.state == Card_Tran) {
+                if(arg != 512)
+                    sd.status_errors |= R1_BLOCK_LEN_ERROR;
+                short_resp(idx, card_status());
+                resp = RESP_SHORT;
+            }
+            break;
+
+        case 17: // READ_SINGLE_BLOCK
+        case 18: // READ_MULTIPLE_BLOCK
+            if(sd.state == Card_Tran) {
+                if((sd.block = block_of(arg)) != UINT32_MAX) {
+                    sd.state = Card_Data;
+                    sd.multiple = idx == 18;
+                    read_start(512);
+                    if(sd.multiple)
+                        sd.stats.multiple_reads++;
+                }
+                short_resp(idx, card_status());
+                resp = RESP_SHORT;
+            }
+            break;
+
+        case 24: // WRITE_BLOCK
+        case 25: // WRITE_MULTIPLE_BLOCK
+            if(sd.state == Card_Tran) {
+                if((sd.block = block_of(arg)) != UINT32_MAX) {
+                    sd.state = Card_Rcv;
+                    sd.multiple = idx == 25;
+                    sd.block_len = 512;
+                    if(sd.multiple)
+                        sd.stats.multiple_writes++;
+                }
+                short_resp(idx, card_status());
+                resp = RESP_SHORT;
+            }
+            break;
+
+        case 0x69: // ACMD41, SD_SEND_OP_COND
+            if(sd.state == Card_Idle) {
+                // An SDHC card does not leave the idle state unless the host supports high capacity (HCS).
+                if(++sd.init_polls >= INIT_POLLS && (sd.type != SIM_SD_HC || (arg & (1UL << 30))))
+                    sd.state = Card_Ready;
+                short_resp(0x3F, 0x00FF8000UL | (sd.state == Card_Ready ? (1UL << 31) : 0) |
+                                  (sd.state == Card_Ready && sd.type == SIM_SD_HC ? (1UL << 30) : 0));
+                resp = RESP_R3;
+            }
+            break;
+
+        case 55: // APP_CMD
+            if(sd.type != SIM_SD_MMC && sd.state != Card_Ready && sd.state != Card_Ident && (sd.state == Card_Idle || selected)) {
+                sd.app_cmd = true;
+                short_resp(idx, card_status());
+                resp = RESP_SHORT;
+            }
+            return resp;
+
+        default:
+            break;
+    }
+
+    if(resp == RESP_NONE && idx != 0 && !(idx == 55 || (idx == 7 && !selected)))
+        sd.stats.protocol_errors++; // not valid in the current state
+
+    return resp;
+}
+
+//
+// CPSM
+//
+
+static void command_start (void)
+{
+    uint32_t cmd = SIM_REG(SDMMC1->CMD), waitresp = cmd & SDMMC_CMD_WAITRESP;
+    uint32_t idx = cmd & SDMMC_CMD_CMDINDEX;
+    uint_fast8_t resp;
+
+    if(sd.cmd_active)
+        sd.stats.protocol_errors++;
+
+    if(!powered()) {
+        sd.stats.protocol_errors++;
+        set_flags(waitresp ? SDMMC_STA_CTIMEOUT : SDMMC_STA_CMDSENT);
+        return;
+    }
+
+    check_clock();
+
+    sd.cmd_done = sim_now + clocks(48);
+    resp = card_command(idx, SIM_REG(SDMMC1->ARG));
+
+    if(waitresp == 0 || waitresp == SDMMC_CMD_WAITRESP_1) {
+        sd.cmd_flag = SDMMC_STA_CMDSENT;
+        sd.cmd_active = true;
+        return;
+    }
+
+    if(resp == RESP_NONE) {
+        sd.cmd_flag = SDMMC_STA_CTIMEOUT;
+        sd.cmd_done += clocks(64);
+    } else {
+        sd.cmd_flag = resp == RESP_R3 ? SDMMC_STA_CCRCFAIL : SDMMC_STA_CMDREND;
+        sd.cmd_done += clocks(2 + (resp == RESP_LONG ? 136 : 48)); // N_CR and the response
+        if((resp == RESP_LONG) != (waitresp == SDMMC_CMD_WAITRESP))
+            sd.stats.protocol_errors++;
+    }
+
+    sd.cmd_active = true;
+
+    // The card has started the read latency at the end of the command, count from the response.
+    if(sd.line == Line_ReadStart)
+        sd.line_time = sd.cmd_done + sd.read_latency;
+}
+
+static void command_end (void)
+{
+    sd.cmd_active = false;
+
+    if(sd.cmd_flag == SDMMC_STA_CMDREND || sd.cmd_flag == SDMMC_STA_CCRCFAIL) {
+        SIM_REG_RO(SDMMC1->RESPCMD) = sd.respcmd;
+        SIM_REG_RO(SDMMC1->RESP1) = sd.resp[0];
+        SIM_REG_RO(SDMMC1->RESP2) = sd.resp[1];
+        SIM_REG_RO(SDMMC1->RESP3) = sd.resp[2];
+        SIM_REG_RO(SDMMC1->RESP4) = sd.resp[3];
+    }
+
+    set_flags(sd.cmd_flag);
+}
+
+//
+// DPSM and data line
+//
+
+static void dpsm_stop (uint32_t flags)
+{
+    sd.dpsm_active = false;
+    set_flags(flags);
+}
+
+static void dpsm_timer (void)
+{
+    sd.dtimeout_at = sim_now + clocks(SIM_REG(SDMMC1->DTIMER));
+}
+
+static void dpsm_start (void)
+{
+    uint32_t dctrl = SIM_REG(SDMMC1->DCTRL);
+
+    sd.dpsm_active = true;
+    sd.dpsm_read = !!(dctrl & SDMMC_DCTRL_DTDIR);
+    sd.dpsm_block_len = 1UL << ((dctrl & SDMMC_DCTRL_DBLOCKSIZE) >> SDMMC_DCTRL_DBLOCKSIZE_Pos);
+    sd.dcount = SIM_REG(SDMMC1->DLEN);
+    sd.fetch = sd.dcount / 4;
+    sd.fifo_head = sd.fifo_count = 0;
+    dpsm_timer();
+
+    if(!sd.dpsm_read) {
+        if(sd.line != Line_Idle)
+            sd.stats.protocol_errors++;
+        else {
+            sd.line = Line_WriteStart;
+            sd.line_time = sim_now + clocks(2); // N_WR
+        }
+    }
+}
+
+static inline uint64_t word_time (void)
+{
+    return clocks(host_wide() ? 8 : 32);
+}
+
+// Block transfer setup checks, returns true if the data is received correctly.
+static bool block_check (void)
+{
+    bool ok = true;
+
+    check_clock();
+
+    if(host_wide() != sd.wide) {
+        sd.stats.width_errors++;
+        sd.stats.protocol_errors++;
+        ok = false;
+    }
+
+    if(sd.dpsm_active && sd.dpsm_block_len != sd.block_len) {
+        sd.stats.protocol_errors++;
+        ok = false;
+    }
+
+    return ok;
+}
+
+static void read_block_start (void)
+{
+    sd.block_capture = sd.dpsm_active && sd.dpsm_read;
+
+    // Blocks sent after the DPSM has received DLEN bytes, until CMD12 stops the card, are ignored.
+    if(!sd.block_capture && sd.blocks_sent == 0)
+        sd.stats.protocol_errors++; // the block is lost
+
+    if(sd.block_capture)
+        sd.block_corrupt = !block_check();
+
+    if(sd.block_len == 512) {
+        if(sd.block >= sd.sectors) {
+            // Beyond the end of the card: the card stops sending and flags the error if the host is reading.
+            if(sd.block_capture)
+                sd.status_errors |= R1_OUT_OF_RANGE;
+            sd.line = Line_Idle;
+            return;
+        }
+        memcpy(sd.block_buf, &sd.data[sd.block * 512], 512);
+    } else
+        memcpy(sd.block_buf, sd.switch_status, sd.block_len);
+
+    if(sd.corrupt_reads && sd.block_len == 512 && sd.block_capture) {
+        sd.corrupt_reads--;
+        sd.block_corrupt = true;
+        sd.block_buf[sd.block_len / 3] ^= 0x10;
+    }
+
+    sd.blocks_sent++;
+    sd.word = 0;
+    sd.line = Line_ReadWord;
+    sd.line_time += clocks(1) + word_time(); // start bit and the first word
+}
+
+static void read_word (void)
+{
+    uint32_t value;
+
+    if(sd.block_capture && sd.dpsm_active) {
+        memcpy(&value, &sd.block_buf[sd.word * 4], 4);
+        if(sd.fifo_count == FIFO_SIZE) {
+            sd.stats.overruns++;
+            dpsm_stop(SDMMC_STA_RXOVERR);
+        } else {
+            sd.fifo[(sd.fifo_head + sd.fifo_count++) % FIFO_SIZE] = value;
+            sd.dcount -= 4;
+        }
+    }
+
+    if(++sd.word == sd.block_len / 4) {
+        sd.line = Line_ReadCrc;
+        sd.line_time += clocks(17); // CRC16 and end bit
+    } else
+        sd.line_time += word_time();
+}
+
+static void read_block_end (void)
+{
+    if(sd.block_len == 512) {
+        if(sd.block_capture)
+            sd.stats.blocks_read++;
+        sd.block++;
+    }
+
+    if(sd.block_capture && sd.dpsm_active) {
+        if(sd.block_corrupt) {
+            sd.stats.crc_errors++;
+            dpsm_stop(SDMMC_STA_DCRCFAIL);
+        } else {
+            set_flags(SDMMC_STA_DBCKEND);
+            if(sd.dcount == 0)
+                dpsm_stop(SDMMC_STA_DATAEND);
+            else
+                dpsm_timer();
+        }
+    }
+
+    if(sd.multiple) {
+        sd.line = Line_ReadStart;
+        sd.line_time += clocks(2); // N_AC
+    } else {
+        sd.line = Line_Idle;
+        sd.state = Card_Tran;
+    }
+}
+
+static void write_block_start (void)
+{
+    if(!sd.dpsm_active) {
+        sd.line = Line_Idle;
+        return;
+    }
+
+    if(sd.state != Card_Rcv)
+        sd.stats.protocol_errors++; // the card does not receive, no CRC status follows
+
+    sd.block_corrupt = !block_check();
+    sd.word = 0;
+    sd.line = Line_WriteWord;
+    sd.line_time += clocks(1) + word_time();
+}
+
+static void write_word (void)
+{
+    if(!sd.dpsm_active) {
+        sd.line = Line_Idle;
+        return;
+    }
+
+    if(sd.fifo_count == 0) {
+        sd.stats.underruns++;
+        sd.line = Line_Idle;
+        dpsm_stop(SDMMC_STA_TXUNDERR);
+        return;
+    }
+
+    memcpy(&sd.block_buf[sd.word * 4], &sd.fifo[sd.fifo_head], 4);
+    sd.fifo_head = (sd.fifo_head + 1) % FIFO_SIZE;
+    sd.fifo_count--;
+    sd.dcount -= 4;
+
+    if(++sd.word == sd.dpsm_block_len / 4) {
+        sd.line = Line_WriteCrc;
+        sd.line_time += clocks(17 + 8); // CRC16, end bit and CRC status
+    } else
+        sd.line_time += word_time();
+}
+
+static void write_block_end (void)
+{
+    if(sd.state != Card_Rcv) {
+        sd.line = Line_Idle;
+        sd.dtimeout_at = sim_now; // no CRC status
+        return;
+    }
+
+    if(sd.corrupt_writes) {
+        sd.corrupt_writes--;
+        sd.block_buf[100] ^= 0x01;
+        sd.block_corrupt = true;
+    }
+
+    if(sd.block_corrupt) {
+        // Negative CRC status, the block is not written.
+        sd.stats.crc_errors++;
+        sd.line = Line_Idle;
+        if(!sd.multiple)
+            sd.state = Card_Tran;
+        dpsm_stop(SDMMC_STA_DCRCFAIL);
+        return;
+    }
+
+    if(sd.block >= sd.sectors) {
+        sd.status_errors |= R1_OUT_OF_RANGE;
+        sd.line = Line_Idle;
+        sd.dtimeout_at = sim_now;
+        return;
+    }
+
+    memcpy(&sd.data[sd.block++ * 512], sd.block_buf, 512);
+    sd.stats.blocks_written++;
+    sd.stats.busy_periods++;
+    sd.busy_until = sim_now + sd.busy_cycles;
+
+    if(!sd.multiple)
+        sd.state = Card_Tran; // programming, reported as such while busy
+
+    set_flags(SDMMC_STA_DBCKEND);
+
+    if(sd.dcount == 0) {
+        sd.line = Line_WriteBusy;
+        sd.line_time = sd.busy_until;
+    } else {
+        sd.line = Line_WriteStart;
+        sd.line_time = sd.busy_until + clocks(2);
+    }
+
+    dpsm_timer();
+    if(sd.dtimeout_at < sd.busy_until)
+        sd.dtimeout_at = sd.busy_until; // the data timer covers the busy time, not modelled
+}
+
+static void line_event (void)
+{
+    switch(sd.line) {
+
+        case Line_ReadStart:
+            read_block_start();
+            break;
+
+        case Line_ReadWord:
+            read_word();
+            break;
+
+        case Line_ReadCrc:
+            read_block_end();
+            break;
+
+        case Line_WriteStart:
+            write_block_start();
+            break;
+
+        case Line_WriteWord:
+            write_word();
+            break;
+
+        case Line_WriteCrc:
+            write_block_end();
+            break;
+
+        case Line_WriteBusy:
+            sd.line = Line_Idle;
+            if(sd.dpsm_active)
+                dpsm_stop(SDMMC_STA_DATAEND);
+            break;
+
+        default:
+            break;
+    }
+}
+
+// True while the DPSM waits for a read block or a write CRC status that is not coming.
+static bool dpsm_waiting (void)
+{
+    return sd.dpsm_active && (sd.dpsm_read ? (sd.line == Line_Idle || sd.line == Line_ReadStart) : sd.line == Line_Idle);
+}
+
+//
+// Model hooks
+//
+
+static uint64_t sdmmc_next (sim_periph_t *p)
+{
+    uint64_t t = UINT64_MAX;
+
+    if(sd.cmd_active)
+        t = sd.cmd_done;
+    if(sd.line != Line_Idle && sd.line_time < t)
+        t = sd.line_time;
+    if(dpsm_waiting() && sd.dtimeout_at < t)
+        t = sd.dtimeout_at;
+
+    return t;
+}
+
+static void sdmmc_event (sim_periph_t *p)
+{
+    if(sd.cmd_active && sd.cmd_done <= sim_now)
+        command_end();
+
+    if(sd.line != Line_Idle && sd.line_time <= sim_now)
+        line_event();
+
+    if(dpsm_waiting() && sd.dtimeout_at <= sim_now && (sd.line == Line_Idle || sd.line_time > sim_now)) {
+        sd.stats.timeouts++;
+        dpsm_stop(SDMMC_STA_DTIMEOUT);
+    }
+}
+
+static void sdmmc_read (sim_periph_t *p, uint32_t offset)
+{
+    uint32_t sta;
+
+    switch(offset) {
+
+        case offsetof(SDMMC_TypeDef, STA):
+            sta = sd.flags;
+            if(sd.cmd_active)
+                sta |= SDMMC_STA_CMDACT;
+            if(sd.dpsm_active && sd.dpsm_read)
+                sta |= SDMMC_STA_RXACT;
+            if(sd.dpsm_active && !sd.dpsm_read)
+                sta |= SDMMC_STA_TXACT;
+            if(sd.dpsm_read || !sd.dpsm_active) {
+                sta |= sd.fifo_count ? SDMMC_STA_RXDAVL : SDMMC_STA_RXFIFOE;
+                if(sd.fifo_count >= FIFO_SIZE / 2)
+                    sta |= SDMMC_STA_RXFIFOHF;
+                if(sd.fifo_count == FIFO_SIZE)
+                    sta |= SDMMC_STA_RXFIFOF;
+            } else {
+                sta |= sd.fifo_count ? SDMMC_STA_TXDAVL : SDMMC_STA_TXFIFOE;
+                if(sd.fifo_count <= FIFO_SIZE / 2)
+                    sta |= SDMMC_STA_TXFIFOHE;
+                if(sd.fifo_count == FIFO_SIZE)
+                    sta |= SDMMC_STA_TXFIFOF;
+            }
+            SIM_REG_RO(SDMMC1->STA) = sta;
+            break;
+
+        case offsetof(SDMMC_TypeDef, DCOUNT):
+            SIM_REG_RO(SDMMC1->DCOUNT) = sd.dcount;
+            break;
+
+        case offsetof(SDMMC_TypeDef, FIFOCNT):
+            SIM_REG_RO(SDMMC1->FIFOCNT) = sd.dpsm_read ? (sd.dcount + 3) / 4 + sd.fifo_count : sd.fetch;
+            break;
+
+        default:
+            if(offset >= offsetof(SDMMC_TypeDef, FIFO))
+                *(volatile uint32_t *)((uint8_t *)&SIM_REG(*SDMMC1) + (offset & ~3)) = sd.fifo_count ? sd.fifo[sd.fifo_head] : 0;
+            break;
+    }
+}
+
+static void sdmmc_after_read (sim_periph_t *p, uint32_t offset)
+{
+    if(offset >= offsetof(SDMMC_TypeDef, FIFO) && sd.fifo_count && (sd.dpsm_read || !sd.dpsm_active)) {
+        sd.fifo_head = (sd.fifo_head + 1) % FIFO_SIZE;
+        sd.fifo_count--;
+    }
+}
+
+static void sdmmc_write (sim_periph_t *p, uint32_t offset, uint32_t old)
+{
+    volatile uint32_t *reg = (volatile uint32_t *)((uint8_t *)&SIM_REG(*SDMMC1) + offset);
+
+    switch(offset) {
+
+        case offsetof(SDMMC_TypeDef, POWER):
+            if(!(*reg & SDMMC_POWER_PWRCTRL) && sd.inserted) {
+                card_reset(); // card power is switched with the peripheral
+                sd.line = Line_Idle;
+                sd.dpsm_active = sd.cmd_active = false;
+            }
+            break;
+
+        case offsetof(SDMMC_TypeDef, CMD):
+            if(*reg & SDMMC_CMD_CPSMEN)
+                command_start();
+            break;
+
+        case offsetof(SDMMC_TypeDef, DCTRL):
+            if((*reg & SDMMC_DCTRL_DTEN) && !(old & SDMMC_DCTRL_DTEN))
+                dpsm_start();
+            else if(!(*reg & SDMMC_DCTRL_DTEN)) {
+                sd.dpsm_active = false;
+                sd.fifo_count = 0;
+            }
+            break;
+
+        case offsetof(SDMMC_TypeDef, ICR):
+            sd.flags &= ~*reg;
+            *reg = 0;
+            update_irq();
+            break;
+
+        case offsetof(SDMMC_TypeDef, MASK):
+            update_irq();
+            break;
+
+        case offsetof(SDMMC_TypeDef, RESPCMD) ... offsetof(SDMMC_TypeDef, RESP4):
+        case offsetof(SDMMC_TypeDef, DCOUNT):
+        case offsetof(SDMMC_TypeDef, STA):
+        case offsetof(SDMMC_TypeDef, FIFOCNT):
+            *reg = old; // read only
+            break;
+
+        default:
+            if(offset >= offsetof(SDMMC_TypeDef, FIFO)) {
+                if(sd.dpsm_active && !sd.dpsm_read && sd.fifo_count < FIFO_SIZE) {
+                    sd.fifo[(sd.fifo_head + sd.fifo_count++) % FIFO_SIZE] = *reg;
+                    if(sd.fetch)
+                        sd.fetch--;
+                } else
+                    sd.stats.overruns++;
+            }
+            break;
+    }
+}
+
+static bool sdmmc_dma_request (sim_periph_t *p, uint32_t request)
+{
+    if(!(SIM_REG(SDMMC1->DCTRL) & SDMMC_DCTRL_DMAEN))
+        return false;
+
+    if(sd.dpsm_read || !sd.dpsm_active)
+        return sd.fifo_count > 0;
+
+    return sd.fifo_count < FIFO_SIZE && sd.fetch > 0;
+}
+
+// Only the status register is read in wait loops, the response registers are read one after another.
+static bool sdmmc_polled (sim_periph_t *p, uint32_t offset)
+{
+    return offset == offsetof(SDMMC_TypeDef, STA);
+}
+
+static void sdmmc_reset (sim_periph_t *p)
+{
+    sd.cmd_active = sd.dpsm_active = false;
+    sd.line = Line_Idle;
+    sd.flags = 0;
+    sd.fifo_head = sd.fifo_count = 0;
+    card_reset();
+}
+
+static void make_csd (void)
+{
+    uint8_t *csd = sd.csd;
+    uint32_t c_size, mult = 0;
+
+    memset(csd, 0, sizeof(sd.csd));
+
+    csd[1] = 0x0E;          // TAAC
+    csd[3] = 0x32;          // TRAN_SPEED 25 MHz
+    csd[4] = 0x5B;          // CCC, class 10 (switch) included
+    csd[5] = 0x50 | 9;      // READ_BL_LEN 512
+
+    if(sd.type == SIM_SD_HC) {
+        csd[0] = 0x40;      // CSD version 2.0
+        c_size = sd.sectors / 1024 - 1;
+        csd[7] = (c_size >> 16) & 0x3F;
+        csd[8] = (c_size >> 8) & 0xFF;
+        csd[9] = c_size & 0xFF;
+    } else {
+        if(sd.type == SIM_SD_V1)
+            csd[4] = 0x1B;  // no class 10
+        while(sd.sectors >> (mult + 2) > 4096)
+            mult++;
+        c_size = (sd.sectors >> (mult + 2)) - 1;
+        csd[6] = (c_size >> 10) & 0x03;
+        csd[7] = (c_size >> 2) & 0xFF;
+        csd[8] = (c_size & 0x03) << 6;
+        csd[9] = (mult >> 1) & 0x03;
+        csd[10] = (mult & 0x01) << 7;
+    }
+
+    csd[15] = crc7(csd, 15);
+}
+
+void sim_sdmmc_insert (sim_sd_type_t type, uint32_t sectors)
+{
+    free(sd.data);
+    sd.data = NULL;
+
+    sd.inserted = sectors > 0;
+    sd.type = type;
+    sd.sectors = sectors;
+    sd.high_speed_supported = type >= SIM_SD_V2;
+    sd.read_latency = 100 * SIM_CYCLES_PER_US;
+    sd.busy_cycles = 250 * SIM_CYCLES_PER_US;
+    sd.corrupt_reads = sd.corrupt_writes = 0;
+
+    if(sd.inserted) {
+        sd.data = calloc(sectors, 512);
+        make_csd();
+        memcpy(sd.cid, "\x03SDSIMCARD\x10\x12\x34\x56\x78", 15);
+        sd.cid[15] = crc7(sd.cid, 15);
+    }
+
+    card_reset();
+    memset(&sd.stats, 0, sizeof(sim_sdmmc_stats_t));
+}
+
+uint8_t *sim_sdmmc_data (void)
+{
+    return sd.data;
+}
+
+void sim_sdmmc_high_speed (bool supported)
+{
+    sd.high_speed_supported = supported;
+}
+
+void sim_sdmmc_busy_time (uint64_t cycles)
+{
+    sd.busy_cycles = cycles;
+}
+
+void sim_sdmmc_read_latency (uint64_t cycles)
+{
+    sd.read_latency = cycles;
+}
+
+void sim_sdmmc_corrupt_reads (uint32_t blocks)
+{
+    sd.corrupt_reads = blocks;
+}
+
+void sim_sdmmc_corrupt_writes (uint32_t blocks)
+{
+    sd.corrupt_writes = blocks;
+}
+
+uint32_t sim_sdmmc_clock (void)
+{
+    return powered() ? clock_hz() : 0;
+}
+
+uint32_t sim_sdmmc_bus_width (void)
+{
+    return sd.wide ? 4 : 1;
+}
+
+const sim_sdmmc_stats_t *sim_sdmmc_stats (void)
+{
+    return &sd.stats;
+}
+
+void sim_sdmmc_stats_reset (void)
+{
+    memset(&sd.stats, 0, sizeof(sim_sdmmc_stats_t));
+}
+
+__attribute__((constructor(150))) static void sim_sdmmc_attach (void)
+{
+    periph.name = "SDMMC1";
+    periph.base = SDMMC1_BASE;
+    periph.size = 0x400;
+    periph.reset = sdmmc_reset;
+    periph.read = sdmmc_read;
+    periph.after_read = sdmmc_after_read;
+    periph.write = sdmmc_write;
+    periph.next_event = sdmmc_next;
+    periph.event = sdmmc_event;
+    periph.dma_request = sdmmc_dma_request;
+    periph.polled = sdmmc_polled;
+    sim_attach(&periph);
+    sim_dma_source(SIM_DMA_SDMMC1, &periph);
+}
@@ -0,0 +1,254 @@
+/*
+
+  sim_spi.c - SPI1/SPI2/SPI3 model, master mode with 8-bit data frames
+
+  The transmit and receive FIFOs hold four frames each. A frame written to DR is shifted out
+  eight SPI clock periods after the previous one, the SPI clock is PCLK divided by the CR1 BR
+  prescaler. Each frame is exchanged with the device attached by the test, the received frame
+  is added to the receive FIFO, a frame received while it is full is lost and flags overrun.
+  RXNE follows the FRXTH threshold, TXE is set while the transmit FIFO is at most half full.
+  The RXDMAEN and TXDMAEN requests are levels served by the DMA model.
+
+  sim_spi_mask_rx_dma() masks the receive DMA request, e.g. to test the timeout of a DMA transfer
+  that never completes.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define FIFO_SIZE 4
+
+typedef struct {
+    SPI_TypeDef *spi;
+    bool apb2;
+    uint32_t dma_rx, dma_tx;
+    uint8_t (*device)(uint8_t mosi);
+    bool rx_dma_masked, shifting, dr_read;
+    uint8_t shift;
+    uint64_t shift_done;
+    uint8_t tx[FIFO_SIZE], rx[FIFO_SIZE];
+    uint_fast8_t tx_head, tx_count, rx_head, rx_count;
+    uint32_t frames, lost;
+} spi_state_t;
+
+static spi_state_t spis[] = {
+    { SPI1, true,  SIM_DMA_SPI1_RX, SIM_DMA_SPI1_TX },
+    { SPI2, false, SIM_DMA_SPI2_RX, SIM_DMA_SPI2_TX },
+    { SPI3, false, SIM_DMA_SPI3_RX, SIM_DMA_SPI3_TX }
+};
+
+#define N_SPIS (sizeof(spis) / sizeof(spi_state_t))
+
+static sim_periph_t periph[N_SPIS];
+
+static spi_state_t *state_of (SPI_TypeDef *spi)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < N_SPIS; idx++) {
+        if(spis[idx].spi == spi)
+            return &spis[idx];
+    }
+
+    abort();
+}
+
+// CPU cycles per frame.
+static uint64_t frame_cycles (spi_state_t *s)
+{
+    uint32_t cfgr = SIM_REG(RCC->CFGR);
+    uint32_t ppre = s->apb2 ? (cfgr & RCC_CFGR_PPRE2) >> RCC_CFGR_PPRE2_Pos : (cfgr & RCC_CFGR_PPRE1) >> RCC_CFGR_PPRE1_Pos;
+    uint64_t div = ppre & 0x4 ? 1UL << ((ppre & 0x3) + 1) : 1;
+
+    return 8 * div * (2UL << ((SIM_REG(s->spi->CR1) & SPI_CR1_BR) >> SPI_CR1_BR_Pos));
+}
+
+static inline bool enabled (spi_state_t *s)
+{
+    return !!(SIM_REG(s->spi->CR1) & SPI_CR1_SPE);
+}
+
+static void update_sr (spi_state_t *s)
+{
+    uint32_t sr = SIM_REG(s->spi->SR) & SPI_SR_OVR;
+
+    if(s->rx_count >= (SIM_REG(s->spi->CR2) & SPI_CR2_FRXTH ? 1 : 2))
+        sr |= SPI_SR_RXNE;
+    if(s->tx_count <= FIFO_SIZE / 2)
+        sr |= SPI_SR_TXE;
+    if(s->shifting || s->tx_count)
+        sr |= SPI_SR_BSY;
+
+    sr |= (uint32_t)(s->rx_count > 3 ? 3 : s->rx_count) << SPI_SR_FRLVL_Pos;
+    sr |= (uint32_t)(s->tx_count > 3 ? 3 : s->tx_count) << SPI_SR_FTLVL_Pos;
+
+    SIM_REG(s->spi->SR) = sr;
+}
+
+static void shift_start (spi_state_t *s)
+{
+    if(!s->shifting && s->tx_count && enabled(s)) {
+        s->shift = s->tx[s->tx_head];
+        s->tx_head = (s->tx_head + 1) % FIFO_SIZE;
+        s->tx_count--;
+        s->shifting = true;
+        s->shift_done = sim_now + frame_cycles(s);
+    }
+    update_sr(s);
+}
+
+static uint64_t spi_next (sim_periph_t *p)
+{
+    spi_state_t *s = (spi_state_t *)p->state;
+
+    return s->shifting ? s->shift_done : UINT64_MAX;
+}
+
+static void spi_event (sim_periph_t *p)
+{
+    spi_state_t *s = (spi_state_t *)p->state;
+    uint8_t miso;
+
+    if(s->shifting && s->shift_done <= sim_now) {
+        s->shifting = false;
+        s->frames++;
+        miso = s->device ? s->device(s->shift) : 0xFF;
+        if(s->rx_count == FIFO_SIZE) {
+            s->lost++;
+            SIM_REG(s->spi->SR) |= SPI_SR_OVR;
+        } else {
+            s->rx[(s->rx_head + s->rx_count) % FIFO_SIZE] = miso;
+            s->rx_count++;
+        }
+        shift_start(s);
+    }
+}
+
+static void spi_read (sim_periph_t *p, uint32_t offset)
+{
+    spi_state_t *s = (spi_state_t *)p->state;
+
+    if(offset == offsetof(SPI_TypeDef, DR))
+        SIM_REG(s->spi->DR) = s->rx_count ? s->rx[s->rx_head] : 0;
+}
+
+static void spi_after_read (sim_periph_t *p, uint32_t offset)
+{
+    spi_state_t *s = (spi_state_t *)p->state;
+
+    if(offset == offsetof(SPI_TypeDef, DR)) {
+        if(s->rx_count) {
+            s->rx_head = (s->rx_head + 1) % FIFO_SIZE;
+            s->rx_count--;
+        }
+        s->dr_read = true;
+        update_sr(s);
+    } else if(offset == offsetof(SPI_TypeDef, SR)) {
+        if(s->dr_read)  // OVR is cleared by a DR read followed by a SR read
+            SIM_REG(s->spi->SR) &= ~SPI_SR_OVR;
+        s->dr_read = false;
+    }
+}
+
+static void spi_write (sim_periph_t *p, uint32_t offset, uint32_t old)
+{
+    spi_state_t *s = (spi_state_t *)p->state;
+
+    switch(offset) {
+
+        case offsetof(SPI_TypeDef, DR):
+            if(enabled(s) && s->tx_count < FIFO_SIZE) {
+                s->tx[(s->tx_head + s->tx_count) % FIFO_SIZE] = (uint8_t)SIM_REG(s->spi->DR);
+                s->tx_count++;
+            }
+            shift_start(s);
+            break;
+
+        case offsetof(SPI_TypeDef, SR):
+            SIM_REG(s->spi->SR) = old; // read only
+            break;
+
+        case offsetof(SPI_TypeDef, CR1):
+            if(!enabled(s)) {
+                s->shifting = false;
+                s->tx_count = 0;
+            }
+            shift_start(s);
+            break;
+
+        case offsetof(SPI_TypeDef, CR2):
+            update_sr(s);
+            break;
+    }
+}
+
+static bool spi_dma_request (sim_periph_t *p, uint32_t request)
+{
+    spi_state_t *s = (spi_state_t *)p->state;
+    uint32_t cr2 = SIM_REG(s->spi->CR2), sr = SIM_REG(s->spi->SR);
+
+    if(request == s->dma_rx)
+        return (cr2 & SPI_CR2_RXDMAEN) && (sr & SPI_SR_RXNE) && !s->rx_dma_masked;
+
+    return (cr2 & SPI_CR2_TXDMAEN) && (sr & SPI_SR_TXE) && enabled(s);
+}
+
+static void spi_reset (sim_periph_t *p)
+{
+    spi_state_t *s = (spi_state_t *)p->state;
+
+    s->rx_dma_masked = s->shifting = s->dr_read = false;
+    s->tx_head = s->tx_count = s->rx_head = s->rx_count = 0;
+    s->frames = s->lost = 0;
+    SIM_REG(s->spi->SR) = SPI_SR_TXE;
+}
+
+void sim_spi_device (SPI_TypeDef *spi, uint8_t (*exchange)(uint8_t mosi))
+{
+    state_of(spi)->device = exchange;
+}
+
+void sim_spi_mask_rx_dma (SPI_TypeDef *spi, bool mask)
+{
+    state_of(spi)->rx_dma_masked = mask;
+}
+
+uint32_t sim_spi_frames (SPI_TypeDef *spi)
+{
+    return state_of(spi)->frames;
+}
+
+uint32_t sim_spi_lost (SPI_TypeDef *spi)
+{
+    return state_of(spi)->lost;
+}
+
+uint64_t sim_spi_frame_time (SPI_TypeDef *spi)
+{
+    return frame_cycles(state_of(spi));
+}
+
+__attribute__((constructor(150))) static void sim_spi_attach (void)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < N_SPIS; idx++) {
+        periph[idx].name = "SPI";
+        periph[idx].base = (uint32_t)(uintptr_t)spis[idx].spi;
+        periph[idx].size = 0x400;
+        periph[idx].reset = spi_reset;
+        periph[idx].read = spi_read;
+        periph[idx].after_read = spi_after_read;
+        periph[idx].write = spi_write;
+        periph[idx].next_event = spi_next;
+        periph[idx].event = spi_event;
+        periph[idx].dma_request = spi_dma_request;
+        periph[idx].state = &spis[idx];
+        sim_attach(&periph[idx]);
+        sim_dma_source(spis[idx].dma_rx, &periph[idx]);
+        sim_dma_source(spis[idx].dma_tx, &periph[idx]);
+    }
+}
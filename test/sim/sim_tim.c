@@ -0,0 +1,222 @@
+/*
+
+  sim_tim.c - basic, general purpose and advanced timer model
+
+  Up and down counting with auto-reload preload, prescaler buffering, one pulse mode,
+  update generation by UG (suppressed by URS), update interrupts and update DMA requests.
+  Capture/compare channels are not modelled.
+
+*/
+
+#include <string.h>
+
+#include "sim.h"
+
+typedef struct {
+    TIM_TypeDef *tim;
+    bool apb2;
+    bool bits32;
+    IRQn_Type irq;          // update interrupt
+    uint32_t dma_up;        // update DMA request, 0 if none
+    uint32_t cnt;           // counter at t_ref
+    uint64_t t_ref;         // time of the last counter tick accounted for
+    uint32_t arr, psc;      // active values
+} tim_state_t;
+
+static tim_state_t timers[] = {
+    { TIM1,  true,  false, TIM1_UP_TIM10_IRQn },
+    { TIM2,  false, true,  TIM2_IRQn },
+    { TIM3,  false, false, TIM3_IRQn },
+    { TIM4,  false, false, TIM4_IRQn },
+    { TIM5,  false, true,  TIM5_IRQn },
+    { TIM6,  false, false, TIM6_DAC_IRQn },
+    { TIM7,  false, false, TIM7_IRQn },
+    { TIM8,  true,  false, TIM8_UP_TIM13_IRQn, SIM_DMA_TIM8_UP },
+    { TIM9,  true,  false, TIM1_BRK_TIM9_IRQn },
+    { TIM10, true,  false, TIM1_UP_TIM10_IRQn },
+    { TIM11, true,  false, TIM1_TRG_COM_TIM11_IRQn },
+    { TIM12, false, false, TIM8_BRK_TIM12_IRQn },
+    { TIM13, false, false, TIM8_UP_TIM13_IRQn },
+    { TIM14, false, false, TIM8_TRG_COM_TIM14_IRQn }
+};
+
+#define N_TIMERS (sizeof(timers) / sizeof(tim_state_t))
+
+static sim_periph_t periph[N_TIMERS];
+
+// CPU cycles per counter tick.
+static uint64_t tick_cycles (tim_state_t *t)
+{
+    uint32_t cfgr = SIM_REG(RCC->CFGR);
+    uint32_t ppre = t->apb2 ? (cfgr & RCC_CFGR_PPRE2) >> RCC_CFGR_PPRE2_Pos : (cfgr & RCC_CFGR_PPRE1) >> RCC_CFGR_PPRE1_Pos;
+    uint64_t div = ppre & 0x4 ? 1UL << ((ppre & 0x3) + 1) : 1; // APB prescaler
+
+    return (div > 1 ? div / 2 : 1) * (t->psc + 1);              // timer clock is 2x PCLK when prescaled
+}
+
+static inline uint32_t max_count (tim_state_t *t)
+{
+    return t->bits32 ? 0xFFFFFFFFUL : 0xFFFFUL;
+}
+
+static inline bool down (tim_state_t *t)
+{
+    return !!(SIM_REG(t->tim->CR1) & TIM_CR1_DIR);
+}
+
+// Accounts for counter ticks up to now, never past the next update.
+static void tim_sync (tim_state_t *t, bool running)
+{
+    if(running) {
+        uint64_t ticks = (sim_now - t->t_ref) / tick_cycles(t);
+        t->t_ref += ticks * tick_cycles(t);
+        t->cnt = down(t) ? t->cnt - (uint32_t)ticks : t->cnt + (uint32_t)ticks;
+    } else
+        t->t_ref = sim_now;
+}
+
+static void tim_irq_lines (void)
+{
+    uint_fast8_t idx, other;
+
+    for(idx = 0; idx < N_TIMERS; idx++) {
+        bool level = false;
+        for(other = 0; other < N_TIMERS; other++) {
+            if(timers[other].irq == timers[idx].irq)
+                level |= !!(SIM_REG(timers[other].tim->SR) & SIM_REG(timers[other].tim->DIER) & TIM_DIER_UIE);
+        }
+        sim_irq_line(timers[idx].irq, level);
+    }
+}
+
+static void tim_update (tim_state_t *t, bool flag)
+{
+    TIM_TypeDef *tim = t->tim;
+
+    t->psc = SIM_REG(tim->PSC);
+    t->arr = SIM_REG(tim->ARR);
+    t->cnt = down(t) ? t->arr : 0;
+
+    if(flag) {
+        SIM_REG(tim->SR) |= TIM_SR_UIF;
+        if(t->dma_up && (SIM_REG(tim->DIER) & TIM_DIER_UDE))
+            sim_dma_request(t->dma_up);
+    }
+
+    tim_irq_lines();
+}
+
+static uint64_t tim_next (sim_periph_t *p)
+{
+    tim_state_t *t = (tim_state_t *)p->state;
+    uint64_t ticks;
+
+    if(!(SIM_REG(t->tim->CR1) & TIM_CR1_CEN))
+        return UINT64_MAX;
+
+    if(down(t))
+        ticks = (uint64_t)t->cnt + 1;
+    else if(t->cnt > t->arr)
+        ticks = (uint64_t)max_count(t) - t->cnt + 1;    // counts to the top and wraps without update
+    else
+        ticks = (uint64_t)t->arr - t->cnt + 1;
+
+    return t->t_ref + ticks * tick_cycles(t);
+}
+
+static void tim_event (sim_periph_t *p)
+{
+    tim_state_t *t = (tim_state_t *)p->state;
+    bool wrap = !down(t) && t->cnt > t->arr;
+
+    t->t_ref = sim_now;
+
+    if(wrap) {
+        t->cnt = 0;
+        return;
+    }
+
+    if(SIM_REG(t->tim->CR1) & TIM_CR1_OPM)
+        SIM_REG(t->tim->CR1) &= ~TIM_CR1_CEN;
+
+    tim_update(t, !(SIM_REG(t->tim->CR1) & TIM_CR1_UDIS));
+}
+
+static void tim_read (sim_periph_t *p, uint32_t offset)
+{
+    tim_state_t *t = (tim_state_t *)p->state;
+
+    if(offset == offsetof(TIM_TypeDef, CNT)) {
+        tim_sync(t, !!(SIM_REG(t->tim->CR1) & TIM_CR1_CEN));
+        SIM_REG(t->tim->CNT) = t->cnt & max_count(t);
+    }
+}
+
+static void tim_write (sim_periph_t *p, uint32_t offset, uint32_t old)
+{
+    tim_state_t *t = (tim_state_t *)p->state;
+    TIM_TypeDef *tim = t->tim;
+    uint32_t value = *(uint32_t *)((uint8_t *)&SIM_REG(*tim) + offset);
+
+    tim_sync(t, !!((offset == offsetof(TIM_TypeDef, CR1) ? old : SIM_REG(tim->CR1)) & TIM_CR1_CEN));
+
+    switch(offset) {
+
+        case offsetof(TIM_TypeDef, CR1):
+            if((value & TIM_CR1_CEN) && !(old & TIM_CR1_CEN))
+                t->t_ref = sim_now;
+            break;
+
+        case offsetof(TIM_TypeDef, CNT):
+            t->cnt = value & max_count(t);
+            t->t_ref = sim_now;
+            break;
+
+        case offsetof(TIM_TypeDef, ARR):
+            if(!(SIM_REG(tim->CR1) & TIM_CR1_ARPE))
+                t->arr = value & max_count(t);
+            break;
+
+        case offsetof(TIM_TypeDef, EGR):
+            SIM_REG(tim->EGR) = 0;
+            if(value & TIM_EGR_UG) {
+                t->t_ref = sim_now;
+                tim_update(t, !(SIM_REG(tim->CR1) & TIM_CR1_URS));
+            }
+            break;
+
+        case offsetof(TIM_TypeDef, SR):
+            SIM_REG(tim->SR) = old & value; // rc_w0
+            break;
+    }
+
+    tim_irq_lines();
+}
+
+static void tim_reset (sim_periph_t *p)
+{
+    tim_state_t *t = (tim_state_t *)p->state;
+
+    t->cnt = t->psc = 0;
+    t->t_ref = 0;
+    t->arr = max_count(t);
+    SIM_REG(t->tim->ARR) = t->arr;
+}
+
+__attribute__((constructor(150))) static void sim_tim_attach (void)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < N_TIMERS; idx++) {
+        periph[idx].name = "TIM";
+        periph[idx].base = (uint32_t)(uintptr_t)timers[idx].tim;
+        periph[idx].size = 0x400;
+        periph[idx].reset = tim_reset;
+        periph[idx].read = tim_read;
+        periph[idx].write = tim_write;
+        periph[idx].next_event = tim_next;
+        periph[idx].event = tim_event;
+        periph[idx].state = &timers[idx];
+        sim_attach(&periph[idx]);
+    }
+}
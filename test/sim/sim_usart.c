@@ -0,0 +1,307 @@
+/*
+
+  sim_usart.c - USART1/USART3 model
+
+  Asynchronous mode, 16x oversampling, character time 10 bits. The transmitter has a data
+  register and a shift register, transmitted characters are captured for the test. Received
+  characters are queued by the test and arrive back to back at the configured baud rate, a
+  character arriving while RXNE is set is lost (counted) and flags overrun unless OVRDIS is set.
+  The idle line flag is set one character time after the last character of a burst.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+typedef struct {
+    USART_TypeDef *usart;
+    bool apb2;
+    IRQn_Type irq;
+    uint32_t dma_rx, dma_tx;
+    // transmitter
+    bool shifting, tdr_full;
+    uint8_t shift, tdr;
+    uint64_t shift_done;
+    uint8_t *tx;
+    uint32_t tx_len, tx_size;
+    // receiver
+    uint8_t *rx;
+    uint32_t rx_head, rx_len, rx_size;
+    uint64_t rx_next;       // arrival time of the next character
+    uint64_t idle_at;       // UINT64_MAX when no idle line detection is pending
+    uint32_t lost;
+} usart_state_t;
+
+static usart_state_t usarts[] = {
+    { USART1, true,  USART1_IRQn, SIM_DMA_USART1_RX, SIM_DMA_USART1_TX },
+    { USART3, false, USART3_IRQn, SIM_DMA_USART3_RX, SIM_DMA_USART3_TX }
+};
+
+#define N_USARTS (sizeof(usarts) / sizeof(usart_state_t))
+
+static sim_periph_t periph[N_USARTS];
+
+static usart_state_t *state_of (USART_TypeDef *usart)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < N_USARTS; idx++) {
+        if(usarts[idx].usart == usart)
+            return &usarts[idx];
+    }
+
+    abort();
+}
+
+// CPU cycles per character, kernel clock is PCLK.
+static uint64_t char_cycles (usart_state_t *u)
+{
+    uint32_t cfgr = SIM_REG(RCC->CFGR);
+    uint32_t ppre = u->apb2 ? (cfgr & RCC_CFGR_PPRE2) >> RCC_CFGR_PPRE2_Pos : (cfgr & RCC_CFGR_PPRE1) >> RCC_CFGR_PPRE1_Pos;
+    uint64_t div = ppre & 0x4 ? 1UL << ((ppre & 0x3) + 1) : 1, brr = SIM_REG(u->usart->BRR) & 0xFFFF;
+
+    return 10 * (brr ? brr : 16) * div;
+}
+
+static inline bool enabled (usart_state_t *u, uint32_t bit)
+{
+    return (SIM_REG(u->usart->CR1) & (USART_CR1_UE|bit)) == (USART_CR1_UE|bit);
+}
+
+static void usart_irq_line (usart_state_t *u)
+{
+    uint32_t isr = SIM_REG(u->usart->ISR), cr1 = SIM_REG(u->usart->CR1);
+
+    sim_irq_line(u->irq, ((cr1 & USART_CR1_RXNEIE) && (isr & (USART_ISR_RXNE|USART_ISR_ORE))) ||
+                          ((cr1 & USART_CR1_TXEIE) && (isr & USART_ISR_TXE)) ||
+                           ((cr1 & USART_CR1_TCIE) && (isr & USART_ISR_TC)) ||
+                            ((cr1 & USART_CR1_IDLEIE) && (isr & USART_ISR_IDLE)));
+}
+
+static void update_isr (usart_state_t *u)
+{
+    volatile uint32_t *isr = &SIM_REG(u->usart->ISR);
+
+    if(u->tdr_full)
+        *isr &= ~USART_ISR_TXE;
+    else
+        *isr |= USART_ISR_TXE;
+
+    usart_irq_line(u);
+}
+
+static void tx_load (usart_state_t *u)
+{
+    if(!u->shifting && u->tdr_full && enabled(u, USART_CR1_TE)) {
+        u->shift = u->tdr;
+        u->tdr_full = false;
+        u->shifting = true;
+        u->shift_done = sim_now + char_cycles(u);
+        SIM_REG(u->usart->ISR) &= ~USART_ISR_TC;
+    }
+    update_isr(u);
+}
+
+static uint64_t usart_next (sim_periph_t *p)
+{
+    usart_state_t *u = (usart_state_t *)p->state;
+    uint64_t t = UINT64_MAX;
+
+    if(u->shifting)
+        t = u->shift_done;
+    if(u->rx_head < u->rx_len && u->rx_next < t)
+        t = u->rx_next;
+    if(u->idle_at < t)
+        t = u->idle_at;
+
+    return t;
+}
+
+static void usart_event (sim_periph_t *p)
+{
+    usart_state_t *u = (usart_state_t *)p->state;
+    volatile uint32_t *isr = &SIM_REG(u->usart->ISR);
+
+    if(u->shifting && u->shift_done <= sim_now) {
+        if(u->tx_len == u->tx_size)
+            u->tx = realloc(u->tx, u->tx_size = u->tx_size ? u->tx_size * 2 : 4096);
+        u->tx[u->tx_len++] = u->shift;
+        u->shifting = false;
+        if(u->tdr_full)
+            tx_load(u);
+        else
+            *isr |= USART_ISR_TC;
+    }
+
+    if(u->rx_head < u->rx_len && u->rx_next <= sim_now) {
+        uint8_t c = u->rx[u->rx_head++];
+        u->rx_next += char_cycles(u);
+        if(enabled(u, USART_CR1_RE)) {
+            if(*isr & USART_ISR_RXNE) {
+                u->lost++;
+                if(!(SIM_REG(u->usart->CR3) & USART_CR3_OVRDIS))
+                    *isr |= USART_ISR_ORE;
+            } else {
+                SIM_REG(u->usart->RDR) = c;
+                *isr |= USART_ISR_RXNE;
+            }
+            u->idle_at = u->rx_head < u->rx_len ? UINT64_MAX : sim_now + char_cycles(u);
+        } else
+            u->lost++;
+    }
+
+    if(u->idle_at <= sim_now) {
+        u->idle_at = UINT64_MAX;
+        *isr |= USART_ISR_IDLE;
+    }
+
+    usart_irq_line(u);
+}
+
+static void usart_after_read (sim_periph_t *p, uint32_t offset)
+{
+    usart_state_t *u = (usart_state_t *)p->state;
+
+    if(offset == offsetof(USART_TypeDef, RDR)) {
+        SIM_REG(u->usart->ISR) &= ~USART_ISR_RXNE;
+        usart_irq_line(u);
+    }
+}
+
+static void usart_write (sim_periph_t *p, uint32_t offset, uint32_t old)
+{
+    usart_state_t *u = (usart_state_t *)p->state;
+    USART_TypeDef *usart = u->usart;
+
+    switch(offset) {
+
+        case offsetof(USART_TypeDef, TDR):
+            if(!u->tdr_full) {
+                u->tdr = (uint8_t)SIM_REG(usart->TDR);
+                u->tdr_full = true;
+            }
+            tx_load(u);
+            break;
+
+        case offsetof(USART_TypeDef, ICR):
+            SIM_REG(usart->ISR) &= ~(SIM_REG(usart->ICR) & (USART_ICR_PECF|USART_ICR_FECF|USART_ICR_NCF|USART_ICR_ORECF|USART_ICR_IDLECF|USART_ICR_TCCF));
+            SIM_REG(usart->ICR) = 0;
+            usart_irq_line(u);
+            break;
+
+        case offsetof(USART_TypeDef, RQR):
+            if(SIM_REG(usart->RQR) & USART_RQR_RXFRQ)
+                SIM_REG(usart->ISR) &= ~USART_ISR_RXNE;
+            SIM_REG(usart->RQR) = 0;
+            usart_irq_line(u);
+            break;
+
+        case offsetof(USART_TypeDef, ISR):
+        case offsetof(USART_TypeDef, RDR):
+            *(uint32_t *)((uint8_t *)&SIM_REG(*usart) + offset) = old; // read only
+            break;
+
+        case offsetof(USART_TypeDef, CR1):
+            if(!(SIM_REG(usart->CR1) & USART_CR1_UE)) {
+                u->shifting = u->tdr_full = false;
+                SIM_REG(usart->ISR) = USART_ISR_TC;
+            } else
+                tx_load(u);
+            update_isr(u);
+            break;
+    }
+}
+
+static bool usart_dma_request (sim_periph_t *p, uint32_t request)
+{
+    usart_state_t *u = (usart_state_t *)p->state;
+    uint32_t cr3 = SIM_REG(u->usart->CR3), isr = SIM_REG(u->usart->ISR);
+
+    if(request == u->dma_rx)
+        return (cr3 & USART_CR3_DMAR) && (isr & USART_ISR_RXNE);
+
+    return (cr3 & USART_CR3_DMAT) && (isr & USART_ISR_TXE) && enabled(u, USART_CR1_TE);
+}
+
+static void usart_reset (sim_periph_t *p)
+{
+    usart_state_t *u = (usart_state_t *)p->state;
+
+    u->shifting = u->tdr_full = false;
+    u->tx_len = u->rx_head = u->rx_len = u->lost = 0;
+    u->idle_at = UINT64_MAX;
+    SIM_REG(u->usart->ISR) = USART_ISR_TXE|USART_ISR_TC;
+}
+
+void sim_usart_rx (USART_TypeDef *usart, const void *data, uint32_t length)
+{
+    usart_state_t *u = state_of(usart);
+
+    if(u->rx_head == u->rx_len) {
+        u->rx_head = u->rx_len = 0;
+        if(u->rx_next < sim_now)
+            u->rx_next = sim_now + char_cycles(u);
+    }
+
+    if(u->rx_len + length > u->rx_size)
+        u->rx = realloc(u->rx, u->rx_size = u->rx_len + length + 4096);
+
+    memcpy(&u->rx[u->rx_len], data, length);
+    u->rx_len += length;
+    u->idle_at = UINT64_MAX;
+}
+
+uint32_t sim_usart_rx_pending (USART_TypeDef *usart)
+{
+    usart_state_t *u = state_of(usart);
+
+    return u->rx_len - u->rx_head;
+}
+
+uint32_t sim_usart_rx_lost (USART_TypeDef *usart)
+{
+    return state_of(usart)->lost;
+}
+
+uint32_t sim_usart_tx (USART_TypeDef *usart, const uint8_t **data)
+{
+    usart_state_t *u = state_of(usart);
+
+    if(data)
+        *data = u->tx;
+
+    return u->tx_len;
+}
+
+void sim_usart_tx_clear (USART_TypeDef *usart)
+{
+    state_of(usart)->tx_len = 0;
+}
+
+uint64_t sim_usart_char_time (USART_TypeDef *usart)
+{
+    return char_cycles(state_of(usart));
+}
+
+__attribute__((constructor(150))) static void sim_usart_attach (void)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < N_USARTS; idx++) {
+        periph[idx].name = "USART";
+        periph[idx].base = (uint32_t)(uintptr_t)usarts[idx].usart;
+        periph[idx].size = 0x400;
+        periph[idx].reset = usart_reset;
+        periph[idx].after_read = usart_after_read;
+        periph[idx].write = usart_write;
+        periph[idx].next_event = usart_next;
+        periph[idx].event = usart_event;
+        periph[idx].dma_request = usart_dma_request;
+        periph[idx].state = &usarts[idx];
+        sim_attach(&periph[idx]);
+        sim_dma_source(usarts[idx].dma_rx, &periph[idx]);
+        sim_dma_source(usarts[idx].dma_tx, &periph[idx]);
+    }
+}
@@ -0,0 +1,345 @@
+/*
+
+  sim_usb.c - USB OTG FS device and host model at the USB device library low level interface
+
+  Replaces usbd_conf.c and the PCD driver: the USBD_LL_* functions called by the USB device
+  library are implemented here against a simulated host, and the library callbacks are made from
+  OTG_FS_IRQHandler() so that disabling OTG_FS_IRQn in the NVIC defers them as on hardware.
+
+  Host model:
+  - sim_usb_connect() resets the device and sets the address and configuration 1,
+    sim_usb_disconnect() detaches it, transfers in progress are dropped.
+  - IN endpoints: a transfer started by USBD_LL_Transmit() completes after the host latency
+    plus one packet time per packet, the data is captured for the test. The latency is the
+    time the host takes to poll the endpoint, e.g. a full speed frame.
+  - OUT endpoints: data queued by the test with sim_usb_out() is sent in packets of the
+    endpoint max packet size. A packet is delivered the host latency after the endpoint was
+    armed by USBD_LL_PrepareReceive(), the endpoint NAKs the host while it is not armed.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+#include "usbd_core.h"
+
+#define N_EP 4
+#define PACKET_CYCLES (64 * 8 * SIM_CYCLES_PER_US / 12) // 64 bytes at 12 Mbit/s
+
+typedef struct {
+    bool busy;
+    uint64_t done;
+    uint8_t *buf;
+    uint32_t length;
+} in_ep_t;
+
+typedef struct {
+    bool armed;
+    uint64_t armed_at;
+    uint8_t *buf;
+    uint32_t size;
+    uint32_t count;
+} out_ep_t;
+
+static struct {
+    USBD_HandleTypeDef *pdev;
+    PCD_HandleTypeDef hpcd;
+    bool connect, disconnect;
+    bool irq;                       // interrupt raised, events are handled by OTG_FS_IRQHandler()
+    uint64_t latency;
+    in_ep_t in[N_EP];
+    out_ep_t out[N_EP];
+    uint8_t *in_data;               // captured IN data
+    uint32_t in_len, in_size;
+    uint8_t *out_data;              // OUT data queued by the test
+    uint32_t out_head, out_len, out_size;
+    sim_usb_stats_t stats;
+} usb;
+
+static sim_periph_t periph;
+
+static uint64_t out_due (uint_fast8_t ep)
+{
+    return usb.out[ep].armed && usb.out_head < usb.out_len ? usb.out[ep].armed_at + usb.latency + PACKET_CYCLES : UINT64_MAX;
+}
+
+static uint64_t usb_next (sim_periph_t *p)
+{
+    uint_fast8_t ep;
+    uint64_t t = usb.connect || usb.disconnect ? sim_now : UINT64_MAX, e;
+
+    if(usb.irq)
+        return UINT64_MAX;
+
+    for(ep = 1; ep < N_EP; ep++) {
+        if(usb.in[ep].busy && usb.in[ep].done < t)
+            t = usb.in[ep].done;
+        if((e = out_due(ep)) < t)
+            t = e;
+    }
+
+    return t;
+}
+
+static void usb_event (sim_periph_t *p)
+{
+    usb.irq = true;
+    sim_irq_line(OTG_FS_IRQn, true);
+}
+
+static void setup (uint8_t request, uint16_t value)
+{
+    uint8_t packet[8] = { 0x00, request, value & 0xFF, value >> 8, 0, 0, 0, 0 };
+
+    USBD_LL_SetupStage(usb.pdev, packet);
+}
+
+void OTG_FS_IRQHandler (void)
+{
+    uint_fast8_t ep;
+
+    usb.irq = false;
+    sim_irq_line(OTG_FS_IRQn, false);
+
+    if(usb.disconnect) {
+        usb.disconnect = false;
+        memset(usb.in, 0, sizeof(usb.in));
+        memset(usb.out, 0, sizeof(usb.out));
+        USBD_LL_DevDisconnected(usb.pdev);
+    }
+
+    if(usb.connect) {
+        usb.connect = false;
+        USBD_LL_SetSpeed(usb.pdev, USBD_SPEED_FULL);
+        USBD_LL_Reset(usb.pdev);
+        setup(USB_REQ_SET_ADDRESS, 1);
+        setup(USB_REQ_SET_CONFIGURATION, 1);
+    }
+
+    for(ep = 1; ep < N_EP; ep++) {
+
+        in_ep_t *in = &usb.in[ep];
+        out_ep_t *out = &usb.out[ep];
+
+        if(in->busy && in->done <= sim_now) {
+            in->busy = false;
+            if(in->length) {
+                if(usb.in_len + in->length > usb.in_size)
+                    usb.in_data = realloc(usb.in_data, usb.in_size = usb.in_len + in->length + 4096);
+                memcpy(&usb.in_data[usb.in_len], in->buf, in->length);
+                usb.in_len += in->length;
+            } else
+                usb.stats.zlps++;
+            USBD_LL_DataInStage(usb.pdev, ep, in->buf);
+        }
+
+        if(out_due(ep) <= sim_now) {
+            out->count = MIN(out->size, usb.out_len - usb.out_head);
+            memcpy(out->buf, &usb.out_data[usb.out_head], out->count);
+            usb.out_head += out->count;
+            out->armed = false;
+            usb.stats.out_packets++;
+            USBD_LL_DataOutStage(usb.pdev, ep, out->buf);
+        }
+    }
+}
+
+static void usb_reset (sim_periph_t *p)
+{
+    usb.connect = usb.disconnect = usb.irq = false;
+    usb.in_len = usb.out_head = usb.out_len = 0;
+    memset(usb.in, 0, sizeof(usb.in));
+    memset(usb.out, 0, sizeof(usb.out));
+    memset(&usb.stats, 0, sizeof(sim_usb_stats_t));
+}
+
+void sim_usb_connect (void)
+{
+    usb.connect = true;
+}
+
+void sim_usb_disconnect (void)
+{
+    usb.disconnect = true;
+}
+
+void sim_usb_latency (uint64_t cycles)
+{
+    usb.latency = cycles;
+}
+
+void sim_usb_out (const void *data, uint32_t length)
+{
+    if(usb.out_head == usb.out_len)
+        usb.out_head = usb.out_len = 0;
+
+    if(usb.out_len + length > usb.out_size)
+        usb.out_data = realloc(usb.out_data, usb.out_size = usb.out_len + length + 4096);
+
+    memcpy(&usb.out_data[usb.out_len], data, length);
+    usb.out_len += length;
+}
+
+uint32_t sim_usb_out_pending (void)
+{
+    return usb.out_len - usb.out_head;
+}
+
+uint32_t sim_usb_in (const uint8_t **data)
+{
+    if(data)
+        *data = usb.in_data;
+
+    return usb.in_len;
+}
+
+void sim_usb_in_clear (void)
+{
+    usb.in_len = 0;
+}
+
+const sim_usb_stats_t *sim_usb_stats (void)
+{
+    return &usb.stats;
+}
+
+void sim_usb_stats_reset (void)
+{
+    memset(&usb.stats, 0, sizeof(sim_usb_stats_t));
+}
+
+// USB device library low level interface
+
+USBD_StatusTypeDef USBD_LL_Init (USBD_HandleTypeDef *pdev)
+{
+    usb.pdev = pdev;
+    usb.hpcd.pData = pdev;
+    pdev->pData = &usb.hpcd;
+
+    // As HAL_PCD_MspInit() in usbd_conf.c.
+    HAL_NVIC_SetPriority(OTG_FS_IRQn, 2, 0);
+    HAL_NVIC_EnableIRQ(OTG_FS_IRQn);
+
+    return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_DeInit (USBD_HandleTypeDef *pdev)
+{
+    return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_Start (USBD_HandleTypeDef *pdev)
+{
+    return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_Stop (USBD_HandleTypeDef *pdev)
+{
+    return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_OpenEP (USBD_HandleTypeDef *pdev, uint8_t ep_addr, uint8_t ep_type, uint16_t ep_mps)
+{
+    if(ep_addr & 0x80)
+        usb.hpcd.IN_ep[ep_addr & 0x7F].maxpacket = ep_mps;
+    else
+        usb.hpcd.OUT_ep[ep_addr & 0x7F].maxpacket = ep_mps;
+
+    return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_CloseEP (USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+    uint_fast8_t ep = ep_addr & 0x7F;
+
+    if(ep < N_EP) {
+        if(ep_addr & 0x80)
+            usb.in[ep].busy = false;
+        else
+            usb.out[ep].armed = false;
+    }
+
+    return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_FlushEP (USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+    return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_StallEP (USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+    return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_ClearStallEP (USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+    return USBD_OK;
+}
+
+uint8_t USBD_LL_IsStallEP (USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+    return 0;
+}
+
+USBD_StatusTypeDef USBD_LL_SetUSBAddress (USBD_HandleTypeDef *pdev, uint8_t dev_addr)
+{
+    return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_Transmit (USBD_HandleTypeDef *pdev, uint8_t ep_addr, uint8_t *pbuf, uint32_t size)
+{
+    uint_fast8_t ep = ep_addr & 0x7F;
+
+    // Control transfers complete immediately.
+    if(ep == 0 || ep >= N_EP)
+        return USBD_OK;
+
+    if(usb.in[ep].busy)
+        return USBD_BUSY;
+
+    usb.in[ep].busy = true;
+    usb.in[ep].buf = pbuf;
+    usb.in[ep].length = size;
+    usb.in[ep].done = sim_now + usb.latency + PACKET_CYCLES * (size ? (size + 63) / 64 : 1);
+    usb.stats.in_transfers++;
+    usb.stats.in_packets += size ? (size + 63) / 64 : 1;
+
+    return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_PrepareReceive (USBD_HandleTypeDef *pdev, uint8_t ep_addr, uint8_t *pbuf, uint32_t size)
+{
+    uint_fast8_t ep = ep_addr & 0x7F;
+
+    if(ep == 0 || ep >= N_EP)
+        return USBD_OK;
+
+    usb.out[ep].armed = true;
+    usb.out[ep].armed_at = sim_now;
+    usb.out[ep].buf = pbuf;
+    usb.out[ep].size = size;
+
+    return USBD_OK;
+}
+
+uint32_t USBD_LL_GetRxDataSize (USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+    return (ep_addr & 0x7F) < N_EP ? usb.out[ep_addr & 0x7F].count : 0;
+}
+
+void USBD_LL_Delay (uint32_t Delay)
+{
+}
+
+__attribute__((constructor(150))) static void sim_usb_attach (void)
+{
+    periph.name = "USB";
+    periph.base = USB_OTG_FS_PERIPH_BASE;
+    periph.size = 0; // no register level model
+    periph.reset = usb_reset;
+    periph.next_event = usb_next;
+    periph.event = usb_event;
+    sim_attach(&periph);
+}
@@ -0,0 +1,243 @@
+/*
+
+  sim_vectors.c - interrupt vector table, handler names as in the startup file
+
+  Handlers not provided by the code under test abort the test when taken.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sim.h"
+
+static void sim_default_handler (void)
+{
+    fprintf(stderr, "sim: unexpected interrupt\n");
+    abort();
+}
+
+void NMI_Handler (void) __attribute__((weak, alias("sim_default_handler")));
+void HardFault_Handler (void) __attribute__((weak, alias("sim_default_handler")));
+void MemManage_Handler (void) __attribute__((weak, alias("sim_default_handler")));
+void BusFault_Handler (void) __attribute__((weak, alias("sim_default_handler")));
+void UsageFault_Handler (void) __attribute__((weak, alias("sim_default_handler")));
+void SVC_Handler (void) __attribute__((weak, alias("sim_default_handler")));
+void DebugMon_Handler (void) __attribute__((weak, alias("sim_default_handler")));
+void PendSV_Handler (void) __attribute__((weak, alias("sim_default_handler")));
+void SysTick_Handler (void) __attribute__((weak, alias("sim_default_handler")));
+void WWDG_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void PVD_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void TAMP_STAMP_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void RTC_WKUP_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void FLASH_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void RCC_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void EXTI0_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void EXTI1_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void EXTI2_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void EXTI3_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void EXTI4_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void DMA1_Stream0_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void DMA1_Stream1_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void DMA1_Stream2_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void DMA1_Stream3_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void DMA1_Stream4_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void DMA1_Stream5_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void DMA1_Stream6_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void ADC_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void CAN1_TX_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void CAN1_RX0_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void CAN1_RX1_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void CAN1_SCE_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void EXTI9_5_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void TIM1_BRK_TIM9_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void TIM1_UP_TIM10_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void TIM1_TRG_COM_TIM11_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void TIM1_CC_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void TIM2_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void TIM3_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void TIM4_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void I2C1_EV_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void I2C1_ER_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void I2C2_EV_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void I2C2_ER_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void SPI1_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void SPI2_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void USART1_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void USART2_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void USART3_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void EXTI15_10_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void RTC_Alarm_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void OTG_FS_WKUP_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void TIM8_BRK_TIM12_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void TIM8_UP_TIM13_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void TIM8_TRG_COM_TIM14_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void TIM8_CC_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void DMA1_Stream7_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void FMC_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void SDMMC1_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void TIM5_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void SPI3_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void UART4_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void UART5_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void TIM6_DAC_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void TIM7_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void DMA2_Stream0_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void DMA2_Stream1_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void DMA2_Stream2_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void DMA2_Stream3_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void DMA2_Stream4_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void ETH_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void ETH_WKUP_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void CAN2_TX_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void CAN2_RX0_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void CAN2_RX1_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void CAN2_SCE_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void OTG_FS_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void DMA2_Stream5_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void DMA2_Stream6_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void DMA2_Stream7_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void USART6_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void I2C3_EV_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void I2C3_ER_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void OTG_HS_EP1_OUT_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void OTG_HS_EP1_IN_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void OTG_HS_WKUP_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void OTG_HS_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void DCMI_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void CRYP_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void HASH_RNG_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void FPU_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void UART7_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void UART8_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void SPI4_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void SPI5_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void SPI6_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void SAI1_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void LTDC_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void LTDC_ER_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void DMA2D_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void SAI2_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void QUADSPI_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void LPTIM1_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void CEC_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void I2C4_EV_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void I2C4_ER_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+void SPDIF_RX_IRQHandler (void) __attribute__((weak, alias("sim_default_handler")));
+
+void (* const sim_vectors[16 + 98])(void) = {
+    0,
+    0,
+    NMI_Handler,
+    HardFault_Handler,
+    MemManage_Handler,
+    BusFault_Handler,
+    UsageFault_Handler,
+    0,
+    0,
+    0,
+    0,
+    SVC_Handler,
+    DebugMon_Handler,
+    0,
+    PendSV_Handler,
+    SysTick_Handler,
+    WWDG_IRQHandler,
+    PVD_IRQHandler,
+    TAMP_STAMP_IRQHandler,
+    RTC_WKUP_IRQHandler,
+    FLASH_IRQHandler,
+    RCC_IRQHandler,
+    EXTI0_IRQHandler,
+    EXTI1_IRQHandler,
+    EXTI2_IRQHandler,
+    EXTI3_IRQHandler,
+    EXTI4_IRQHandler,
+    DMA1_Stream0_IRQHandler,
+    DMA1_Stream1_IRQHandler,
+    DMA1_Stream2_IRQHandler,
+    DMA1_Stream3_IRQHandler,
+    DMA1_Stream4_IRQHandler,
+    DMA1_Stream5_IRQHandler,
+    DMA1_Stream6_IRQHandler,
+    ADC_IRQHandler,
+    CAN1_TX_IRQHandler,
+    CAN1_RX0_IRQHandler,
+    CAN1_RX1_IRQHandler,
+    CAN1_SCE_IRQHandler,
+    EXTI9_5_IRQHandler,
+    TIM1_BRK_TIM9_IRQHandler,
+    TIM1_UP_TIM10_IRQHandler,
+    TIM1_TRG_COM_TIM11_IRQHandler,
+    TIM1_CC_IRQHandler,
+    TIM2_IRQHandler,
+    TIM3_IRQHandler,
+    TIM4_IRQHandler,
+    I2C1_EV_IRQHandler,
+    I2C1_ER_IRQHandler,
+    I2C2_EV_IRQHandler,
+    I2C2_ER_IRQHandler,
+    SPI1_IRQHandler,
+    SPI2_IRQHandler,
+    USART1_IRQHandler,
+    USART2_IRQHandler,
+    USART3_IRQHandler,
+    EXTI15_10_IRQHandler,
+    RTC_Alarm_IRQHandler,
+    OTG_FS_WKUP_IRQHandler,
+    TIM8_BRK_TIM12_IRQHandler,
+    TIM8_UP_TIM13_IRQHandler,
+    TIM8_TRG_COM_TIM14_IRQHandler,
+    TIM8_CC_IRQHandler,
+    DMA1_Stream7_IRQHandler,
+    FMC_IRQHandler,
+    SDMMC1_IRQHandler,
+    TIM5_IRQHandler,
+    SPI3_IRQHandler,
+    UART4_IRQHandler,
+    UART5_IRQHandler,
+    TIM6_DAC_IRQHandler,
+    TIM7_IRQHandler,
+    DMA2_Stream0_IRQHandler,
+    DMA2_Stream1_IRQHandler,
+    DMA2_Stream2_IRQHandler,
+    DMA2_Stream3_IRQHandler,
+    DMA2_Stream4_IRQHandler,
+    ETH_IRQHandler,
+    ETH_WKUP_IRQHandler,
+    CAN2_TX_IRQHandler,
+    CAN2_RX0_IRQHandler,
+    CAN2_RX1_IRQHandler,
+    CAN2_SCE_IRQHandler,
+    OTG_FS_IRQHandler,
+    DMA2_Stream5_IRQHandler,
+    DMA2_Stream6_IRQHandler,
+    DMA2_Stream7_IRQHandler,
+    USART6_IRQHandler,
+    I2C3_EV_IRQHandler,
+    I2C3_ER_IRQHandler,
+    OTG_HS_EP1_OUT_IRQHandler,
+    OTG_HS_EP1_IN_IRQHandler,
+    OTG_HS_WKUP_IRQHandler,
+    OTG_HS_IRQHandler,
+    DCMI_IRQHandler,
+    CRYP_IRQHandler,
+    HASH_RNG_IRQHandler,
+    FPU_IRQHandler,
+    UART7_IRQHandler,
+    UART8_IRQHandler,
+    SPI4_IRQHandler,
+    SPI5_IRQHandler,
+    SPI6_IRQHandler,
+    SAI1_IRQHandler,
+    LTDC_IRQHandler,
+    LTDC_ER_IRQHandler,
+    DMA2D_IRQHandler,
+    SAI2_IRQHandler,
+    QUADSPI_IRQHandler,
+    LPTIM1_IRQHandler,
+    CEC_IRQHandler,
+    I2C4_EV_IRQHandler,
+    I2C4_ER_IRQHandler,
+    SPDIF_RX_IRQHandler
+};
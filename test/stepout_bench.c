@@ -0,0 +1,96 @@
+/*
+  stepout_bench.c - step and direction output cost per output mode and number of axes
+
+  Built for 3, 4 and 6 axes with the GPIO_SINGLE, GPIO_MAP and GPIO_OUTPUT_TABLES output modes
+  against sim/my_machine_map.h, run with "make -C test bench". Reports the instructions and
+  register accesses for starting a step pulse on all axes with a direction change, and for
+  the pulse timer interrupt that ends it. The outputs are checked after both.
+
+  NOTE: instructions are host instructions, comparable to but not the same as Cortex-M7 cycles.
+        Register accesses are the better measure of the difference between the modes.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sim.h"
+#include "driver.h"
+#include "i2c.h"
+#include "flash.h"
+#include "grbl/motor_pins.h"
+
+#define CHECK(cond) if(!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; }
+
+#if GPIO_OUTPUT_TABLES
+#define MODE "table"
+#elif STEP_OUTMODE == GPIO_MAP
+#define MODE "GPIO_MAP"
+#else
+#define MODE "GPIO_SINGLE"
+#endif
+
+#define PASSES 16
+
+// Not under test.
+
+void i2c_init (void)
+{
+}
+
+bool memcpy_from_flash (uint8_t *dest)
+{
+    return false;
+}
+
+bool memcpy_to_flash (uint8_t *source)
+{
+    return false;
+}
+
+static int failed = 0;
+static stepper_t stepper;
+
+static void pulse_start (void *arg)
+{
+    hal.stepper.pulse_start(&stepper);
+}
+
+int main (void)
+{
+    uint32_t pass, start = 0, end = 0, start_acc = 0, end_acc = 0, acc;
+
+    hal.version = 8;
+    CHECK(driver_init());
+    CHECK(hal.driver_setup(&settings));
+
+    sim_time_isrs(true);
+
+    stepper.step_outbits.mask = AXES_BITMASK;
+    stepper.dir_change = true;
+
+    for(pass = 0; pass < PASSES; pass++) {
+
+        stepper.dir_outbits.mask = pass & 1 ? AXES_BITMASK : 0;
+
+        acc = sim_reads + sim_writes;
+        start += sim_count_instructions(pulse_start, NULL);
+        start_acc += sim_reads + sim_writes - acc;
+
+        CHECK((SIM_REG(STEP_PORT->ODR) & STEP_MASK) == STEP_MASK);
+        CHECK((SIM_REG(DIRECTION_PORT->ODR) & DIRECTION_MASK) == (pass & 1 ? DIRECTION_MASK : 0));
+
+        sim_irq_stats_reset();
+        acc = sim_reads + sim_writes;
+        sim_run(20 * SIM_CYCLES_PER_US);
+        end += sim_irq_stats(PULSE_TIMER_IRQn)->cycles;
+        end_acc += sim_reads + sim_writes - acc;
+
+        CHECK(sim_irq_stats(PULSE_TIMER_IRQn)->count == 1);
+        CHECK((SIM_REG(STEP_PORT->ODR) & STEP_MASK) == 0);
+    }
+
+    printf("%u axes, %-11s: pulse start %3u instructions, %2u register accesses; pulse end %3u instructions, %2u register accesses%s\n",
+            N_AXIS, MODE, start / PASSES, start_acc / PASSES, end / PASSES, end_acc / PASSES, failed ? " FAILED" : "");
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,64 @@
+/*
+  Host test stub for driver.h, options of the driver sources under test.
+  Defines the include guard of Inc/driver.h so that headers in Inc/ including it get this
+  stub instead when it is force included (-include driver.h).
+*/
+
+#pragma once
+
+#define __DRIVER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SDCARD_ENABLE   1
+
+#ifndef SDCARD_RAMDISK
+#define SDCARD_RAMDISK  64
+#endif
+
+#ifndef SDCARD_JOBCACHE
+#define SDCARD_JOBCACHE 0
+#endif
+
+#ifndef SDCARD_DATALOG
+#define SDCARD_DATALOG  0
+#endif
+
+#ifndef SDCARD_FASTSEEK
+#define SDCARD_FASTSEEK 0
+#endif
+
+#ifndef ISR_PROFILER_ENABLE
+#define ISR_PROFILER_ENABLE 0
+#endif
+
+#if ISR_PROFILER_ENABLE
+
+// Cortex-M core registers and intrinsics used by profiler.c, the test advances DWT->CYCCNT as a fake cycle counter.
+
+typedef struct {
+    uint32_t CTRL;
+    uint32_t CYCCNT;
+    uint32_t LAR;
+} DWT_Type;
+
+typedef struct {
+    uint32_t DEMCR;
+} CoreDebug_Type;
+
+#define DWT_CTRL_CYCCNTENA_Msk      (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk  (1UL << 24)
+
+extern DWT_Type dwt;
+extern CoreDebug_Type core_debug;
+extern uint32_t SystemCoreClock;
+
+#define DWT         (&dwt)
+#define CoreDebug   (&core_debug)
+
+#define __CLZ(x) ((x) ? (uint32_t)__builtin_clz(x) : 32U)
+#define __disable_irq()
+#define __enable_irq()
+
+#endif
@@ -0,0 +1,57 @@
+/*
+  Host test stub, minimal subset of grbl/driver_opts.h used by the driver sources under test.
+*/
+
+#pragma once
+
+#include "hal.h"
+
+#ifndef N_ABC_MOTORS
+#define N_ABC_MOTORS (N_AXIS - 3)
+#endif
+
+#ifndef USB_SERIAL_CDC
+#define USB_SERIAL_CDC 0
+#endif
+#ifndef SDCARD_ENABLE
+#define SDCARD_ENABLE 0
+#endif
+#ifndef EEPROM_ENABLE
+#define EEPROM_ENABLE 0
+#endif
+#ifndef KEYPAD_ENABLE
+#define KEYPAD_ENABLE 0
+#endif
+#ifndef SPINDLE_SYNC_ENABLE
+#define SPINDLE_SYNC_ENABLE 0
+#endif
+#ifndef SAFETY_DOOR_ENABLE
+#define SAFETY_DOOR_ENABLE 0
+#endif
+#ifndef PPI_ENABLE
+#define PPI_ENABLE 0
+#endif
+#ifndef ETHERNET_ENABLE
+#define ETHERNET_ENABLE 0
+#endif
+#ifndef TELNET_ENABLE
+#define TELNET_ENABLE 0
+#endif
+#ifndef WEBSOCKET_ENABLE
+#define WEBSOCKET_ENABLE 0
+#endif
+#ifndef BLUETOOTH_ENABLE
+#define BLUETOOTH_ENABLE 0
+#endif
+#ifndef TRINAMIC_ENABLE
+#define TRINAMIC_ENABLE 0
+#endif
+#ifndef ODOMETER_ENABLE
+#define ODOMETER_ENABLE 0
+#endif
+#ifndef OPENPNP_ENABLE
+#define OPENPNP_ENABLE 0
+#endif
+#ifndef PLASMA_ENABLE
+#define PLASMA_ENABLE 0
+#endif
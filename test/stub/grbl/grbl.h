@@ -0,0 +1,13 @@
+/*
+  Host test stub, minimal subset of grbl/grbl.h used by the driver sources under test.
+*/
+
+#pragma once
+
+#include "hal.h"
+
+#define CMD_STATUS_REPORT   '?'
+#define CMD_CYCLE_START     '~'
+#define CMD_FEED_HOLD       '!'
+#define CMD_RESET           0x18 // ctrl-x
+#define CMD_TOOL_ACK        0xA3
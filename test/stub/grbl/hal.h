@@ -0,0 +1,398 @@
+/*
+  Host test stub, minimal subset of grbl/hal.h used by the driver sources under test.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nuts_bolts.h"
+#include "stream.h"
+#include "settings.h"
+
+#define HAL_VERSION 8
+
+typedef uint_fast16_t sys_state_t;
+
+#define STATE_IDLE          0
+#define STATE_ALARM         bit(0)
+#define STATE_CHECK_MODE    bit(1)
+#define STATE_HOMING        bit(2)
+#define STATE_CYCLE         bit(3)
+#define STATE_HOLD          bit(4)
+#define STATE_JOG           bit(5)
+#define STATE_SAFETY_DOOR   bit(6)
+#define STATE_SLEEP         bit(7)
+
+typedef enum {
+    Status_OK = 0,
+    Status_SDReadError = 62,
+    Status_Unhandled = 255
+} status_code_t;
+
+typedef uint32_t report_tracking_flags_t;
+
+typedef enum {
+    Input_Probe = 0,
+    Input_Reset,
+    Input_FeedHold,
+    Input_CycleStart,
+    Input_SafetyDoor,
+    Input_LimitsOverride,
+    Input_EStop,
+    Input_ModeSelect,
+    Input_LimitX,
+    Input_LimitX_2,
+    Input_LimitX_Max,
+    Input_LimitY,
+    Input_LimitY_2,
+    Input_LimitY_Max,
+    Input_LimitZ,
+    Input_LimitZ_2,
+    Input_LimitZ_Max,
+    Input_LimitA,
+    Input_LimitA_Max,
+    Input_LimitB,
+    Input_LimitB_Max,
+    Input_LimitC,
+    Input_LimitC_Max,
+    Input_KeypadStrobe,
+    Input_SpindleIndex,
+    Input_SpindlePulse,
+    Input_Aux0,
+    Input_Aux1,
+    Input_Aux2,
+    Input_Aux3,
+    Input_Aux4,
+    Input_Aux5,
+    Input_Aux6,
+    Input_Aux7,
+    Input_RX,
+    Output_StepX,
+    Output_StepX_2,
+    Output_StepY,
+    Output_StepY_2,
+    Output_StepZ,
+    Output_StepZ_2,
+    Output_StepA,
+    Output_StepB,
+    Output_StepC,
+    Output_DirX,
+    Output_DirX_2,
+    Output_DirY,
+    Output_DirY_2,
+    Output_DirZ,
+    Output_DirZ_2,
+    Output_DirA,
+    Output_DirB,
+    Output_DirC,
+    Output_StepperEnable,
+    Output_StepperEnableX,
+    Output_StepperEnableY,
+    Output_StepperEnableZ,
+    Output_StepperEnableA,
+    Output_StepperEnableB,
+    Output_StepperEnableC,
+    Output_SpindleOn,
+    Output_SpindleDir,
+    Output_SpindlePWM,
+    Output_CoolantMist,
+    Output_CoolantFlood,
+    Output_SdCardCS,
+    Output_Aux0,
+    Output_Aux1,
+    Output_Aux2,
+    Output_Aux3,
+    Output_TX
+} pin_function_t;
+
+typedef enum {
+    PinGroup_Control = 0,
+    PinGroup_Limit,
+    PinGroup_SpindleControl,
+    PinGroup_SpindlePWM,
+    PinGroup_SpindleIndex,
+    PinGroup_SpindlePulse,
+    PinGroup_Coolant,
+    PinGroup_Probe,
+    PinGroup_Keypad,
+    PinGroup_MPG,
+    PinGroup_StepperStep,
+    PinGroup_StepperDir,
+    PinGroup_StepperEnable,
+    PinGroup_AuxInput,
+    PinGroup_AuxOutput,
+    PinGroup_SdCard,
+    PinGroup_UART
+} pin_group_t;
+
+typedef enum {
+    IRQ_Mode_None    = 0b00,
+    IRQ_Mode_Rising  = 0b01,
+    IRQ_Mode_Falling = 0b10,
+    IRQ_Mode_Change  = 0b11
+} pin_irq_mode_t;
+
+typedef enum {
+    PullMode_None = 0b00,
+    PullMode_Up   = 0b01,
+    PullMode_Down = 0b10
+} pull_mode_t;
+
+#define PINMODE_NONE        0
+#define PINMODE_OUTPUT      (1<<1)
+#define PINMODE_OD          (1<<2)
+
+typedef union {
+    uint16_t mask;
+    struct {
+        uint16_t input      :1,
+                 output     :1,
+                 open_drain :1,
+                 pull_mode  :2,
+                 irq_mode   :2,
+                 invert     :1,
+                 analog     :1,
+                 pwm        :1,
+                 unused     :6;
+    };
+} pin_mode_t;
+
+typedef enum {
+    WaitMode_Immediate = 0,
+    WaitMode_Rise,
+    WaitMode_Fall,
+    WaitMode_High,
+    WaitMode_Low
+} wait_mode_t;
+
+typedef struct {
+    pin_function_t function;
+    pin_group_t group;
+    uint8_t pin;
+    void *port;
+    pin_mode_t mode;
+    const char *description;
+} xbar_t;
+
+typedef void (*pin_info_ptr)(xbar_t *pin);
+typedef void (*ioport_interrupt_callback_ptr)(uint8_t port, bool state);
+
+typedef struct {
+    axes_signals_t min;
+    axes_signals_t max;
+    axes_signals_t min2;
+    axes_signals_t max2;
+} limit_signals_t;
+
+typedef struct {
+    uint8_t triggered   :1,
+            connected   :1,
+            inverted    :1,
+            is_probing  :1,
+            unused      :4;
+} probe_state_t;
+
+typedef enum {
+    SquaringMode_Both = 0,
+    SquaringMode_A,
+    SquaringMode_B
+} squaring_mode_t;
+
+typedef void (*delay_callback_ptr)(void);
+
+typedef struct {
+    volatile uint32_t ms;
+    delay_callback_ptr callback;
+} delay_t;
+
+typedef enum {
+    NVS_None = 0,
+    NVS_EEPROM,
+    NVS_FRAM,
+    NVS_Flash,
+    NVS_Emulated
+} nvs_type;
+
+typedef enum {
+    NVS_TransferResult_OK = 0,
+    NVS_TransferResult_Failed,
+    NVS_TransferResult_Busy
+} nvs_transfer_result_t;
+
+typedef struct {
+    uint8_t address;
+    uint8_t word_addr_bytes;
+    uint16_t word_addr;
+    volatile int16_t count;
+    bool add_checksum;
+    uint8_t checksum;
+    uint8_t *data;
+} nvs_transfer_t;
+
+nvs_transfer_result_t i2c_nvs_transfer (nvs_transfer_t *i2c, bool read);
+
+typedef struct {
+    uint32_t cycles_per_tick;
+    uint_fast8_t amass_level;
+    uint_fast16_t n_step;
+    uint32_t id;
+    bool cruising;
+    bool spindle_sync;
+    float target_position;
+} segment_t;
+
+typedef struct {
+    float programmed_rate;
+    float steps_per_mm;
+} st_block_t;
+
+typedef struct stepper {
+    uint32_t step_count;
+    axes_signals_t step_outbits;
+    axes_signals_t dir_outbits;
+    bool new_block;
+    bool dir_change;
+    segment_t *exec_segment;
+    st_block_t *exec_block;
+} stepper_t;
+
+typedef struct {
+    bool always_on;
+    bool invert_pwm;
+    uint32_t period;
+    uint32_t off_value;
+    uint32_t min_value;
+    uint32_t max_value;
+    float pwm_gradient;
+} spindle_pwm_t;
+
+typedef void (*stream_write_ptr)(const char *s);
+typedef status_code_t (*on_unknown_sys_command_ptr)(sys_state_t state, char *line);
+typedef void (*on_report_options_ptr)(bool newopt);
+typedef void (*on_realtime_report_ptr)(stream_write_ptr stream_write, report_tracking_flags_t report);
+typedef void (*on_execute_realtime_ptr)(sys_state_t state);
+typedef void (*on_state_change_ptr)(sys_state_t state);
+
+typedef struct {
+    on_state_change_ptr on_state_change;
+    on_unknown_sys_command_ptr on_unknown_sys_command;
+    on_report_options_ptr on_report_options;
+    on_realtime_report_ptr on_realtime_report;
+    on_execute_realtime_ptr on_execute_realtime;
+    on_get_settings_ptr on_get_settings;
+} grbl_t;
+
+typedef struct {
+    uint32_t version;
+    const char *info;
+    const char *driver_version;
+    const char *board;
+    uint32_t f_step_timer;
+    uint32_t rx_buffer_size;
+
+    bool (*driver_setup)(settings_t *settings);
+    void (*settings_changed)(settings_t *settings);
+    void (*delay_ms)(uint32_t ms, delay_callback_ptr callback);
+    void (*irq_enable)(void);
+    void (*irq_disable)(void);
+    void (*set_bits_atomic)(volatile uint_fast16_t *value, uint_fast16_t bits);
+    uint_fast16_t (*clear_bits_atomic)(volatile uint_fast16_t *value, uint_fast16_t bits);
+    uint_fast16_t (*set_value_atomic)(volatile uint_fast16_t *value, uint_fast16_t bits);
+    uint32_t (*get_elapsed_ticks)(void);
+    void (*enumerate_pins)(bool low_level, pin_info_ptr pin_info);
+    bool (*stream_blocking_callback)(void);
+    bool (*stream_select)(const io_stream_t *stream);
+
+    struct {
+        void (*wake_up)(void);
+        void (*go_idle)(bool clear_signals);
+        void (*enable)(axes_signals_t enable);
+        void (*disable_motors)(axes_signals_t axes, squaring_mode_t mode);
+        axes_signals_t (*get_auto_squared)(void);
+        void (*cycles_per_tick)(uint32_t cycles_per_tick);
+        void (*pulse_start)(stepper_t *stepper);
+        void (*interrupt_callback)(void);
+    } stepper;
+
+    struct {
+        void (*enable)(bool on, bool homing);
+        limit_signals_t (*get_state)(void);
+        void (*interrupt_callback)(limit_signals_t state);
+    } limits;
+
+    struct {
+        void (*set_state)(coolant_state_t state);
+        coolant_state_t (*get_state)(void);
+    } coolant;
+
+    struct {
+        void (*configure)(bool is_probe_away, bool probing);
+        probe_state_t (*get_state)(void);
+    } probe;
+
+    struct {
+        void (*set_state)(spindle_state_t state, float rpm);
+        spindle_state_t (*get_state)(void);
+        uint_fast16_t (*get_pwm)(float rpm);
+        void (*update_pwm)(uint_fast16_t pwm);
+        void (*update_rpm)(float rpm);
+        void (*pulse_on)(uint_fast16_t pulse_length);
+        void *(*get_data)(int request);
+        void (*reset_data)(void);
+    } spindle;
+
+    struct {
+        control_signals_t (*get_state)(void);
+        void (*interrupt_callback)(control_signals_t signals);
+    } control;
+
+    struct {
+        nvs_type type;
+        uint32_t size;
+        bool (*memcpy_from_flash)(uint8_t *dest);
+        bool (*memcpy_to_flash)(uint8_t *source);
+    } nvs;
+
+    struct {
+        uint8_t num_digital_in;
+        uint8_t num_digital_out;
+        void (*digital_out)(uint8_t port, bool on);
+        int32_t (*wait_on_input)(bool digital, uint8_t port, wait_mode_t wait_mode, float timeout);
+        bool (*register_interrupt_handler)(uint8_t port, pin_irq_mode_t irq_mode, ioport_interrupt_callback_ptr interrupt_callback);
+        void (*set_pin_description)(bool digital, bool output, uint8_t port, const char *s);
+    } port;
+
+    control_signals_t signals_cap;
+
+    struct {
+        uint32_t mist_control       :1,
+                 variable_spindle   :1,
+                 spindle_dir        :1,
+                 spindle_pwm_invert :1,
+                 spindle_sync       :1,
+                 spindle_at_speed   :1,
+                 software_debounce  :1,
+                 step_pulse_delay   :1,
+                 control_pull_up    :1,
+                 limits_pull_up     :1,
+                 probe_pull_up      :1,
+                 amass_level        :2;
+    } driver_cap;
+
+    io_stream_t stream;
+} hal_t;
+
+typedef struct {
+    volatile bool abort;
+    volatile sys_state_t state;
+} system_t;
+
+extern grbl_t grbl;
+extern hal_t hal;
+extern system_t sys;
+
+axes_signals_t limit_signals_merge (limit_signals_t signals);
+bool spindle_precompute_pwm_values (spindle_pwm_t *pwm_data, uint32_t clock_hz);
+uint_fast16_t spindle_compute_pwm_value (spindle_pwm_t *pwm_data, float rpm, bool pid_limit);
@@ -0,0 +1,7 @@
+/*
+  Host test stub, grbl/limits.h types are in the hal.h stub.
+*/
+
+#pragma once
+
+#include "hal.h"
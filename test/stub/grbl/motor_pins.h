@@ -0,0 +1,146 @@
+/*
+  Host test stub, minimal subset of grbl/motor_pins.h used by the driver sources under test.
+  Ganged and ABC motors are taken from the board map as is, the M3..M5 mapping is not done.
+*/
+
+#pragma once
+
+#if defined(X2_STEP_PIN) || defined(Y2_STEP_PIN) || defined(Z2_STEP_PIN)
+#define N_GANGED 1
+#else
+#define N_GANGED 0
+#endif
+
+#ifndef X_STEP_PORT
+#define X_STEP_PORT STEP_PORT
+#endif
+#ifndef Y_STEP_PORT
+#define Y_STEP_PORT STEP_PORT
+#endif
+#ifndef Z_STEP_PORT
+#define Z_STEP_PORT STEP_PORT
+#endif
+#if defined(A_AXIS) && !defined(A_STEP_PORT)
+#define A_STEP_PORT STEP_PORT
+#endif
+#if defined(B_AXIS) && !defined(B_STEP_PORT)
+#define B_STEP_PORT STEP_PORT
+#endif
+#if defined(C_AXIS) && !defined(C_STEP_PORT)
+#define C_STEP_PORT STEP_PORT
+#endif
+
+#ifndef X_DIRECTION_PORT
+#define X_DIRECTION_PORT DIRECTION_PORT
+#endif
+#ifndef Y_DIRECTION_PORT
+#define Y_DIRECTION_PORT DIRECTION_PORT
+#endif
+#ifndef Z_DIRECTION_PORT
+#define Z_DIRECTION_PORT DIRECTION_PORT
+#endif
+#if defined(A_AXIS) && !defined(A_DIRECTION_PORT)
+#define A_DIRECTION_PORT DIRECTION_PORT
+#endif
+#if defined(B_AXIS) && !defined(B_DIRECTION_PORT)
+#define B_DIRECTION_PORT DIRECTION_PORT
+#endif
+#if defined(C_AXIS) && !defined(C_DIRECTION_PORT)
+#define C_DIRECTION_PORT DIRECTION_PORT
+#endif
+
+#ifndef X_LIMIT_PORT
+#define X_LIMIT_PORT LIMIT_PORT
+#endif
+#ifndef Y_LIMIT_PORT
+#define Y_LIMIT_PORT LIMIT_PORT
+#endif
+#ifndef Z_LIMIT_PORT
+#define Z_LIMIT_PORT LIMIT_PORT
+#endif
+
+#ifndef X_STEP_BIT
+#define X_STEP_BIT (1<<X_STEP_PIN)
+#endif
+#ifndef Y_STEP_BIT
+#define Y_STEP_BIT (1<<Y_STEP_PIN)
+#endif
+#ifndef Z_STEP_BIT
+#define Z_STEP_BIT (1<<Z_STEP_PIN)
+#endif
+#if defined(A_AXIS) && !defined(A_STEP_BIT)
+#define A_STEP_BIT (1<<A_STEP_PIN)
+#endif
+#if defined(B_AXIS) && !defined(B_STEP_BIT)
+#define B_STEP_BIT (1<<B_STEP_PIN)
+#endif
+#if defined(C_AXIS) && !defined(C_STEP_BIT)
+#define C_STEP_BIT (1<<C_STEP_PIN)
+#endif
+#if defined(X2_STEP_PIN) && !defined(X2_STEP_BIT)
+#define X2_STEP_BIT (1<<X2_STEP_PIN)
+#endif
+
+#ifndef X_DIRECTION_BIT
+#define X_DIRECTION_BIT (1<<X_DIRECTION_PIN)
+#endif
+#ifndef Y_DIRECTION_BIT
+#define Y_DIRECTION_BIT (1<<Y_DIRECTION_PIN)
+#endif
+#ifndef Z_DIRECTION_BIT
+#define Z_DIRECTION_BIT (1<<Z_DIRECTION_PIN)
+#endif
+#if defined(A_AXIS) && !defined(A_DIRECTION_BIT)
+#define A_DIRECTION_BIT (1<<A_DIRECTION_PIN)
+#endif
+#if defined(B_AXIS) && !defined(B_DIRECTION_BIT)
+#define B_DIRECTION_BIT (1<<B_DIRECTION_PIN)
+#endif
+#if defined(C_AXIS) && !defined(C_DIRECTION_BIT)
+#define C_DIRECTION_BIT (1<<C_DIRECTION_PIN)
+#endif
+#if defined(X2_DIRECTION_PIN) && !defined(X2_DIRECTION_BIT)
+#define X2_DIRECTION_BIT (1<<X2_DIRECTION_PIN)
+#endif
+
+#ifndef X_LIMIT_BIT
+#define X_LIMIT_BIT (1<<X_LIMIT_PIN)
+#endif
+#ifndef Y_LIMIT_BIT
+#define Y_LIMIT_BIT (1<<Y_LIMIT_PIN)
+#endif
+#ifndef Z_LIMIT_BIT
+#define Z_LIMIT_BIT (1<<Z_LIMIT_PIN)
+#endif
+
+#ifndef LIMIT_MASK
+#define LIMIT_MASK (X_LIMIT_BIT|Y_LIMIT_BIT|Z_LIMIT_BIT)
+#endif
+
+#ifndef STEP_MASK
+#if defined(C_AXIS)
+#define STEP_MASK (X_STEP_BIT|Y_STEP_BIT|Z_STEP_BIT|A_STEP_BIT|B_STEP_BIT|C_STEP_BIT)
+#elif defined(B_AXIS)
+#define STEP_MASK (X_STEP_BIT|Y_STEP_BIT|Z_STEP_BIT|A_STEP_BIT|B_STEP_BIT)
+#elif defined(A_AXIS)
+#define STEP_MASK (X_STEP_BIT|Y_STEP_BIT|Z_STEP_BIT|A_STEP_BIT)
+#else
+#define STEP_MASK (X_STEP_BIT|Y_STEP_BIT|Z_STEP_BIT)
+#endif
+#endif
+
+#ifndef DIRECTION_MASK
+#if defined(C_AXIS)
+#define DIRECTION_MASK (X_DIRECTION_BIT|Y_DIRECTION_BIT|Z_DIRECTION_BIT|A_DIRECTION_BIT|B_DIRECTION_BIT|C_DIRECTION_BIT)
+#elif defined(B_AXIS)
+#define DIRECTION_MASK (X_DIRECTION_BIT|Y_DIRECTION_BIT|Z_DIRECTION_BIT|A_DIRECTION_BIT|B_DIRECTION_BIT)
+#elif defined(A_AXIS)
+#define DIRECTION_MASK (X_DIRECTION_BIT|Y_DIRECTION_BIT|Z_DIRECTION_BIT|A_DIRECTION_BIT)
+#else
+#define DIRECTION_MASK (X_DIRECTION_BIT|Y_DIRECTION_BIT|Z_DIRECTION_BIT)
+#endif
+#endif
+
+#ifndef AUXINPUT_MASK
+#define AUXINPUT_MASK 0
+#endif
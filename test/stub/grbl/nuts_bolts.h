@@ -0,0 +1,57 @@
+/*
+  Host test stub, minimal subset of grbl/nuts_bolts.h used by the driver sources under test.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef N_AXIS
+#define N_AXIS 3
+#endif
+
+#define X_AXIS 0
+#define Y_AXIS 1
+#define Z_AXIS 2
+#if N_AXIS > 3
+#define A_AXIS 3
+#endif
+#if N_AXIS > 4
+#define B_AXIS 4
+#endif
+#if N_AXIS > 5
+#define C_AXIS 5
+#endif
+
+#define AXES_BITMASK ((1 << N_AXIS) - 1)
+
+#define On  1
+#define Off 0
+
+#define bit(n) (1UL << (n))
+
+#ifndef min
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+#endif
+
+#ifndef max
+#define max(a,b) (((a) > (b)) ? (a) : (b))
+#endif
+
+typedef union {
+    uint8_t mask;
+    uint8_t value;
+    struct {
+        uint8_t x :1,
+                y :1,
+                z :1,
+                a :1,
+                b :1,
+                c :1,
+                u :1,
+                v :1;
+    };
+} axes_signals_t;
+
+char *uitoa (uint32_t n);
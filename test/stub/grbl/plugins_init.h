@@ -0,0 +1,3 @@
+/*
+  Host test stub for grbl/plugins_init.h, no plugins are built.
+*/
@@ -0,0 +1,10 @@
+/*
+  Host test stub, minimal subset of grbl/protocol.h used by the driver sources under test.
+*/
+
+#pragma once
+
+#include "hal.h"
+
+bool protocol_enqueue_realtime_command (char c);
+bool protocol_execute_realtime (void);
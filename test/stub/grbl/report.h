@@ -0,0 +1,7 @@
+/*
+  Host test stub, grbl/report.h types are in the hal.h stub.
+*/
+
+#pragma once
+
+#include "hal.h"
@@ -0,0 +1,209 @@
+/*
+  Host test stub, minimal subset of grbl/settings.h used by the driver sources under test.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nuts_bolts.h"
+
+typedef union {
+    uint8_t value;
+    uint8_t mask;
+    struct {
+        uint8_t on               :1,
+                ccw              :1,
+                pwm              :1,
+                reserved3        :1,
+                reserved4        :1,
+                reserved5        :1,
+                at_speed         :1,
+                encoder_error    :1;
+    };
+} spindle_state_t;
+
+typedef union {
+    uint8_t value;
+    uint8_t mask;
+    struct {
+        uint8_t flood :1,
+                mist  :1,
+                unused :6;
+    };
+} coolant_state_t;
+
+typedef union {
+    uint16_t value;
+    uint16_t mask;
+    struct {
+        uint16_t reset              :1,
+                 feed_hold          :1,
+                 cycle_start        :1,
+                 safety_door_ajar   :1,
+                 block_delete       :1,
+                 stop_disable       :1,
+                 e_stop             :1,
+                 probe_disconnected :1,
+                 motor_fault        :1,
+                 motor_warning      :1,
+                 limits_override    :1,
+                 single_block       :1,
+                 unassigned         :4;
+    };
+} control_signals_t;
+
+typedef union {
+    uint8_t mask;
+    struct {
+        uint8_t bit0 :1,
+                bit1 :1,
+                bit2 :1,
+                bit3 :1,
+                bit4 :1,
+                bit5 :1,
+                bit6 :1,
+                bit7 :1;
+    };
+} ioport_bus_t;
+
+typedef enum {
+    SpindleAction_None = 0,
+    SpindleAction_DisableWithZeroSPeed
+} spindle_action_t;
+
+typedef struct {
+    float p_gain, i_gain, d_gain, i_max_error;
+} pid_values_t;
+
+typedef struct {
+    float steps_per_mm;
+    float max_rate;
+    float acceleration;
+    float max_travel;
+} axis_settings_t;
+
+typedef struct {
+    uint32_t version;
+    struct {
+        float pulse_microseconds;
+        float pulse_delay_microseconds;
+        uint16_t idle_lock_time;
+        axes_signals_t step_invert;
+        axes_signals_t dir_invert;
+        axes_signals_t enable_invert;
+        axes_signals_t deenergize;
+    } steppers;
+    struct {
+        struct {
+            uint8_t hard_enabled :1,
+                    soft_enabled :1,
+                    check_at_init :1,
+                    unused :5;
+        } flags;
+        axes_signals_t invert;
+        axes_signals_t disable_pullup;
+    } limits;
+    control_signals_t control_invert;
+    control_signals_t control_disable_pullup;
+    coolant_state_t coolant_invert;
+    struct {
+        float rpm_max;
+        float rpm_min;
+        float pwm_freq;
+        float pwm_period;
+        float pwm_off_value;
+        float pwm_min_value;
+        float pwm_max_value;
+        float at_speed_tolerance;
+        uint16_t ppr;
+        spindle_state_t invert;
+        struct {
+            uint8_t pwm_action :2,
+                    unused :6;
+        } flags;
+    } spindle;
+    struct {
+        bool invert_probe_pin;
+    } probe;
+    struct {
+        ioport_bus_t invert_in;
+        ioport_bus_t invert_out;
+        ioport_bus_t pullup_disable_in;
+        ioport_bus_t od_enable_out;
+    } ioport;
+    struct {
+        pid_values_t pid;
+    } position;
+    axis_settings_t axis[N_AXIS];
+} settings_t;
+
+typedef enum {
+    Settings_IoPort_InvertIn = 370,
+    Settings_IoPort_Pullup_Disable = 371,
+    Settings_IoPort_InvertOut = 372,
+    Settings_IoPort_OD_Enable = 373
+} setting_id_t;
+
+typedef enum {
+    Group_Root = 0,
+    Group_AuxPorts = 30
+} setting_group_t;
+
+typedef enum {
+    Format_Bool = 0,
+    Format_Bitfield,
+    Format_Integer
+} setting_datatype_t;
+
+typedef enum {
+    Setting_NonCore = 0,
+    Setting_NonCoreFn,
+    Setting_IsExtended,
+    Setting_IsExtendedFn
+} setting_type_t;
+
+typedef struct {
+    setting_group_t parent;
+    setting_group_t id;
+    const char *name;
+} setting_group_detail_t;
+
+typedef struct setting_detail setting_detail_t;
+
+typedef bool (*setting_available_ptr)(const setting_detail_t *setting);
+
+struct setting_detail {
+    setting_id_t id;
+    setting_group_t group;
+    const char *name;
+    const char *unit;
+    setting_datatype_t datatype;
+    const char *format;
+    const char *min_value;
+    const char *max_value;
+    setting_type_t type;
+    void *value;
+    void *get_value;
+    setting_available_ptr is_available;
+};
+
+typedef struct setting_details setting_details_t;
+
+typedef setting_details_t *(*on_get_settings_ptr)(void);
+
+struct setting_details {
+    const uint8_t n_groups;
+    const setting_group_detail_t *groups;
+    const uint16_t n_settings;
+    const setting_detail_t *settings;
+    void (*save)(void);
+    void (*load)(void);
+    void (*restore)(void);
+    on_get_settings_ptr on_get_settings;
+};
+
+extern settings_t settings;
+
+void settings_write_global (void);
@@ -0,0 +1,9 @@
+/*
+  Host test stub, minimal subset of grbl/state_machine.h used by the driver sources under test.
+*/
+
+#pragma once
+
+#include "hal.h"
+
+sys_state_t state_get (void);
@@ -0,0 +1,58 @@
+/*
+  Host test stub for grbl/stepdir_map.h, step and direction lookup tables for GPIO_MAP output mode.
+*/
+
+#pragma once
+
+#if STEP_OUTMODE == GPIO_MAP || DIRECTION_OUTMODE == GPIO_MAP
+
+#define USE_STEPDIR_MAP 1
+
+#if STEP_OUTMODE == GPIO_MAP
+static uint32_t step_outmap[1 << N_AXIS];
+#endif
+#if DIRECTION_OUTMODE == GPIO_MAP
+static uint32_t dir_outmap[1 << N_AXIS];
+#endif
+
+static void stepdirmap_init (settings_t *settings)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < (1 << N_AXIS); idx++) {
+#if STEP_OUTMODE == GPIO_MAP
+        uint_fast8_t bits = idx ^ settings->steppers.step_invert.mask;
+        step_outmap[idx] = ((bits & bit(X_AXIS)) ? X_STEP_BIT : 0) |
+                            ((bits & bit(Y_AXIS)) ? Y_STEP_BIT : 0) |
+  #ifdef A_AXIS
+                             ((bits & bit(A_AXIS)) ? A_STEP_BIT : 0) |
+  #endif
+  #ifdef B_AXIS
+                             ((bits & bit(B_AXIS)) ? B_STEP_BIT : 0) |
+  #endif
+  #ifdef C_AXIS
+                             ((bits & bit(C_AXIS)) ? C_STEP_BIT : 0) |
+  #endif
+                              ((bits & bit(Z_AXIS)) ? Z_STEP_BIT : 0);
+#endif
+#if DIRECTION_OUTMODE == GPIO_MAP
+        uint_fast8_t dirs = idx ^ settings->steppers.dir_invert.mask;
+        dir_outmap[idx] = ((dirs & bit(X_AXIS)) ? X_DIRECTION_BIT : 0) |
+                           ((dirs & bit(Y_AXIS)) ? Y_DIRECTION_BIT : 0) |
+  #ifdef A_AXIS
+                            ((dirs & bit(A_AXIS)) ? A_DIRECTION_BIT : 0) |
+  #endif
+  #ifdef B_AXIS
+                            ((dirs & bit(B_AXIS)) ? B_DIRECTION_BIT : 0) |
+  #endif
+  #ifdef C_AXIS
+                            ((dirs & bit(C_AXIS)) ? C_DIRECTION_BIT : 0) |
+  #endif
+                             ((dirs & bit(Z_AXIS)) ? Z_DIRECTION_BIT : 0);
+#endif
+    }
+}
+
+#else
+#define USE_STEPDIR_MAP 0
+#endif
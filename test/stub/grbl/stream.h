@@ -0,0 +1,73 @@
+/*
+  Host test stub, minimal subset of grbl/stream.h used by the driver sources under test.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef RX_BUFFER_SIZE
+#define RX_BUFFER_SIZE 1024 // must be a power of 2
+#endif
+
+#ifndef TX_BUFFER_SIZE
+#define TX_BUFFER_SIZE 512  // must be a power of 2
+#endif
+
+#define ASCII_CAN 0x18
+#define ASCII_CR  0x0D
+#define ASCII_LF  0x0A
+#define ASCII_EOL "\r\n"
+
+#define BUFCOUNT(head, tail, size) ((head >= tail) ? (head - tail) : (size - tail + head))
+#define BUFNEXT(ptr, buffer) ((ptr + 1) & (sizeof(buffer.data) - 1))
+
+typedef enum {
+    StreamType_Serial = 0,
+    StreamType_MPG,
+    StreamType_Bluetooth,
+    StreamType_Telnet,
+    StreamType_WebSocket,
+    StreamType_SDCard,
+    StreamType_Null
+} stream_type_t;
+
+typedef bool (*enqueue_realtime_command_ptr)(char c);
+
+typedef struct {
+    volatile uint_fast16_t head;
+    volatile uint_fast16_t tail;
+    bool overflow;
+    bool rts_state;
+    bool backup;
+    char data[RX_BUFFER_SIZE];
+} stream_rx_buffer_t;
+
+typedef struct {
+    volatile uint_fast16_t head;
+    volatile uint_fast16_t tail;
+    char data[TX_BUFFER_SIZE];
+} stream_tx_buffer_t;
+
+typedef struct io_stream {
+    stream_type_t type;
+    bool connected;
+    int16_t (*read)(void);
+    void (*write)(const char *s);
+    void (*write_n)(const char *s, uint16_t length);
+    bool (*write_char)(const char c);
+    void (*write_all)(const char *s);
+    uint16_t (*get_rx_buffer_free)(void);
+    uint16_t (*get_rx_buffer_count)(void);
+    void (*reset_read_buffer)(void);
+    void (*cancel_read_buffer)(void);
+    bool (*suspend_read)(bool await);
+    bool (*disable)(bool disable);
+    bool (*set_baud_rate)(uint32_t baud_rate);
+    enqueue_realtime_command_ptr (*set_enqueue_rt_handler)(enqueue_realtime_command_ptr handler);
+} io_stream_t;
+
+bool stream_rx_suspend (stream_rx_buffer_t *rxbuffer, bool suspend);
+void stream_rx_backup (stream_rx_buffer_t *rxbuffer);
+bool stream_buffer_all (char c);
@@ -0,0 +1,90 @@
+/*
+  Host test stub, grbl core globals and functions called by the driver sources under test.
+*/
+
+#include <string.h>
+
+#include "grbl/hal.h"
+#include "grbl/protocol.h"
+#include "grbl/state_machine.h"
+
+grbl_t grbl;
+hal_t hal;
+system_t sys;
+
+settings_t settings = {
+    .version = 19,
+    .steppers.pulse_microseconds = 10.0f,
+    .steppers.idle_lock_time = 25,
+    .spindle.rpm_max = 1000.0f,
+    .spindle.pwm_freq = 5000.0f,
+    .spindle.pwm_max_value = 100.0f
+};
+
+char *uitoa (uint32_t n)
+{
+    static char buf[11];
+    char *s = &buf[sizeof(buf) - 1];
+
+    *s = '\0';
+    do {
+        *--s = '0' + n % 10;
+        n /= 10;
+    } while(n);
+
+    return s;
+}
+
+void settings_write_global (void)
+{
+}
+
+bool protocol_enqueue_realtime_command (char c)
+{
+    return false;
+}
+
+bool protocol_execute_realtime (void)
+{
+    return !sys.abort;
+}
+
+sys_state_t state_get (void)
+{
+    return sys.state;
+}
+
+bool stream_rx_suspend (stream_rx_buffer_t *rxbuffer, bool suspend)
+{
+    return false;
+}
+
+void stream_rx_backup (stream_rx_buffer_t *rxbuffer)
+{
+    rxbuffer->backup = true;
+}
+
+axes_signals_t limit_signals_merge (limit_signals_t signals)
+{
+    axes_signals_t state;
+
+    state.mask = signals.min.mask | signals.min2.mask | signals.max.mask | signals.max2.mask;
+
+    return state;
+}
+
+bool spindle_precompute_pwm_values (spindle_pwm_t *pwm_data, uint32_t clock_hz)
+{
+    pwm_data->period = (uint32_t)((float)clock_hz / settings.spindle.pwm_freq);
+    pwm_data->off_value = 0;
+    pwm_data->min_value = 1;
+    pwm_data->max_value = pwm_data->period;
+    pwm_data->pwm_gradient = (float)pwm_data->max_value / settings.spindle.rpm_max;
+
+    return true;
+}
+
+uint_fast16_t spindle_compute_pwm_value (spindle_pwm_t *pwm_data, float rpm, bool pid_limit)
+{
+    return rpm <= 0.0f ? pwm_data->off_value : (uint_fast16_t)(rpm * pwm_data->pwm_gradient);
+}
@@ -0,0 +1,388 @@
+/*
+  usb_sim_test.c - USB CDC stream of usb_serial.c on the simulated MCU
+
+  usb_serial.c, usbd_cdc_if.c and the USB device library are built unchanged for the host and
+  run against the USB device and host model in sim/sim_usb.c, which replaces the PCD driver.
+  The host latency is configurable and is varied by the tests. Checks that:
+
+    - output written while no host is connected is discarded without blocking.
+    - output is received by the host unchanged and in order, with writes coalesced into
+      multi-packet transfers, for host latencies from none to a full speed frame.
+    - output is sent after the host leaves and reconnects while a transfer is in progress.
+    - a transfer refused by the USB stack is retried when the stream is polled for input.
+    - input is passed to the input buffer and realtime commands to the realtime handler,
+      each in the order sent, and realtime commands are handled while the input buffer is full.
+
+  Built twice, without and with USB_RX_FLOW_CONTROL. Without, input that does not fit in the
+  input buffer is dropped. With, a 4 MB stream read slower than it is sent is received without
+  loss, and the tool change acknowledge is received while input is suspended with a full buffer.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sim.h"
+#include "driver.h"
+#include "usb_serial.h"
+#include "usbd_cdc_if.h"
+#include "grbl/grbl.h"
+
+#define CHECK(cond) if(!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; }
+
+#if USB_RX_FLOW_CONTROL
+#define TEST_NAME "usb_sim_flow_test"
+#define RX_LENGTH (4 * 1024 * 1024)
+#else
+#define TEST_NAME "usb_sim_test"
+#define RX_LENGTH (64 * 1024)
+#endif
+
+#define MS (1000 * SIM_CYCLES_PER_US)
+#define TX_LENGTH 16000
+
+extern USBD_HandleTypeDef hUsbDeviceFS;
+
+// Not under test.
+
+void Error_Handler (void)
+{
+}
+
+static int failed = 0;
+static uint32_t blocked;
+static char rt_log[RX_LENGTH / 40 + 1];
+static uint32_t n_rt;
+
+// Waits for output queue space, gives up after 100000 waits without a transfer started so that
+// a stalled queue fails the test instead of hanging it.
+static bool tx_blocking (void)
+{
+    static uint32_t transfers, waits;
+
+    if(transfers != sim_usb_stats()->in_transfers) {
+        transfers = sim_usb_stats()->in_transfers;
+        waits = 0;
+    }
+
+    blocked++;
+    sim_wfi();
+
+    return ++waits < 100000;
+}
+
+static bool configured (void)
+{
+    return hUsbDeviceFS.dev_state == USBD_STATE_CONFIGURED;
+}
+
+static void connect (void)
+{
+    sim_usb_connect();
+    sim_run_until(configured, MS);
+    sim_usb_in_clear();
+}
+
+// Runs until length characters are received by the host or timeout ms have passed.
+static bool received (uint32_t length, uint32_t timeout)
+{
+    uint64_t end = sim_now + (uint64_t)timeout * MS;
+
+    while(sim_usb_in(NULL) < length && sim_now < end)
+        sim_run(MS / 8);
+
+    return sim_usb_in(NULL) == length;
+}
+
+static bool host_received (const char *s)
+{
+    const uint8_t *data;
+
+    return sim_usb_in(&data) == strlen(s) && !memcmp(data, s, strlen(s));
+}
+
+// Writes length characters in lines of 40 characters, returns the characters per second received by the host.
+static uint32_t stream_out (uint64_t latency, const char *text, uint32_t length)
+{
+    char line[41];
+    uint32_t idx;
+    uint64_t t0;
+    const uint8_t *data;
+
+    sim_usb_latency(latency);
+    sim_usb_in_clear();
+    sim_usb_stats_reset();
+    t0 = sim_now;
+
+    for(idx = 0; idx < length; idx += 40) {
+        memcpy(line, &text[idx], 40);
+        line[40] = '\0';
+        hal.stream.write(line);
+    }
+
+    CHECK(received(length, 1000));
+    CHECK(sim_usb_in(&data) == length && !memcmp(data, text, length));
+
+    return (uint32_t)((uint64_t)length * SIM_HCLK / (sim_now - t0));
+}
+
+static bool is_realtime (char c)
+{
+    return c == CMD_STATUS_REPORT || c == CMD_FEED_HOLD || c == CMD_CYCLE_START || c == CMD_RESET;
+}
+
+static bool enqueue_realtime_command (char c)
+{
+    if(!is_realtime(c))
+        return false;
+
+    if(n_rt < sizeof(rt_log))
+        rt_log[n_rt] = c;
+    n_rt++;
+
+    return true;
+}
+
+#if USB_RX_FLOW_CONTROL
+
+static int16_t read_suspended (void)
+{
+    return -1;
+}
+
+#endif
+
+typedef struct {
+    uint32_t received;          // characters read from the input buffer
+    uint32_t mismatches;        // characters not matching the input sent
+    uint32_t rt;                // realtime commands handled
+    uint32_t rt_mismatches;
+} rx_result_t;
+
+// Reads up to max characters from the input buffer and checks them against the input sent, less the realtime commands.
+static void read_input (rx_result_t *r, const char *expected, uint32_t n_expected, uint32_t max)
+{
+    int16_t c;
+
+    while(max-- && (c = hal.stream.read()) != -1) {
+        if(r->received >= n_expected || c != expected[r->received])
+            r->mismatches++;
+        r->received++;
+    }
+}
+
+// Sends length characters of data, reading up to read_chars characters every 125 us.
+static rx_result_t receive (const char *data, uint32_t length, uint32_t read_chars)
+{
+    static char expected[RX_LENGTH], expected_rt[sizeof(rt_log)];
+
+    rx_result_t r = {0};
+    uint32_t idx, n_expected = 0, n_expected_rt = 0;
+
+    for(idx = 0; idx < length; idx++) {
+        if(is_realtime(data[idx])) {
+            if(n_expected_rt < sizeof(expected_rt))
+                expected_rt[n_expected_rt] = data[idx];
+            n_expected_rt++;
+        } else
+            expected[n_expected++] = data[idx];
+    }
+
+    uint64_t end = sim_now + 2 * (length / read_chars + 1) * (MS / 8); // twice the time to read it
+
+    n_rt = 0;
+    sim_usb_out(data, length);
+
+    while(sim_usb_out_pending() && sim_now < end) {
+        sim_run(MS / 8);
+        read_input(&r, expected, n_expected, read_chars);
+    }
+
+    sim_run(MS);
+    read_input(&r, expected, n_expected, UINT32_MAX);
+
+    r.rt = n_rt;
+    if(n_rt != n_expected_rt || memcmp(rt_log, expected_rt, min(n_rt, sizeof(rt_log))))
+        r.rt_mismatches++;
+
+    return r;
+}
+
+int main (void)
+{
+    static char text[TX_LENGTH];
+
+    uint32_t idx, rate;
+
+    memcpy(&hal.stream, usbInit(), sizeof(io_stream_t));
+    hal.stream_blocking_callback = tx_blocking;
+
+    for(idx = 0; idx < TX_LENGTH; idx++)
+        text[idx] = idx % 40 == 39 ? ASCII_LF : 'A' + idx % 26;
+
+    // No host: output is discarded without blocking.
+
+    blocked = 0;
+    for(idx = 0; idx < 100; idx++)
+        hal.stream.write("discarded" ASCII_EOL);
+    CHECK(blocked == 0);
+
+    connect();
+    sim_run(10 * MS);
+    CHECK(sim_usb_in(NULL) == 0);
+
+    // Lines written back to back are coalesced into multi-packet transfers.
+
+    static char lines[100 * 11 + 1];
+
+    sim_usb_latency(MS);
+    sim_usb_stats_reset();
+    for(idx = 0; idx < 100; idx++) {
+        sprintf(&lines[idx * 11], "line %04u" ASCII_EOL, idx);
+        hal.stream.write(&lines[idx * 11]);
+    }
+    CHECK(received(100 * 11, 100));
+    CHECK(host_received(lines));
+    printf("100 lines: %u transfers, %u packets\n", sim_usb_stats()->in_transfers, sim_usb_stats()->in_packets);
+    CHECK(sim_usb_stats()->in_transfers < 10);
+
+    // Output rate with host latency, 16000 characters is 16 times the transmit queue.
+
+    rate = stream_out(0, text, TX_LENGTH);
+    printf("16000 characters, no latency: %u KB/s, %u transfers\n", rate / 1024, sim_usb_stats()->in_transfers);
+    rate = stream_out(MS / 8, text, TX_LENGTH);
+    printf("16000 characters, 125 us latency: %u KB/s, %u transfers\n", rate / 1024, sim_usb_stats()->in_transfers);
+    rate = stream_out(MS, text, TX_LENGTH);
+    printf("16000 characters, 1 ms latency: %u KB/s, %u transfers\n", rate / 1024, sim_usb_stats()->in_transfers);
+    CHECK(rate >= 1024 * 1000 / 5); // the 1 KB queue is sent in at most five host polls: two transfers, their ZLPs and one spare
+
+    // Host leaves while a transfer is in progress.
+
+    sim_usb_in_clear();
+    hal.stream.write_n(text, 300);
+    sim_run(MS / 10);
+    CHECK(sim_usb_in(NULL) == 0);
+    sim_usb_disconnect();
+    sim_run(MS);
+
+    blocked = 0;
+    hal.stream.write_n(text, 2048);
+    CHECK(blocked == 0);
+
+    connect();
+    hal.stream.write("ok" ASCII_EOL);
+    CHECK(received(4, 10));
+    CHECK(host_received("ok" ASCII_EOL));
+
+    // The USB stack refuses a transfer: retried when polled for input.
+
+    sim_usb_in_clear();
+    ((USBD_CDC_HandleTypeDef *)hUsbDeviceFS.pClassData)->TxState = 1;
+    hal.stream.write("busy" ASCII_EOL);
+    sim_run(5 * MS);
+    CHECK(sim_usb_in(NULL) == 0);
+
+    ((USBD_CDC_HandleTypeDef *)hUsbDeviceFS.pClassData)->TxState = 0;
+    sim_run(5 * MS);
+    CHECK(sim_usb_in(NULL) == 0);
+
+    CHECK(hal.stream.read() == -1);
+    CHECK(received(6, 10));
+    CHECK(host_received("busy" ASCII_EOL));
+
+    // Input with a realtime command about every 40 characters, read slower than it is sent.
+
+    static char data[RX_LENGTH];
+    uint32_t seed = 1;
+    rx_result_t r;
+
+    hal.stream.set_enqueue_rt_handler(enqueue_realtime_command);
+    sim_usb_latency(0);
+
+    for(idx = 0; idx < RX_LENGTH; idx++) {
+        seed = seed * 1103515245 + 12345;
+        if(idx % 40 == 39)
+            data[idx] = "?!~?"[(seed >> 16) & 3];
+        else if(idx % 20 == 19)
+            data[idx] = ASCII_LF;
+        else
+            data[idx] = "GXYZ0123456789.-"[(seed >> 16) & 0xF];
+    }
+
+    r = receive(data, RX_LENGTH, 100);
+    printf("%u characters sent, %u received, %u realtime, %u packets\n", RX_LENGTH, r.received, r.rt, sim_usb_stats()->out_packets);
+
+    CHECK(r.rt == RX_LENGTH / 40 && r.rt_mismatches == 0);
+#if USB_RX_FLOW_CONTROL
+    CHECK(r.mismatches == 0);
+    CHECK(r.received == RX_LENGTH - RX_LENGTH / 40);
+#else
+    CHECK(r.received < RX_LENGTH - RX_LENGTH / 40); // dropped
+#endif
+
+    // Input is not read: a realtime command in the packet that does not fit in the input buffer
+    // is handled, then the input is received when read. The first 10 characters are sent in a
+    // separate packet so that the packet does not end where the buffer is full.
+
+    static char input[RX_BUFFER_SIZE * 2];
+    uint32_t length = RX_BUFFER_SIZE + 128, rt_idx = 10 + RX_BUFFER_SIZE - 4;
+
+    memset(data, 'X', length);
+    data[length - 1] = ASCII_LF;
+    data[rt_idx] = CMD_FEED_HOLD;
+    memcpy(input, data, rt_idx);
+    memcpy(&input[rt_idx], &data[rt_idx + 1], length - rt_idx - 1);
+
+    n_rt = 0;
+    sim_usb_out(data, 10);
+    sim_run(MS);
+    sim_usb_out(&data[10], length - 10);
+    sim_run(10 * MS);
+    CHECK(n_rt == 1 && rt_log[0] == CMD_FEED_HOLD);
+
+    r = (rx_result_t){0};
+    for(idx = 0; sim_usb_out_pending() && idx < 100; idx++) {
+        read_input(&r, input, length - 1, UINT32_MAX);
+        sim_run(MS);
+    }
+    read_input(&r, input, length - 1, UINT32_MAX);
+    CHECK(r.mismatches == 0);
+#if USB_RX_FLOW_CONTROL
+    CHECK(r.received == length - 1);
+#else
+    CHECK(r.received == RX_BUFFER_SIZE - 1);
+#endif
+
+#if USB_RX_FLOW_CONTROL
+
+    // Input is suspended for a tool change while the input buffer is full:
+    // the tool change acknowledge is received, input that does not fit is dropped.
+
+    int16_t (*read)(void) = hal.stream.read;
+
+    memset(data, 'X', length);
+    sim_usb_out(data, length);
+    sim_run(10 * MS);
+    CHECK(sim_usb_out_pending() > 0);
+
+    hal.stream.suspend_read(true);
+    hal.stream.read = read_suspended;
+    sim_usb_out((char []){ CMD_TOOL_ACK }, 1);
+    sim_run(10 * MS);
+    CHECK(hal.stream.read == read);
+    CHECK(sim_usb_out_pending() == 0);
+
+    hal.stream.suspend_read(false);
+    hal.stream.reset_read_buffer();
+    CHECK(hal.stream.read() == -1);
+
+    sim_usb_out("G0X1\n", 5);
+    sim_run(MS);
+    r = (rx_result_t){0};
+    read_input(&r, "G0X1\n", 5, UINT32_MAX);
+    CHECK(r.received == 5 && r.mismatches == 0);
+#endif
+
+    printf(TEST_NAME ": %s\n", failed ? "FAILED" : "OK");
+
+    return failed ? 1 : 0;
+}